@@ -0,0 +1,63 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: arena.h
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* arena.h */
+
+/* every block handed out by an arena is aligned to ARENA_ALIGN bytes */
+#define ARENA_ALIGN 16
+
+/* blocks up to this size are carved out of shared slabs and recycled
+   through per-size free lists. larger blocks get a slab of their own */
+#define ARENA_MAX_SMALL 1024
+
+/* number of size classes, one per ARENA_ALIGN bytes */
+#define ARENA_NUM_CLASSES (ARENA_MAX_SMALL / ARENA_ALIGN)
+
+/* size of a shared slab */
+#define ARENA_SLAB_SIZE (64 * 1024)
+
+struct ArenaSlab;
+
+/* a slab allocator for variable-length records that are freed all at
+   once when their owner goes away. the structure is public only so
+   that it can be embedded; use the functions below to access it */
+struct Arena {
+    /* shared slabs, most recent first */
+    struct ArenaSlab *slabs;
+
+    /* slabs holding a single large block */
+    struct ArenaSlab *large;
+
+    /* unused tail of the most recent shared slab */
+    char *cursor;
+    char *limit;
+
+    /* freed small blocks, one list per size class */
+    void *freeLists[ARENA_NUM_CLASSES];
+
+    /* bytes obtained from malloc, and bytes handed out */
+    size_t bytesReserved;
+    size_t bytesInUse;
+};
+
+/* initialize an empty arena */
+void ArenaInit(struct Arena *a);
+
+/* allocate a block of 'size' bytes. returns NULL if out of memory */
+void *ArenaAlloc(struct Arena *a, size_t size);
+
+/* give back a block returned by ArenaAlloc(a, size) */
+void ArenaFree(struct Arena *a, void *p, size_t size);
+
+/* free every block and slab of the arena at once */
+void ArenaRelease(struct Arena *a);
+
+#endif /* end of ARENA_H */
@@ -21,9 +21,130 @@ typedef struct DB *DB_T;
 typedef int (*FUNCPTR_T)(const char *id, const char *name,
                          const int purchase);
 
+/* hash function type definition. see keyhash.h for the built-in ones */
+typedef unsigned int (*HASHFUNC_T)(const char *key,
+                                   unsigned long long seed);
+
+/* same as CreateCustomerDB, but the tables are sized up front for 'n'
+   customers, so that registering them does not grow the tables. returns
+   NULL on invalid arguments */
+DB_T CreateCustomerDBWithCapacity(int n);
+
 /* create and return a db structure */
 DB_T CreateCustomerDB(void);
 
+/* same as CreateCustomerDB, but keys are hashed with 'hash' under
+   'seed' instead of with HashKeyWide under a random seed. only provided
+   by customer_manager2.c/3.c/4.c/5.c. customer_manager5.c keeps every
+   key in one of two buckets its hash selects, so it can't hold more
+   than 8 keys of the same hash value */
+DB_T CreateCustomerDBWithHash(HASHFUNC_T hash,
+                              unsigned long long seed);
+
+/* create and return a db structure that can be shared by several
+   threads. its tables are split into 'nshards' independently locked
+   shards. only provided by customer_manager2.c */
+DB_T CreateCustomerDBConcurrent(int nshards);
+
+/* same as CreateCustomerDBConcurrent, but lookups take no lock at all.
+   removed customers are reclaimed once no reader can see them. only
+   provided by customer_manager2.c */
+DB_T CreateCustomerDBLockFree(int nshards);
+
+/* create a db like CreateCustomerDB, but one whose customers never
+   take more than 'maxBytes' bytes, counting their fields and keys but
+   not the tables. registering a customer evicts others, least recently
+   used first as a CLOCK tells them apart, until it fits, and fails if
+   it can't fit at all. lookups are counted as hits or misses in
+   struct DBStats. SnapshotCustomerDB refuses a cache, whose customers
+   it would keep beyond the budget. returns NULL on invalid arguments.
+   only provided by customer_manager2.c */
+DB_T CreateCustomerCache(unsigned long long maxBytes);
+
+/* write a snapshot of db to the file 'path'. returns 0 on success, -1
+   otherwise. only provided by customer_manager4.c */
+int SaveCustomerDB(DB_T d, const char *path);
+
+/* open a db from a snapshot written by SaveCustomerDB. the file is
+   mapped and used in place; updates are not written back to it.
+   only provided by customer_manager4.c */
+DB_T LoadCustomerDB(const char *path);
+
+/* when the mutations of a db with a journal return */
+enum DBJournalMode {
+    DB_JOURNAL_DURABLE, /* once they are on disk */
+    DB_JOURNAL_ASYNC,   /* once they are buffered */
+    DB_JOURNAL_DEFERRED /* once they are buffered, to be acknowledged
+                           after WaitCustomerJournal */
+};
+
+/* replay the journal file 'path' into db and log every later mutation
+   to it. mutations are committed in groups of at most 'maxBytes' bytes
+   that share one fdatasync. in DB_JOURNAL_DURABLE and
+   DB_JOURNAL_DEFERRED mode, a group is committed as soon as the
+   previous one is on disk, and holds every mutation logged meanwhile.
+   in DB_JOURNAL_ASYNC mode, a group is committed at the latest
+   'maxDelayMs' milliseconds after its first mutation, so a crash may
+   lose that much acknowledged work. returns the number of replayed
+   mutations, -1 on failure. only provided by customer_manager4.c */
+int OpenCustomerJournal(DB_T d, const char *path,
+                        enum DBJournalMode mode, int maxDelayMs,
+                        int maxBytes);
+
+/* wait until every logged mutation of db is on disk. returns 0 on
+   success, -1 otherwise. only provided by customer_manager4.c */
+int SyncCustomerJournal(DB_T d);
+
+/* get the sequence number of the last mutation of db, 0 if there is
+   none. call it right after a mutation to wait for it later. only
+   provided by customer_manager4.c */
+unsigned long long CustomerJournalSeq(DB_T d);
+
+/* wait until the logged mutations of db up to the one numbered 'seq'
+   are on disk. it may be called from another thread while db is
+   updated, so that a single updating thread can go on with the next
+   mutations, which then share the fdatasync of the group, while their
+   results are acknowledged once this returns. returns 0 on success,
+   -1 otherwise. only provided by customer_manager4.c */
+int WaitCustomerJournal(DB_T d, unsigned long long seq);
+
+/* create a db like CreateCustomerDB, but in the shared memory object
+   'name' (see shm_open), replacing any object of that name. other
+   processes of the same user can then read it through
+   OpenSharedCustomerDB while the returned handle, the only writer,
+   goes on updating it. destroying the writer removes the name. returns
+   NULL on failure. only provided by customer_manager6.c */
+DB_T CreateSharedCustomerDB(const char *name);
+
+/* open a read-only handle on the db created as 'name'. the lookup, sum,
+   ordered and name prefix functions and GetCustomerDBStats accept it;
+   the other functions fail on it. reads take no lock: one that overlaps
+   an update of the writer is retried, and the sums and ordered queries
+   walk a copy of the customers. a handle is used by one thread at a
+   time. returns NULL on failure. only provided by
+   customer_manager6.c */
+DB_T OpenSharedCustomerDB(const char *name);
+
+/* shrink the tables of db to fit its customers and give unused memory
+   back to the system. returns 0 on success, -1 otherwise, as while a
+   snapshot of db is open. only provided by customer_manager2.c */
+int CompactCustomerDB(DB_T d);
+
+/* open a read-only view of db as it is now. the view is a DB_T that
+   the lookup, sum and name prefix functions accept, and it never
+   changes while db goes on being updated. the other functions fail on
+   it. reading it takes no lock, and updates of db do not wait for it,
+   but until every snapshot of db is released, removed customers are
+   kept, and so are those a resize of the tables copies instead of
+   moving them. a snapshot has to be released before db is destroyed.
+   returns NULL on failure and for a db made by CreateCustomerCache.
+   only provided by customer_manager2.c */
+DB_T SnapshotCustomerDB(DB_T d);
+
+/* release a view opened by SnapshotCustomerDB. only provided by
+   customer_manager2.c */
+void ReleaseCustomerSnapshot(DB_T snapshot);
+
 /* destory db and its associated memory */
 void DestroyCustomerDB(DB_T d);
 
@@ -43,8 +164,152 @@ int GetPurchaseByID(DB_T d, const char *id);
 /* get the purchase amount of a user whose name is 'name' */
 int GetPurchaseByName(DB_T d, const char *name);
 
+/* add 'amount', which may be negative, to the purchase amount of the
+   user whose ID is 'id'. returns the new amount, -1 if the user does
+   not exist or the new amount would not be a positive int. the ordered
+   queries see the new amount right away */
+int AddPurchaseByID(DB_T d, const char *id, int amount);
+
+/* same as AddPurchaseByID, but in a db made by CreateCustomerDBLockFree
+   the amount is added without any lock, and adds to customers of the
+   same shard never wait for each other. the ordered queries are not
+   kept up to date meanwhile: GetCustomersByPurchaseRange,
+   GetTopKCustomers and the name prefix functions rebuild what they
+   read first, and then see the amounts as they were at that moment,
+   not adds made while they run. any other db, and one with a snapshot
+   open or being compacted, takes the lock as AddPurchaseByID does.
+   only provided by customer_manager2.c */
+int AddPurchaseByIDAtomic(DB_T d, const char *id, int amount);
+
+/* set the purchase amount of the user whose name is 'name' to
+   'purchase' (> 0). returns 0 on success, -1 otherwise */
+int SetPurchaseByName(DB_T d, const char *name, int purchase);
+
+/* get the purchase amounts of 'n' users whose IDs are 'ids' at once.
+   out[i] receives what GetPurchaseByID(d, ids[i]) returns. returns the
+   number of users found, -1 on invalid arguments */
+int GetPurchaseByIDBatch(DB_T d, const char **ids, int n, int *out);
+
+/* register 'n' customers with (names[i], ids[i], purchases[i]) at
+   once. out[i], unless out is NULL, receives what RegisterCustomer
+   returns for the i-th customer. returns the number of customers
+   registered, -1 on invalid arguments */
+int RegisterCustomerBatch(DB_T d, const char **ids, const char **names,
+                          const int *purchases, int n, int *out);
+
+/* register the customers of the file 'path', one "id,name,purchase"
+   line each (tabs may separate the fields instead of commas, and a
+   first line "id,name,purchase" is skipped as a header). the file is
+   parsed by several threads and the tables are grown once for all of
+   its customers. customers whose id or name is already taken are
+   skipped as in RegisterCustomerBatch. returns the number of customers
+   registered, -1 if the file can't be read or holds a malformed line,
+   such as one whose purchase is not a positive number */
+int LoadCustomersFromFile(DB_T d, const char *path);
+
 /* iterate all valid user items once, evaluate fp for each valid user
    and return the sum of all fp function calls */
 int GetSumCustomerPurchase(DB_T d, FUNCPTR_T fp);
 
+/* same as GetSumCustomerPurchase, but the users are split among up to
+   'nthreads' threads and the sum is 64 bits wide. fp may be called from
+   several threads at once */
+long long GetSumCustomerPurchaseParallel(DB_T d, FUNCPTR_T fp,
+                                         int nthreads);
+
+/* apply fp to every user whose purchase amount is between 'low' and
+   'high' inclusive, largest amount first, and return the sum of all fp
+   function calls. users with equal amounts are visited in id order.
+   the first call of this or the next function builds the purchase
+   index both use, in O(n log n), and updates keep it from then on. a
+   db never asked for either has none */
+int GetCustomersByPurchaseRange(DB_T d, int low, int high,
+                                FUNCPTR_T fp);
+
+/* apply fp to the 'k' users with the largest purchase amounts, in the
+   same order, and return the sum of all fp function calls */
+int GetTopKCustomers(DB_T d, int k, FUNCPTR_T fp);
+
+/* apply fp to every user whose name starts with 'prefix' and return
+   the number of such users. the order of the calls is unspecified.
+   the first call of this or the next function builds the name index
+   both use, in time proportional to the size of the db, and updates
+   keep it from then on. a db never asked for a prefix has none */
+int ForEachCustomerWithNamePrefix(DB_T d, const char *prefix,
+                                  FUNCPTR_T fp);
+
+/* apply fp to every user whose name starts with 'prefix' and return
+   the sum of all fp function calls */
+int GetSumCustomerPurchaseByNamePrefix(DB_T d, const char *prefix,
+                                       FUNCPTR_T fp);
+
+/* kinds of operations counted by struct DBStats. the batch functions
+   count once per customer */
+enum DBStatsOp {
+    DB_OP_REGISTER,   /* RegisterCustomer */
+    DB_OP_UNREGISTER, /* UnregisterCustomerByID/Name */
+    DB_OP_LOOKUP,     /* GetPurchaseByID/Name */
+    DB_OP_UPDATE,     /* AddPurchaseByID, SetPurchaseByName */
+    DB_NUM_OPS
+};
+
+/* shape of one of the tables customers are found by. the chain length
+   of a customer is the number of entries, slots or groups a lookup of
+   its key examines before reaching it */
+struct DBTableStats {
+    unsigned long long capacity; /* slots, buckets or array entries */
+    unsigned long long count;    /* customers in the table */
+    double loadFactor;           /* count / capacity */
+    unsigned int maxChain;       /* longest chain length */
+    double meanChain;            /* average chain length */
+
+    /* expected share of keys not in the table that its membership
+       filter lets through to the buckets, from the bits set in it. 0
+       if the table has no filter */
+    double filterFalsePositiveRate;
+};
+
+/* statistics of a db as returned by GetCustomerDBStats */
+struct DBStats {
+    struct DBTableStats idTable;
+    struct DBTableStats nameTable;
+
+    /* bytes of memory the db holds: tables, key storage and the
+       ordered indexes */
+    unsigned long long bytesAllocated;
+
+    /* times the tables were grown, shrunk or rebuilt, and the
+       nanoseconds spent doing so. the time is counted like ops and
+       probes, and always 0 unless the db was built with USE_STATS=1 */
+    unsigned long long rehashes;
+    unsigned long long rehashNsec;
+
+    /* calls and table probes of each kind of operation since the db
+       was created. always 0 unless the db was built with USE_STATS=1,
+       so that other builds pay nothing for counting */
+    unsigned long long ops[DB_NUM_OPS];
+    unsigned long long probes[DB_NUM_OPS];
+
+    /* lookups checked against the membership filter of a table, those
+       it rejected without reading a bucket, and those it let through
+       although the key was not in the table. counted like ops and
+       probes, by dbs whose tables have filters */
+    unsigned long long filterChecks;
+    unsigned long long filterMisses;
+    unsigned long long filterFalsePositives;
+
+    /* lookups of a cache (see CreateCustomerCache) that found their
+       customer and those that did not, customers it evicted, and the
+       bytes its customers take. always 0 unless the db is a cache */
+    unsigned long long cacheHits;
+    unsigned long long cacheMisses;
+    unsigned long long cacheEvictions;
+    unsigned long long cacheBytes;
+};
+
+/* fill *stats with the current statistics of the db. walks every
+   customer, so it takes time linear in their number. returns 0, or -1
+   on invalid arguments */
+int GetCustomerDBStats(DB_T d, struct DBStats *stats);
+
 #endif /* end of CUSTOMER_MANAGER_H */
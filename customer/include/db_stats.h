@@ -0,0 +1,109 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: db_stats.h
+ */
+
+#ifndef DB_STATS_H
+#define DB_STATS_H
+
+#include "customer_manager.h"
+#include <time.h>
+
+/* db_stats.h */
+
+/* helpers the dbs fill struct DBStats with. the per-operation counters
+   are only compiled in with -DUSE_STATS=1; otherwise STATS_OP,
+   STATS_PROBES and STATS_COUNT do nothing and the dbs carry no
+   counters. STATS_OP still evaluates its kind of operation, which may
+   be a parameter that is passed along for counting only */
+#ifndef USE_STATS
+#define USE_STATS 0
+#endif
+
+/* calls and table probes of each kind of operation */
+struct DBCounters {
+    unsigned long long ops[DB_NUM_OPS];
+    unsigned long long probes[DB_NUM_OPS];
+    unsigned long long filterChecks;
+    unsigned long long filterMisses;
+    unsigned long long filterFalsePositives;
+};
+
+#if USE_STATS
+/* kind of operation the calling thread is in, so that the probes of
+   the shared lookup functions are charged to it */
+static __thread enum DBStatsOp statsOp;
+
+/* count a call of kind 'op' in the counters 'c' */
+#define STATS_OP(c, op)                                                \
+    (statsOp = (op),                                                   \
+     (void)__atomic_fetch_add(&(c)->ops[op], 1, __ATOMIC_RELAXED))
+
+/* count 'n' probes of the current operation in the counters 'c' */
+#define STATS_PROBES(c, n)                                             \
+    ((void)__atomic_fetch_add(&(c)->probes[statsOp], (n),              \
+                              __ATOMIC_RELAXED))
+
+/* count one event in the counter 'field' of the counters 'c' */
+#define STATS_COUNT(c, field)                                          \
+    ((void)__atomic_fetch_add(&(c)->field, 1, __ATOMIC_RELAXED))
+#else
+#define STATS_OP(c, op) ((void)(op))
+#define STATS_PROBES(c, n) ((void)0)
+#define STATS_COUNT(c, field) ((void)0)
+#endif
+
+/* current time in nanoseconds, for timing rehashes. resizes go on a
+   few buckets at a time during updates, so without USE_STATS the clock
+   is not read at all and the time is always 0 */
+static inline unsigned long long StatsNow(void) {
+#if USE_STATS
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL +
+           (unsigned long long)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* account for one customer found after examining 'len' entries */
+static inline void StatsAddChain(struct DBTableStats *t,
+                                 unsigned int len) {
+    t->count++;
+    t->meanChain += len;
+    if (len > t->maxChain)
+        t->maxChain = len;
+}
+
+/* turn the chain lengths summed by StatsAddChain into their mean, and
+   fill in the capacity and load factor */
+static inline void StatsFinishTable(struct DBTableStats *t,
+                                    unsigned long long capacity) {
+    t->capacity = capacity;
+    if (capacity > 0)
+        t->loadFactor = (double)t->count / capacity;
+    if (t->count > 0)
+        t->meanChain /= t->count;
+}
+
+/* add counters to those of stats. they may be updated by other
+   threads at the same time, so each is read on its own */
+static inline void StatsAddCounters(struct DBStats *stats,
+                                    const struct DBCounters *c) {
+    for (int i = 0; i < DB_NUM_OPS; i++) {
+        stats->ops[i] += __atomic_load_n(&c->ops[i], __ATOMIC_RELAXED);
+        stats->probes[i] +=
+            __atomic_load_n(&c->probes[i], __ATOMIC_RELAXED);
+    }
+    stats->filterChecks +=
+        __atomic_load_n(&c->filterChecks, __ATOMIC_RELAXED);
+    stats->filterMisses +=
+        __atomic_load_n(&c->filterMisses, __ATOMIC_RELAXED);
+    stats->filterFalsePositives +=
+        __atomic_load_n(&c->filterFalsePositives, __ATOMIC_RELAXED);
+}
+
+#endif /* end of DB_STATS_H */
@@ -0,0 +1,87 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: journal.h
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+/* journal.h */
+
+/* kinds of logged mutations */
+enum JournalType {
+    JOURNAL_REGISTER = 1,
+    JOURNAL_UNREGISTER = 2,
+    JOURNAL_SET_PURCHASE = 3
+};
+
+/* a logged mutation. an unregistration or a purchase update is logged
+   with the id of the customer, whichever key it was found with */
+struct JournalEntry {
+    enum JournalType type;
+
+    /* sequence number. every mutation of a db gets the next one */
+    unsigned long long seq;
+
+    /* customer keys. name is NULL unless this is a registration */
+    const char *id;
+    const char *name;
+
+    /* purchase amount of a registration, or the new amount of a
+       purchase update */
+    int purchase;
+};
+
+/* called for every valid entry found when a journal is opened */
+typedef void (*JOURNAL_REPLAY_T)(void *arg,
+                                 const struct JournalEntry *e);
+
+/* when an append returns, and when its group is committed */
+enum JournalMode {
+    JOURNAL_DURABLE,  /* once on disk. committed right away */
+    JOURNAL_DEFERRED, /* once buffered. committed right away */
+    JOURNAL_ASYNC     /* once buffered. committed after a delay */
+};
+
+struct Journal;
+
+/* open or create the journal file 'path'. entries already in it with a
+   sequence number above 'afterSeq' are passed to 'replay' in order, and
+   a torn tail left by a crash is cut off. new entries are buffered and
+   written with one write and fdatasync per group. unless the mode is
+   JOURNAL_ASYNC, a group is committed as soon as the previous one is
+   on disk. otherwise it is committed at the latest 'maxDelayMs'
+   milliseconds after its first entry, or once 'maxBytes' are buffered.
+   returns NULL on failure */
+struct Journal *JournalOpen(const char *path, enum JournalMode mode,
+                            int maxDelayMs, size_t maxBytes,
+                            unsigned long long afterSeq,
+                            JOURNAL_REPLAY_T replay, void *arg);
+
+/* buffer an entry and, in JOURNAL_DURABLE mode, wait until it is on
+   disk. entries must be appended in the order of their sequence
+   numbers. returns 0 on success, -1 once the journal failed */
+int JournalAppend(struct Journal *j, const struct JournalEntry *e);
+
+/* wait until every appended entry is on disk. returns 0 on success,
+   -1 if the journal failed */
+int JournalSync(struct Journal *j);
+
+/* wait until every appended entry with a sequence number up to 'seq' is
+   on disk, without committing the current group earlier than its mode
+   does, except in JOURNAL_ASYNC mode. may be called while another
+   thread appends. returns 0 on success, -1 if the journal failed */
+int JournalWait(struct Journal *j, unsigned long long seq);
+
+/* drop every entry after a checkpoint made them redundant. returns 0 on
+   success, -1 on failure */
+int JournalTruncate(struct Journal *j);
+
+/* sync and close the journal. returns 0 on success, -1 if entries may
+   have been lost */
+int JournalClose(struct Journal *j);
+
+#endif /* end of JOURNAL_H */
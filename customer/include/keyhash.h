@@ -0,0 +1,31 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: keyhash.h
+ */
+
+#ifndef KEYHASH_H
+#define KEYHASH_H
+
+/* keyhash.h */
+
+/* hash functions for customer keys. both have the HASHFUNC_T signature
+   of customer_manager.h and return the whole 32-bit hash value of a
+   null terminated key under a seed */
+
+/* reads the key 8 bytes at a time and mixes them with 64x64->128 bit
+   multiplications. without knowing the seed, keys that collide can not
+   be chosen in advance. the default hash of every db */
+unsigned int HashKeyWide(const char *key, unsigned long long seed);
+
+/* the byte-at-a-time hash with multiplier 65599 the dbs used to have,
+   starting from the low 32 bits of the seed. with seed 0, dbs hash as
+   they used to. for keys of equal length, the difference of two hash
+   values does not depend on the seed, so neither do collisions */
+unsigned int HashKeyMultiplicative(const char *key,
+                                   unsigned long long seed);
+
+/* returns an unpredictable seed, different on every call */
+unsigned long long RandomHashSeed(void);
+
+#endif /* end of KEYHASH_H */
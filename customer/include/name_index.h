@@ -0,0 +1,76 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: name_index.h
+ */
+
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include "arena.h"
+#include "customer_manager.h"
+
+/* name_index.h */
+
+/* a node of a name index. the path from the root spells a prefix of
+   the names below, and a node with a single child only exists if a
+   name ends there */
+struct NameNode {
+    /* bytes following those of the parent. stored right after the
+       node, and never empty except at the root */
+    char *label;
+    unsigned int len;
+
+    /* customer whose name ends here. id is NULL if there is none. the
+       keys are not copied, so they must stay where they are while the
+       customer is indexed */
+    const char *id;
+    const char *name;
+    int purchase;
+
+    /* first child, and the next sibling. siblings are ordered by the
+       first byte of their label */
+    struct NameNode *child;
+    struct NameNode *next;
+};
+
+/* a compressed trie of customer names. the structure is public only so
+   that it can be embedded; use the functions below to access it */
+struct NameIndex {
+    struct NameNode root;
+
+    /* storage of the nodes and their labels */
+    struct Arena arena;
+};
+
+/* initialize an empty index */
+void NameIndexInit(struct NameIndex *ix);
+
+/* add a customer whose name is not indexed yet. returns 0 on success,
+   -1 if out of memory */
+int NameIndexInsert(struct NameIndex *ix, const char *id,
+                    const char *name, int purchase);
+
+/* remove the customer with 'name', which must be there */
+void NameIndexRemove(struct NameIndex *ix, const char *name);
+
+/* set the purchase amount of the customer with 'name', which must be
+   there */
+void NameIndexUpdate(struct NameIndex *ix, const char *name,
+                     int purchase);
+
+/* point the customer with 'name' at 'id' and 'name', copies of the
+   keys it was indexed with */
+void NameIndexRelocate(struct NameIndex *ix, const char *id,
+                       const char *name);
+
+/* apply fp to every customer whose name starts with 'prefix', in name
+   order, and return the sum of the results. the number of customers
+   visited is added to *count */
+long long NameIndexVisit(const struct NameIndex *ix, const char *prefix,
+                         FUNCPTR_T fp, int *count);
+
+/* free every node at once */
+void NameIndexRelease(struct NameIndex *ix);
+
+#endif /* end of NAME_INDEX_H */
@@ -0,0 +1,90 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: purchase_index.h
+ */
+
+#ifndef PURCHASE_INDEX_H
+#define PURCHASE_INDEX_H
+
+#include "arena.h"
+#include "customer_manager.h"
+
+/* purchase_index.h */
+
+/* most levels a skip list node can have. with a quarter of the nodes
+   of each level promoted to the next, this covers 4^24 customers */
+#define PURCHASE_INDEX_MAX_LEVEL 24
+
+/* a customer in a purchase index. the keys are not copied, so they
+   must stay where they are while the customer is indexed */
+struct PurchaseNode {
+    const char *id;
+    const char *name;
+    int purchase;
+
+    /* number of levels the node is linked into */
+    int level;
+
+    /* next node on each level */
+    struct PurchaseNode *next[];
+};
+
+/* a skip list of customers ordered by purchase amount, largest first,
+   and by id among equal amounts. the structure is public only so that
+   it can be embedded; use the functions below to access it */
+struct PurchaseIndex {
+    /* first node on each level */
+    struct PurchaseNode *head[PURCHASE_INDEX_MAX_LEVEL];
+
+    /* highest level in use */
+    int level;
+
+    /* state of the generator choosing node levels */
+    unsigned long long random;
+
+    /* storage of the nodes */
+    struct Arena arena;
+};
+
+/* initialize an empty index. 'seed' varies the node levels */
+void PurchaseIndexInit(struct PurchaseIndex *ix,
+                       unsigned long long seed);
+
+/* add a customer. returns 0 on success, -1 if out of memory */
+int PurchaseIndexInsert(struct PurchaseIndex *ix, const char *id,
+                        const char *name, int purchase);
+
+/* remove the customer with 'id' and 'purchase', which must be there */
+void PurchaseIndexRemove(struct PurchaseIndex *ix, const char *id,
+                         int purchase);
+
+/* move the customer with 'id' and 'old' to its place for 'purchase'.
+   the node is reused, so this never runs out of memory */
+void PurchaseIndexUpdate(struct PurchaseIndex *ix, const char *id,
+                         int old, int purchase);
+
+/* point the customer with 'id' and 'purchase' at 'id' and 'name',
+   copies of the keys it was indexed with */
+void PurchaseIndexRelocate(struct PurchaseIndex *ix, const char *id,
+                           const char *name, int purchase);
+
+/* first customer whose purchase amount is at most 'high'. NULL if
+   there is none. following customers are reached through next[0] */
+const struct PurchaseNode *
+PurchaseIndexSeek(const struct PurchaseIndex *ix, int high);
+
+/* apply fp to every customer whose purchase amount is between 'low' and
+   'high', largest first, and return the sum of the results */
+long long PurchaseIndexRange(const struct PurchaseIndex *ix, int low,
+                             int high, FUNCPTR_T fp);
+
+/* apply fp to the first 'k' customers and return the sum of the
+   results */
+long long PurchaseIndexTop(const struct PurchaseIndex *ix, int k,
+                           FUNCPTR_T fp);
+
+/* free every node at once */
+void PurchaseIndexRelease(struct PurchaseIndex *ix);
+
+#endif /* end of PURCHASE_INDEX_H */
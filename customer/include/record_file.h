@@ -0,0 +1,41 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: record_file.h
+ */
+
+#ifndef RECORD_FILE_H
+#define RECORD_FILE_H
+
+#include <stddef.h>
+
+/* record_file.h */
+
+/* a file of customer records, one "id,name,purchase" line each. fields
+   are separated by commas or by tabs, whichever the first line uses,
+   and cannot contain the separator. purchases are positive decimal
+   numbers. empty lines are skipped, and so is a first line that reads
+   "id,name,purchase" in any case, which is taken as a header */
+struct RecordFile {
+    /* fields of the records, in file order. the keys point into the
+       mapping below and stay valid until the file is closed */
+    const char **ids;
+    const char **names;
+    int *purchases;
+    int count;
+
+    /* private mapping of the file. the separators after the keys are
+       overwritten with terminators */
+    char *map;
+    size_t mapSize;
+};
+
+/* map the file 'path' and parse its records, splitting the work among
+   several threads for large files. returns 0 on success, -1 if the
+   file can't be read or holds a malformed line */
+int RecordFileOpen(struct RecordFile *f, const char *path);
+
+/* free the records and unmap the file */
+void RecordFileClose(struct RecordFile *f);
+
+#endif /* end of RECORD_FILE_H */
@@ -0,0 +1,120 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: record_pool.h
+ */
+
+#ifndef RECORD_POOL_H
+#define RECORD_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* record_pool.h */
+
+/* records are aligned to RECORD_ALIGN bytes, and a reference counts
+   in units of that size */
+#define RECORD_ALIGN 8
+
+/* a pool is made of chunks of RECORD_CHUNK_SIZE bytes. the low
+   RECORD_CHUNK_SHIFT bits of a reference are the unit within its chunk
+   and the other bits the number of the chunk */
+#define RECORD_CHUNK_SHIFT 13
+#define RECORD_CHUNK_SIZE (RECORD_ALIGN << RECORD_CHUNK_SHIFT)
+#define RECORD_MAX_CHUNKS (1U << (32 - RECORD_CHUNK_SHIFT))
+
+/* records up to this size are carved out of shared chunks and
+   recycled through per-size free lists. larger records get chunks of
+   their own */
+#define RECORD_MAX_SMALL 1024
+
+/* number of size classes, one per RECORD_ALIGN bytes */
+#define RECORD_NUM_CLASSES (RECORD_MAX_SMALL / RECORD_ALIGN)
+
+/* reference to no record. chunk 0 is never handed out */
+#define RECORD_NONE 0U
+
+/* the chunks of records shared by several record arenas. a reference
+   stays valid, and the record in place, until its arena frees it */
+struct RecordPool {
+    /* address of each chunk, indexed by chunk number. entries are set
+       before any reference into the chunk is handed out, so readers
+       can use them without the lock */
+    char **chunks;
+
+    /* protects the fields below */
+    pthread_mutex_t lock;
+
+    /* chunk numbers handed out so far, and numbers given back */
+    unsigned int nchunks;
+    unsigned int *freeChunks;
+    unsigned int nfree;
+    unsigned int freeCapacity;
+};
+
+/* chunks of contiguous numbers holding one large record */
+struct RecordRun {
+    unsigned int first;
+    unsigned int count;
+};
+
+/* an allocator of variable-length records from the chunks of a pool,
+   used by a single thread at a time. the structure is public only so
+   that it can be embedded; use the functions below to access it */
+struct RecordArena {
+    struct RecordPool *pool;
+
+    /* numbers of the shared chunks, and runs of large records */
+    unsigned int *chunks;
+    unsigned int nchunks;
+    unsigned int chunkCapacity;
+    struct RecordRun *runs;
+    unsigned int nruns;
+    unsigned int runCapacity;
+
+    /* unused tail of the most recent shared chunk, as references */
+    unsigned int cursor;
+    unsigned int limit;
+
+    /* freed small records, one list per size class. each holds the
+       reference of the next in its first bytes */
+    unsigned int freeLists[RECORD_NUM_CLASSES];
+
+    /* bytes obtained from malloc, and bytes handed out */
+    size_t bytesReserved;
+    size_t bytesInUse;
+};
+
+/* initialize an empty pool. returns 0 on success, -1 if out of
+   memory */
+int RecordPoolInit(struct RecordPool *pool);
+
+/* free the chunk table of a pool whose arenas are all released */
+void RecordPoolRelease(struct RecordPool *pool);
+
+/* bytes of the chunk table in use */
+size_t RecordPoolBytes(struct RecordPool *pool);
+
+/* initialize an empty arena drawing chunks from 'pool' */
+void RecordArenaInit(struct RecordArena *a, struct RecordPool *pool);
+
+/* allocate a record of 'size' bytes. returns its reference, or
+   RECORD_NONE if out of memory */
+unsigned int RecordAlloc(struct RecordArena *a, size_t size);
+
+/* give back a record returned by RecordAlloc(a, size) */
+void RecordFree(struct RecordArena *a, unsigned int ref, size_t size);
+
+/* free every record of the arena at once and give its chunks back to
+   the pool */
+void RecordArenaRelease(struct RecordArena *a);
+
+/* address of the record 'ref', which must not be RECORD_NONE */
+static inline void *RecordAt(const struct RecordPool *pool,
+                             unsigned int ref) {
+    return pool->chunks[ref >> RECORD_CHUNK_SHIFT] +
+           (size_t)(ref & ((1U << RECORD_CHUNK_SHIFT) - 1)) *
+               RECORD_ALIGN;
+}
+
+#endif /* end of RECORD_POOL_H */
@@ -0,0 +1,31 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: sum_job.h
+ */
+
+#ifndef SUM_JOB_H
+#define SUM_JOB_H
+
+/* sum_job.h */
+
+/* the thread driver of GetSumCustomerPurchaseParallel(). a backend cuts
+   its customers into chunks and gives a function that sums one chunk.
+   the calling thread and up to nthreads - 1 helper threads take the
+   chunks one at a time, each adding into its own partial sum */
+
+/* returns the sum of chunk 'chunk' of a job. 'arg' is the one given to
+   RunSumJob(). it is called from several threads at once */
+typedef long long (*SUMCHUNK_T)(void *arg, unsigned int chunk);
+
+/* the most threads a job runs on, the calling one included */
+enum { MAX_SUM_THREADS = 64 };
+
+/* returns the sum of chunkSum(arg, c) for every chunk c below
+   'nchunks', or 0 if there is none. runs on at most 'nthreads' threads,
+   and never on more threads than there are chunks. if a helper thread
+   can't be started, the remaining threads take over its chunks */
+long long RunSumJob(unsigned int nchunks, SUMCHUNK_T chunkSum,
+                    void *arg, int nthreads);
+
+#endif /* end of SUM_JOB_H */
@@ -0,0 +1,44 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: testutil.h
+ */
+
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+/* testutil.h */
+
+/* helpers shared by the tests of the functions only some of the
+   backends provide. the checks may be made from several threads */
+
+/* size of the buffer of a key or a name, including the null byte */
+#define KEY_SIZE 32
+
+/* print "[PASSED]" or "[FAILED]" and the printf-style message, and
+   count the check as failed unless 'ok' is nonzero */
+void Check(int ok, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* print "[FAILED]" and the printf-style message, and count a failed
+   check. for checks made too often to print each one that passes */
+void Fail(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/* returns the number of checks that failed so far */
+int Failures(void);
+
+/* a FUNCPTR_T that returns the purchase of every customer */
+int Purchase(const char *id, const char *name, const int purchase);
+
+/* a FUNCPTR_T that returns the purchase of a stable customer, whose id
+   starts with 's', and 0 for any other */
+int StablePurchase(const char *id, const char *name,
+                   const int purchase);
+
+/* write the id and the name of customer k to buffers of KEY_SIZE
+   bytes. they are "id" and "name" followed by k in at least 5 digits,
+   so the keys of customers below 100000 all have the same length */
+void KeysOf(int k, char *id, char *name);
+
+#endif /* end of TESTUTIL_H */
@@ -0,0 +1,174 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: arena.c
+ */
+
+#include "arena.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaSlab {
+    // neighbor slabs in the owning list. prev is only maintained for
+    // large slabs, which are freed one by one
+    struct ArenaSlab *next;
+    struct ArenaSlab *prev;
+
+    // total size of the slab including this header
+    size_t size;
+
+    // keep the payload aligned
+    size_t pad;
+};
+
+/**
+ * RoundUp: round a size up to a multiple of ARENA_ALIGN
+ */
+static inline size_t RoundUp(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/**
+ * ArenaInit: initialize an empty arena
+ *
+ * param a: pointer to arena
+ */
+void ArenaInit(struct Arena *a) { memset(a, 0, sizeof(struct Arena)); }
+
+/**
+ * AllocLarge: allocate a block that does not fit in a size class
+ *
+ * param a: pointer to arena
+ * param size: size of the block, already rounded up
+ *
+ * returns: pointer to the block. NULL if out of memory
+ */
+static void *AllocLarge(struct Arena *a, size_t size) {
+    struct ArenaSlab *slab = malloc(sizeof(struct ArenaSlab) + size);
+    if (slab == NULL)
+        return NULL;
+
+    slab->size = sizeof(struct ArenaSlab) + size;
+    slab->prev = NULL;
+    slab->next = a->large;
+    if (a->large != NULL)
+        a->large->prev = slab;
+    a->large = slab;
+
+    a->bytesReserved += slab->size;
+    a->bytesInUse += size;
+
+    return slab + 1;
+}
+
+/**
+ * ArenaAlloc: allocate a block from an arena
+ *
+ *  small blocks are taken from the free list of their size class, or
+ *  else carved out of the current slab. a new slab is started when the
+ *  current one is exhausted; its unused tail is given up
+ *
+ * param a: pointer to arena
+ * param size: size of the block in bytes
+ *
+ * returns: pointer to the block, aligned to ARENA_ALIGN. NULL if out of
+ *  memory
+ */
+void *ArenaAlloc(struct Arena *a, size_t size) {
+    if (size == 0)
+        size = 1;
+    size = RoundUp(size);
+
+    if (size > ARENA_MAX_SMALL)
+        return AllocLarge(a, size);
+
+    void **list = &a->freeLists[size / ARENA_ALIGN - 1];
+    if (*list != NULL) {
+        void *p = *list;
+        *list = *(void **)p;
+        a->bytesInUse += size;
+        return p;
+    }
+
+    if ((size_t)(a->limit - a->cursor) < size) {
+        struct ArenaSlab *slab = malloc(ARENA_SLAB_SIZE);
+        if (slab == NULL)
+            return NULL;
+
+        slab->size = ARENA_SLAB_SIZE;
+        slab->next = a->slabs;
+        a->slabs = slab;
+        a->cursor = (char *)(slab + 1);
+        a->limit = (char *)slab + ARENA_SLAB_SIZE;
+        a->bytesReserved += ARENA_SLAB_SIZE;
+    }
+
+    void *p = a->cursor;
+    a->cursor += size;
+    a->bytesInUse += size;
+
+    return p;
+}
+
+/**
+ * ArenaFree: give a block back to an arena
+ *
+ *  small blocks are pushed on the free list of their size class and
+ *  stay reserved by the arena. large blocks are returned to malloc
+ *
+ * param a: pointer to arena
+ * param p: pointer to block, as returned by ArenaAlloc(a, size)
+ * param size: size the block was allocated with
+ */
+void ArenaFree(struct Arena *a, void *p, size_t size) {
+    if (p == NULL)
+        return;
+
+    if (size == 0)
+        size = 1;
+    size = RoundUp(size);
+    assert(a->bytesInUse >= size);
+    a->bytesInUse -= size;
+
+    if (size > ARENA_MAX_SMALL) {
+        struct ArenaSlab *slab = (struct ArenaSlab *)p - 1;
+        if (slab->prev != NULL)
+            slab->prev->next = slab->next;
+        else
+            a->large = slab->next;
+        if (slab->next != NULL)
+            slab->next->prev = slab->prev;
+
+        a->bytesReserved -= slab->size;
+        free(slab);
+        return;
+    }
+
+    void **list = &a->freeLists[size / ARENA_ALIGN - 1];
+    *(void **)p = *list;
+    *list = p;
+}
+
+/**
+ * ArenaRelease: free all blocks of an arena at once
+ *
+ *  the arena is left empty and may be used again
+ *
+ * param a: pointer to arena
+ */
+void ArenaRelease(struct Arena *a) {
+    struct ArenaSlab *slab, *next;
+
+    for (slab = a->slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+
+    for (slab = a->large; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+
+    ArenaInit(a);
+}
@@ -0,0 +1,193 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* cachetest.c */
+
+/* test of CreateCustomerCache of customer_manager2.c. a cache full of
+   customers must evict those not used since the CLOCK hand last passed
+   them before those that were, must never hold more than its budget,
+   and must count its hits, misses and evictions in struct DBStats. a
+   customer that can never fit must be refused without evicting any,
+   and so must a snapshot, which would keep customers beyond the
+   budget */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "customer_manager.h"
+#include "testutil.h"
+
+/* customers a full cache holds. the keys of KeysOf() have the same
+   length, so that each customer takes the same number of bytes */
+#define FULL 1000
+
+/* updates of the churn, over this many keys */
+#define OPS 200000
+#define CHURN_KEYS 5000
+
+/*--------------------------------------------------------------------*/
+static int One(const char *id, const char *name, const int purchase) {
+    (void)id;
+    (void)name;
+    (void)purchase;
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+static struct DBStats StatsOf(DB_T c) {
+    struct DBStats stats;
+
+    GetCustomerDBStats(c, &stats);
+    return stats;
+}
+/*--------------------------------------------------------------------*/
+int main(void) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    struct DBStats st;
+    int kept;
+
+    Check(CreateCustomerCache(0) == NULL,
+          "CreateCustomerCache rejects a budget of 0");
+
+    /* bytes one customer takes */
+    DB_T c = CreateCustomerCache(1ULL << 30);
+    KeysOf(0, id, name);
+    RegisterCustomer(c, id, name, 1);
+    unsigned long long each = StatsOf(c).cacheBytes;
+    DestroyCustomerDB(c);
+    Check(each > 0, "cacheBytes counts a customer");
+
+    /* a full cache evicts nothing */
+    unsigned long long budget = each * FULL;
+    c = CreateCustomerCache(budget);
+    for (int k = 0; k < FULL; k++) {
+        KeysOf(k, id, name);
+        RegisterCustomer(c, id, name, k + 1);
+    }
+    st = StatsOf(c);
+    Check(st.cacheBytes == budget && st.cacheEvictions == 0 &&
+              st.idTable.count == FULL,
+          "cache filled up to its budget");
+
+    /* customers used since they were registered outlive those that
+       were not */
+    for (int k = 0; k < FULL / 2; k++) {
+        KeysOf(k, id, name);
+        GetPurchaseByID(c, id);
+    }
+    for (int k = FULL; k < FULL + FULL / 2; k++) {
+        KeysOf(k, id, name);
+        RegisterCustomer(c, id, name, k + 1);
+    }
+    st = StatsOf(c);
+    Check(st.cacheEvictions == FULL / 2 && st.cacheHits == FULL / 2 &&
+              st.cacheMisses == 0,
+          "counters after evictions");
+    Check(st.cacheBytes <= budget && st.idTable.count == FULL &&
+              st.nameTable.count == FULL &&
+              GetSumCustomerPurchase(c, One) == FULL,
+          "cache holds no more than its budget");
+
+    kept = 0;
+    for (int k = 0; k < FULL / 2; k++) {
+        KeysOf(k, id, name);
+        if (GetPurchaseByName(c, name) == k + 1)
+            kept++;
+    }
+    Check(kept == FULL / 2, "used customers are evicted last");
+
+    /* a lookup of an evicted customer is a miss */
+    st = StatsOf(c);
+    int found = 0;
+    for (int k = FULL / 2; k < FULL; k++) {
+        KeysOf(k, id, name);
+        found += GetPurchaseByID(c, id) == k + 1;
+    }
+    struct DBStats after = StatsOf(c);
+    Check(after.cacheHits == st.cacheHits + found &&
+              after.cacheMisses ==
+                  st.cacheMisses + (FULL / 2 - found) &&
+              found < FULL / 2,
+          "lookups counted as hits and misses");
+
+    /* a customer larger than the whole budget is refused, and
+       evicts nobody */
+    size_t bigSize = (size_t)budget + 1;
+    char *big = malloc(bigSize);
+    if (big != NULL) {
+        memset(big, 'x', bigSize - 1);
+        big[bigSize - 1] = '\0';
+        st = StatsOf(c);
+        Check(RegisterCustomer(c, big, "big", 1) == -1 &&
+                  GetPurchaseByName(c, "big") == -1,
+              "customer that can't fit is refused");
+        after = StatsOf(c);
+        Check(after.cacheEvictions == st.cacheEvictions &&
+                  after.idTable.count == st.idTable.count,
+              "refused customer evicts nobody");
+        free(big);
+    }
+
+    /* a snapshot is refused, and changes nothing */
+    st = StatsOf(c);
+    Check(SnapshotCustomerDB(c) == NULL, "cache refuses a snapshot");
+    KeysOf(0, id, name);
+    Check(SetPurchaseByName(c, name, 3) == 0 &&
+              UnregisterCustomerByID(c, id) == 0 &&
+              StatsOf(c).cacheBytes == st.cacheBytes - each,
+          "updates after the refused snapshot are charged");
+    RegisterCustomer(c, id, name, 1);
+
+    /* the budget holds under every kind of update */
+    unsigned int seed = 1;
+    int over = 0;
+    for (int i = 0; i < OPS; i++) {
+        int k = rand_r(&seed) % CHURN_KEYS;
+
+        KeysOf(k, id, name);
+        switch (rand_r(&seed) % 6) {
+        case 0:
+        case 1:
+            RegisterCustomer(c, id, name, k + 1);
+            break;
+        case 2:
+            GetPurchaseByID(c, id);
+            break;
+        case 3:
+            AddPurchaseByID(c, id, 1);
+            break;
+        case 4:
+            SetPurchaseByName(c, name, 5);
+            break;
+        default:
+            UnregisterCustomerByName(c, name);
+            break;
+        }
+        if (i % 1000 == 0 && StatsOf(c).cacheBytes > budget)
+            over = 1;
+    }
+    st = StatsOf(c);
+    Check(!over && st.cacheBytes ==
+                       each * (unsigned long long)st.idTable.count,
+          "budget kept during the churn");
+
+    /* unregistering every customer gives the budget back */
+    for (int k = 0; k < CHURN_KEYS; k++) {
+        KeysOf(k, id, name);
+        UnregisterCustomerByID(c, id);
+    }
+    Check(StatsOf(c).cacheBytes == 0, "cache emptied");
+    DestroyCustomerDB(c);
+
+    /* a db that is not a cache counts nothing */
+    DB_T d = CreateCustomerDB();
+    RegisterCustomer(d, "a", "b", 1);
+    GetPurchaseByID(d, "a");
+    st = StatsOf(d);
+    Check(st.cacheHits == 0 && st.cacheMisses == 0 &&
+              st.cacheBytes == 0,
+          "plain db counts no cache statistics");
+    DestroyCustomerDB(d);
+
+    return Failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* compacttest.c */
+
+/* test of CompactCustomerDB of customer_manager2.c. after most of the
+   customers of a db are unregistered, compacting it must shrink its
+   tables and the memory it holds, and every lookup, sum and later
+   registration must still find what the db holds. a lock-free db is
+   compacted while a reader thread looks customers up */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "customer_manager.h"
+#include "testutil.h"
+
+/* number of customers registered, and one of every KEEP of them is
+   left after the purge */
+#define KEYS 200000
+#define KEEP 100
+
+/* shards of the concurrent and lock-free dbs */
+#define SHARDS 4
+
+static DB_T db;
+static int stopReader;
+
+/*--------------------------------------------------------------------*/
+/* look up the kept customers until told to stop. returns the number
+   of lookups that failed, cast to a pointer */
+static void *ReaderMain(void *arg) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    long bad = 0;
+
+    (void)arg;
+    for (int i = 0;
+         !__atomic_load_n(&stopReader, __ATOMIC_ACQUIRE); i++) {
+        int k = i % (KEYS / KEEP) * KEEP;
+
+        KeysOf(k, id, name);
+        if (GetPurchaseByID(db, id) != k + 1 ||
+            GetPurchaseByName(db, name) != k + 1)
+            bad++;
+    }
+
+    return (void *)bad;
+}
+/*--------------------------------------------------------------------*/
+/* returns nonzero if every customer that should be in the db is, with
+   'purchase' as the purchase of those registered again */
+static int LookUpAll(int again, int purchase) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    long long sum = 0;
+
+    for (int k = 0; k < KEYS; k++) {
+        int e = k % KEEP == 0 ? k + 1 : again ? purchase : -1;
+
+        KeysOf(k, id, name);
+        if (GetPurchaseByID(db, id) != e ||
+            GetPurchaseByName(db, name) != e)
+            return 0;
+        if (e > 0)
+            sum += e;
+    }
+
+    return GetSumCustomerPurchase(db, Purchase) == sum &&
+           GetSumCustomerPurchaseParallel(db, Purchase, 2) == sum;
+}
+/*--------------------------------------------------------------------*/
+static void RunTest(const char *kind, DB_T d, int withReader) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    struct DBStats full, purged, compact;
+    pthread_t reader;
+    void *bad = NULL;
+
+    db = d;
+    for (int k = 0; k < KEYS; k++) {
+        KeysOf(k, id, name);
+        RegisterCustomer(db, id, name, k + 1);
+    }
+    GetCustomerDBStats(db, &full);
+
+    for (int k = 0; k < KEYS; k++) {
+        KeysOf(k, id, name);
+        if (k % KEEP != 0)
+            UnregisterCustomerByName(db, name);
+    }
+    GetCustomerDBStats(db, &purged);
+
+    stopReader = 0;
+    if (withReader)
+        pthread_create(&reader, NULL, ReaderMain, NULL);
+    Check(CompactCustomerDB(db) == 0, "%s: CompactCustomerDB", kind);
+    if (withReader) {
+        __atomic_store_n(&stopReader, 1, __ATOMIC_RELEASE);
+        pthread_join(reader, &bad);
+        Check(bad == NULL, "%s: lookups during the compaction", kind);
+    }
+    GetCustomerDBStats(db, &compact);
+
+    Check(compact.idTable.count == KEYS / KEEP &&
+              compact.nameTable.count == KEYS / KEEP,
+          "%s: customers kept", kind);
+    Check(compact.idTable.capacity < full.idTable.capacity &&
+              compact.nameTable.capacity < full.nameTable.capacity,
+          "%s: tables shrunk", kind);
+    Check(compact.bytesAllocated < purged.bytesAllocated &&
+              compact.bytesAllocated < full.bytesAllocated / 10,
+          "%s: memory given back", kind);
+    Check(LookUpAll(0, 0), "%s: lookups after the compaction", kind);
+
+    // the compacted tables grow again as usual
+    for (int k = 0; k < KEYS; k++) {
+        KeysOf(k, id, name);
+        if (k % KEEP != 0)
+            RegisterCustomer(db, id, name, 2);
+    }
+    Check(LookUpAll(1, 2), "%s: registrations after the compaction",
+          kind);
+
+    DestroyCustomerDB(db);
+}
+/*--------------------------------------------------------------------*/
+int main(void) {
+    RunTest("CreateCustomerDB", CreateCustomerDB(), 0);
+    RunTest("CreateCustomerDBConcurrent",
+            CreateCustomerDBConcurrent(SHARDS), 0);
+    RunTest("CreateCustomerDBLockFree",
+            CreateCustomerDBLockFree(SHARDS), 1);
+
+    return Failures() == 0 ? 0 : 1;
+}
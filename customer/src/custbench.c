@@ -0,0 +1,594 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* custbench.c */
+
+/* benchmark driver for the customer dbs. every workload starts from a
+   fresh db loaded with the same customers and times each call on its
+   own, so that the tail of the latency distribution shows up next to
+   the throughput */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "customer_manager.h"
+
+/* size of the buffer of a key, including the null byte */
+#define KEY_SIZE 24
+
+/* length of a random key */
+#define RANDOM_KEY_LEN 12
+
+/* a latency histogram has SUB_BUCKETS linear buckets per power of 2,
+   so that every percentile is within 1/SUB_BUCKETS of the truth */
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+/* kinds of timed calls */
+enum OpKind {
+    OP_REGISTER,
+    OP_UNREGISTER,
+    OP_LOOKUP_ID,
+    OP_LOOKUP_NAME,
+    NUM_OPS
+};
+
+static const char *opNames[NUM_OPS] = {"register", "unregister",
+                                       "lookup_id", "lookup_name"};
+
+enum Workload { WL_LOOKUP, WL_MISS, WL_MIXED, WL_CHURN, NUM_WORKLOADS };
+
+static const char *workloadNames[NUM_WORKLOADS] = {"lookup", "miss",
+                                                   "mixed", "churn"};
+
+enum Format { FMT_TEXT, FMT_CSV, FMT_JSON };
+
+/* latencies of one kind of call, in nanoseconds */
+struct Histogram {
+    unsigned long long counts[NUM_BUCKETS];
+    unsigned long long n;
+    unsigned long long sum;
+    unsigned long long max;
+};
+
+/* command line settings */
+struct Config {
+    const char *label;
+    int customers;
+    int ops;
+    int workloads; // bit i set if workload i runs
+    int zipf;
+    double theta;
+    int readPercent;
+    int missPercent;
+    int randomKeys;
+    enum Format format;
+    unsigned long long seed;
+};
+
+/* keys of the customers. there are twice as many as are loaded, so
+   that misses and registrations have keys to use */
+struct Keys {
+    char *ids;
+    char *names;
+    int n;
+};
+
+/* zipfian generator of ranks in [0, n), after Gray et al., "Quickly
+   generating billion-record synthetic databases" */
+struct Zipf {
+    int n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+};
+
+/* a running workload */
+struct Bench {
+    const struct Config *cfg;
+    const struct Keys *keys;
+    struct Zipf zipf;
+
+    // key of each popularity rank, so that hot keys are scattered
+    int *rankKey;
+
+    // live[k] is nonzero while key k is registered. liveList holds the
+    // registered keys and deadList the others, each in no order
+    char *live;
+    int *liveList;
+    int *deadList;
+    int *pos;
+    int nlive;
+    int ndead;
+
+    unsigned long long random;
+    struct Histogram hist[NUM_OPS];
+};
+
+/*--------------------------------------------------------------------*/
+static unsigned long long NowNsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*--------------------------------------------------------------------*/
+static void *Alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (p == NULL) {
+        fprintf(stderr, "Can't allocate a memory of size %zu\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+/*--------------------------------------------------------------------*/
+/* xorshift64* */
+static unsigned long long NextRandom(unsigned long long *state) {
+    unsigned long long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+/*--------------------------------------------------------------------*/
+static double RandomUnit(unsigned long long *state) {
+    return (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+/*--------------------------------------------------------------------*/
+static void ZipfInit(struct Zipf *z, int n, double theta) {
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = 0;
+    for (int i = 1; i <= n; i++)
+        z->zetan += 1.0 / pow(i, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) /
+             (1.0 - zeta2 / z->zetan);
+}
+/*--------------------------------------------------------------------*/
+static int ZipfNext(const struct Zipf *z, unsigned long long *state) {
+    double u = RandomUnit(state);
+    double uz = u * z->zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+
+    int r = (int)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+/*--------------------------------------------------------------------*/
+static int BucketOf(unsigned long long v) {
+    if (v < SUB_BUCKETS)
+        return (int)v;
+
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS +
+           (int)((v >> shift) & (SUB_BUCKETS - 1));
+}
+/*--------------------------------------------------------------------*/
+/* largest value that falls into a bucket */
+static unsigned long long BucketLimit(int b) {
+    if (b < SUB_BUCKETS)
+        return (unsigned long long)b;
+
+    int shift = b / SUB_BUCKETS - 1;
+    unsigned long long base =
+        (unsigned long long)(SUB_BUCKETS + b % SUB_BUCKETS) << shift;
+    return base + (1ULL << shift) - 1;
+}
+/*--------------------------------------------------------------------*/
+static void Record(struct Histogram *h, unsigned long long ns) {
+    h->counts[BucketOf(ns)]++;
+    h->n++;
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+/*--------------------------------------------------------------------*/
+static unsigned long long Percentile(const struct Histogram *h,
+                                     double p) {
+    unsigned long long rank = (unsigned long long)ceil(p * h->n);
+    unsigned long long seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank)
+            return BucketLimit(b) < h->max ? BucketLimit(b) : h->max;
+    }
+    return h->max;
+}
+/*--------------------------------------------------------------------*/
+static void MakeKeys(struct Keys *k, const struct Config *cfg) {
+    static const char alnum[] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    unsigned long long state = cfg->seed | 1;
+
+    k->n = 2 * cfg->customers;
+    k->ids = Alloc((size_t)k->n * KEY_SIZE);
+    k->names = Alloc((size_t)k->n * KEY_SIZE);
+
+    for (int i = 0; i < k->n; i++) {
+        char *id = k->ids + (size_t)i * KEY_SIZE;
+        char *name = k->names + (size_t)i * KEY_SIZE;
+
+        if (!cfg->randomKeys) {
+            sprintf(id, "id%d", i);
+            sprintf(name, "name%d", i);
+            continue;
+        }
+
+        // the index keeps random keys distinct
+        int len = sprintf(id, "%x.", i);
+        for (int j = len; j < RANDOM_KEY_LEN; j++)
+            id[j] = alnum[NextRandom(&state) % (sizeof(alnum) - 1)];
+        id[RANDOM_KEY_LEN] = '\0';
+        len = sprintf(name, "%x.", i);
+        for (int j = len; j < RANDOM_KEY_LEN; j++)
+            name[j] = alnum[NextRandom(&state) % (sizeof(alnum) - 1)];
+        name[RANDOM_KEY_LEN] = '\0';
+    }
+}
+/*--------------------------------------------------------------------*/
+static inline const char *IdOf(const struct Bench *b, int k) {
+    return b->keys->ids + (size_t)k * KEY_SIZE;
+}
+/*--------------------------------------------------------------------*/
+static inline const char *NameOf(const struct Bench *b, int k) {
+    return b->keys->names + (size_t)k * KEY_SIZE;
+}
+/*--------------------------------------------------------------------*/
+static void MoveKey(struct Bench *b, int k, int toLive) {
+    int *from = toLive ? b->deadList : b->liveList;
+    int *nfrom = toLive ? &b->ndead : &b->nlive;
+    int *to = toLive ? b->liveList : b->deadList;
+    int *nto = toLive ? &b->nlive : &b->ndead;
+
+    int last = from[--*nfrom];
+    from[b->pos[k]] = last;
+    b->pos[last] = b->pos[k];
+
+    b->pos[k] = *nto;
+    to[(*nto)++] = k;
+    b->live[k] = (char)toLive;
+}
+/*--------------------------------------------------------------------*/
+static void TimedRegister(struct Bench *b, DB_T d, int k) {
+    unsigned long long t0 = NowNsec();
+    int res =
+        RegisterCustomer(d, IdOf(b, k), NameOf(b, k), k % 100 + 1);
+    Record(&b->hist[OP_REGISTER], NowNsec() - t0);
+
+    if (res != 0) {
+        fprintf(stderr, "RegisterCustomer(%s) failed\n", IdOf(b, k));
+        exit(EXIT_FAILURE);
+    }
+    MoveKey(b, k, 1);
+}
+/*--------------------------------------------------------------------*/
+static void TimedUnregister(struct Bench *b, DB_T d, int k) {
+    unsigned long long t0 = NowNsec();
+    int res = UnregisterCustomerByID(d, IdOf(b, k));
+    Record(&b->hist[OP_UNREGISTER], NowNsec() - t0);
+
+    if (res != 0) {
+        fprintf(stderr, "UnregisterCustomerByID(%s) failed\n",
+                IdOf(b, k));
+        exit(EXIT_FAILURE);
+    }
+    MoveKey(b, k, 0);
+}
+/*--------------------------------------------------------------------*/
+/* look a key up by id or name, chosen at random, and check the
+   answer */
+static void TimedLookup(struct Bench *b, DB_T d, int k) {
+    int byName = (int)(NextRandom(&b->random) & 1);
+    unsigned long long t0 = NowNsec();
+    int res = byName ? GetPurchaseByName(d, NameOf(b, k))
+                     : GetPurchaseByID(d, IdOf(b, k));
+    Record(&b->hist[byName ? OP_LOOKUP_NAME : OP_LOOKUP_ID],
+           NowNsec() - t0);
+
+    if (res != (b->live[k] ? k % 100 + 1 : -1)) {
+        fprintf(stderr, "lookup of %s returned %d\n", IdOf(b, k), res);
+        exit(EXIT_FAILURE);
+    }
+}
+/*--------------------------------------------------------------------*/
+/* a key of the loaded half, drawn from the configured popularity */
+static int PickKey(struct Bench *b) {
+    int rank = b->cfg->zipf
+                   ? ZipfNext(&b->zipf, &b->random)
+                   : (int)(NextRandom(&b->random) % b->cfg->customers);
+    return b->rankKey[rank];
+}
+/*--------------------------------------------------------------------*/
+static void BenchInit(struct Bench *b, const struct Config *cfg,
+                      const struct Keys *keys) {
+    int n = keys->n;
+
+    memset(b, 0, sizeof(*b));
+    b->cfg = cfg;
+    b->keys = keys;
+    b->random = cfg->seed * 2 + 1;
+    if (cfg->zipf)
+        ZipfInit(&b->zipf, cfg->customers, cfg->theta);
+
+    b->live = Alloc(n);
+    b->liveList = Alloc(n * sizeof(int));
+    b->deadList = Alloc(n * sizeof(int));
+    b->pos = Alloc(n * sizeof(int));
+    for (int k = 0; k < n; k++) {
+        b->pos[k] = k;
+        b->deadList[b->ndead++] = k;
+    }
+
+    b->rankKey = Alloc(cfg->customers * sizeof(int));
+    for (int r = 0; r < cfg->customers; r++)
+        b->rankKey[r] = r;
+    for (int r = cfg->customers - 1; r > 0; r--) {
+        int j = (int)(NextRandom(&b->random) % (r + 1));
+        int t = b->rankKey[r];
+        b->rankKey[r] = b->rankKey[j];
+        b->rankKey[j] = t;
+    }
+}
+/*--------------------------------------------------------------------*/
+static void BenchFree(struct Bench *b) {
+    free(b->live);
+    free(b->liveList);
+    free(b->deadList);
+    free(b->pos);
+    free(b->rankKey);
+}
+/*--------------------------------------------------------------------*/
+static void PrintHeader(const struct Config *cfg) {
+    if (cfg->format == FMT_CSV)
+        printf("backend,workload,keys,dist,op,count,mean_ns,p50_ns,"
+               "p99_ns,p999_ns,max_ns,ops_per_sec\n");
+    else if (cfg->format == FMT_JSON)
+        printf("[");
+    else
+        printf("%-12s %-12s %10s %9s %9s %9s %9s %10s %12s\n",
+               "workload", "op", "count", "mean_ns", "p50_ns", "p99_ns",
+               "p999_ns", "max_ns", "ops/sec");
+}
+/*--------------------------------------------------------------------*/
+static void PrintRow(const struct Config *cfg, const char *workload,
+                     const struct Histogram *h, const char *op,
+                     double opsPerSec, int *first) {
+    double mean = (double)h->sum / h->n;
+    unsigned long long p50 = Percentile(h, 0.50);
+    unsigned long long p99 = Percentile(h, 0.99);
+    unsigned long long p999 = Percentile(h, 0.999);
+    const char *keys = cfg->randomKeys ? "random" : "sequential";
+    const char *dist = cfg->zipf ? "zipf" : "uniform";
+
+    if (cfg->format == FMT_CSV) {
+        printf("%s,%s,%s,%s,%s,%llu,%.1f,%llu,%llu,%llu,%llu,%.0f\n",
+               cfg->label, workload, keys, dist, op, h->n, mean, p50,
+               p99, p999, h->max, opsPerSec);
+    } else if (cfg->format == FMT_JSON) {
+        printf("%s\n  {\"backend\": \"%s\", \"workload\": \"%s\", "
+               "\"keys\": \"%s\", \"dist\": \"%s\", \"op\": \"%s\", "
+               "\"count\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, "
+               "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu, "
+               "\"ops_per_sec\": %.0f}",
+               *first ? "" : ",", cfg->label, workload, keys, dist, op,
+               h->n, mean, p50, p99, p999, h->max, opsPerSec);
+    } else {
+        printf("%-12s %-12s %10llu %9.1f %9llu %9llu %9llu %10llu "
+               "%12.0f\n",
+               workload, op, h->n, mean, p50, p99, p999, h->max,
+               opsPerSec);
+    }
+    *first = 0;
+}
+/*--------------------------------------------------------------------*/
+/* print a row per kind of call, each with the throughput of all calls
+   of the workload */
+static void PrintWorkload(const struct Config *cfg, const char *name,
+                          const struct Histogram *hist,
+                          unsigned long long ns, int *first) {
+    unsigned long long calls = 0;
+
+    for (int op = 0; op < NUM_OPS; op++)
+        calls += hist[op].n;
+    for (int op = 0; op < NUM_OPS; op++)
+        if (hist[op].n > 0)
+            PrintRow(cfg, name, &hist[op], opNames[op],
+                     calls * 1e9 / ns, first);
+}
+/*--------------------------------------------------------------------*/
+/* run a workload on a fresh db. the loading of the db is reported too
+   if printLoad is nonzero */
+static void RunWorkload(const struct Config *cfg,
+                        const struct Keys *keys, enum Workload w,
+                        int printLoad, int *first) {
+    struct Bench b;
+    DB_T d = CreateCustomerDB();
+
+    if (d == NULL) {
+        fprintf(stderr, "CreateCustomerDB() failed\n");
+        exit(EXIT_FAILURE);
+    }
+    BenchInit(&b, cfg, keys);
+
+    // the first half of the keys is loaded
+    unsigned long long t0 = NowNsec();
+    for (int k = 0; k < cfg->customers; k++)
+        TimedRegister(&b, d, k);
+    unsigned long long loadNs = NowNsec() - t0;
+    if (printLoad)
+        PrintWorkload(cfg, "load", b.hist, loadNs, first);
+    memset(b.hist, 0, sizeof(b.hist));
+
+    t0 = NowNsec();
+    for (int i = 0; i < cfg->ops; i++) {
+        int k;
+
+        switch (w) {
+        case WL_LOOKUP:
+            TimedLookup(&b, d, PickKey(&b));
+            break;
+        case WL_MISS:
+            // misses use keys of the half that is never loaded
+            if ((int)(NextRandom(&b.random) % 100) < cfg->missPercent)
+                k = cfg->customers + PickKey(&b);
+            else
+                k = PickKey(&b);
+            TimedLookup(&b, d, k);
+            break;
+        case WL_MIXED:
+            // a write takes a customer out or puts it back
+            k = PickKey(&b);
+            if ((int)(NextRandom(&b.random) % 100) < cfg->readPercent)
+                TimedLookup(&b, d, k);
+            else if (b.live[k])
+                TimedUnregister(&b, d, k);
+            else
+                TimedRegister(&b, d, k);
+            break;
+        default:
+            // churn replaces a random customer with a new one, so the
+            // size stays the same
+            TimedUnregister(
+                &b, d,
+                b.liveList[NextRandom(&b.random) % b.nlive]);
+            TimedRegister(&b, d,
+                          b.deadList[NextRandom(&b.random) % b.ndead]);
+            break;
+        }
+    }
+    unsigned long long ns = NowNsec() - t0;
+
+    PrintWorkload(cfg, workloadNames[w], b.hist, ns, first);
+
+    DestroyCustomerDB(d);
+    BenchFree(&b);
+}
+/*--------------------------------------------------------------------*/
+static void Usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n num      customers loaded before each workload "
+            "(100000)\n"
+            "  -o num      operations per workload (1000000)\n"
+            "  -w list     workloads to run, separated by commas: "
+            "lookup,\n"
+            "              miss, mixed, churn (all)\n"
+            "  -z theta    zipfian key popularity with the given skew "
+            "(uniform)\n"
+            "  -r percent  share of reads in the mixed workload (90)\n"
+            "  -m percent  share of misses in the miss workload (90)\n"
+            "  -q          sequential id%%d and name%%d keys (random)\n"
+            "  -f format   text, csv or json (text)\n"
+            "  -l label    backend name in the output (program name)\n"
+            "  -s seed     seed of keys and operations (1)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+/*--------------------------------------------------------------------*/
+static int ParseWorkloads(char *list) {
+    int mask = 0;
+
+    for (char *w = strtok(list, ","); w != NULL;
+         w = strtok(NULL, ",")) {
+        int i;
+
+        for (i = 0; i < NUM_WORKLOADS; i++)
+            if (strcmp(w, workloadNames[i]) == 0)
+                break;
+        if (i == NUM_WORKLOADS)
+            return -1;
+        mask |= 1 << i;
+    }
+    return mask;
+}
+/*--------------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+    struct Config cfg = {NULL, 100000, 1000000,
+                         (1 << NUM_WORKLOADS) - 1, 0, 0.99, 90, 90, 1,
+                         FMT_TEXT, 1};
+    struct Keys keys;
+    int opt, first = 1;
+
+    const char *slash = strrchr(argv[0], '/');
+    cfg.label = slash != NULL ? slash + 1 : argv[0];
+
+    while ((opt = getopt(argc, argv, "n:o:w:z:r:m:qf:l:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            cfg.customers = atoi(optarg);
+            break;
+        case 'o':
+            cfg.ops = atoi(optarg);
+            break;
+        case 'w':
+            cfg.workloads = ParseWorkloads(optarg);
+            break;
+        case 'z':
+            cfg.zipf = 1;
+            cfg.theta = atof(optarg);
+            break;
+        case 'r':
+            cfg.readPercent = atoi(optarg);
+            break;
+        case 'm':
+            cfg.missPercent = atoi(optarg);
+            break;
+        case 'q':
+            cfg.randomKeys = 0;
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0)
+                cfg.format = FMT_CSV;
+            else if (strcmp(optarg, "json") == 0)
+                cfg.format = FMT_JSON;
+            else if (strcmp(optarg, "text") == 0)
+                cfg.format = FMT_TEXT;
+            else
+                Usage(argv[0]);
+            break;
+        case 'l':
+            cfg.label = optarg;
+            break;
+        case 's':
+            cfg.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            Usage(argv[0]);
+        }
+    }
+
+    if (optind != argc || cfg.customers <= 1 || cfg.ops < 0 ||
+        cfg.workloads <= 0 || cfg.theta <= 0 || cfg.theta >= 1 ||
+        cfg.readPercent < 0 || cfg.readPercent > 100 ||
+        cfg.missPercent < 0 || cfg.missPercent > 100)
+        Usage(argv[0]);
+
+    MakeKeys(&keys, &cfg);
+    PrintHeader(&cfg);
+    for (int w = 0; w < NUM_WORKLOADS; w++)
+        if (cfg.workloads & (1 << w))
+            RunWorkload(&cfg, &keys, (enum Workload)w, first, &first);
+    if (cfg.format == FMT_JSON)
+        printf("\n]\n");
+
+    free(keys.ids);
+    free(keys.names);
+
+    return 0;
+}
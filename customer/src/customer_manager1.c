@@ -5,18 +5,39 @@
  */
 
 #include "customer_manager.h"
+#include "arena.h"
+#include "db_stats.h"
+#include "keyhash.h"
+#include "name_index.h"
+#include "purchase_index.h"
+#include "record_file.h"
+#include "sum_job.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define UNIT_ARRAY_SIZE 1024
 
+// customers are looked up through open addressing index tables of
+// 32-bit slots rather than by scanning the array. build with
+// -DUSE_INDEX=0 for the bare array
+#ifndef USE_INDEX
+#define USE_INDEX 1
+#endif
+
+// an index slot that refers to no customer
+#define NO_RECORD 0xffffffffU
+
+// customers in a chunk of GetSumCustomerPurchaseParallel()
+#define SUM_CHUNK_SIZE 16384
+
 struct UserInfo {
     // customer name
     char *name;
 
-    // customer id
+    // customer id. id and name share one arena block, id first
     char *id;
 
     // purchase amount (> 0)
@@ -32,10 +53,68 @@ struct DB {
 
     // current array size
     int size;
+
+    // storage of id and name strings
+    struct Arena arena;
+
+    // customers ordered by purchase amount, and by name. each is built
+    // by the first query that needs it, so that a db that never runs
+    // one doesn't maintain it
+    struct PurchaseIndex purchases;
+    struct NameIndex names;
+    int purchasesBuilt;
+    int namesBuilt;
+
+#if USE_INDEX
+    // linear probing tables for id and name, allocated in one block
+    // with the array, right after it. a slot holds the index of a
+    // customer in array, or NO_RECORD. each table has 2 * capacity
+    // slots, so it is never more than half full
+    unsigned int *idIndex;
+    unsigned int *nameIndex;
+
+    // seed the keys are hashed with
+    unsigned long long seed;
+#endif
+
+    // times the array was expanded, and the nanoseconds it took
+    unsigned long long rehashes;
+    unsigned long long rehashNsec;
+
+#if USE_STATS
+    // calls and probes of each kind of operation
+    struct DBCounters counters;
+#endif
 };
 
-static void ExpandCustomerDB(DB_T db);
+/* which key of a customer an index table is indexed with */
+enum KeyKind { KEY_ID, KEY_NAME };
+
+/* a GetSumCustomerPurchaseParallel() call, summed a chunk at a time
+   by SumChunk() */
+struct SumJob {
+    DB_T db;
+    FUNCPTR_T fp;
+};
+
+static size_t ArraySize(int capacity);
+static int AllocArray(DB_T db, int capacity);
+static int CapacityFor(int capacity, long long n);
+static int ExpandCustomerDB(DB_T db, int capacity);
 static int SearchCustomer(DB_T db, const char *id, const char *name);
+static void RemoveCustomer(DB_T db, int idx);
+static void UpdatePurchase(DB_T db, int idx, int purchase);
+static long long SumChunk(void *arg, unsigned int chunk);
+static int BuildPurchaseIndex(DB_T db);
+static int BuildNameIndex(DB_T db);
+#if USE_INDEX
+static unsigned int *FindSlot(DB_T db, enum KeyKind kind,
+                              const char *key);
+static unsigned int *SlotOf(DB_T db, enum KeyKind kind, int idx);
+static void EraseSlot(DB_T db, enum KeyKind kind, unsigned int *slot);
+static void BuildIndex(DB_T db);
+static inline unsigned int HomeOf(DB_T db, const char *key);
+#endif
 
 /**
  * CreateCustomerDB: create a new customer db
@@ -46,23 +125,41 @@ static int SearchCustomer(DB_T db, const char *id, const char *name);
  * returns: pointer to newly allocated database
  */
 DB_T CreateCustomerDB(void) {
+    // start with 1024 elements
+    return CreateCustomerDBWithCapacity(UNIT_ARRAY_SIZE);
+}
+
+/**
+ * CreateCustomerDBWithCapacity: create a new customer db with room for
+ * a given number of customers
+ *
+ * param n: number of customers the array is sized for
+ *
+ * returns: pointer to newly allocated database. NULL on invalid
+ *  arguments or if memory allocation fails
+ */
+DB_T CreateCustomerDBWithCapacity(int n) {
     DB_T db;
+    int capacity = CapacityFor(UNIT_ARRAY_SIZE, n);
+
+    if (n < 0 || capacity < 0)
+        return NULL;
 
     db = (DB_T)calloc(1, sizeof(struct DB));
     if (db == NULL) {
         fprintf(stderr, "Can't allocate a memory for DB_T\n");
         return NULL;
     }
-    db->capacity = UNIT_ARRAY_SIZE; // start with 1024 elements
-    db->array = (struct UserInfo *)calloc(db->capacity,
-                                          sizeof(struct UserInfo));
-    if (db->array == NULL) {
-        fprintf(stderr,
-                "Can't allocate a memory for array of size %d\n",
-                db->capacity);
+#if USE_INDEX
+    db->seed = RandomHashSeed();
+#endif
+    if (AllocArray(db, capacity) < 0) {
         free(db);
         return NULL;
     }
+    ArenaInit(&db->arena);
+    PurchaseIndexInit(&db->purchases, RandomHashSeed());
+    NameIndexInit(&db->names);
 
     return db;
 }
@@ -76,10 +173,10 @@ DB_T CreateCustomerDB(void) {
  * param db: pointer to database
  */
 void DestroyCustomerDB(DB_T db) {
-    for (size_t i = 0; i < db->size; i++) {
-        free(db->array[i].name);
-        free(db->array[i].id);
-    }
+    // strings live in the arena, so there is no array to walk
+    ArenaRelease(&db->arena);
+    PurchaseIndexRelease(&db->purchases);
+    NameIndexRelease(&db->names);
 
     free(db->array);
     free(db);
@@ -99,33 +196,135 @@ int RegisterCustomer(DB_T db, const char *id, const char *name,
                      const int purchase) {
     if (db == NULL || id == NULL || name == NULL || purchase <= 0)
         return -1;
+    STATS_OP(&db->counters, DB_OP_REGISTER);
+
+    // expand customer DB if necessary. this comes before the search,
+    // which would have to be redone in the new index tables otherwise
+    if (db->size == db->capacity &&
+        ExpandCustomerDB(db, db->capacity << 1) < 0)
+        return -1;
 
     // check for already existing item
+#if USE_INDEX
+    // the empty slots the searches end at are where the new customer
+    // goes
+    unsigned int *idSlot = FindSlot(db, KEY_ID, id);
+    if (*idSlot != NO_RECORD)
+        return -1;
+    unsigned int *nameSlot = FindSlot(db, KEY_NAME, name);
+    if (*nameSlot != NO_RECORD)
+        return -1;
+#else
     if (SearchCustomer(db, id, name) != -1)
         return -1;
+#endif
 
     struct UserInfo *newUser = db->array + db->size;
 
-    newUser->id = strdup(id);
+    size_t idSize = strlen(id) + 1;
+    size_t nameSize = strlen(name) + 1;
+    newUser->id = ArenaAlloc(&db->arena, idSize + nameSize);
     if (newUser->id == NULL) {
-        fprintf(stderr, "Can't allocate memory for new user id\n");
+        fprintf(stderr, "Can't allocate memory for new user\n");
         return -1;
     }
 
-    newUser->name = strdup(name);
-    if (newUser->name == NULL) {
-        free(newUser->id);
-        fprintf(stderr, "Can't allocate memory for new user name\n");
-        return -1;
-    }
+    newUser->name = newUser->id + idSize;
+    memcpy(newUser->id, id, idSize);
+    memcpy(newUser->name, name, nameSize);
 
     newUser->purchase = purchase;
+    if (db->purchasesBuilt &&
+        PurchaseIndexInsert(&db->purchases, newUser->id, newUser->name,
+                            purchase) < 0) {
+        fprintf(stderr, "Can't allocate memory for new user\n");
+        ArenaFree(&db->arena, newUser->id, idSize + nameSize);
+        return -1;
+    }
+    if (db->namesBuilt && NameIndexInsert(&db->names, newUser->id,
+                                          newUser->name, purchase) < 0) {
+        fprintf(stderr, "Can't allocate memory for new user\n");
+        if (db->purchasesBuilt)
+            PurchaseIndexRemove(&db->purchases, newUser->id, purchase);
+        ArenaFree(&db->arena, newUser->id, idSize + nameSize);
+        return -1;
+    }
+#if USE_INDEX
+    *idSlot = (unsigned int)db->size;
+    *nameSlot = (unsigned int)db->size;
+#endif
     db->size++;
-    ExpandCustomerDB(db); // expand customer DB if necessary
 
     return 0;
 }
 
+/**
+ * RegisterCustomerBatch: register several customers at once
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param names: array of n names
+ * param purchases: array of n purchase values
+ * param n: number of customers
+ * param out: array receiving the result of each registration as
+ *  RegisterCustomer() returns it. may be NULL
+ *
+ * returns: number of customers registered. -1 on invalid arguments
+ */
+int RegisterCustomerBatch(DB_T db, const char **ids, const char **names,
+                          const int *purchases, int n, int *out) {
+    if (db == NULL || ids == NULL || names == NULL ||
+        purchases == NULL || n < 0)
+        return -1;
+
+    int registered = 0;
+
+    for (int i = 0; i < n; i++) {
+        int res = RegisterCustomer(db, ids[i], names[i], purchases[i]);
+        if (res == 0)
+            registered++;
+        if (out != NULL)
+            out[i] = res;
+    }
+
+    return registered;
+}
+
+/**
+ * LoadCustomersFromFile: register the customers of a file
+ *
+ *  the array is grown once to hold every customer of the file before
+ *  they are registered
+ *
+ * param db: pointer to database
+ * param path: path of a file of "id,name,purchase" lines
+ *
+ * returns: number of customers registered. -1 if the file can't be
+ *  read or parsed, or on invalid arguments
+ */
+int LoadCustomersFromFile(DB_T db, const char *path) {
+    struct RecordFile f;
+
+    if (db == NULL || path == NULL)
+        return -1;
+    if (RecordFileOpen(&f, path) < 0)
+        return -1;
+
+    int capacity =
+        CapacityFor(db->capacity, (long long)db->size + f.count);
+    if (capacity < 0 || (capacity > db->capacity &&
+                         ExpandCustomerDB(db, capacity) < 0)) {
+        RecordFileClose(&f);
+        return -1;
+    }
+
+    int registered = RegisterCustomerBatch(db, f.ids, f.names,
+                                           f.purchases, f.count, NULL);
+    RecordFileClose(&f);
+
+    return registered;
+}
+
 /**
  * UnregisterCustomerByID: unregister a customer by id
  *
@@ -139,17 +338,13 @@ int RegisterCustomer(DB_T db, const char *id, const char *name,
 int UnregisterCustomerByID(DB_T db, const char *id) {
     if (db == NULL || id == NULL)
         return -1;
+    STATS_OP(&db->counters, DB_OP_UNREGISTER);
 
     int idx = SearchCustomer(db, id, NULL);
     if (idx == -1)
         return -1;
 
-    free(db->array[idx].id);
-    free(db->array[idx].name);
-
-    for (int i = idx + 1; i < db->size; i++)
-        db->array[i - 1] = db->array[i];
-    db->size--;
+    RemoveCustomer(db, idx);
 
     return 0;
 }
@@ -167,17 +362,13 @@ int UnregisterCustomerByID(DB_T db, const char *id) {
 int UnregisterCustomerByName(DB_T db, const char *name) {
     if (db == NULL || name == NULL)
         return -1;
+    STATS_OP(&db->counters, DB_OP_UNREGISTER);
 
     int idx = SearchCustomer(db, NULL, name);
     if (idx == -1)
         return -1;
 
-    free(db->array[idx].id);
-    free(db->array[idx].name);
-
-    for (int i = idx + 1; i < db->size; i++)
-        db->array[i - 1] = db->array[i];
-    db->size--;
+    RemoveCustomer(db, idx);
 
     return 0;
 }
@@ -194,6 +385,7 @@ int UnregisterCustomerByName(DB_T db, const char *name) {
 int GetPurchaseByID(DB_T db, const char *id) {
     if (db == NULL || id == NULL)
         return -1;
+    STATS_OP(&db->counters, DB_OP_LOOKUP);
 
     int idx = SearchCustomer(db, id, NULL);
     if (idx == -1)
@@ -202,6 +394,33 @@ int GetPurchaseByID(DB_T db, const char *id) {
     return db->array[idx].purchase;
 }
 
+/**
+ * GetPurchaseByIDBatch: get the purchase fields of several customers by
+ * id at once
+ *
+ * the customers are simply looked up one by one
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param n: number of ids
+ * param out: array receiving the purchase field of each customer. -1
+ *  if customer with the id does not exist
+ *
+ * returns: number of customers found. -1 on invalid arguments
+ */
+int GetPurchaseByIDBatch(DB_T db, const char **ids, int n, int *out) {
+    if (db == NULL || ids == NULL || out == NULL || n < 0)
+        return -1;
+
+    int found = 0;
+
+    for (int i = 0; i < n; i++)
+        if ((out[i] = GetPurchaseByID(db, ids[i])) != -1)
+            found++;
+
+    return found;
+}
+
 /**
  * GetPurchaseByName: get the purchase field of a customer by name
  *
@@ -214,6 +433,7 @@ int GetPurchaseByID(DB_T db, const char *id) {
 int GetPurchaseByName(DB_T db, const char *name) {
     if (db == NULL || name == NULL)
         return -1;
+    STATS_OP(&db->counters, DB_OP_LOOKUP);
 
     int idx = SearchCustomer(db, NULL, name);
     if (idx == -1)
@@ -222,6 +442,61 @@ int GetPurchaseByName(DB_T db, const char *name) {
     return db->array[idx].purchase;
 }
 
+/**
+ * AddPurchaseByID: add an amount to the purchase field of a customer
+ * found by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param amount: amount to add. may be negative
+ *
+ * returns: new purchase field value of customer with id.
+ *  -1 if customer with id does not exist, or if the new value is not
+ *  a positive int
+ */
+int AddPurchaseByID(DB_T db, const char *id, int amount) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UPDATE);
+
+    int idx = SearchCustomer(db, id, NULL);
+    if (idx == -1)
+        return -1;
+
+    long long purchase = (long long)db->array[idx].purchase + amount;
+    if (purchase <= 0 || purchase > INT_MAX)
+        return -1;
+
+    UpdatePurchase(db, idx, (int)purchase);
+
+    return (int)purchase;
+}
+
+/**
+ * SetPurchaseByName: set the purchase field of a customer found by
+ * name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ * param purchase: new purchase amount (> 0)
+ *
+ * returns: 0 on success. -1 if customer with name does not exist or
+ *  purchase is not positive
+ */
+int SetPurchaseByName(DB_T db, const char *name, int purchase) {
+    if (db == NULL || name == NULL || purchase <= 0)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UPDATE);
+
+    int idx = SearchCustomer(db, NULL, name);
+    if (idx == -1)
+        return -1;
+
+    UpdatePurchase(db, idx, purchase);
+
+    return 0;
+}
+
 /**
  * GetSumCustomerPurchase: apply a given function to all customers and
  * get the sum of results
@@ -245,33 +520,576 @@ int GetSumCustomerPurchase(DB_T db, FUNCPTR_T fp) {
 }
 
 /**
- * ExpandCustomerDB: resize customer db array, but only if necessary
+ * GetSumCustomerPurchaseParallel: apply a given function to all
+ * customers on several threads and get the 64-bit sum of results
+ *
+ * the array is cut into chunks that the calling thread and up to
+ * nthreads - 1 helper threads take one at a time, each adding into
+ * its own partial sum
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T. it is called from
+ *  several threads at once
+ * param nthreads: number of threads to use
+ *
+ * returns: sum of function applications to all customers. -1 on
+ *  invalid arguments
+ */
+long long GetSumCustomerPurchaseParallel(DB_T db, FUNCPTR_T fp,
+                                         int nthreads) {
+    struct SumJob job;
+
+    if (db == NULL || fp == NULL || nthreads <= 0)
+        return -1;
+
+    job.db = db;
+    job.fp = fp;
+
+    return RunSumJob((db->size + SUM_CHUNK_SIZE - 1) / SUM_CHUNK_SIZE,
+                     SumChunk, &job, nthreads);
+}
+
+/**
+ * GetCustomersByPurchaseRange: apply a given function to the customers
+ * whose purchase amount lies in a range and get the sum of results
+ *
+ * the customers are found through the purchase index, largest amount
+ * first, in O(log n + k) for k customers in the range. the index is
+ * built first if no purchase query has run yet
+ *
+ * param db: pointer to database
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetCustomersByPurchaseRange(DB_T db, int low, int high,
+                                FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexRange(&db->purchases, low, high, fp);
+}
+
+/**
+ * GetTopKCustomers: apply a given function to the customers with the
+ * largest purchase amounts and get the sum of results
+ *
+ * param db: pointer to database
+ * param k: number of customers
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetTopKCustomers(DB_T db, int k, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || k < 0 ||
+        BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexTop(&db->purchases, k, fp);
+}
+
+/**
+ * ForEachCustomerWithNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix
+ *
+ * the customers are found through the name index in time proportional
+ * to the prefix length and the number of matches. the index is built
+ * first if no prefix query has run yet
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: number of matching customers. -1 on invalid arguments or if
+ *  the index can't be built
+ */
+int ForEachCustomerWithNamePrefix(DB_T db, const char *prefix,
+                                  FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    NameIndexVisit(&db->names, prefix, fp, &count);
+    return count;
+}
+
+/**
+ * GetSumCustomerPurchaseByNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix and get the sum of
+ * results
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetSumCustomerPurchaseByNamePrefix(DB_T db, const char *prefix,
+                                       FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    return (int)NameIndexVisit(&db->names, prefix, fp, &count);
+}
+
+/**
+ * GetCustomerDBStats: get the statistics of a customer db
  *
- * this function resizes the database array by twice if current capacity
- * is full.
+ *  the chain length of a customer is its distance from its home slot
+ *  plus one. without index tables a lookup scans the array, so it is
+ *  the position of the customer in the array plus one
  *
  * param db: pointer to database
+ * param stats: pointer to the structure receiving the statistics
+ *
+ * returns: 0 on success. -1 on invalid arguments
+ */
+int GetCustomerDBStats(DB_T db, struct DBStats *stats) {
+    if (db == NULL || stats == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(struct DBStats));
+#if USE_INDEX
+    unsigned int mask = 2 * db->capacity - 1;
+
+    for (unsigned int i = 0; i <= mask; i++) {
+        unsigned int idx = db->idIndex[i];
+        if (idx != NO_RECORD)
+            StatsAddChain(&stats->idTable,
+                          ((i - HomeOf(db, db->array[idx].id)) & mask) +
+                              1);
+
+        idx = db->nameIndex[i];
+        if (idx != NO_RECORD)
+            StatsAddChain(&stats->nameTable,
+                          ((i - HomeOf(db, db->array[idx].name)) &
+                           mask) + 1);
+    }
+    StatsFinishTable(&stats->idTable, mask + 1);
+    StatsFinishTable(&stats->nameTable, mask + 1);
+#else
+    for (int i = 0; i < db->size; i++) {
+        StatsAddChain(&stats->idTable, (unsigned int)i + 1);
+        StatsAddChain(&stats->nameTable, (unsigned int)i + 1);
+    }
+    StatsFinishTable(&stats->idTable, db->capacity);
+    StatsFinishTable(&stats->nameTable, db->capacity);
+#endif
+
+    stats->bytesAllocated = sizeof(struct DB) +
+                            ArraySize(db->capacity) +
+                            db->arena.bytesReserved +
+                            db->purchases.arena.bytesReserved +
+                            db->names.arena.bytesReserved;
+    stats->rehashes = db->rehashes;
+    stats->rehashNsec = db->rehashNsec;
+#if USE_STATS
+    StatsAddCounters(stats, &db->counters);
+#endif
+
+    return 0;
+}
+
+/**
+ * ArraySize: get the size of the block holding the array, and its
+ * index tables, for a given number of customers
+ *
+ * param capacity: number of customers
+ *
+ * returns: size in bytes
+ */
+static size_t ArraySize(int capacity) {
+    size_t size = (size_t)capacity * sizeof(struct UserInfo);
+#if USE_INDEX
+    size += 4 * (size_t)capacity * sizeof(unsigned int);
+#endif
+
+    return size;
+}
+
+/**
+ * AllocArray: allocate an empty array, and its index tables, for a
+ * given number of customers
+ *
+ * param db: pointer to database. its array is replaced, not freed
+ * param capacity: number of customers
+ *
+ * returns: 0 on success. -1 if memory allocation fails
  */
-static void ExpandCustomerDB(DB_T db) {
-    if (db->capacity == db->size) {
-        db->capacity <<= 1;
-        db->array =
-            realloc(db->array, db->capacity * sizeof(struct UserInfo));
+static int AllocArray(DB_T db, int capacity) {
+    struct UserInfo *array = malloc(ArraySize(capacity));
+    if (array == NULL) {
+        fprintf(stderr,
+                "Can't allocate a memory for array of size %d\n",
+                capacity);
+        return -1;
     }
+
+    db->array = array;
+    db->capacity = capacity;
+#if USE_INDEX
+    db->idIndex = (unsigned int *)(array + capacity);
+    db->nameIndex = db->idIndex + 2 * (size_t)capacity;
+    memset(db->idIndex, 0xff,
+           4 * (size_t)capacity * sizeof(unsigned int));
+#endif
+
+    return 0;
+}
+
+/**
+ * CapacityFor: get the array capacity needed for a number of customers
+ *
+ * param capacity: current capacity, a power of 2
+ * param n: number of customers
+ *
+ * returns: capacity doubled until it is at least n. -1 if that does
+ *  not fit in an int
+ */
+static int CapacityFor(int capacity, long long n) {
+    while (capacity < n) {
+        if (capacity > INT_MAX / 4) {
+            fprintf(stderr, "Can't hold %lld customers\n", n);
+            return -1;
+        }
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+/**
+ * ExpandCustomerDB: grow the capacity of customer db array
+ *
+ * the customers are copied into a new, larger block and the index
+ * tables are rebuilt in it
+ *
+ * param db: pointer to database
+ * param capacity: new capacity, a power of 2 larger than the current
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the db is left as it was
+ */
+static int ExpandCustomerDB(DB_T db, int capacity) {
+    struct UserInfo *old = db->array;
+    unsigned long long start = StatsNow();
+
+    if (AllocArray(db, capacity) < 0)
+        return -1;
+
+    memcpy(db->array, old, db->size * sizeof(struct UserInfo));
+    free(old);
+#if USE_INDEX
+    BuildIndex(db);
+#endif
+
+    db->rehashes++;
+    db->rehashNsec += StatsNow() - start;
+    return 0;
 }
 
+#if USE_INDEX
 /**
  * SearchCustomer: search for a customer with a given id or name
  *
- * returns: the index of the array if customer with same id or name exists
- *  -1 otherwise
+ * returns: the index of the array if customer with same id or name
+ *  exists. -1 otherwise
+ */
+static int SearchCustomer(DB_T db, const char *id, const char *name) {
+    unsigned int idx;
+
+    if (id && (idx = *FindSlot(db, KEY_ID, id)) != NO_RECORD)
+        return (int)idx;
+    if (name && (idx = *FindSlot(db, KEY_NAME, name)) != NO_RECORD)
+        return (int)idx;
+
+    return -1;
+}
+#else
+/**
+ * SearchCustomer: search for a customer with a given id or name
+ *
+ * returns: the index of the array if customer with same id or name
+ *  exists. -1 otherwise
  */
 static int SearchCustomer(DB_T db, const char *id, const char *name) {
     for (int i = 0; i < db->size; i++) {
         if ((id && !strcmp(db->array[i].id, id)) ||
-            (name && !strcmp(db->array[i].name, name)))
+            (name && !strcmp(db->array[i].name, name))) {
+            STATS_PROBES(&db->counters, i + 1);
             return i;
+        }
     }
 
+    STATS_PROBES(&db->counters, db->size);
     return -1;
 }
+#endif
+
+/**
+ * RemoveCustomer: free the strings of a customer and remove it from
+ * the array
+ *
+ *  the last customer is moved into the hole, so that the array stays
+ *  dense without shifting its tail
+ *
+ * param db: pointer to database
+ * param idx: index of the customer in the array
+ */
+static void RemoveCustomer(DB_T db, int idx) {
+    struct UserInfo *p = db->array + idx;
+    int last = db->size - 1;
+
+#if USE_INDEX
+    EraseSlot(db, KEY_ID, SlotOf(db, KEY_ID, idx));
+    EraseSlot(db, KEY_NAME, SlotOf(db, KEY_NAME, idx));
+    if (idx != last) {
+        *SlotOf(db, KEY_ID, last) = (unsigned int)idx;
+        *SlotOf(db, KEY_NAME, last) = (unsigned int)idx;
+    }
+#endif
+
+    if (db->purchasesBuilt)
+        PurchaseIndexRemove(&db->purchases, p->id, p->purchase);
+    if (db->namesBuilt)
+        NameIndexRemove(&db->names, p->name);
+
+    size_t size = (size_t)(p->name - p->id) + strlen(p->name) + 1;
+    ArenaFree(&db->arena, p->id, size);
+
+    db->array[idx] = db->array[last];
+    db->size--;
+}
+
+/**
+ * UpdatePurchase: change the purchase field of a customer in place
+ *
+ *  the customer keeps its array entry and index slots. only its
+ *  position in the purchase index moves
+ *
+ * param db: pointer to database
+ * param idx: index of the customer in the array
+ * param purchase: new purchase amount
+ */
+static void UpdatePurchase(DB_T db, int idx, int purchase) {
+    struct UserInfo *p = db->array + idx;
+
+    if (purchase == p->purchase)
+        return;
+
+    if (db->purchasesBuilt)
+        PurchaseIndexUpdate(&db->purchases, p->id, p->purchase, purchase);
+    if (db->namesBuilt)
+        NameIndexUpdate(&db->names, p->name, purchase);
+    p->purchase = purchase;
+}
+
+/**
+ * SumChunk: sum a chunk of a GetSumCustomerPurchaseParallel() call
+ *
+ * param arg: pointer to the call's struct SumJob
+ * param chunk: index of the chunk
+ *
+ * returns: sum of function applications to the customers of the chunk
+ */
+static long long SumChunk(void *arg, unsigned int chunk) {
+    struct SumJob *job = arg;
+    DB_T db = job->db;
+    int begin = (int)chunk * SUM_CHUNK_SIZE;
+    int end = begin + SUM_CHUNK_SIZE;
+    long long sum = 0;
+
+    if (end > db->size)
+        end = db->size;
+    for (int i = begin; i < end; i++)
+        sum += job->fp(db->array[i].id, db->array[i].name,
+                       db->array[i].purchase);
+
+    return sum;
+}
+
+/**
+ * BuildPurchaseIndex: build the purchase index of a db unless it is
+ * already there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildPurchaseIndex(DB_T db) {
+    if (db->purchasesBuilt)
+        return 0;
+
+    for (int i = 0; i < db->size; i++) {
+        const struct UserInfo *p = db->array + i;
+
+        if (PurchaseIndexInsert(&db->purchases, p->id, p->name,
+                                p->purchase) < 0) {
+            fprintf(stderr, "Can't allocate a memory for index\n");
+            PurchaseIndexRelease(&db->purchases);
+            return -1;
+        }
+    }
+
+    db->purchasesBuilt = 1;
+    return 0;
+}
+
+/**
+ * BuildNameIndex: build the name index of a db unless it is already
+ * there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildNameIndex(DB_T db) {
+    if (db->namesBuilt)
+        return 0;
+
+    for (int i = 0; i < db->size; i++) {
+        const struct UserInfo *p = db->array + i;
+
+        if (NameIndexInsert(&db->names, p->id, p->name,
+                            p->purchase) < 0) {
+            fprintf(stderr, "Can't allocate a memory for index\n");
+            NameIndexRelease(&db->names);
+            return -1;
+        }
+    }
+
+    db->namesBuilt = 1;
+    return 0;
+}
+
+#if USE_INDEX
+/**
+ * KeyOf: get the key of a customer an index table is indexed with
+ */
+static inline const char *KeyOf(const struct UserInfo *p,
+                                enum KeyKind kind) {
+    return kind == KEY_ID ? p->id : p->name;
+}
+
+/**
+ * HomeOf: get the slot a key hashes to
+ *
+ * param db: pointer to database
+ * param key: pointer to null terminated string
+ *
+ * returns: slot number, less than 2 * capacity
+ */
+static inline unsigned int HomeOf(DB_T db, const char *key) {
+    return HashKeyWide(key, db->seed) & (2 * db->capacity - 1);
+}
+
+/**
+ * FindSlot: find the index slot of a key
+ *
+ * param db: pointer to database
+ * param kind: index table to search
+ * param key: pointer to null terminated string containing the key
+ *
+ * returns: pointer to the slot holding the customer with the key. if
+ *  there is none, pointer to the empty slot it would be put in
+ */
+static unsigned int *FindSlot(DB_T db, enum KeyKind kind,
+                              const char *key) {
+    unsigned int *index = kind == KEY_ID ? db->idIndex : db->nameIndex;
+    unsigned int mask = 2 * db->capacity - 1;
+    unsigned int home = HomeOf(db, key);
+
+    for (unsigned int i = home;; i = (i + 1) & mask) {
+        if (index[i] == NO_RECORD ||
+            strcmp(KeyOf(&db->array[index[i]], kind), key) == 0) {
+            STATS_PROBES(&db->counters, ((i - home) & mask) + 1);
+            return &index[i];
+        }
+    }
+}
+
+/**
+ * SlotOf: find the index slot referring to a customer
+ *
+ * param db: pointer to database
+ * param kind: index table to search
+ * param idx: index of the customer in the array
+ *
+ * returns: pointer to slot
+ */
+static unsigned int *SlotOf(DB_T db, enum KeyKind kind, int idx) {
+    unsigned int *index = kind == KEY_ID ? db->idIndex : db->nameIndex;
+    unsigned int mask = 2 * db->capacity - 1;
+    unsigned int i = HomeOf(db, KeyOf(&db->array[idx], kind));
+
+    while (index[i] != (unsigned int)idx)
+        i = (i + 1) & mask;
+
+    return &index[i];
+}
+
+/**
+ * EraseSlot: empty an index slot
+ *
+ *  later slots of the probe sequence are shifted back into the hole
+ *  unless that would move them before their home slot, so that no
+ *  tombstones are needed. the customers store no hash value, so the
+ *  home slots are computed from their keys again
+ *
+ * param db: pointer to database
+ * param kind: index table of the slot
+ * param slot: pointer to slot
+ */
+static void EraseSlot(DB_T db, enum KeyKind kind, unsigned int *slot) {
+    unsigned int *index = kind == KEY_ID ? db->idIndex : db->nameIndex;
+    unsigned int mask = 2 * db->capacity - 1;
+    unsigned int hole = (unsigned int)(slot - index);
+
+    for (unsigned int i = (hole + 1) & mask; index[i] != NO_RECORD;
+         i = (i + 1) & mask) {
+        unsigned int home =
+            HomeOf(db, KeyOf(&db->array[index[i]], kind));
+
+        // move the slot unless its home lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            index[hole] = index[i];
+            hole = i;
+        }
+    }
+
+    index[hole] = NO_RECORD;
+}
+
+/**
+ * BuildIndex: fill the empty index tables with every customer
+ *
+ * param db: pointer to database
+ */
+static void BuildIndex(DB_T db) {
+    unsigned int mask = 2 * db->capacity - 1;
+
+    for (int k = 0; k < db->size; k++) {
+        unsigned int i = HomeOf(db, db->array[k].id);
+        while (db->idIndex[i] != NO_RECORD)
+            i = (i + 1) & mask;
+        db->idIndex[i] = (unsigned int)k;
+
+        i = HomeOf(db, db->array[k].name);
+        while (db->nameIndex[i] != NO_RECORD)
+            i = (i + 1) & mask;
+        db->nameIndex[i] = (unsigned int)k;
+    }
+}
+#endif
@@ -5,57 +5,566 @@
  */
 
 #include "customer_manager.h"
+#include "db_stats.h"
+#include "keyhash.h"
+#include "name_index.h"
+#include "purchase_index.h"
+#include "record_file.h"
+#include "record_pool.h"
+#include "sum_job.h"
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define UNIT_BUCKET_SIZE 1024
 #define THRESHOLD_RATIO 0.75f
 
-enum { HASH_MULTIPLIER = 65599 };
+// a shard's tables are halved once both of its counts drop below this
+// share of the capacity. halving leaves them at twice this load, far
+// from THRESHOLD_RATIO, so that a size hovering around either limit
+// does not resize back and forth
+#define SHRINK_RATIO 0.125f
 
-struct UserInfo {
-    // customer name
-    char *name;
+// work done by each update while a resize is in progress, counted as
+// one unit per old bucket and one per customer moved out of it, so that
+// a run of long chains doesn't make a single update slow. a bucket is
+// never split, and each update moves at least one. growing completes
+// within about 2.5 * capacity / this many updates, well before the
+// size can reach the next threshold at 0.75 * capacity more
+#define MIGRATE_WORK_PER_OP 8
 
-    // customer id
-    char *id;
+// limits on the number of shards of a concurrent db. each shard starts
+// with UNIT_BUCKET_SIZE / nshards buckets, but no less than the minimum
+#define MAX_SHARDS 1024
+#define MIN_SHARD_BUCKET_SIZE 64
 
-    // purchase amount (> 0)
-    int purchase;
+// shards are aligned so that their locks do not share a cache line
+#define CACHE_LINE_SIZE 64
+
+// smallest page size of the platforms the tables are prefaulted on.
+// larger pages are just written more than once
+#define MIN_PAGE_SIZE 4096
+
+// keys of a batch are hashed and prefetched in groups of this many, so
+// that their cache misses overlap
+#define BATCH_SIZE 16
+
+// buckets in a chunk of GetSumCustomerPurchaseParallel()
+#define SUM_CHUNK_BUCKETS 4096
+
+// maximum number of threads that can read lock-free dbs at once
+// without locking. further threads fall back to shared locks
+#define MAX_READERS 128
+
+// unlinked customers kept by a shard before trying to free them
+#define RECLAIM_BATCH 64
+
+// chain links, bucket heads and table pointers are read without locks
+// in a lock-free db, so they are always accessed atomically. on common
+// hardware these are plain loads and stores
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+// build with -DUSE_FILTER=1 to have lookups check a blocked bloom
+// filter of each table before its buckets, so that most keys that are
+// not in the db are rejected without reading a bucket or a customer.
+// that only pays off when most lookups miss: every insertion sets the
+// bits of its keys, and churn makes the tables rebuild, see
+// FILTER_STALE_RATIO
+#ifndef USE_FILTER
+#define USE_FILTER 0
+#endif
+
+// filter bits per bucket. tables grow before they hold THRESHOLD_RATIO
+// keys per bucket, so there are always more than 21 bits per key
+#define FILTER_BITS_PER_BUCKET 16
+
+// a filter block is 8 words of 32 bits, and a key sets one bit in
+// each word of its block. blocks are aligned, so that checking a key
+// reads a single cache line
+#define FILTER_BLOCK_WORDS 8
+#define FILTER_BLOCK_BITS (FILTER_BLOCK_WORDS * 32)
+
+// bits of removed keys stay set. a shard's tables are rebuilt at the
+// same capacity once either filter holds this many removed keys per
+// bucket. the rebuild is a resize like any other, migrated a few
+// buckets per update, so a shard of c buckets pays for one every
+// c / 2 removals
+#define FILTER_STALE_RATIO 0.5f
+
+// the top bit of the died field of a customer of a cache is its
+// reference bit rather than part of a version. it is set when the
+// customer is used and cleared when the CLOCK hand passes it
+#define USER_REFERENCED 0x80000000U
+
+/* a customer is a record of the db's pool, and refers to other
+   customers by their 32-bit references rather than by address, which
+   keeps it at 24 bytes before its keys */
+struct UserInfo {
+    // reference to next element. RECORD_NONE at the end of a chain
+    unsigned int idNext;
+    unsigned int nameNext;
 
     // hash value of id and name. not the remainder but the whole value.
+    // compared before the keys, so that other keys of the bucket are
+    // almost never read
     unsigned int idHash;
     unsigned int nameHash;
 
-    // address of next element
-    struct UserInfo *idNext;
-    struct UserInfo *nameNext;
+    // purchase amount (> 0)
+    int purchase;
+
+    // version of the db at which the customer was removed or replaced
+    // while snapshots were open, which still see it. 0 while it is
+    // current, but for USER_REFERENCED
+    unsigned int died;
+
+    // customer id followed by customer name, both null terminated.
+    // stored inline so that a customer is a single allocation
+    char keys[];
 };
 
-struct DB {
-    // buckets for id and name
-    struct UserInfo **idTable;
-    struct UserInfo **nameTable;
+#if USE_FILTER
+/* a blocked bloom filter of the keys linked into a table */
+struct Filter {
+    // nblocks blocks of FILTER_BLOCK_WORDS words
+    unsigned int *blocks;
+    unsigned int nblocks;
+
+    // keys added since the filter was allocated, including those
+    // removed since. only counted under the lock of the shard
+    unsigned int adds;
+};
+#endif
 
-    // current bucket size (max # of elements)
+/* the id and name tables of a shard, allocated together. the size
+   and the bucket arrays never change once published, so that a reader
+   always sees a bucket array along with its own capacity */
+struct Tables {
+    // bucket size (max # of elements)
     unsigned int capacity;
 
-    // current number of elements in the hash table
-    unsigned int size;
+    // open snapshots sharing the tables. shared tables are never
+    // written; an update copies them first
+    unsigned int snapshots;
+
+    // buckets for id and name, holding the reference of the first
+    // customer. both point into buckets
+    unsigned int *idTable;
+    unsigned int *nameTable;
+
+#if USE_FILTER
+    // filters of the keys linked into idTable and nameTable. their
+    // blocks follow the buckets
+    struct Filter idFilter;
+    struct Filter nameFilter;
+#endif
+
+    unsigned int buckets[];
+};
+
+/* a block unlinked from a lock-free db, freed once no reader can
+   still be looking at it */
+struct Retired {
+    // tables if size is 0
+    void *block;
+
+    // otherwise the reference of a customer, and the size of its record
+    unsigned int ref;
+    size_t size;
+
+    // epoch at which the block was unlinked
+    unsigned long epoch;
+};
+
+/* a shard owns a slice of the hash value space. a customer is linked
+   into the id table of the shard of its id hash and into the name table
+   of the shard of its name hash, which may be different shards */
+struct Shard {
+    // protects everything below in a concurrent db. in a lock-free db,
+    // only updates take it
+    pthread_rwlock_t lock;
 
-    // threshold value of size. if size >= threshold, resize.
+    // current tables
+    struct Tables *tables;
+
+    // previous tables while they are migrated into the current ones.
+    // NULL if no resize is in progress
+    struct Tables *oldTables;
+
+    // old buckets below this index have already been migrated
+    unsigned int migrated;
+
+    // odd while customers are moved between buckets. a lock-free
+    // lookup that misses while it changes has to be repeated
+    unsigned int seq;
+
+    // nonzero if lookups may read the shard while an update writes it,
+    // i.e. in a lock-free db
+    int lockFree;
+
+    // current number of elements in the id and name table
+    unsigned int idCount;
+    unsigned int nameCount;
+
+    // customers of the id table marked as removed, which stay linked
+    // until the last snapshot is released
+    unsigned int removed;
+
+    // references of the customers a resize left behind in old id
+    // buckets while snapshots were open, which may still be walking
+    // them. freed once the last snapshot is released
+    unsigned int *orphans;
+    unsigned int norphans;
+    unsigned int orphanCapacity;
+
+    // nonzero once a resize copied customers of this shard while
+    // snapshots were open. the ordered indexes still refer to the keys
+    // of the originals, which are the same, until they are freed
+    int copied;
+
+    // customers removed at a later version of the db are still seen
+    // through the shard. UINT_MAX in a db, which sees none of them,
+    // and the version a snapshot was taken at in its shards
+    unsigned int version;
+
+    // threshold value of size. if either count >= threshold, resize.
     unsigned int threshold;
+
+    // if both counts < shrinkThreshold, shrink. 0 while the tables
+    // are at their initial capacity, which they never shrink below
+    unsigned int shrinkThreshold;
+    unsigned int minCapacity;
+
+    // blocks waiting for lock-free readers to move on
+    struct Retired *retired;
+    unsigned int nretired;
+    unsigned int retiredCapacity;
+
+    // storage of the customers whose id belongs to this shard, in the
+    // pool of the db
+    struct RecordArena arena;
+
+    // the same customers ordered by purchase amount, and by name.
+    // lookups of a lock-free db never use them, so they are always read
+    // under the lock. each is built by the first query that needs it,
+    // so that a db that never runs one doesn't maintain it
+    struct PurchaseIndex purchases;
+    struct NameIndex names;
+    int purchasesBuilt;
+    int namesBuilt;
+
+    // nonzero once AddPurchaseByIDAtomic() changed an amount without
+    // the lock, which the indexes above may not hold. updates leave
+    // them alone meanwhile, and they are rebuilt before they are read
+    int stale;
+
+    // resizes and rebuilds of the tables, and the nanoseconds spent
+    // allocating the new tables and migrating buckets into them
+    unsigned long long rehashes;
+    unsigned long long rehashNsec;
+
+#if USE_STATS
+    // calls and probes of each kind of operation on this shard
+    struct DBCounters counters;
+#endif
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* the epoch a reader thread entered a lock-free db at, 0 if it is not
+   reading. each reader writes only to its own slot */
+struct EpochSlot {
+    unsigned long epoch;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct DB {
+    // shards of the tables. a db that is not concurrent has one
+    struct Shard *shards;
+    unsigned int nshards;
+
+    // the shard of a hash value is its mixed value shifted by this
+    unsigned int shardShift;
+
+    // nonzero if shards are locked, i.e. the db may be shared by
+    // several threads
+    int concurrent;
+
+    // nonzero if lookups run without locks. unlinked customers are then
+    // reclaimed through epochs
+    int lockFree;
+
+    // global epoch of a lock-free db, starting at 1, and the epoch
+    // slot of each reader thread
+    unsigned long epoch;
+    struct EpochSlot *epochSlots;
+
+    // nonzero if AddPurchaseByIDAtomic() may add without a lock, i.e.
+    // in a lock-free db unless snapshots are open or it is compacted,
+    // which copy customers
+    int atomicAdds;
+
+    // function keys are hashed with, and the seed it is given. the
+    // seed is random unless the creator chose one
+    HASHFUNC_T hash;
+    unsigned long long seed;
+
+    // chunks the customers of every shard are allocated from
+    struct RecordPool pool;
+
+    // version of the db, starting at 1, and the number of snapshots
+    // open. both only change with every shard locked
+    unsigned int version;
+    unsigned int snapshots;
+
+    // db a snapshot was taken of. NULL unless the db is a snapshot,
+    // whose shards share their tables and customers with it
+    struct DB *origin;
+
+    // calls of CompactCustomerDB() that rebuilt the tables, and the
+    // nanoseconds they took
+    unsigned long long compactions;
+    unsigned long long compactNsec;
+
+    // bytes the customers of a cache may take, and take now. maxBytes
+    // is 0 unless the db is a cache
+    unsigned long long maxBytes;
+    unsigned long long cacheBytes;
+
+    // lookups of a cache that found their customer and those that did
+    // not, and the customers it evicted
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+
+    // id bucket of the current tables the CLOCK hand of a cache is at
+    unsigned int hand;
+};
+
+/* a GetSumCustomerPurchaseParallel() call, summed a chunk at a time
+   by SumChunk() */
+struct SumJob {
+    DB_T db;
+    FUNCPTR_T fp;
+
+    // a chunk is a whole shard in a db with several shards or locks,
+    // and SUM_CHUNK_BUCKETS buckets of the only shard otherwise
+    int byShard;
 };
 
-static unsigned int hashfunc_raw(const char *key);
-static int hashfunc(const char *key, unsigned int bucketSize);
-static struct UserInfo *SearchCustomerById(DB_T db, const char *id);
-static struct UserInfo *SearchCustomerByName(DB_T db, const char *name);
-static struct UserInfo *UnlinkCustomerById(DB_T db, const char *id);
-static struct UserInfo *UnlinkCustomerByName(DB_T db, const char *name);
-static void rehash(DB_T db);
+/* reader threads of lock-free dbs. each thread gets the index of its
+   epoch slot on its first lock-free lookup and gives it back on exit */
+static pthread_mutex_t readerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t readerOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t readerKey;
+static unsigned char readerUsed[MAX_READERS];
+static unsigned int readerCount; // highest index handed out + 1
+static __thread int readerIndex = -1;
+
+#if USE_FILTER
+/* odd multipliers picking the bit a key sets in each word of its
+   filter block */
+static const unsigned int filterSalt[FILTER_BLOCK_WORDS]
+    __attribute__((aligned(32))) = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+#endif
+
+/* customer id, stored at the start of keys */
+static inline const char *IdOf(const struct UserInfo *p) {
+    return p->keys;
+}
+
+/* customer name, stored right after the id */
+static inline const char *NameOf(const struct UserInfo *p) {
+    return p->keys + strlen(p->keys) + 1;
+}
+
+/* size of the record of a customer */
+static inline size_t UserSize(const struct UserInfo *p) {
+    const char *name = NameOf(p);
+    return (size_t)(name - (const char *)p) + strlen(name) + 1;
+}
+
+/* customer a reference points to. all shards share one pool */
+static inline struct UserInfo *UserAt(const struct Shard *s,
+                                      unsigned int ref) {
+    return RecordAt(s->arena.pool, ref);
+}
+
+/* nonzero if a customer is seen through a shard: if it is current, or
+   in a snapshot if it was removed after the snapshot was taken */
+static inline int Visible(const struct Shard *s,
+                          const struct UserInfo *p) {
+    unsigned int died = __atomic_load_n(&p->died, __ATOMIC_RELAXED) &
+                        ~USER_REFERENCED;
+    return died == 0 || died > s->version;
+}
+
+/* bytes a customer whose record is 'size' bytes takes in a cache */
+static inline size_t CacheCharge(size_t size) {
+    return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+/* mark a customer of a cache as used. the bit is only written while
+   it is clear, so that using a customer again before the hand passes
+   it writes nothing */
+static inline void CacheTouch(DB_T db, struct UserInfo *p) {
+    if (db->maxBytes == 0)
+        return;
+
+    unsigned int died = __atomic_load_n(&p->died, __ATOMIC_RELAXED);
+    if (!(died & USER_REFERENCED))
+        __atomic_fetch_or(&p->died, USER_REFERENCED, __ATOMIC_RELAXED);
+}
+
+/* count a lookup of a cache as a hit or a miss */
+static inline void CacheCount(DB_T db, int hit) {
+    if (db->maxBytes == 0)
+        return;
+    if (hit)
+        db->hits++;
+    else
+        db->misses++;
+}
+
+/* nonzero if the ordered indexes of a shard may be out of date. read
+   in one total order with the purchase fields, see AddToPurchase() */
+static inline int IndexesStale(const struct Shard *s) {
+    return __atomic_load_n(&s->stale, __ATOMIC_SEQ_CST);
+}
+
+static DB_T CreateDB(unsigned int nshards, unsigned int capacity,
+                     int concurrent, int lockFree, HASHFUNC_T hash,
+                     unsigned long long seed);
+static int InitShard(struct Shard *s, struct RecordPool *pool,
+                     unsigned int capacity, unsigned long long seed);
+static size_t TablesSize(unsigned int capacity);
+static struct Tables *AllocTables(unsigned int capacity);
+static struct Tables *UnsharedTables(struct Shard *s,
+                                     struct Tables *t);
+static void DropTables(DB_T db, struct Shard *s, struct Tables *t);
+static void AddChains(struct DBTableStats *t, struct Shard *s,
+                      unsigned int ref, int byName);
+#if USE_FILTER
+static unsigned int FilterBlocks(unsigned int capacity);
+static unsigned int *FilterBlock(const struct Filter *f,
+                                 unsigned int hash);
+static void FilterAdd(struct Filter *f, unsigned int hash);
+static int FilterCheck(const struct Filter *f, unsigned int hash,
+                       int lockFree);
+static double FilterFalsePositives(const struct Filter *f);
+#endif
+static int FiltersStale(struct Shard *s);
+/* raw hash value of a key under the hash function of db */
+static inline unsigned int HashOfKey(DB_T db, const char *key) {
+    return db->hash(key, db->seed);
+}
+
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash);
+static struct Shard *ShardOf(DB_T db, unsigned int hash);
+static void WriteLockPair(DB_T db, struct Shard *a, struct Shard *b);
+static void UnlockPair(DB_T db, struct Shard *a, struct Shard *b);
+static struct Tables *IdTables(struct Shard *s, unsigned int idHash);
+static struct Tables *NameTables(struct Shard *s,
+                                 unsigned int nameHash);
+static unsigned int *IdBucket(struct Shard *s, unsigned int idHash);
+static unsigned int *NameBucket(struct Shard *s, unsigned int nameHash);
+static void LinkById(struct Tables *t, unsigned int ref,
+                     struct UserInfo *p);
+static void LinkByName(struct Tables *t, unsigned int ref,
+                       struct UserInfo *p);
+static struct UserInfo *SearchCustomerById(struct Shard *s,
+                                           const char *id,
+                                           unsigned int idHash);
+static struct UserInfo *SearchCustomerByName(struct Shard *s,
+                                             const char *name,
+                                             unsigned int nameHash);
+static struct UserInfo *LockCustomerById(DB_T db, const char *id,
+                                         enum DBStatsOp op,
+                                         struct Shard **idShard,
+                                         struct Shard **nameShard);
+static struct UserInfo *LockCustomerByName(DB_T db, const char *name,
+                                           enum DBStatsOp op,
+                                           struct Shard **idShard,
+                                           struct Shard **nameShard);
+static unsigned int UnlinkCustomerById(struct Shard *s,
+                                       struct UserInfo *user);
+static void UnlinkCustomerByName(struct Shard *s,
+                                 struct UserInfo *user);
+static void RemoveCustomer(DB_T db, struct Shard *idShard,
+                           struct Shard *nameShard,
+                           struct UserInfo *user);
+static int AddToPurchase(struct UserInfo *p, int amount, int *old);
+static void ReindexPurchase(struct Shard *idShard,
+                            const struct UserInfo *p, int old,
+                            int purchase);
+static void UpdatePurchase(struct Shard *idShard, struct UserInfo *p,
+                           int purchase);
+static int ReplaceCustomer(DB_T db, struct Shard *idShard,
+                           struct Shard *nameShard, struct UserInfo *p,
+                           int purchase);
+static int EvictCustomers(DB_T db, size_t charge);
+static int EvictFromChain(DB_T db, struct Shard *s, unsigned int ref,
+                          unsigned int bucket);
+static void SweepRemoved(DB_T db);
+static void RelocateIndexes(struct Shard *s);
+static void SweepBuckets(DB_T db, struct Shard *s, struct Tables *t,
+                         unsigned int first, int byName);
+static void rehash(struct Shard *s);
+static void SetThresholds(struct Shard *s, unsigned int capacity);
+static unsigned int BucketsFor(unsigned int capacity,
+                               unsigned long long count);
+static void ReserveShards(DB_T db, unsigned long long n);
+static int CompactShards(DB_T db);
+static void LockAll(DB_T db);
+static void UnlockAll(DB_T db);
+static void SetAtomicAdds(DB_T db, int on);
+static int RefreshIndexes(DB_T db, struct Shard *s);
+static int BuildIndex(struct Shard *s, int byName);
+static int IndexShard(struct Shard *s, struct PurchaseIndex *purchases,
+                      struct NameIndex *names);
+static int IndexChain(struct Shard *s, unsigned int ref,
+                      struct PurchaseIndex *purchases,
+                      struct NameIndex *names);
+static long long VisitByPurchase(DB_T db, int low, int high, int k,
+                                 FUNCPTR_T fp);
+static long long VisitByNamePrefix(DB_T db, const char *prefix,
+                                   FUNCPTR_T fp, int *count);
+static void WaitForReaders(DB_T db);
+static void MigrateBuckets(DB_T db, struct Shard *s,
+                           struct Shard *other, unsigned int count);
+static int CopyBucket(DB_T db, struct Shard *s, struct Shard *other,
+                      unsigned int i);
+static struct Tables *CopyTables(struct Shard *s, unsigned int i,
+                                 struct Shard *to, unsigned int hash);
+static int Holds(DB_T db, struct Shard *other, struct Shard *t);
+static unsigned int ShardBuckets(struct Shard *s);
+static long long SumBuckets(struct Shard *s, unsigned int begin,
+                            unsigned int end, const char *prefix,
+                            FUNCPTR_T fp, int *count);
+static long long SumChain(struct Shard *s, unsigned int ref,
+                          const char *prefix, FUNCPTR_T fp,
+                          int *count);
+static long long SumChunk(void *arg, unsigned int chunk);
+static struct EpochSlot *EnterEpoch(DB_T db);
+static void ExitEpoch(struct EpochSlot *slot);
+static void Retire(DB_T db, struct Shard *s, void *tables,
+                   unsigned int ref, size_t size);
 
 /**
  * CreateCustomerDB: create a new customer db
@@ -67,35 +576,122 @@ static void rehash(DB_T db);
  * returns: pointer to newly allocated database
  */
 DB_T CreateCustomerDB(void) {
-    DB_T db;
+    return CreateDB(1, UNIT_BUCKET_SIZE, 0, 0, HashKeyWide,
+                    RandomHashSeed());
+}
 
-    db = (DB_T)calloc(1, sizeof(struct DB));
-    if (db == NULL) {
-        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+/**
+ * CreateCustomerDBWithHash: create a new customer db with a given hash
+ * function
+ *
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithHash(HASHFUNC_T hash,
+                              unsigned long long seed) {
+    if (hash == NULL)
         return NULL;
-    }
-    db->capacity = UNIT_BUCKET_SIZE; // start with 1024 elements
-    db->threshold = (int)(THRESHOLD_RATIO *
-                          UNIT_BUCKET_SIZE); // start with 1024 elements
-    db->size = 0;
-    db->idTable = calloc(db->capacity, sizeof(struct UserInfo *));
-    if (db->idTable == NULL) {
-        fprintf(stderr,
-                "Can't allocate a memory for array of size %d\n",
-                db->capacity);
-        free(db);
+
+    return CreateDB(1, UNIT_BUCKET_SIZE, 0, 0, hash, seed);
+}
+
+/**
+ * CreateCustomerDBWithCapacity: create a new customer db with room for
+ * a given number of customers
+ *
+ *  the tables start large enough to hold n customers without a resize,
+ *  and are never shrunk below that
+ *
+ * param n: number of customers the tables are sized for
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithCapacity(int n) {
+    if (n < 0)
         return NULL;
-    }
 
-    db->nameTable = calloc(db->capacity, sizeof(struct UserInfo *));
-    if (db->nameTable == NULL) {
-        fprintf(stderr,
-                "Can't allocate a memory for array of size %d\n",
-                db->capacity);
-        free(db->idTable);
-        free(db);
+    unsigned int capacity = BucketsFor(UNIT_BUCKET_SIZE, n);
+    if (capacity == 0)
         return NULL;
-    }
+
+    return CreateDB(1, capacity, 0, 0, HashKeyWide, RandomHashSeed());
+}
+
+/**
+ * CreateCustomerDBConcurrent: create a new customer db that can be
+ * shared by several threads
+ *
+ * the hash tables are partitioned into independently locked shards.
+ * lookups take a shared lock on one shard, updates take exclusive
+ * locks on the shards of the customer's id and name
+ *
+ * param nshards: number of shards. rounded up to a power of 2
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBConcurrent(int nshards) {
+    if (nshards <= 0 || nshards > MAX_SHARDS)
+        return NULL;
+
+    unsigned int n = 1;
+    while (n < (unsigned int)nshards)
+        n <<= 1;
+
+    return CreateDB(n, UNIT_BUCKET_SIZE, 1, 0, HashKeyWide,
+                    RandomHashSeed());
+}
+
+/**
+ * CreateCustomerDBLockFree: create a new customer db that can be
+ * shared by several threads, with lock-free lookups
+ *
+ * updates lock shards as in CreateCustomerDBConcurrent(). lookups take
+ * no lock and write no shared memory. customers removed while a lookup
+ * may still see them are freed once every reader has moved on to a
+ * later epoch
+ *
+ * param nshards: number of shards. rounded up to a power of 2
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBLockFree(int nshards) {
+    if (nshards <= 0 || nshards > MAX_SHARDS)
+        return NULL;
+
+    unsigned int n = 1;
+    while (n < (unsigned int)nshards)
+        n <<= 1;
+
+    return CreateDB(n, UNIT_BUCKET_SIZE, 1, 1, HashKeyWide,
+                    RandomHashSeed());
+}
+
+/**
+ * CreateCustomerCache: create a new customer db that holds at most a
+ * given number of bytes of customers
+ *
+ *  each customer is charged the bytes of its record, i.e. its fields
+ *  and both keys. registering a customer that does not fit evicts
+ *  others as the hand of a CLOCK sweeps the id buckets: a customer
+ *  looked up or updated since the hand last passed it is spared once
+ *  and has its reference bit cleared, any other is evicted. a hit only
+ *  sets that bit, and only if it is clear, so no list is relinked
+ *
+ * param maxBytes: bytes the customers may take. the tables and the
+ *  ordered indexes are not counted
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerCache(unsigned long long maxBytes) {
+    if (maxBytes == 0)
+        return NULL;
+
+    DB_T db = CreateDB(1, UNIT_BUCKET_SIZE, 0, 0, HashKeyWide,
+                       RandomHashSeed());
+    if (db != NULL)
+        db->maxBytes = maxBytes;
 
     return db;
 }
@@ -104,23 +700,42 @@ DB_T CreateCustomerDB(void) {
  * DestroyCustomerDB: destroy a customer db
  *
  * this function frees all dynamically allocated resources in the
- * database
+ * database. a snapshot is released as by ReleaseCustomerSnapshot()
  *
  * param db: pointer to database
  */
 void DestroyCustomerDB(DB_T db) {
-    struct UserInfo *p, *nextp;
+    if (db == NULL)
+        return;
 
-    for (size_t i = 0; i < db->capacity; i++)
-        for (p = db->idTable[i]; p != NULL; p = nextp) {
-            nextp = p->idNext;
-            free(p->id);
-            free(p->name);
-            free(p);
-        }
+    if (db->origin != NULL) {
+        ReleaseCustomerSnapshot(db);
+        return;
+    }
+
+    for (unsigned int i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+
+        // customers live in the arena, so there is no chain to walk
+        RecordArenaRelease(&s->arena);
+        PurchaseIndexRelease(&s->purchases);
+        NameIndexRelease(&s->names);
 
-    free(db->idTable);
-    free(db->nameTable);
+        for (unsigned int j = 0; j < s->nretired; j++)
+            if (s->retired[j].size == 0)
+                free(s->retired[j].block);
+        free(s->retired);
+        free(s->orphans);
+
+        free(s->oldTables);
+        free(s->tables);
+        pthread_rwlock_destroy(&s->lock);
+    }
+
+    if (db->pool.chunks != NULL)
+        RecordPoolRelease(&db->pool);
+    free(db->epochSlots);
+    free(db->shards);
     free(db);
 }
 
@@ -136,55 +751,233 @@ void DestroyCustomerDB(DB_T db) {
  */
 int RegisterCustomer(DB_T db, const char *id, const char *name,
                      const int purchase) {
-    if (db == NULL || id == NULL || name == NULL || purchase <= 0)
+    if (db == NULL || db->origin != NULL || id == NULL ||
+        name == NULL || purchase <= 0)
         return -1;
 
-    struct UserInfo *idsearch = SearchCustomerById(db, id);
-    struct UserInfo *namesearch = SearchCustomerByName(db, name);
+    return InsertCustomer(db, id, name, purchase, HashOfKey(db, id),
+                          HashOfKey(db, name));
+}
+
+/**
+ * RegisterCustomerBatch: register several customers at once
+ *
+ * the keys of a group are hashed and their buckets prefetched before
+ * any customer is inserted, so that the cache misses of the group
+ * overlap instead of being taken one after another
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param names: array of n names
+ * param purchases: array of n purchase values
+ * param n: number of customers
+ * param out: array receiving the result of each registration as
+ *  RegisterCustomer() returns it. may be NULL
+ *
+ * returns: number of customers registered. -1 on invalid arguments
+ */
+int RegisterCustomerBatch(DB_T db, const char **ids, const char **names,
+                          const int *purchases, int n, int *out) {
+    unsigned int idHashes[BATCH_SIZE], nameHashes[BATCH_SIZE];
+    int registered = 0;
 
-    if (idsearch != NULL || namesearch != NULL) {
+    if (db == NULL || db->origin != NULL || ids == NULL ||
+        names == NULL || purchases == NULL || n < 0)
         return -1;
+
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            if (id != NULL && name != NULL) {
+                idHashes[j] = HashOfKey(db, id);
+                nameHashes[j] = HashOfKey(db, name);
+            }
+        }
+
+        // without locks, the tables of a concurrent db may be freed
+        // while they are looked at. a lock-free db keeps them alive
+        // for the current epoch
+        struct EpochSlot *slot = EnterEpoch(db);
+        if (!db->concurrent || slot != NULL) {
+            for (int j = 0; j < m; j++) {
+                if (ids[base + j] == NULL || names[base + j] == NULL)
+                    continue;
+                __builtin_prefetch(IdBucket(
+                    ShardOf(db, idHashes[j]), idHashes[j]));
+                __builtin_prefetch(NameBucket(
+                    ShardOf(db, nameHashes[j]), nameHashes[j]));
+            }
+        }
+        if (slot != NULL)
+            ExitEpoch(slot);
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            int purchase = purchases[base + j];
+            int res = -1;
+
+            if (id != NULL && name != NULL && purchase > 0)
+                res = InsertCustomer(db, id, name, purchase,
+                                     idHashes[j], nameHashes[j]);
+            if (res == 0)
+                registered++;
+            if (out != NULL)
+                out[base + j] = res;
+        }
     }
 
-    struct UserInfo *newUser = calloc(1, sizeof(struct UserInfo));
-    if (newUser == NULL) {
-        fprintf(stderr, "Can't allocate memory for new user\n");
+    return registered;
+}
+
+/**
+ * LoadCustomersFromFile: register the customers of a file
+ *
+ *  the tables of every shard are resized once, up front, for its share
+ *  of the customers of the file. a shard that receives more than its
+ *  share grows as usual
+ *
+ * param db: pointer to database
+ * param path: path of a file of "id,name,purchase" lines
+ *
+ * returns: number of customers registered. -1 if the file can't be
+ *  read or parsed, or on invalid arguments
+ */
+int LoadCustomersFromFile(DB_T db, const char *path) {
+    struct RecordFile f;
+
+    if (db == NULL || db->origin != NULL || path == NULL)
+        return -1;
+    if (RecordFileOpen(&f, path) < 0)
+        return -1;
+
+    ReserveShards(db, (unsigned long long)f.count);
+    int registered = RegisterCustomerBatch(db, f.ids, f.names,
+                                           f.purchases, f.count, NULL);
+    RecordFileClose(&f);
+
+    // shrinking was held off while the shards filled up
+    LockAll(db);
+    for (unsigned int i = 0; i < db->nshards; i++)
+        SetThresholds(&db->shards[i],
+                      db->shards[i].tables->capacity);
+    UnlockAll(db);
+
+    return registered;
+}
+
+/**
+ * InsertCustomer: register a new customer whose keys are hashed
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param name: pointer to null terminated string that contains name
+ * param purchase: purchase value of customer. must be positive
+ * param idHash: raw hash value of id
+ * param nameHash: raw hash value of name
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash) {
+    struct Shard *idShard = ShardOf(db, idHash);
+    struct Shard *nameShard = ShardOf(db, nameHash);
+
+    STATS_OP(&idShard->counters, DB_OP_REGISTER);
+
+    // holding both shards makes the check and the insertion atomic
+    // with respect to other updates of either key
+    WriteLockPair(db, idShard, nameShard);
+
+    if (SearchCustomerById(idShard, id, idHash) != NULL ||
+        SearchCustomerByName(nameShard, name, nameHash) != NULL) {
+        UnlockPair(db, idShard, nameShard);
         return -1;
     }
 
-    newUser->id = strdup(id);
-    if (newUser->id == NULL) {
-        free(newUser);
-        fprintf(stderr, "Can't allocate memory for new user id\n");
+    // the customer and both keys are a single record
+    size_t idSize = strlen(id) + 1;
+    size_t nameSize = strlen(name) + 1;
+    size_t size = offsetof(struct UserInfo, keys) + idSize + nameSize;
+
+    // a cache makes room first. its only shard is already held
+    if (db->maxBytes != 0 &&
+        EvictCustomers(db, CacheCharge(size)) < 0) {
+        UnlockPair(db, idShard, nameShard);
         return -1;
     }
 
-    newUser->name = strdup(name);
-    if (newUser->name == NULL) {
-        free(newUser->id);
-        free(newUser);
-        fprintf(stderr, "Can't allocate memory for new user name\n");
+    unsigned int ref = RecordAlloc(&idShard->arena, size);
+    if (ref == RECORD_NONE) {
+        UnlockPair(db, idShard, nameShard);
+        fprintf(stderr, "Can't allocate memory for new user\n");
         return -1;
     }
 
+    struct UserInfo *newUser = UserAt(idShard, ref);
+    memcpy(newUser->keys, id, idSize);
+    memcpy(newUser->keys + idSize, name, nameSize);
     newUser->purchase = purchase;
+    newUser->died = 0;
 
-    unsigned int idHash = hashfunc_raw(id);
-    int idHashModulo = (int)(idHash & (db->capacity - 1));
-    newUser->idNext = db->idTable[idHashModulo];
     newUser->idHash = idHash;
-    db->idTable[idHashModulo] = newUser;
-
-    unsigned int nameHash = hashfunc_raw(name);
-    int nameHashModulo = (int)(nameHash & (db->capacity - 1));
-    newUser->nameNext = db->nameTable[nameHashModulo];
     newUser->nameHash = nameHash;
-    db->nameTable[nameHashModulo] = newUser;
 
-    db->size++;
-    rehash(db);
+    // tables shared with snapshots are copied before they are written.
+    // the id tables may be the name tables, so they are copied first
+    struct Tables *idTables =
+        UnsharedTables(idShard, IdTables(idShard, idHash));
+    if (idTables == NULL)
+        goto fail;
+    struct Tables *nameTables =
+        UnsharedTables(nameShard, NameTables(nameShard, nameHash));
+    if (nameTables == NULL)
+        goto fail;
+
+    // a stale shard gets the customer when its indexes are rebuilt
+    if (!IndexesStale(idShard)) {
+        if (idShard->purchasesBuilt &&
+            PurchaseIndexInsert(&idShard->purchases, IdOf(newUser),
+                                NameOf(newUser), purchase) < 0)
+            goto fail;
+        if (idShard->namesBuilt &&
+            NameIndexInsert(&idShard->names, IdOf(newUser),
+                            NameOf(newUser), purchase) < 0) {
+            if (idShard->purchasesBuilt)
+                PurchaseIndexRemove(&idShard->purchases, IdOf(newUser),
+                                    purchase);
+            goto fail;
+        }
+    }
+
+    // the customer is complete before it is published in either table
+    LinkById(idTables, ref, newUser);
+    idShard->idCount++;
+
+    LinkByName(nameTables, ref, newUser);
+    nameShard->nameCount++;
+
+    if (db->maxBytes != 0)
+        db->cacheBytes += CacheCharge(size);
+
+    MigrateBuckets(db, idShard, nameShard, MIGRATE_WORK_PER_OP);
+    rehash(idShard);
+    if (nameShard != idShard) {
+        MigrateBuckets(db, nameShard, idShard, MIGRATE_WORK_PER_OP);
+        rehash(nameShard);
+    }
+
+    UnlockPair(db, idShard, nameShard);
 
     return 0;
+
+fail:
+    RecordFree(&idShard->arena, ref, size);
+    UnlockPair(db, idShard, nameShard);
+    fprintf(stderr, "Can't allocate memory for new user\n");
+    return -1;
 }
 
 /**
@@ -198,21 +991,17 @@ int RegisterCustomer(DB_T db, const char *id, const char *name,
  * returns: 0 if customer is successfully removed. -1 otherwise
  */
 int UnregisterCustomerByID(DB_T db, const char *id) {
-    if (db == NULL || id == NULL)
+    if (db == NULL || db->origin != NULL || id == NULL)
         return -1;
 
-    struct UserInfo *p = UnlinkCustomerById(db, id);
+    struct Shard *idShard, *nameShard;
+    struct UserInfo *p = LockCustomerById(db, id, DB_OP_UNREGISTER,
+                                          &idShard, &nameShard);
     if (p == NULL)
         return -1;
 
-    p = UnlinkCustomerByName(db, p->name);
-    assert(p != NULL);
-
-    free(p->name);
-    free(p->id);
-    free(p);
-
-    db->size--;
+    RemoveCustomer(db, idShard, nameShard, p);
+    UnlockPair(db, idShard, nameShard);
 
     return 0;
 }
@@ -228,21 +1017,18 @@ int UnregisterCustomerByID(DB_T db, const char *id) {
  * returns: 0 if customer is successfully removed. -1 otherwise
  */
 int UnregisterCustomerByName(DB_T db, const char *name) {
-    if (db == NULL || name == NULL)
+    if (db == NULL || db->origin != NULL || name == NULL)
         return -1;
 
-    struct UserInfo *p = UnlinkCustomerByName(db, name);
+    struct Shard *idShard, *nameShard;
+    struct UserInfo *p =
+        LockCustomerByName(db, name, DB_OP_UNREGISTER, &idShard,
+                           &nameShard);
     if (p == NULL)
         return -1;
 
-    p = UnlinkCustomerById(db, p->id);
-    assert(p != NULL);
-
-    free(p->name);
-    free(p->id);
-    free(p);
-
-    db->size--;
+    RemoveCustomer(db, idShard, nameShard, p);
+    UnlockPair(db, idShard, nameShard);
 
     return 0;
 }
@@ -260,241 +1046,3339 @@ int GetPurchaseByID(DB_T db, const char *id) {
     if (db == NULL || id == NULL)
         return -1;
 
-    struct UserInfo *p = SearchCustomerById(db, id);
-    if (p == NULL)
-        return -1;
+    unsigned int idHash = HashOfKey(db, id);
+    struct Shard *s = ShardOf(db, idHash);
+    int purchase = -1;
 
-    return p->purchase;
-}
+    STATS_OP(&s->counters, DB_OP_LOOKUP);
 
-/**
- * GetPurchaseByName: get the purchase field of a customer by name
- *
- * param db: pointer to database
- * param name: pointer to null terminated string that contains name
- *
- * returns: purchase field value of customer with name
- *  -1 if customer with name does not exist
- */
-int GetPurchaseByName(DB_T db, const char *name) {
-    if (db == NULL || name == NULL)
-        return -1;
+    struct EpochSlot *slot = EnterEpoch(db);
+    if (slot != NULL) {
+        unsigned int seq = LOAD(s->seq);
+        struct UserInfo *p = SearchCustomerById(s, id, idHash);
+        if (p != NULL)
+            purchase = __atomic_load_n(&p->purchase, __ATOMIC_RELAXED);
+        ExitEpoch(slot);
 
-    struct UserInfo *p = SearchCustomerByName(db, name);
-    if (p == NULL)
-        return -1;
+        // a miss is only trusted if no customer moved meanwhile.
+        // otherwise the lookup is repeated under the lock
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (p != NULL ||
+            ((seq & 1) == 0 &&
+             __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq))
+            return purchase;
+    }
 
-    return p->purchase;
+    if (db->concurrent)
+        pthread_rwlock_rdlock(&s->lock);
+
+    // AddPurchaseByIDAtomic() writes the field without the lock
+    struct UserInfo *p = SearchCustomerById(s, id, idHash);
+    if (p != NULL) {
+        purchase = __atomic_load_n(&p->purchase, __ATOMIC_RELAXED);
+        CacheTouch(db, p);
+    }
+    CacheCount(db, p != NULL);
+
+    if (db->concurrent)
+        pthread_rwlock_unlock(&s->lock);
+
+    return purchase;
 }
 
 /**
- * GetSumCustomerPurchase: apply a given function to all customers and
- * get the sum of results
+ * GetPurchaseByIDBatch: get the purchase fields of several customers by
+ * id at once
+ *
+ * each group of keys is looked up in three passes: hash every key and
+ * prefetch its bucket and filter block, check the filter and prefetch
+ * the first customer of every bucket it lets through, then walk those
+ * chains. the misses of a pass are all in flight before the next pass
+ * needs them
  *
  * param db: pointer to database
- * param fp: pointer to a function of type FUNCPTR_T
+ * param ids: array of n ids
+ * param n: number of ids
+ * param out: array receiving the purchase field of each customer. -1
+ *  if customer with the id does not exist
  *
- * returns: sum of function applications to all customers
+ * returns: number of customers found. -1 on invalid arguments
  */
-int GetSumCustomerPurchase(DB_T db, FUNCPTR_T fp) {
-    if (db == NULL || fp == NULL)
+int GetPurchaseByIDBatch(DB_T db, const char **ids, int n, int *out) {
+    struct Shard *shards[BATCH_SIZE];
+    unsigned int *buckets[BATCH_SIZE];
+    unsigned int hashes[BATCH_SIZE], seqs[BATCH_SIZE];
+#if USE_FILTER
+    struct Filter *filters[BATCH_SIZE];
+#endif
+    int found = 0;
+
+    if (db == NULL || ids == NULL || out == NULL || n < 0)
         return -1;
 
-    int sum = 0;
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+        const char **keys = ids + base;
+        int *res = out + base;
 
-    for (int i = 0; i < db->capacity; i++)
-        for (struct UserInfo *p = db->idTable[i]; p != NULL;
-             p = p->idNext)
-            sum += fp(p->id, p->name, p->purchase);
+        // a concurrent db that is not lock-free may free its tables
+        // under an unlocked reader, so it is searched key by key
+        struct EpochSlot *slot = EnterEpoch(db);
+        if (db->concurrent && slot == NULL) {
+            for (int j = 0; j < m; j++)
+                if ((res[j] = GetPurchaseByID(db, keys[j])) != -1)
+                    found++;
+            continue;
+        }
 
-    return sum;
+        for (int j = 0; j < m; j++) {
+            if (keys[j] == NULL)
+                continue;
+            hashes[j] = HashOfKey(db, keys[j]);
+            shards[j] = ShardOf(db, hashes[j]);
+            seqs[j] = LOAD(shards[j]->seq);
+
+            struct Tables *t = IdTables(shards[j], hashes[j]);
+            buckets[j] = &t->idTable[hashes[j] & (t->capacity - 1)];
+            STATS_OP(&shards[j]->counters, DB_OP_LOOKUP);
+            __builtin_prefetch(buckets[j]);
+#if USE_FILTER
+            filters[j] = &t->idFilter;
+            __builtin_prefetch(FilterBlock(filters[j], hashes[j]));
+#endif
+        }
+
+        // keys the filter rejects need no bucket
+        for (int j = 0; j < m; j++) {
+            if (keys[j] == NULL)
+                continue;
+#if USE_FILTER
+            STATS_COUNT(&shards[j]->counters, filterChecks);
+            if (!FilterCheck(filters[j], hashes[j],
+                             shards[j]->lockFree)) {
+                STATS_COUNT(&shards[j]->counters, filterMisses);
+                buckets[j] = NULL;
+                continue;
+            }
+#endif
+            unsigned int ref = LOAD(*buckets[j]);
+            if (ref != RECORD_NONE)
+                __builtin_prefetch(UserAt(shards[j], ref));
+        }
+
+        for (int j = 0; j < m; j++) {
+            res[j] = -1;
+            if (keys[j] == NULL || buckets[j] == NULL)
+                continue;
+
+            unsigned int ref = LOAD(*buckets[j]);
+            while (ref != RECORD_NONE) {
+                struct UserInfo *p = UserAt(shards[j], ref);
+
+                STATS_PROBES(&shards[j]->counters, 1);
+                if (p->idHash == hashes[j] &&
+                    strcmp(IdOf(p), keys[j]) == 0 &&
+                    Visible(shards[j], p)) {
+                    res[j] = __atomic_load_n(&p->purchase,
+                                             __ATOMIC_RELAXED);
+                    CacheTouch(db, p);
+                    break;
+                }
+                ref = LOAD(p->idNext);
+            }
+#if USE_FILTER
+            if (res[j] == -1)
+                STATS_COUNT(&shards[j]->counters, filterFalsePositives);
+#endif
+        }
+
+        if (slot != NULL) {
+            ExitEpoch(slot);
+
+            // misses are only trusted as in GetPurchaseByID()
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            for (int j = 0; j < m; j++) {
+                if (keys[j] == NULL || res[j] != -1)
+                    continue;
+
+                unsigned int *seq = &shards[j]->seq;
+                if ((seqs[j] & 1) != 0 ||
+                    __atomic_load_n(seq, __ATOMIC_RELAXED) != seqs[j])
+                    res[j] = GetPurchaseByID(db, keys[j]);
+            }
+        }
+
+        for (int j = 0; j < m; j++) {
+            if (res[j] != -1)
+                found++;
+            if (keys[j] != NULL)
+                CacheCount(db, res[j] != -1);
+        }
+    }
+
+    return found;
+}
+
+/**
+ * GetPurchaseByName: get the purchase field of a customer by name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: purchase field value of customer with name
+ *  -1 if customer with name does not exist
+ */
+int GetPurchaseByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+
+    unsigned int nameHash = HashOfKey(db, name);
+    struct Shard *s = ShardOf(db, nameHash);
+    int purchase = -1;
+
+    STATS_OP(&s->counters, DB_OP_LOOKUP);
+
+    struct EpochSlot *slot = EnterEpoch(db);
+    if (slot != NULL) {
+        unsigned int seq = LOAD(s->seq);
+        struct UserInfo *p = SearchCustomerByName(s, name, nameHash);
+        if (p != NULL)
+            purchase = __atomic_load_n(&p->purchase, __ATOMIC_RELAXED);
+        ExitEpoch(slot);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (p != NULL ||
+            ((seq & 1) == 0 &&
+             __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq))
+            return purchase;
+    }
+
+    if (db->concurrent)
+        pthread_rwlock_rdlock(&s->lock);
+
+    // the purchase field is written under the lock of the id shard
+    struct UserInfo *p = SearchCustomerByName(s, name, nameHash);
+    if (p != NULL) {
+        purchase = __atomic_load_n(&p->purchase, __ATOMIC_RELAXED);
+        CacheTouch(db, p);
+    }
+    CacheCount(db, p != NULL);
+
+    if (db->concurrent)
+        pthread_rwlock_unlock(&s->lock);
+
+    return purchase;
+}
+
+/**
+ * AddPurchaseByID: add an amount to the purchase field of a customer
+ * found by id
+ *
+ * only the shard of the id is locked, exclusively, whichever shard the
+ * name is in. lookups of other customers of the shard still wait for
+ * it, but lock-free lookups never do. while snapshots are open, the
+ * customer is replaced, which locks the shard of the name as well
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param amount: amount to add. may be negative
+ *
+ * returns: new purchase field value of customer with id.
+ *  -1 if customer with id does not exist, if the new value is not a
+ *  positive int, or if out of memory
+ */
+int AddPurchaseByID(DB_T db, const char *id, int amount) {
+    if (db == NULL || db->origin != NULL || id == NULL)
+        return -1;
+
+    unsigned int idHash = HashOfKey(db, id);
+    struct Shard *s = ShardOf(db, idHash);
+    long long purchase = -1;
+
+    if (db->concurrent)
+        pthread_rwlock_wrlock(&s->lock);
+
+    // the number of snapshots can't change while a shard is locked
+    if (db->snapshots == 0) {
+        STATS_OP(&s->counters, DB_OP_UPDATE);
+
+        struct UserInfo *p = SearchCustomerById(s, id, idHash);
+        if (p != NULL) {
+            int old;
+
+            CacheTouch(db, p);
+            purchase = AddToPurchase(p, amount, &old);
+            if (purchase > 0)
+                ReindexPurchase(s, p, old, (int)purchase);
+        }
+
+        if (db->concurrent)
+            pthread_rwlock_unlock(&s->lock);
+
+        return (int)purchase;
+    }
+
+    if (db->concurrent)
+        pthread_rwlock_unlock(&s->lock);
+
+    struct Shard *idShard, *nameShard;
+    struct UserInfo *p = LockCustomerById(db, id, DB_OP_UPDATE,
+                                          &idShard, &nameShard);
+    if (p == NULL)
+        return -1;
+
+    // the last snapshot may have been released before the lock was
+    // taken, and then nothing would sweep the replaced customer, while
+    // atomic adds may go on again
+    if (db->snapshots == 0) {
+        int old;
+
+        purchase = AddToPurchase(p, amount, &old);
+        if (purchase > 0)
+            ReindexPurchase(idShard, p, old, (int)purchase);
+    } else {
+        purchase = (long long)p->purchase + amount;
+        if (purchase <= 0 || purchase > INT_MAX)
+            purchase = -1;
+        else if (ReplaceCustomer(db, idShard, nameShard, p,
+                                 (int)purchase) < 0)
+            purchase = -1;
+    }
+    UnlockPair(db, idShard, nameShard);
+
+    return (int)purchase;
+}
+
+/**
+ * AddPurchaseByIDAtomic: add an amount to the purchase field of a
+ * customer found by id, without a lock in a lock-free db
+ *
+ *  the customer is found as by a lock-free lookup and the amount is
+ *  added by compare and swap, so that adds never wait for each other
+ *  nor for updates of the shard. instead of moving the customer in the
+ *  ordered indexes, the shard is marked stale, and its indexes are
+ *  rebuilt by the next ordered query. a db that is not lock-free, one
+ *  whose customers may be copied meanwhile, i.e. with snapshots open
+ *  or being compacted, and a miss while customers move fall back to
+ *  AddPurchaseByID()
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param amount: amount to add. may be negative
+ *
+ * returns: new purchase field value of customer with id.
+ *  -1 if customer with id does not exist, if the new value is not a
+ *  positive int, or if out of memory
+ */
+int AddPurchaseByIDAtomic(DB_T db, const char *id, int amount) {
+    if (db == NULL || db->origin != NULL || id == NULL)
+        return -1;
+
+    unsigned int idHash = HashOfKey(db, id);
+    struct Shard *s = ShardOf(db, idHash);
+
+    // the flag is read after the slot is published, so that
+    // SetAtomicAdds() either sees the slot or is seen here
+    struct EpochSlot *slot = EnterEpoch(db);
+    if (slot != NULL &&
+        !__atomic_load_n(&db->atomicAdds, __ATOMIC_SEQ_CST)) {
+        ExitEpoch(slot);
+        slot = NULL;
+    }
+
+    if (slot != NULL) {
+        STATS_OP(&s->counters, DB_OP_UPDATE);
+
+        unsigned int seq = LOAD(s->seq);
+        struct UserInfo *p = SearchCustomerById(s, id, idHash);
+        int purchase = -1, old;
+
+        if (p != NULL) {
+            // the shard is marked before the field changes, see
+            // AddToPurchase()
+            if (!IndexesStale(s))
+                __atomic_store_n(&s->stale, 1, __ATOMIC_SEQ_CST);
+            purchase = AddToPurchase(p, amount, &old);
+        }
+        ExitEpoch(slot);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (p != NULL ||
+            ((seq & 1) == 0 &&
+             __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq))
+            return purchase;
+    }
+
+    return AddPurchaseByID(db, id, amount);
+}
+
+/**
+ * SetPurchaseByName: set the purchase field of a customer found by
+ * name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ * param purchase: new purchase amount (> 0)
+ *
+ * returns: 0 on success. -1 if customer with name does not exist,
+ *  purchase is not positive or out of memory
+ */
+int SetPurchaseByName(DB_T db, const char *name, int purchase) {
+    int res = 0;
+
+    if (db == NULL || db->origin != NULL || name == NULL ||
+        purchase <= 0)
+        return -1;
+
+    struct Shard *idShard, *nameShard;
+    struct UserInfo *p = LockCustomerByName(db, name, DB_OP_UPDATE,
+                                            &idShard, &nameShard);
+    if (p == NULL)
+        return -1;
+
+    CacheTouch(db, p);
+    if (db->snapshots > 0)
+        res = ReplaceCustomer(db, idShard, nameShard, p, purchase);
+    else
+        UpdatePurchase(idShard, p, purchase);
+    UnlockPair(db, idShard, nameShard);
+
+    return res;
+}
+
+/**
+ * GetSumCustomerPurchase: apply a given function to all customers and
+ * get the sum of results
+ *
+ * in a concurrent or lock-free db, shards are visited one at a time
+ * under a shared lock, so fp must not update the db. a snapshot is
+ * visited without locks, and fp may update the db it was taken of
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to all customers
+ */
+int GetSumCustomerPurchase(DB_T db, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL)
+        return -1;
+
+    int sum = 0;
+
+    // every customer is in the id table of exactly one shard
+    for (unsigned int k = 0; k < db->nshards; k++) {
+        struct Shard *s = &db->shards[k];
+
+        if (db->concurrent)
+            pthread_rwlock_rdlock(&s->lock);
+
+        sum += (int)SumBuckets(s, 0, ShardBuckets(s), NULL, fp, NULL);
+
+        if (db->concurrent)
+            pthread_rwlock_unlock(&s->lock);
+    }
+
+    return sum;
+}
+
+/**
+ * GetSumCustomerPurchaseParallel: apply a given function to all
+ * customers on several threads and get the 64-bit sum of results
+ *
+ * the buckets are cut into chunks that the calling thread and up to
+ * nthreads - 1 helper threads take one at a time, each adding into
+ * its own partial sum. a concurrent db is cut into whole shards, each
+ * summed under its shared lock, so it takes several shards to keep
+ * the threads busy
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T. it is called from
+ *  several threads at once
+ * param nthreads: number of threads to use
+ *
+ * returns: sum of function applications to all customers. -1 on
+ *  invalid arguments
+ */
+long long GetSumCustomerPurchaseParallel(DB_T db, FUNCPTR_T fp,
+                                         int nthreads) {
+    struct SumJob job;
+    unsigned int nchunks;
+
+    if (db == NULL || fp == NULL || nthreads <= 0)
+        return -1;
+
+    job.db = db;
+    job.fp = fp;
+    job.byShard = db->concurrent || db->nshards > 1;
+    if (job.byShard)
+        nchunks = db->nshards;
+    else
+        nchunks = (ShardBuckets(&db->shards[0]) +
+                   SUM_CHUNK_BUCKETS - 1) /
+                  SUM_CHUNK_BUCKETS;
+
+    return RunSumJob(nchunks, SumChunk, &job, nthreads);
+}
+
+/**
+ * GetCustomersByPurchaseRange: apply a given function to the customers
+ * whose purchase amount lies in a range and get the sum of results
+ *
+ * the customers are found through the purchase index of each shard,
+ * and the shards are merged so that the largest amounts come first.
+ * every shard is locked shared meanwhile. snapshots have no purchase
+ * index, and are not supported. the index of a shard is built by the
+ * first such query. one that atomic adds left stale is rebuilt first,
+ * and adds made after that are not seen
+ *
+ * param db: pointer to database
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments, on a snapshot or if out of memory
+ */
+int GetCustomersByPurchaseRange(DB_T db, int low, int high,
+                                FUNCPTR_T fp) {
+    if (db == NULL || db->origin != NULL || fp == NULL)
+        return -1;
+
+    return (int)VisitByPurchase(db, low, high, INT_MAX, fp);
+}
+
+/**
+ * GetTopKCustomers: apply a given function to the customers with the
+ * largest purchase amounts and get the sum of results
+ *
+ * as in GetCustomersByPurchaseRange(), atomic adds made while the
+ * customers are visited are not seen
+ *
+ * param db: pointer to database
+ * param k: number of customers
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments, on a snapshot or if out of memory
+ */
+int GetTopKCustomers(DB_T db, int k, FUNCPTR_T fp) {
+    if (db == NULL || db->origin != NULL || fp == NULL || k < 0)
+        return -1;
+
+    return (int)VisitByPurchase(db, INT_MIN, INT_MAX, k, fp);
+}
+
+/**
+ * ForEachCustomerWithNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix
+ *
+ * the customers are found through the name index of each shard in
+ * time proportional to the prefix length and the number of matches.
+ * each shard is locked shared while it is searched. a snapshot has no
+ * name index, so all of its customers are checked. the name index of a
+ * shard is built by the first such query, and one that atomic adds
+ * left stale is rebuilt first
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: number of matching customers. -1 on invalid arguments
+ */
+int ForEachCustomerWithNamePrefix(DB_T db, const char *prefix,
+                                  FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL)
+        return -1;
+
+    VisitByNamePrefix(db, prefix, fp, &count);
+    return count;
+}
+
+/**
+ * GetSumCustomerPurchaseByNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix and get the sum of
+ * results
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments
+ */
+int GetSumCustomerPurchaseByNamePrefix(DB_T db, const char *prefix,
+                                       FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL)
+        return -1;
+
+    return (int)VisitByNamePrefix(db, prefix, fp, &count);
+}
+
+/**
+ * CompactCustomerDB: shrink a customer db to fit its customers and give
+ * unused memory back
+ *
+ * unlike the gradual shrinking of updates, every shard is resized at
+ * once to the smallest tables its counts fit in, and its customers are
+ * copied into a fresh arena so that the chunks holding freed customers
+ * can be returned. all shards are locked exclusively meanwhile. in a
+ * lock-free db, lookups go on during the call, which waits until none
+ * of them can still see the old tables or customers
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if out of memory or snapshots of the db are
+ *  open, in which case the db is left as it was
+ */
+int CompactCustomerDB(DB_T db) {
+    int res = -1;
+
+    if (db == NULL || db->origin != NULL)
+        return -1;
+
+    LockAll(db);
+    unsigned long long start = StatsNow();
+    if (db->snapshots == 0) {
+        SetAtomicAdds(db, 0);
+        res = CompactShards(db);
+        SetAtomicAdds(db, 1);
+    }
+    if (res == 0) {
+        db->compactions++;
+        db->compactNsec += StatsNow() - start;
+    }
+    UnlockAll(db);
+
+#ifdef __GLIBC__
+    // freed slabs and tables may stay in the heap rather than be
+    // unmapped
+    if (res == 0)
+        malloc_trim(0);
+#endif
+
+    return res;
+}
+
+/**
+ * SnapshotCustomerDB: open a read-only view of a customer db as it is
+ * now
+ *
+ *  the view is a db of its own whose shards share the tables of the
+ *  db's shards, which are taken with every shard locked. from then on,
+ *  nothing it can reach changes: an update copies a shared table before
+ *  writing it, removed customers stay linked, and a customer whose
+ *  purchase field changes is replaced by a copy. a resize copies the
+ *  customers it migrates as well, see CopyBucket()
+ *
+ *  a cache can't be snapshotted, since the customers kept and copied
+ *  for a snapshot would take memory outside of its budget
+ *
+ * param db: pointer to database
+ *
+ * returns: pointer to the snapshot. NULL on failure or for a cache
+ */
+DB_T SnapshotCustomerDB(DB_T db) {
+    if (db == NULL || db->origin != NULL || db->maxBytes != 0)
+        return NULL;
+
+    DB_T snap = (DB_T)calloc(1, sizeof(struct DB));
+    if (snap == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        return NULL;
+    }
+
+    if (posix_memalign((void **)&snap->shards, CACHE_LINE_SIZE,
+                       db->nshards * sizeof(struct Shard)) != 0) {
+        fprintf(stderr, "Can't allocate a memory for %u shards\n",
+                db->nshards);
+        free(snap);
+        return NULL;
+    }
+    memset(snap->shards, 0, db->nshards * sizeof(struct Shard));
+
+    // nothing the snapshot reads is written, so it needs no locks
+    snap->hash = db->hash;
+    snap->seed = db->seed;
+    snap->nshards = db->nshards;
+    snap->shardShift = db->shardShift;
+    snap->origin = db;
+
+    LockAll(db);
+    unsigned int version = db->version++;
+    if (db->snapshots++ == 0)
+        SetAtomicAdds(db, 0);
+
+    for (unsigned int i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+        struct Shard *v = &snap->shards[i];
+
+        v->tables = s->tables;
+        v->oldTables = s->oldTables;
+        v->migrated = s->migrated;
+        v->version = version;
+        RecordArenaInit(&v->arena, &db->pool);
+
+        v->tables->snapshots++;
+        if (v->oldTables != NULL)
+            v->oldTables->snapshots++;
+    }
+    UnlockAll(db);
+
+    return snap;
+}
+
+/**
+ * ReleaseCustomerSnapshot: release a snapshot of a customer db
+ *
+ *  tables only the snapshot still shares are freed. releasing the last
+ *  snapshot of a db also unlinks and frees the customers removed or
+ *  copied while snapshots were open, which walks every bucket with all
+ *  shards locked
+ *
+ * param snap: pointer to snapshot
+ */
+void ReleaseCustomerSnapshot(DB_T snap) {
+    if (snap == NULL || snap->origin == NULL)
+        return;
+
+    DB_T db = snap->origin;
+
+    LockAll(db);
+    for (unsigned int i = 0; i < db->nshards; i++) {
+        DropTables(db, &db->shards[i], snap->shards[i].tables);
+        DropTables(db, &db->shards[i], snap->shards[i].oldTables);
+    }
+    if (--db->snapshots == 0) {
+        SweepRemoved(db);
+        SetAtomicAdds(db, 1);
+    }
+    UnlockAll(db);
+
+    free(snap->shards);
+    free(snap);
+}
+
+/**
+ * GetCustomerDBStats: get the statistics of a customer db
+ *
+ * the tables of all shards are summed up as a single table. the chain
+ * length of a customer is its position in its bucket. each shard is
+ * locked shared while it is walked, so the result of a db being
+ * updated meanwhile is not a snapshot of any single moment
+ *
+ * param db: pointer to database
+ * param stats: pointer to the structure receiving the statistics
+ *
+ * returns: 0 on success. -1 on invalid arguments or a snapshot
+ */
+int GetCustomerDBStats(DB_T db, struct DBStats *stats) {
+    unsigned long long capacity = 0;
+#if USE_FILTER
+    unsigned long long filterBlocks = 0;
+#endif
+
+    if (db == NULL || db->origin != NULL || stats == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(struct DBStats));
+    stats->cacheHits = db->hits;
+    stats->cacheMisses = db->misses;
+    stats->cacheEvictions = db->evictions;
+    stats->cacheBytes = db->cacheBytes;
+    stats->bytesAllocated = sizeof(struct DB) +
+                            db->nshards * sizeof(struct Shard) +
+                            RecordPoolBytes(&db->pool);
+    if (db->lockFree)
+        stats->bytesAllocated += MAX_READERS * sizeof(struct EpochSlot);
+
+    for (unsigned int k = 0; k < db->nshards; k++) {
+        struct Shard *s = &db->shards[k];
+
+        if (db->concurrent)
+            pthread_rwlock_rdlock(&s->lock);
+
+        struct Tables *t = s->tables;
+        struct Tables *old = s->oldTables;
+
+        capacity += t->capacity;
+        stats->bytesAllocated += TablesSize(t->capacity);
+        for (unsigned int b = 0; b < t->capacity; b++) {
+            AddChains(&stats->idTable, s, t->idTable[b], 0);
+            AddChains(&stats->nameTable, s, t->nameTable[b], 1);
+        }
+
+#if USE_FILTER
+        // summed over the blocks of the current tables, and divided by
+        // their number below
+        filterBlocks += t->idFilter.nblocks;
+        stats->idTable.filterFalsePositiveRate +=
+            FilterFalsePositives(&t->idFilter);
+        stats->nameTable.filterFalsePositiveRate +=
+            FilterFalsePositives(&t->nameFilter);
+#endif
+
+        // unmigrated old buckets still hold customers
+        if (old != NULL) {
+            stats->bytesAllocated += TablesSize(old->capacity);
+            for (unsigned int b = s->migrated; b < old->capacity; b++) {
+                AddChains(&stats->idTable, s, old->idTable[b], 0);
+                AddChains(&stats->nameTable, s, old->nameTable[b], 1);
+            }
+        }
+
+        stats->bytesAllocated +=
+            s->retiredCapacity * sizeof(struct Retired) +
+            s->arena.bytesReserved + s->purchases.arena.bytesReserved +
+            s->names.arena.bytesReserved;
+        stats->rehashes += s->rehashes;
+        stats->rehashNsec += s->rehashNsec;
+
+        // a compaction holds every shard, and rebuilds the tables of
+        // each
+        if (k == 0) {
+            stats->rehashes += db->compactions * db->nshards;
+            stats->rehashNsec += db->compactNsec;
+        }
+#if USE_STATS
+        StatsAddCounters(stats, &s->counters);
+#endif
+
+        if (db->concurrent)
+            pthread_rwlock_unlock(&s->lock);
+    }
+
+    StatsFinishTable(&stats->idTable, capacity);
+    StatsFinishTable(&stats->nameTable, capacity);
+#if USE_FILTER
+    stats->idTable.filterFalsePositiveRate /= filterBlocks;
+    stats->nameTable.filterFalsePositiveRate /= filterBlocks;
+#endif
+
+    return 0;
+}
+
+/**
+ * CreateDB: allocate a db with a given number of shards
+ *
+ * param nshards: number of shards. must be a power of 2
+ * param capacity: initial bucket size of all shards together. must be
+ *  a power of 2
+ * param concurrent: nonzero if shards have to be locked
+ * param lockFree: nonzero if lookups run without locks
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+static DB_T CreateDB(unsigned int nshards, unsigned int capacity,
+                     int concurrent, int lockFree, HASHFUNC_T hash,
+                     unsigned long long seed) {
+    DB_T db;
+
+    db = (DB_T)calloc(1, sizeof(struct DB));
+    if (db == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        return NULL;
+    }
+
+    if (posix_memalign((void **)&db->shards, CACHE_LINE_SIZE,
+                       nshards * sizeof(struct Shard)) != 0) {
+        fprintf(stderr, "Can't allocate a memory for %u shards\n",
+                nshards);
+        free(db);
+        return NULL;
+    }
+    memset(db->shards, 0, nshards * sizeof(struct Shard));
+
+    db->hash = hash;
+    db->seed = seed;
+    db->nshards = nshards;
+    db->concurrent = concurrent;
+    db->lockFree = lockFree;
+    db->version = 1;
+    db->shardShift = 32;
+    while ((1U << (32 - db->shardShift)) < nshards)
+        db->shardShift--;
+
+    capacity /= nshards;
+    if (capacity < MIN_SHARD_BUCKET_SIZE)
+        capacity = MIN_SHARD_BUCKET_SIZE;
+
+    if (RecordPoolInit(&db->pool) < 0) {
+        fprintf(stderr, "Can't allocate a memory for record pool\n");
+        db->nshards = 0;
+        DestroyCustomerDB(db);
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < nshards; i++) {
+        struct Shard *s = &db->shards[i];
+
+        if (InitShard(s, &db->pool, capacity, seed + i) < 0) {
+            db->nshards = i;
+            DestroyCustomerDB(db);
+            return NULL;
+        }
+        s->lockFree = lockFree;
+    }
+
+    if (lockFree) {
+        size_t size = MAX_READERS * sizeof(struct EpochSlot);
+
+        db->epoch = 1;
+        db->atomicAdds = 1;
+        if (posix_memalign((void **)&db->epochSlots, CACHE_LINE_SIZE,
+                           size) != 0) {
+            fprintf(stderr, "Can't allocate a memory for readers\n");
+            DestroyCustomerDB(db);
+            return NULL;
+        }
+        memset(db->epochSlots, 0, size);
+    }
+
+    return db;
+}
+
+/**
+ * InitShard: allocate the empty tables of a shard
+ *
+ * param s: pointer to zero-filled shard
+ * param pool: pointer to the pool of the db
+ * param capacity: initial bucket size. must be a power of 2
+ * param seed: seed of the purchase index
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  nothing is left allocated
+ */
+static int InitShard(struct Shard *s, struct RecordPool *pool,
+                     unsigned int capacity, unsigned long long seed) {
+    s->minCapacity = capacity;
+    s->version = UINT_MAX;
+    SetThresholds(s, capacity);
+    RecordArenaInit(&s->arena, pool);
+    PurchaseIndexInit(&s->purchases, seed);
+    NameIndexInit(&s->names);
+
+    s->tables = AllocTables(capacity);
+    if (s->tables == NULL) {
+        fprintf(stderr,
+                "Can't allocate a memory for array of size %d\n",
+                capacity);
+        return -1;
+    }
+
+    if (pthread_rwlock_init(&s->lock, NULL) != 0) {
+        free(s->tables);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * TablesSize: get the size of id and name tables
+ *
+ * param capacity: bucket size
+ *
+ * returns: size in bytes
+ */
+static size_t TablesSize(unsigned int capacity) {
+    size_t size = sizeof(struct Tables) +
+                  2 * (size_t)capacity * sizeof(unsigned int);
+
+#if USE_FILTER
+    // and room to start the filters at a cache line
+    size += CACHE_LINE_SIZE + 2 * (size_t)FilterBlocks(capacity) *
+                                  FILTER_BLOCK_WORDS *
+                                  sizeof(unsigned int);
+#endif
+
+    return size;
+}
+
+/**
+ * AllocTables: allocate empty id and name tables
+ *
+ *  large blocks of calloc() are fresh pages that fault in on first
+ *  use. each page is written once here, so that the resize allocating
+ *  the tables pays for all of them, instead of one update in every few
+ *  hundred paying for a page while buckets migrate
+ *
+ * param capacity: bucket size. must be a power of 2
+ *
+ * returns: pointer to tables. NULL if memory allocation fails
+ */
+static struct Tables *AllocTables(unsigned int capacity) {
+    size_t size = TablesSize(capacity);
+    struct Tables *t = calloc(1, size);
+    if (t == NULL)
+        return NULL;
+
+    // volatile, since the compiler knows the bytes are already 0
+    for (size_t offset = 0; offset < size; offset += MIN_PAGE_SIZE)
+        ((volatile char *)t)[offset] = 0;
+
+    t->capacity = capacity;
+    t->idTable = t->buckets;
+    t->nameTable = t->buckets + capacity;
+
+#if USE_FILTER
+    uintptr_t end = (uintptr_t)(t->buckets + 2 * (size_t)capacity);
+    unsigned int nblocks = FilterBlocks(capacity);
+
+    t->idFilter.blocks =
+        (unsigned int *)((end + CACHE_LINE_SIZE - 1) &
+                         ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+    t->idFilter.nblocks = nblocks;
+    t->nameFilter.blocks =
+        t->idFilter.blocks + (size_t)nblocks * FILTER_BLOCK_WORDS;
+    t->nameFilter.nblocks = nblocks;
+#endif
+
+    return t;
+}
+
+/**
+ * UnsharedTables: get tables of a shard that can be written
+ *
+ *  tables shared with snapshots are copied, and the copy takes their
+ *  place in the shard. the snapshots keep the original
+ *
+ * param s: pointer to the locked shard
+ * param t: pointer to its current or old tables
+ *
+ * returns: t, or its copy. NULL if memory allocation fails
+ */
+static struct Tables *UnsharedTables(struct Shard *s,
+                                     struct Tables *t) {
+    if (t->snapshots == 0)
+        return t;
+
+    struct Tables *copy = AllocTables(t->capacity);
+    if (copy == NULL)
+        return NULL;
+
+    memcpy(copy->buckets, t->buckets,
+           2 * (size_t)t->capacity * sizeof(unsigned int));
+#if USE_FILTER
+    // the blocks of both filters are contiguous
+    memcpy(copy->idFilter.blocks, t->idFilter.blocks,
+           2 * (size_t)t->idFilter.nblocks * FILTER_BLOCK_WORDS *
+               sizeof(unsigned int));
+    copy->idFilter.adds = t->idFilter.adds;
+    copy->nameFilter.adds = t->nameFilter.adds;
+#endif
+
+    // lock-free readers find the same customers in either
+    if (t == s->tables)
+        STORE(s->tables, copy);
+    else
+        STORE(s->oldTables, copy);
+
+    return copy;
+}
+
+/**
+ * DropTables: drop the reference of a released snapshot to tables
+ *
+ *  tables that were copied meanwhile are freed once no snapshot shares
+ *  them any more
+ *
+ * param db: pointer to database, with every shard locked
+ * param s: pointer to the shard the tables were taken from
+ * param t: pointer to tables. may be NULL
+ */
+static void DropTables(DB_T db, struct Shard *s, struct Tables *t) {
+    if (t == NULL || --t->snapshots > 0)
+        return;
+    if (t == s->tables || t == s->oldTables)
+        return;
+
+    if (db->lockFree)
+        Retire(db, s, t, RECORD_NONE, 0);
+    else
+        free(t);
+}
+
+#if USE_FILTER
+/**
+ * FilterBlocks: get the number of blocks of a filter
+ *
+ * param capacity: bucket size of the filter's table
+ *
+ * returns: number of blocks, at least 1
+ */
+static unsigned int FilterBlocks(unsigned int capacity) {
+    unsigned long long bits =
+        (unsigned long long)capacity * FILTER_BITS_PER_BUCKET;
+
+    return bits < FILTER_BLOCK_BITS
+               ? 1
+               : (unsigned int)(bits / FILTER_BLOCK_BITS);
+}
+
+/**
+ * FilterBlock: find the filter block a hash value belongs to
+ *
+ *  the low bits of a hash value choose its bucket, and the top bits of
+ *  its fibonacci-mixed value its shard. the block is chosen by the top
+ *  bits of a value mixed with another multiplier, so that the keys of
+ *  a shard spread over all blocks
+ *
+ * param f: pointer to filter
+ * param hash: raw hash value of the key
+ *
+ * returns: pointer to the first word of the block
+ */
+static inline unsigned int *FilterBlock(const struct Filter *f,
+                                        unsigned int hash) {
+    unsigned long long mixed = (unsigned int)(hash * 0x85ebca6bU);
+    size_t b = (size_t)((mixed * f->nblocks) >> 32);
+
+    return f->blocks + b * FILTER_BLOCK_WORDS;
+}
+
+/**
+ * FilterAdd: add a key to a filter
+ *
+ *  bits are only set by the writer holding the shard, so each word is
+ *  or-ed without a locked instruction and stored atomically for
+ *  lock-free readers. the release store that publishes the key in its
+ *  bucket afterwards makes the bits visible first
+ *
+ * param f: pointer to filter
+ * param hash: raw hash value of the key
+ */
+static void FilterAdd(struct Filter *f, unsigned int hash) {
+    unsigned int *block = FilterBlock(f, hash);
+
+    for (int i = 0; i < FILTER_BLOCK_WORDS; i++) {
+        unsigned int bit = 1U << ((hash * filterSalt[i]) >> 27);
+        __atomic_store_n(&block[i], block[i] | bit, __ATOMIC_RELAXED);
+    }
+    f->adds++;
+}
+
+/**
+ * FilterCheck: check if a key may be in a filter
+ *
+ *  with AVX2, the 8 bits of the key are computed and tested against
+ *  its block at once. with SSE2, they are tested 4 words at a time.
+ *  the filter of a lock-free db may be written by FilterAdd() while it
+ *  is checked, so its words are loaded atomically one by one instead.
+ *  bits are never cleared, so such a check can only miss bits of a key
+ *  that is not published yet
+ *
+ * param f: pointer to filter
+ * param hash: raw hash value of the key
+ * param lockFree: nonzero if the filter may be written meanwhile
+ *
+ * returns: 0 if the key is definitely not in the filter. nonzero if
+ *  it may be
+ */
+static inline int FilterCheck(const struct Filter *f,
+                              unsigned int hash, int lockFree) {
+    const unsigned int *block = FilterBlock(f, hash);
+
+#if defined(__AVX2__)
+    if (!lockFree) {
+        __m256i salt = _mm256_load_si256((const __m256i *)filterSalt);
+        __m256i shift = _mm256_srli_epi32(
+            _mm256_mullo_epi32(_mm256_set1_epi32((int)hash), salt), 27);
+        __m256i bits = _mm256_sllv_epi32(_mm256_set1_epi32(1), shift);
+
+        return _mm256_testc_si256(
+            _mm256_load_si256((const __m256i *)block), bits);
+    }
+#elif defined(__SSE2__)
+    if (!lockFree) {
+        unsigned int bits[FILTER_BLOCK_WORDS]
+            __attribute__((aligned(16)));
+
+        for (int i = 0; i < FILTER_BLOCK_WORDS; i++)
+            bits[i] = 1U << ((hash * filterSalt[i]) >> 27);
+
+        // bits of the key that are clear in the block
+        __m128i lo =
+            _mm_andnot_si128(_mm_load_si128((const __m128i *)block),
+                             _mm_load_si128((const __m128i *)bits));
+        __m128i hi = _mm_andnot_si128(
+            _mm_load_si128((const __m128i *)block + 1),
+            _mm_load_si128((const __m128i *)bits + 1));
+        __m128i clear = _mm_cmpeq_epi32(_mm_or_si128(lo, hi),
+                                        _mm_setzero_si128());
+
+        return _mm_movemask_epi8(clear) == 0xffff;
+    }
+#else
+    (void)lockFree;
+#endif
+
+    for (int i = 0; i < FILTER_BLOCK_WORDS; i++) {
+        unsigned int bit = 1U << ((hash * filterSalt[i]) >> 27);
+        if ((__atomic_load_n(&block[i], __ATOMIC_RELAXED) & bit) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * FilterFalsePositives: get the expected false positives of a filter
+ *
+ *  a key that is not in the filter passes the check of its block if
+ *  the bit it picks in each word is set, which happens as often as the
+ *  word has bits set out of 32
+ *
+ * param f: pointer to filter
+ *
+ * returns: sum over all blocks of the probability that a key that is
+ *  not in the filter passes the check of the block
+ */
+static double FilterFalsePositives(const struct Filter *f) {
+    double sum = 0;
+
+    for (unsigned int b = 0; b < f->nblocks; b++) {
+        const unsigned int *block = f->blocks + b * FILTER_BLOCK_WORDS;
+        double p = 1;
+
+        for (int i = 0; i < FILTER_BLOCK_WORDS; i++)
+            p *= __builtin_popcount(block[i]) / 32.0;
+        sum += p;
+    }
+
+    return sum;
+}
+#endif
+
+/**
+ * FiltersStale: check if the filters of a shard's tables hold too
+ * many keys that were removed since
+ *
+ * param s: pointer to shard with no resize in progress
+ *
+ * returns: nonzero if the tables should be rebuilt at the same
+ *  capacity to clear the bits of removed keys
+ */
+static int FiltersStale(struct Shard *s) {
+#if USE_FILTER
+    struct Tables *t = s->tables;
+    unsigned int limit =
+        (unsigned int)(FILTER_STALE_RATIO * t->capacity);
+
+    // every key in the shard was added to the current filters
+    return t->idFilter.adds - s->idCount >= limit ||
+           t->nameFilter.adds - s->nameCount >= limit;
+#else
+    (void)s;
+    return 0;
+#endif
+}
+
+/**
+ * AddChains: account for the customers of a bucket in table statistics
+ *
+ *  customers marked as removed are not counted, but lengthen the
+ *  chains of those behind them
+ *
+ * param t: pointer to the statistics of the table
+ * param s: pointer to any shard of the db
+ * param ref: first customer of the bucket
+ * param byName: nonzero if the bucket is one of the name table
+ */
+static void AddChains(struct DBTableStats *t, struct Shard *s,
+                      unsigned int ref, int byName) {
+    for (unsigned int len = 1; ref != RECORD_NONE; len++) {
+        struct UserInfo *p = UserAt(s, ref);
+
+        if (Visible(s, p))
+            StatsAddChain(t, len);
+        ref = byName ? p->nameNext : p->idNext;
+    }
+}
+
+/**
+ * ShardOf: find the shard a hash value belongs to
+ *
+ *  buckets are chosen by the low bits of the hash value, so the shard
+ *  is chosen by the top bits of its fibonacci-mixed value
+ *
+ * param db: pointer to database
+ * param hash: raw hash value of id or name
+ *
+ * returns: pointer to shard
+ */
+static inline struct Shard *ShardOf(DB_T db, unsigned int hash) {
+    unsigned long long mixed = (unsigned int)(hash * 2654435769U);
+    return &db->shards[mixed >> db->shardShift];
+}
+
+/**
+ * WriteLockPair: lock two shards exclusively
+ *
+ *  shards are always locked in address order, so that two updates
+ *  holding one shard each never wait for each other
+ *
+ * param db: pointer to database
+ * param a, b: pointers to shards. may be the same shard
+ */
+static void WriteLockPair(DB_T db, struct Shard *a, struct Shard *b) {
+    if (!db->concurrent)
+        return;
+
+    if (a > b) {
+        struct Shard *t = a;
+        a = b;
+        b = t;
+    }
+
+    pthread_rwlock_wrlock(&a->lock);
+    if (b != a)
+        pthread_rwlock_wrlock(&b->lock);
+}
+
+/**
+ * UnlockPair: unlock two shards locked with WriteLockPair
+ *
+ * param db: pointer to database
+ * param a, b: pointers to shards. may be the same shard
+ */
+static void UnlockPair(DB_T db, struct Shard *a, struct Shard *b) {
+    if (!db->concurrent)
+        return;
+
+    pthread_rwlock_unlock(&a->lock);
+    if (b != a)
+        pthread_rwlock_unlock(&b->lock);
+}
+
+/**
+ * IdTables: find the tables whose id table a hash value belongs to
+ *
+ *  while resizing, a hash value belongs to the old tables unless its
+ *  old bucket has already been migrated
+ *
+ * param s: pointer to the shard of the id
+ * param idHash: raw hash value of id
+ *
+ * returns: pointer to the current or the old tables
+ */
+static inline struct Tables *IdTables(struct Shard *s,
+                                      unsigned int idHash) {
+    // the current tables are published after the old ones
+    struct Tables *t = LOAD(s->tables);
+    struct Tables *old = LOAD(s->oldTables);
+
+    if (old != NULL &&
+        (idHash & (old->capacity - 1)) >= LOAD(s->migrated))
+        return old;
+
+    return t;
+}
+
+/**
+ * NameTables: find the tables whose name table a hash value belongs to
+ *
+ * param s: pointer to the shard of the name
+ * param nameHash: raw hash value of name
+ *
+ * returns: pointer to the current or the old tables
+ */
+static inline struct Tables *NameTables(struct Shard *s,
+                                        unsigned int nameHash) {
+    struct Tables *t = LOAD(s->tables);
+    struct Tables *old = LOAD(s->oldTables);
+
+    if (old != NULL &&
+        (nameHash & (old->capacity - 1)) >= LOAD(s->migrated))
+        return old;
+
+    return t;
+}
+
+/**
+ * IdBucket: find the bucket of the id table a hash value belongs to
+ *
+ * param s: pointer to the shard of the id
+ * param idHash: raw hash value of id
+ *
+ * returns: pointer to the head of the bucket
+ */
+static inline unsigned int *IdBucket(struct Shard *s,
+                                     unsigned int idHash) {
+    struct Tables *t = IdTables(s, idHash);
+    return &t->idTable[idHash & (t->capacity - 1)];
+}
+
+/**
+ * NameBucket: find the bucket of the name table a hash value belongs to
+ *
+ * param s: pointer to the shard of the name
+ * param nameHash: raw hash value of name
+ *
+ * returns: pointer to the head of the bucket
+ */
+static inline unsigned int *NameBucket(struct Shard *s,
+                                       unsigned int nameHash) {
+    struct Tables *t = NameTables(s, nameHash);
+    return &t->nameTable[nameHash & (t->capacity - 1)];
+}
+
+/**
+ * LinkById: link a customer at the head of its bucket of an id table
+ *
+ *  the id is added to the filter of the table before the customer can
+ *  be found in the bucket
+ *
+ * param t: pointer to the tables of the bucket
+ * param ref: reference to customer
+ * param p: pointer to customer
+ */
+static void LinkById(struct Tables *t, unsigned int ref,
+                     struct UserInfo *p) {
+    unsigned int *bucket = &t->idTable[p->idHash & (t->capacity - 1)];
+
+#if USE_FILTER
+    FilterAdd(&t->idFilter, p->idHash);
+#endif
+    STORE(p->idNext, *bucket);
+    STORE(*bucket, ref);
+}
+
+/**
+ * LinkByName: link a customer at the head of its bucket of a name
+ * table
+ *
+ * param t: pointer to the tables of the bucket
+ * param ref: reference to customer
+ * param p: pointer to customer
+ */
+static void LinkByName(struct Tables *t, unsigned int ref,
+                       struct UserInfo *p) {
+    unsigned int *bucket =
+        &t->nameTable[p->nameHash & (t->capacity - 1)];
+
+#if USE_FILTER
+    FilterAdd(&t->nameFilter, p->nameHash);
+#endif
+    STORE(p->nameNext, *bucket);
+    STORE(*bucket, ref);
+}
+
+/**
+ * SearchCustomerById: search a customer by id
+ *
+ * param s: pointer to the shard of the id
+ * param id: pointer to null terminated string containing id
+ * param idHash: raw hash value of id
+ *
+ * returns: pointer to customer. NULL if customer with the id does not
+ *  exist
+ */
+static struct UserInfo *SearchCustomerById(struct Shard *s,
+                                           const char *id,
+                                           unsigned int idHash) {
+    struct Tables *t = IdTables(s, idHash);
+
+#if USE_FILTER
+    STATS_COUNT(&s->counters, filterChecks);
+    if (!FilterCheck(&t->idFilter, idHash, s->lockFree)) {
+        STATS_COUNT(&s->counters, filterMisses);
+        return NULL;
+    }
+#endif
+
+    unsigned int ref = LOAD(t->idTable[idHash & (t->capacity - 1)]);
+    while (ref != RECORD_NONE) {
+        struct UserInfo *p = UserAt(s, ref);
+
+        STATS_PROBES(&s->counters, 1);
+        if (p->idHash == idHash && strcmp(IdOf(p), id) == 0 &&
+            Visible(s, p))
+            return p;
+        ref = LOAD(p->idNext);
+    }
+
+#if USE_FILTER
+    STATS_COUNT(&s->counters, filterFalsePositives);
+#endif
+    return NULL;
+}
+
+/**
+ * SearchCustomerByName: search a customer by name
+ *
+ * param s: pointer to the shard of the name
+ * param name: pointer to null terminated string containing name
+ * param nameHash: raw hash value of name
+ *
+ * returns: pointer to customer. NULL if customer with the name does not
+ * exist
+ */
+static struct UserInfo *SearchCustomerByName(struct Shard *s,
+                                             const char *name,
+                                             unsigned int nameHash) {
+    struct Tables *t = NameTables(s, nameHash);
+
+#if USE_FILTER
+    STATS_COUNT(&s->counters, filterChecks);
+    if (!FilterCheck(&t->nameFilter, nameHash, s->lockFree)) {
+        STATS_COUNT(&s->counters, filterMisses);
+        return NULL;
+    }
+#endif
+
+    unsigned int ref =
+        LOAD(t->nameTable[nameHash & (t->capacity - 1)]);
+    while (ref != RECORD_NONE) {
+        struct UserInfo *p = UserAt(s, ref);
+
+        STATS_PROBES(&s->counters, 1);
+        if (p->nameHash == nameHash &&
+            strcmp(NameOf(p), name) == 0 && Visible(s, p))
+            return p;
+        ref = LOAD(p->nameNext);
+    }
+
+#if USE_FILTER
+    STATS_COUNT(&s->counters, filterFalsePositives);
+#endif
+    return NULL;
+}
+
+/**
+ * LockCustomerById: search a customer by id and lock both of its
+ * shards exclusively
+ *
+ *  the shard of the name is only known once the customer is found. if
+ *  it comes before the shard of the id, the id shard is released and
+ *  both are locked again in order, and the search is repeated
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string containing id
+ * param op: kind of operation the call is counted as
+ * param idShard: set to the shard of the id
+ * param nameShard: set to the shard of the customer's name
+ *
+ * returns: pointer to customer, with both shards locked. NULL if
+ *  customer with the id does not exist, with no shard locked
+ */
+static struct UserInfo *LockCustomerById(DB_T db, const char *id,
+                                         enum DBStatsOp op,
+                                         struct Shard **idShard,
+                                         struct Shard **nameShard) {
+    unsigned int idHash = HashOfKey(db, id);
+    struct Shard *is = ShardOf(db, idHash);
+
+    STATS_OP(&is->counters, op);
+    for (;;) {
+        WriteLockPair(db, is, is);
+
+        struct UserInfo *p = SearchCustomerById(is, id, idHash);
+        if (p == NULL) {
+            UnlockPair(db, is, is);
+            return NULL;
+        }
+
+        struct Shard *ns = ShardOf(db, p->nameHash);
+        if (ns == is || !db->concurrent) {
+            *idShard = is;
+            *nameShard = ns;
+            return p;
+        }
+
+        if (ns > is) {
+            pthread_rwlock_wrlock(&ns->lock);
+            *idShard = is;
+            *nameShard = ns;
+            return p;
+        }
+
+        UnlockPair(db, is, is);
+        WriteLockPair(db, is, ns);
+
+        // the customer may have changed while no lock was held
+        p = SearchCustomerById(is, id, idHash);
+        if (p != NULL && ShardOf(db, p->nameHash) == ns) {
+            *idShard = is;
+            *nameShard = ns;
+            return p;
+        }
+
+        UnlockPair(db, is, ns);
+        if (p == NULL)
+            return NULL;
+    }
+}
+
+/**
+ * LockCustomerByName: search a customer by name and lock both of its
+ * shards exclusively
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string containing name
+ * param op: kind of operation the call is counted as
+ * param idShard: set to the shard of the customer's id
+ * param nameShard: set to the shard of the name
+ *
+ * returns: pointer to customer, with both shards locked. NULL if
+ *  customer with the name does not exist, with no shard locked
+ */
+static struct UserInfo *LockCustomerByName(DB_T db, const char *name,
+                                           enum DBStatsOp op,
+                                           struct Shard **idShard,
+                                           struct Shard **nameShard) {
+    unsigned int nameHash = HashOfKey(db, name);
+    struct Shard *ns = ShardOf(db, nameHash);
+
+    STATS_OP(&ns->counters, op);
+    for (;;) {
+        WriteLockPair(db, ns, ns);
+
+        struct UserInfo *p = SearchCustomerByName(ns, name, nameHash);
+        if (p == NULL) {
+            UnlockPair(db, ns, ns);
+            return NULL;
+        }
+
+        struct Shard *is = ShardOf(db, p->idHash);
+        if (is == ns || !db->concurrent) {
+            *idShard = is;
+            *nameShard = ns;
+            return p;
+        }
+
+        if (is > ns) {
+            pthread_rwlock_wrlock(&is->lock);
+            *idShard = is;
+            *nameShard = ns;
+            return p;
+        }
+
+        UnlockPair(db, ns, ns);
+        WriteLockPair(db, is, ns);
+
+        // the customer may have changed while no lock was held
+        p = SearchCustomerByName(ns, name, nameHash);
+        if (p != NULL && ShardOf(db, p->idHash) == is) {
+            *idShard = is;
+            *nameShard = ns;
+            return p;
+        }
+
+        UnlockPair(db, is, ns);
+        if (p == NULL)
+            return NULL;
+    }
+}
+
+/**
+ * UnlinkCustomerById: unlink a customer from the id hash table
+ *  'unlink' means simply removing the desired customer from the id hash
+ * table
+ *
+ * param s: pointer to the shard of the customer's id
+ * param user: pointer to customer
+ *
+ * returns: reference to customer
+ */
+static unsigned int UnlinkCustomerById(struct Shard *s,
+                                       struct UserInfo *user) {
+    unsigned int *link = IdBucket(s, user->idHash);
+
+    for (unsigned int ref = *link; ref != RECORD_NONE;) {
+        struct UserInfo *p = UserAt(s, ref);
+
+        if (p != user) {
+            link = &p->idNext;
+            ref = *link;
+            continue;
+        }
+
+        // a lock-free reader standing on p can still follow its link
+        STORE(*link, p->idNext);
+        s->idCount--;
+        return ref;
+    }
+
+    assert(0);
+    return RECORD_NONE;
+}
+
+/**
+ * UnlinkCustomerByName: unlink a customer from the name hash table
+ *  'unlink' means simply removing the desired customer from the name
+ * hash table
+ *
+ * param s: pointer to the shard of the customer's name
+ * param user: pointer to customer
+ */
+static void UnlinkCustomerByName(struct Shard *s,
+                                 struct UserInfo *user) {
+    unsigned int *link = NameBucket(s, user->nameHash);
+
+    for (unsigned int ref = *link; ref != RECORD_NONE;) {
+        struct UserInfo *p = UserAt(s, ref);
+
+        if (p != user) {
+            link = &p->nameNext;
+            ref = *link;
+            continue;
+        }
+
+        STORE(*link, p->nameNext);
+        s->nameCount--;
+        return;
+    }
+
+    assert(0);
+}
+
+/**
+ * RemoveCustomer: unlink a customer from both tables and free it
+ *
+ *  while snapshots are open, which may be walking its chains, the
+ *  customer is only marked as removed at the current version. it is
+ *  unlinked and freed once the last snapshot is released
+ *
+ * param db: pointer to database
+ * param idShard: pointer to the shard of the customer's id, locked
+ * param nameShard: pointer to the shard of the customer's name, locked
+ * param user: pointer to customer
+ */
+static void RemoveCustomer(DB_T db, struct Shard *idShard,
+                           struct Shard *nameShard,
+                           struct UserInfo *user) {
+    // the amount is read before the shard is checked, see
+    // AddToPurchase()
+    int purchase = __atomic_load_n(&user->purchase, __ATOMIC_SEQ_CST);
+    if (!IndexesStale(idShard)) {
+        if (idShard->purchasesBuilt)
+            PurchaseIndexRemove(&idShard->purchases, IdOf(user),
+                                purchase);
+        if (idShard->namesBuilt)
+            NameIndexRemove(&idShard->names, NameOf(user));
+    }
+    if (db->maxBytes != 0)
+        db->cacheBytes -= CacheCharge(UserSize(user));
+
+    if (db->snapshots > 0) {
+        __atomic_store_n(&user->died, db->version, __ATOMIC_RELAXED);
+        idShard->removed++;
+        idShard->idCount--;
+        nameShard->nameCount--;
+        return;
+    }
+
+    unsigned int ref = UnlinkCustomerById(idShard, user);
+    UnlinkCustomerByName(nameShard, user);
+
+    if (db->lockFree)
+        Retire(db, idShard, NULL, ref, UserSize(user));
+    else
+        RecordFree(&idShard->arena, ref, UserSize(user));
+
+    MigrateBuckets(db, idShard, nameShard, MIGRATE_WORK_PER_OP);
+    rehash(idShard);
+    if (nameShard != idShard) {
+        MigrateBuckets(db, nameShard, idShard, MIGRATE_WORK_PER_OP);
+        rehash(nameShard);
+    }
+}
+
+/**
+ * AddToPurchase: add an amount to the purchase field of a customer in
+ * place
+ *
+ *  the field is changed by compare and swap, since
+ *  AddPurchaseByIDAtomic() adds to it without any lock. the fields and
+ *  the stale marks of the shards are read and written in one total
+ *  order: an atomic add marks the shard before it changes the field,
+ *  and an update under the lock reads the field before the mark. an
+ *  update that finds the shard unmarked thus read the amount its
+ *  indexes hold
+ *
+ * param p: pointer to customer
+ * param amount: amount to add. may be negative
+ * param old: pointer to an int receiving the amount added to
+ *
+ * returns: new purchase amount. -1 if it would not be a positive int,
+ *  in which case the field is left as it was
+ */
+static int AddToPurchase(struct UserInfo *p, int amount, int *old) {
+    int cur = __atomic_load_n(&p->purchase, __ATOMIC_RELAXED);
+    long long purchase;
+
+    do {
+        purchase = (long long)cur + amount;
+        if (purchase <= 0 || purchase > INT_MAX)
+            return -1;
+    } while (!__atomic_compare_exchange_n(&p->purchase, &cur,
+                                          (int)purchase, 1,
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+
+    *old = cur;
+    return (int)purchase;
+}
+
+/**
+ * ReindexPurchase: move a customer whose purchase field changed to its
+ * place in the ordered indexes
+ *
+ *  the indexes of a stale shard are left alone, since they are rebuilt
+ *  as a whole before they are read
+ *
+ * param idShard: pointer to the shard of the customer's id, locked
+ * param p: pointer to customer
+ * param old: purchase amount before the change
+ * param purchase: new purchase amount
+ */
+static void ReindexPurchase(struct Shard *idShard,
+                            const struct UserInfo *p, int old,
+                            int purchase) {
+    if (IndexesStale(idShard))
+        return;
+
+    if (idShard->purchasesBuilt)
+        PurchaseIndexUpdate(&idShard->purchases, IdOf(p), old, purchase);
+    if (idShard->namesBuilt)
+        NameIndexUpdate(&idShard->names, NameOf(p), purchase);
+}
+
+/**
+ * UpdatePurchase: change the purchase field of a customer in place
+ *
+ *  the ordered indexes holding the customer belong to the shard of its
+ *  id, so that shard's lock is all an update needs. the field itself
+ *  is exchanged atomically, since lookups through the name shard and
+ *  lock-free lookups read it without that lock, and atomic adds write
+ *  it
+ *
+ * param idShard: pointer to the shard of the customer's id, locked
+ * param p: pointer to customer
+ * param purchase: new purchase amount
+ */
+static void UpdatePurchase(struct Shard *idShard, struct UserInfo *p,
+                           int purchase) {
+    int old = __atomic_exchange_n(&p->purchase, purchase,
+                                  __ATOMIC_SEQ_CST);
+
+    ReindexPurchase(idShard, p, old, purchase);
+}
+
+/**
+ * ReplaceCustomer: change the purchase field of a customer that open
+ * snapshots may see
+ *
+ *  the customer is left as it is for the snapshots and marked as
+ *  removed at the current version. a copy with the new amount is
+ *  linked at the head of both of its buckets, and takes its place in
+ *  the ordered indexes
+ *
+ * param db: pointer to database
+ * param idShard: pointer to the shard of the customer's id, locked
+ * param nameShard: pointer to the shard of the customer's name, locked
+ * param p: pointer to customer
+ * param purchase: new purchase amount
+ *
+ * returns: 0 on success. -1 if out of memory, in which case the
+ *  customer is left as it was
+ */
+static int ReplaceCustomer(DB_T db, struct Shard *idShard,
+                           struct Shard *nameShard, struct UserInfo *p,
+                           int purchase) {
+    struct Tables *idTables =
+        UnsharedTables(idShard, IdTables(idShard, p->idHash));
+    if (idTables == NULL)
+        goto fail;
+    struct Tables *nameTables =
+        UnsharedTables(nameShard, NameTables(nameShard, p->nameHash));
+    if (nameTables == NULL)
+        goto fail;
+
+    size_t size = UserSize(p);
+    unsigned int ref = RecordAlloc(&idShard->arena, size);
+    if (ref == RECORD_NONE)
+        goto fail;
+
+    struct UserInfo *q = UserAt(idShard, ref);
+    memcpy(q, p, size);
+    q->purchase = purchase;
+
+    // the indexes refer to the keys of the copy from now on. atomic
+    // adds wait for the snapshots, but may have left the shard stale
+    if (!IndexesStale(idShard)) {
+        if (idShard->purchasesBuilt) {
+            PurchaseIndexUpdate(&idShard->purchases, IdOf(p),
+                                p->purchase, purchase);
+            PurchaseIndexRelocate(&idShard->purchases, IdOf(q),
+                                  NameOf(q), purchase);
+        }
+        if (idShard->namesBuilt) {
+            NameIndexUpdate(&idShard->names, NameOf(p), purchase);
+            NameIndexRelocate(&idShard->names, IdOf(q), NameOf(q));
+        }
+    }
+
+    __atomic_store_n(&p->died, db->version, __ATOMIC_RELAXED);
+    idShard->removed++;
+    LinkById(idTables, ref, q);
+    LinkByName(nameTables, ref, q);
+
+    return 0;
+
+fail:
+    fprintf(stderr, "Can't allocate memory for new user\n");
+    return -1;
+}
+
+/**
+ * EvictCustomers: evict customers of a cache until a new one fits
+ *
+ *  the hand moves one id bucket of the current tables at a time,
+ *  clearing the reference bits of the customers it passes, and evicts
+ *  the first customer of a bucket whose bit is already clear. the rest
+ *  of the bucket waits for the next sweep, since evicting may move
+ *  buckets. a sweep clears every bit, so the next one finds a customer
+ *  to evict
+ *
+ *  while a resize goes on, the customers of a bucket that are still in
+ *  unmigrated old buckets are visited along with it, so that migrating
+ *  doesn't move customers the hand passed ahead of it
+ *
+ * param db: pointer to cache, with its only shard locked
+ * param charge: bytes the new customer takes
+ *
+ * returns: 0 once the customer fits. -1 if it can't fit even in an
+ *  empty cache
+ */
+static int EvictCustomers(DB_T db, size_t charge) {
+    struct Shard *s = &db->shards[0];
+
+    if (charge > db->maxBytes)
+        return -1;
+
+    while (db->cacheBytes + charge > db->maxBytes) {
+        struct Tables *old = s->oldTables;
+        unsigned int capacity = s->tables->capacity;
+
+        if (db->hand >= capacity)
+            db->hand = 0;
+        unsigned int j = db->hand++;
+
+        if (EvictFromChain(db, s, s->tables->idTable[j], j))
+            continue;
+
+        // a bucket takes customers from one old bucket when growing,
+        // and from several when shrinking
+        for (unsigned int b = old != NULL ? j & (old->capacity - 1) : 0;
+             old != NULL && b < old->capacity; b += capacity)
+            if (b >= s->migrated &&
+                EvictFromChain(db, s, old->idTable[b], j))
+                break;
+    }
+
+    return 0;
+}
+
+/**
+ * EvictFromChain: clear the reference bits of the customers of an id
+ * chain that belong to a bucket of the current tables, up to the first
+ * whose bit is clear already, and evict that one
+ *
+ * param db: pointer to cache, with its only shard locked
+ * param s: pointer to the shard
+ * param ref: first customer of the chain
+ * param bucket: id bucket of the current tables
+ *
+ * returns: 1 if a customer was evicted. 0 otherwise
+ */
+static int EvictFromChain(DB_T db, struct Shard *s, unsigned int ref,
+                          unsigned int bucket) {
+    unsigned int mask = s->tables->capacity - 1;
+
+    // a cache has no snapshots, so every customer is current
+    for (; ref != RECORD_NONE; ref = UserAt(s, ref)->idNext) {
+        struct UserInfo *p = UserAt(s, ref);
+
+        if ((p->idHash & mask) != bucket)
+            continue;
+        if (p->died & USER_REFERENCED) {
+            __atomic_fetch_and(&p->died, ~USER_REFERENCED,
+                               __ATOMIC_RELAXED);
+            continue;
+        }
+
+        RemoveCustomer(db, s, ShardOf(db, p->nameHash), p);
+        db->evictions++;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * SweepRemoved: unlink and free the customers marked as removed
+ *
+ *  each customer is unlinked from its name chain first, and freed once
+ *  it is unlinked from its id chain as well. orphans, which are in no
+ *  current id chain, are freed last
+ *
+ * param db: pointer to database, with every shard locked and no
+ *  snapshot open
+ */
+static void SweepRemoved(DB_T db) {
+    unsigned long long removed = 0;
+
+    for (unsigned int i = 0; i < db->nshards; i++)
+        removed += db->shards[i].removed + db->shards[i].norphans;
+
+    db->version = 1;
+    if (removed == 0)
+        return;
+
+    for (unsigned int i = 0; i < db->nshards; i++)
+        RelocateIndexes(&db->shards[i]);
+
+    for (int byName = 1; byName >= 0; byName--) {
+        for (unsigned int i = 0; i < db->nshards; i++) {
+            struct Shard *s = &db->shards[i];
+
+            SweepBuckets(db, s, s->tables, 0, byName);
+            if (s->oldTables != NULL)
+                SweepBuckets(db, s, s->oldTables, s->migrated, byName);
+            if (!byName)
+                s->removed = 0;
+        }
+    }
+
+    for (unsigned int i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+
+        for (unsigned int j = 0; j < s->norphans; j++) {
+            unsigned int ref = s->orphans[j];
+            size_t size = UserSize(UserAt(s, ref));
+
+            if (db->lockFree)
+                Retire(db, s, NULL, ref, size);
+            else
+                RecordFree(&s->arena, ref, size);
+        }
+        s->norphans = 0;
+    }
+}
+
+/**
+ * RelocateIndexes: point the ordered indexes of a shard at the keys of
+ * its current customers
+ *
+ *  once for every customer, rather than once for every copy a resize
+ *  made, and before the originals are freed
+ *
+ * param s: pointer to shard, locked
+ */
+static void RelocateIndexes(struct Shard *s) {
+    struct Tables *old = s->oldTables;
+
+    if (!s->copied)
+        return;
+    s->copied = 0;
+
+    // stale indexes are rebuilt from the customers before they are read
+    if (IndexesStale(s))
+        return;
+
+    for (int k = 0; k < 2; k++) {
+        struct Tables *t = k == 0 ? s->tables : old;
+        unsigned int b = k == 0 ? 0 : s->migrated;
+
+        for (; t != NULL && b < t->capacity; b++) {
+            for (unsigned int ref = t->idTable[b]; ref != RECORD_NONE;
+                 ref = UserAt(s, ref)->idNext) {
+                struct UserInfo *p = UserAt(s, ref);
+
+                if ((p->died & ~USER_REFERENCED) != 0)
+                    continue;
+                if (s->purchasesBuilt)
+                    PurchaseIndexRelocate(&s->purchases, IdOf(p),
+                                          NameOf(p), p->purchase);
+                if (s->namesBuilt)
+                    NameIndexRelocate(&s->names, IdOf(p), NameOf(p));
+            }
+        }
+    }
+}
+
+/**
+ * SweepBuckets: unlink the customers marked as removed from buckets of
+ * a table
+ *
+ * param db: pointer to database
+ * param s: pointer to the shard of the table
+ * param t: pointer to the tables of the buckets
+ * param first: first bucket to sweep. the rest of the table follows
+ * param byName: nonzero to sweep the name table. customers unlinked
+ *  from the id table are freed
+ */
+static void SweepBuckets(DB_T db, struct Shard *s, struct Tables *t,
+                         unsigned int first, int byName) {
+    for (unsigned int b = first; b < t->capacity; b++) {
+        unsigned int *link =
+            byName ? &t->nameTable[b] : &t->idTable[b];
+        unsigned int ref;
+
+        while ((ref = *link) != RECORD_NONE) {
+            struct UserInfo *p = UserAt(s, ref);
+            unsigned int *next = byName ? &p->nameNext : &p->idNext;
+
+            if ((p->died & ~USER_REFERENCED) == 0) {
+                link = next;
+                continue;
+            }
+
+            STORE(*link, *next);
+            if (byName)
+                continue;
+            if (db->lockFree)
+                Retire(db, s, NULL, ref, UserSize(p));
+            else
+                RecordFree(&s->arena, ref, UserSize(p));
+        }
+    }
+}
+
+/**
+ * rehash: start resizing hash tables of a shard, but only if necessary
+ *
+ *  the current tables become the old tables and new tables twice or
+ *  half as large, or as large if the filters are stale, are allocated.
+ *  customers are not moved here. instead, each following update moves
+ *  a few old buckets with MigrateBuckets(), so that no single call pays
+ *  for moving every customer
+ *
+ * param s: pointer to shard
+ */
+static void rehash(struct Shard *s) {
+    unsigned int capacity = s->tables->capacity;
+
+    // the previous resize must be complete before starting a new one
+    if (s->oldTables != NULL)
+        return;
+
+    // tables whose filters are stale are rebuilt at the same capacity,
+    // which adds only the keys still in the shard to the new filters
+    if (s->idCount >= s->threshold || s->nameCount >= s->threshold)
+        capacity <<= 1;
+    else if (s->idCount < s->shrinkThreshold &&
+             s->nameCount < s->shrinkThreshold)
+        capacity >>= 1;
+    else if (!FiltersStale(s))
+        return;
+
+    unsigned long long start = StatsNow();
+    struct Tables *newTables = AllocTables(capacity);
+    if (newTables == NULL)
+        return; // keep the current tables and retry on next update
+
+    // every bucket is still found in the old tables until the new ones
+    // are published
+    STORE(s->migrated, 0);
+    STORE(s->oldTables, s->tables);
+    STORE(s->tables, newTables);
+    SetThresholds(s, capacity);
+
+    s->rehashes++;
+    s->rehashNsec += StatsNow() - start;
+}
+
+/**
+ * SetThresholds: set the counts at which a shard's tables of a given
+ * capacity are resized
+ *
+ * param s: pointer to shard
+ * param capacity: bucket size of the current tables
+ */
+static void SetThresholds(struct Shard *s, unsigned int capacity) {
+    s->threshold = (int)(THRESHOLD_RATIO * capacity);
+    s->shrinkThreshold =
+        capacity > s->minCapacity ? (int)(SHRINK_RATIO * capacity) : 0;
+}
+
+/**
+ * BucketsFor: get the bucket size needed for a number of customers
+ *
+ * param capacity: current bucket size, a power of 2
+ * param count: number of customers
+ *
+ * returns: capacity doubled until count is below its threshold. 0 if
+ *  that does not fit in an unsigned int
+ */
+static unsigned int BucketsFor(unsigned int capacity,
+                               unsigned long long count) {
+    while (count >= (unsigned long long)(THRESHOLD_RATIO * capacity)) {
+        if (capacity > UINT_MAX / 2) {
+            fprintf(stderr, "Can't hold %llu customers\n", count);
+            return 0;
+        }
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+/**
+ * ReserveShards: resize the tables of every shard for a given number
+ * of new customers
+ *
+ *  unlike rehash(), the new tables are filled right away, so that the
+ *  customers that follow find no resize in progress. shrinking is held
+ *  off until the thresholds are set again, since the shards are nearly
+ *  empty for their new size until the customers arrive. a shard whose
+ *  new tables can't be allocated keeps its tables and grows as usual
+ *
+ * param db: pointer to database
+ * param n: number of new customers, spread evenly over the shards
+ */
+static void ReserveShards(DB_T db, unsigned long long n) {
+    unsigned long long share = (n + db->nshards - 1) / db->nshards;
+
+    LockAll(db);
+    for (unsigned int i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+        unsigned int count =
+            s->idCount > s->nameCount ? s->idCount : s->nameCount;
+
+        s->shrinkThreshold = 0;
+        if (s->oldTables != NULL)
+            MigrateBuckets(db, s, NULL, UINT_MAX);
+
+        unsigned int capacity = s->tables->capacity;
+        unsigned int newCapacity = BucketsFor(capacity, count + share);
+        if (newCapacity <= capacity)
+            continue;
+
+        unsigned long long start = StatsNow();
+        struct Tables *newTables = AllocTables(newCapacity);
+        if (newTables == NULL)
+            continue;
+
+        STORE(s->migrated, 0);
+        STORE(s->oldTables, s->tables);
+        STORE(s->tables, newTables);
+        s->threshold = (int)(THRESHOLD_RATIO * newCapacity);
+        s->rehashes++;
+        s->rehashNsec += StatsNow() - start;
+
+        MigrateBuckets(db, s, NULL, UINT_MAX);
+    }
+    UnlockAll(db);
+}
+
+/**
+ * MigrateBuckets: move customers of old buckets into the new tables
+ *
+ *  when growing, old bucket i of each table is split into new buckets i
+ *  and i + old capacity. when shrinking, old buckets i and
+ *  i + new capacity are merged into new bucket i. while snapshots are
+ *  open, the customers are copied with CopyBucket() instead. once every
+ *  old bucket is migrated, the old tables are freed, unless snapshots
+ *  still share them
+ *
+ * param db: pointer to database
+ * param s: pointer to shard
+ * param other: pointer to the other shard the caller holds, which may
+ *  be s. NULL if it holds every shard
+ * param work: units of work after which no more buckets are migrated,
+ *  see MIGRATE_WORK_PER_OP. UINT_MAX to finish the resize
+ */
+static void MigrateBuckets(DB_T db, struct Shard *s,
+                           struct Shard *other, unsigned int work) {
+    unsigned int ref, next, done = 0;
+    struct Tables *old = s->oldTables;
+
+    if (old == NULL || work == 0)
+        return;
+
+    unsigned long long start = StatsNow();
+
+    // lock-free readers may miss customers while they move
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    while (done < work && s->migrated < s->oldTables->capacity) {
+        unsigned int i = s->migrated;
+
+        done++;
+
+        // copying may have to wait for a shard or for memory. the
+        // bucket is tried again by a later update
+        if (db->snapshots > 0) {
+            int copied = CopyBucket(db, s, other, i);
+            if (copied < 0)
+                break;
+            done += (unsigned int)copied;
+            STORE(s->migrated, i + 1);
+            continue;
+        }
+
+        old = s->oldTables;
+        for (ref = old->idTable[i]; ref != RECORD_NONE; ref = next) {
+            struct UserInfo *p = UserAt(s, ref);
+            next = p->idNext;
+            LinkById(s->tables, ref, p);
+            done++;
+        }
+
+        for (ref = old->nameTable[i]; ref != RECORD_NONE; ref = next) {
+            struct UserInfo *p = UserAt(s, ref);
+            next = p->nameNext;
+            LinkByName(s->tables, ref, p);
+            done++;
+        }
+
+        STORE(s->migrated, i + 1);
+    }
+
+    // we are done migrating. release the old tables. those snapshots
+    // share are freed by the release of the last one
+    old = s->oldTables;
+    if (s->migrated == old->capacity) {
+        STORE(s->oldTables, NULL);
+        if (old->snapshots == 0) {
+            if (db->lockFree)
+                Retire(db, s, old, RECORD_NONE, 0);
+            else
+                free(old);
+        }
+    }
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    s->rehashNsec += StatsNow() - start;
+}
+
+/**
+ * CopyBucket: migrate an old bucket of a shard while snapshots are open
+ *
+ *  snapshots may be walking the old chains, so no customer in them is
+ *  relinked. instead, each current customer of old id bucket i and of
+ *  old name bucket i is replaced by a copy, as ReplaceCustomer() does,
+ *  whose links go where lookups will look once the bucket is migrated.
+ *  the old customers are marked as removed. those of the id bucket are
+ *  in no current id chain any more, so they are kept as orphans of the
+ *  shard until the last snapshot is released. the ordered indexes are
+ *  left pointing at the keys of the originals until then, see
+ *  RelocateIndexes()
+ *
+ *  the other shards the copies are linked into are locked if the
+ *  caller does not hold them, without waiting, since it already holds
+ *  two. memory is allocated before anything changes, so that a bucket
+ *  that can't be migrated yet is left as it was
+ *
+ * param db: pointer to database, with snapshots open
+ * param s: pointer to shard, locked
+ * param other: pointer to the other shard the caller holds, which may
+ *  be s. NULL if it holds every shard
+ * param i: old bucket to migrate, the first one not migrated yet
+ *
+ * returns: number of customers copied once the bucket is migrated. -1
+ *  if a shard is busy or memory is short
+ */
+static int CopyBucket(DB_T db, struct Shard *s, struct Shard *other,
+                      unsigned int i) {
+    unsigned int mask = s->oldTables->capacity - 1;
+    unsigned int idRefs = 0, nrefs = 0, dead = 0, ntouched = 0;
+    unsigned int *refs, *copies, ref, j;
+    struct Shard **shards, **touched;
+    int res = -1;
+
+    // customers of the id bucket come first in refs. a customer of the
+    // name bucket whose id is in the id bucket is copied only once
+    for (ref = s->oldTables->idTable[i]; ref != RECORD_NONE;
+         ref = UserAt(s, ref)->idNext) {
+        if ((UserAt(s, ref)->died & ~USER_REFERENCED) == 0)
+            idRefs++;
+        else
+            dead++;
+    }
+    nrefs = idRefs;
+    for (ref = s->oldTables->nameTable[i]; ref != RECORD_NONE;
+         ref = UserAt(s, ref)->nameNext) {
+        struct UserInfo *p = UserAt(s, ref);
+        if ((p->died & ~USER_REFERENCED) == 0 &&
+            (ShardOf(db, p->idHash) != s ||
+             (p->idHash & mask) != i))
+            nrefs++;
+    }
+
+    // the customers of the id bucket become orphans
+    if (s->norphans + idRefs + dead > s->orphanCapacity) {
+        unsigned int n = s->orphanCapacity ? s->orphanCapacity
+                                           : RECLAIM_BATCH;
+        while (n < s->norphans + idRefs + dead)
+            n <<= 1;
+        unsigned int *o = realloc(s->orphans, n * sizeof(*o));
+        if (o == NULL)
+            return -1;
+        s->orphans = o;
+        s->orphanCapacity = n;
+    }
+
+    if (nrefs == 0)
+        goto orphan;
+
+    // each customer and its copy, the shard of its other key, and the
+    // other shards that are written
+    refs = malloc(2 * (size_t)nrefs * sizeof(*refs));
+    shards = malloc(2 * (size_t)nrefs * sizeof(*shards));
+    if (refs == NULL || shards == NULL)
+        goto out;
+    copies = refs + nrefs;
+    touched = shards + nrefs;
+
+    j = 0;
+    for (ref = s->oldTables->idTable[i]; ref != RECORD_NONE;
+         ref = UserAt(s, ref)->idNext) {
+        struct UserInfo *p = UserAt(s, ref);
+        if ((p->died & ~USER_REFERENCED) == 0) {
+            shards[j] = ShardOf(db, p->nameHash);
+            refs[j++] = ref;
+        }
+    }
+    for (ref = s->oldTables->nameTable[i]; ref != RECORD_NONE;
+         ref = UserAt(s, ref)->nameNext) {
+        struct UserInfo *p = UserAt(s, ref);
+        if ((p->died & ~USER_REFERENCED) == 0 &&
+            (ShardOf(db, p->idHash) != s ||
+             (p->idHash & mask) != i)) {
+            shards[j] = ShardOf(db, p->idHash);
+            refs[j++] = ref;
+        }
+    }
+
+    for (j = 0; j < nrefs; j++) {
+        struct Shard *t = shards[j];
+        unsigned int k;
+
+        for (k = 0; k < ntouched && touched[k] != t; k++)
+            ;
+        if (t == s || k < ntouched)
+            continue;
+        if (!Holds(db, other, t) &&
+            pthread_rwlock_trywrlock(&t->lock) != 0)
+            goto out;
+        touched[ntouched++] = t;
+    }
+
+    // tables shared with snapshots are copied before anything is
+    // linked into them, and each customer is copied into the arena of
+    // its id shard
+    for (j = 0; j < nrefs; j++) {
+        struct UserInfo *p = UserAt(s, refs[j]);
+        struct Shard *idShard = j < idRefs ? s : shards[j];
+        struct Shard *nameShard = j < idRefs ? shards[j] : s;
+
+        if (UnsharedTables(idShard, CopyTables(s, i, idShard,
+                                               p->idHash)) == NULL ||
+            UnsharedTables(nameShard, CopyTables(s, i, nameShard,
+                                                 p->nameHash)) == NULL)
+            goto out;
+    }
+    for (j = 0; j < nrefs; j++) {
+        struct Shard *idShard = j < idRefs ? s : shards[j];
+
+        copies[j] = RecordAlloc(&idShard->arena,
+                                UserSize(UserAt(s, refs[j])));
+        if (copies[j] == RECORD_NONE) {
+            while (j-- > 0) {
+                idShard = j < idRefs ? s : shards[j];
+                RecordFree(&idShard->arena, copies[j],
+                           UserSize(UserAt(s, refs[j])));
+            }
+            goto out;
+        }
+    }
+
+    // lock-free lookups in the other shards may miss the customers as
+    // well, until each copy is linked and its original is removed
+    for (j = 0; j < ntouched; j++)
+        __atomic_store_n(&touched[j]->seq, touched[j]->seq + 1,
+                         __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (j = 0; j < nrefs; j++) {
+        struct UserInfo *p = UserAt(s, refs[j]);
+        struct UserInfo *q = UserAt(s, copies[j]);
+        struct Shard *idShard = j < idRefs ? s : shards[j];
+        struct Shard *nameShard = j < idRefs ? shards[j] : s;
+
+        memcpy(q, p, UserSize(p));
+        idShard->copied = 1;
+
+        // the tables were unshared above, so they are returned as is
+        LinkById(CopyTables(s, i, idShard, q->idHash), copies[j], q);
+        LinkByName(CopyTables(s, i, nameShard, q->nameHash), copies[j],
+                   q);
+        __atomic_store_n(&p->died, db->version, __ATOMIC_RELEASE);
+
+        // the original of a name bucket stays in its id chain
+        if (j >= idRefs)
+            idShard->removed++;
+    }
+
+    for (j = 0; j < ntouched; j++)
+        __atomic_store_n(&touched[j]->seq, touched[j]->seq + 1,
+                         __ATOMIC_RELEASE);
+    res = 0;
+
+out:
+    for (j = 0; j < ntouched; j++)
+        if (!Holds(db, other, touched[j]))
+            pthread_rwlock_unlock(&touched[j]->lock);
+    free(refs);
+    free(shards);
+    if (res < 0)
+        return -1;
+
+orphan:
+    // the id bucket is left to the snapshots, along with the customers
+    // removed from it before
+    for (ref = s->oldTables->idTable[i]; ref != RECORD_NONE;
+         ref = UserAt(s, ref)->idNext)
+        s->orphans[s->norphans++] = ref;
+    s->removed -= dead;
+
+    return (int)nrefs;
+}
+
+/**
+ * Holds: check whether the caller of MigrateBuckets() holds a shard
+ *
+ * param db: pointer to database
+ * param other: the other shard the caller holds, as passed to
+ *  MigrateBuckets()
+ * param t: pointer to a shard other than the one being migrated
+ *
+ * returns: nonzero if t needs no lock of its own
+ */
+static inline int Holds(DB_T db, struct Shard *other, struct Shard *t) {
+    return !db->concurrent || other == NULL || t == other;
 }
 
 /**
- * hashfunc_raw: computes the raw hash value of a string
- *  here, 'raw' means 'not computed by modulo'
+ * CopyTables: find the tables a copy made by CopyBucket() is linked
+ * into for one of its keys
+ *
+ *  in the shard being migrated, the copy goes where the key belongs
+ *  once old bucket i is migrated as well. in any other shard, it goes
+ *  where the key belongs now
  *
- * param key: pointer to null terminated string
+ * param s: pointer to the shard being migrated
+ * param i: old bucket being migrated
+ * param to: pointer to the shard of the key
+ * param hash: raw hash value of the key
  *
- * returns: raw hash value
+ * returns: pointer to the current or the old tables of to
  */
-static unsigned int hashfunc_raw(const char *key) {
-    unsigned int hash = 0U;
-    for (int i = 0; key[i] != '\0'; i++)
-        hash =
-            hash * (unsigned int)HASH_MULTIPLIER + (unsigned int)key[i];
-    return hash;
+static struct Tables *CopyTables(struct Shard *s, unsigned int i,
+                                 struct Shard *to, unsigned int hash) {
+    struct Tables *old = to->oldTables;
+
+    // ids and names pick their tables alike
+    if (to != s)
+        return IdTables(to, hash);
+    if (old != NULL && (hash & (old->capacity - 1)) > i)
+        return old;
+
+    return to->tables;
 }
 
 /**
- * hashfunc: computes the hash value remainder of a string
+ * ShardBuckets: get the number of id buckets that may hold customers
  *
- * param key: pointer to null terminated string
- * param bucketsize: size of bucket. a hash remainder will be computed
- *  with this value
+ *  these are the unmigrated old buckets, if a resize is in progress,
+ *  followed by the current buckets
  *
- * returns: hash value
+ * param s: pointer to shard
+ *
+ * returns: number of buckets
  */
-static inline int hashfunc(const char *key, unsigned int bucketSize) {
-    return (int)(hashfunc_raw(key) & (bucketSize - 1));
+static unsigned int ShardBuckets(struct Shard *s) {
+    unsigned int n = s->tables->capacity;
+
+    if (s->oldTables != NULL)
+        n += s->oldTables->capacity - s->migrated;
+
+    return n;
 }
 
 /**
- * SearchCustomerById: search a customer by id
+ * SumBuckets: apply a given function to the customers of a range of
+ * id buckets and get the sum of results
+ *
+ * param s: pointer to shard
+ * param begin: first bucket, numbered as in ShardBuckets()
+ * param end: bucket after the last one
+ * param prefix: only customers whose name starts with it are visited.
+ *  NULL to visit all
+ * param fp: pointer to a function of type FUNCPTR_T
+ * param count: pointer to a counter the number of customers visited
+ *  is added to. may be NULL
+ *
+ * returns: sum of function applications to the customers
+ */
+static long long SumBuckets(struct Shard *s, unsigned int begin,
+                            unsigned int end, const char *prefix,
+                            FUNCPTR_T fp, int *count) {
+    struct Tables *old = s->oldTables;
+    long long sum = 0;
+
+    // while resizing, customers in unmigrated old buckets are not
+    // in the current table yet
+    if (old != NULL) {
+        unsigned int n = old->capacity - s->migrated;
+
+        for (; begin < end && begin < n; begin++)
+            sum += SumChain(s, old->idTable[s->migrated + begin],
+                            prefix, fp, count);
+
+        begin -= n;
+        end -= n;
+    }
+
+    for (; begin < end; begin++)
+        sum += SumChain(s, s->tables->idTable[begin], prefix, fp,
+                        count);
+
+    return sum;
+}
+
+/**
+ * SumChain: apply a given function to the customers of an id bucket
+ * and get the sum of results
+ *
+ *  customers marked as removed are skipped unless the shard still sees
+ *  them
+ *
+ * param s: pointer to shard
+ * param ref: first customer of the bucket
+ * param prefix: only customers whose name starts with it are visited.
+ *  NULL to visit all
+ * param fp: pointer to a function of type FUNCPTR_T
+ * param count: pointer to a counter the number of customers visited
+ *  is added to. may be NULL
+ *
+ * returns: sum of function applications to the customers
+ */
+static long long SumChain(struct Shard *s, unsigned int ref,
+                          const char *prefix, FUNCPTR_T fp,
+                          int *count) {
+    long long sum = 0;
+
+    for (; ref != RECORD_NONE; ref = UserAt(s, ref)->idNext) {
+        struct UserInfo *p = UserAt(s, ref);
+        const char *name = NameOf(p);
+
+        if (!Visible(s, p) ||
+            (prefix != NULL &&
+             strncmp(name, prefix, strlen(prefix)) != 0))
+            continue;
+
+        sum += fp(IdOf(p), name,
+                  __atomic_load_n(&p->purchase, __ATOMIC_RELAXED));
+        if (count != NULL)
+            (*count)++;
+    }
+
+    return sum;
+}
+
+/**
+ * SumChunk: sum a chunk of a GetSumCustomerPurchaseParallel() call
+ *
+ * param arg: pointer to the call's struct SumJob
+ * param chunk: index of the chunk
+ *
+ * returns: sum of function applications to the customers of the chunk
+ */
+static long long SumChunk(void *arg, unsigned int chunk) {
+    struct SumJob *job = arg;
+    DB_T db = job->db;
+    long long sum = 0;
+
+    if (job->byShard) {
+        struct Shard *s = &db->shards[chunk];
+
+        if (db->concurrent)
+            pthread_rwlock_rdlock(&s->lock);
+        sum += SumBuckets(s, 0, ShardBuckets(s), NULL, job->fp, NULL);
+        if (db->concurrent)
+            pthread_rwlock_unlock(&s->lock);
+    } else {
+        struct Shard *s = &db->shards[0];
+        unsigned int begin = chunk * SUM_CHUNK_BUCKETS;
+        unsigned int end = begin + SUM_CHUNK_BUCKETS;
+
+        if (end > ShardBuckets(s))
+            end = ShardBuckets(s);
+        sum += SumBuckets(s, begin, end, NULL, job->fp, NULL);
+    }
+
+    return sum;
+}
+
+/**
+ * ReleaseReaderIndex: give back the reader index of an exiting thread
+ *
+ * param value: reader index + 1, as stored for readerKey
+ */
+static void ReleaseReaderIndex(void *value) {
+    pthread_mutex_lock(&readerLock);
+    readerUsed[(size_t)value - 1] = 0;
+    pthread_mutex_unlock(&readerLock);
+}
+
+/**
+ * CreateReaderKey: create the key whose destructor gives back reader
+ * indexes
+ */
+static void CreateReaderKey(void) {
+    pthread_key_create(&readerKey, ReleaseReaderIndex);
+}
+
+/**
+ * EnterEpoch: announce that the calling thread starts a lock-free
+ * lookup
+ *
+ *  the thread's slot is set to the current epoch. blocks unlinked from
+ *  now on are not freed before the slot is cleared again
  *
  * param db: pointer to database
- * param id: pointer to null terminated string containing id
  *
- * returns: pointer to customer. NULL if customer with the id does not
- *  exist
+ * returns: pointer to the thread's epoch slot. NULL if the db is not
+ *  lock-free or no slot is left, in which case the caller has to lock
  */
-static struct UserInfo *SearchCustomerById(DB_T db, const char *id) {
-    if (id == NULL)
+static struct EpochSlot *EnterEpoch(DB_T db) {
+    if (!db->lockFree)
         return NULL;
 
-    int hash = hashfunc(id, db->capacity);
-    for (struct UserInfo *p = db->idTable[hash]; p != NULL;
-         p = p->idNext)
-        if (strcmp(p->id, id) == 0)
-            return p;
+    if (readerIndex == -1) {
+        pthread_once(&readerOnce, CreateReaderKey);
+        pthread_mutex_lock(&readerLock);
 
-    return NULL;
+        readerIndex = -2; // no free slot
+        for (int i = 0; i < MAX_READERS; i++) {
+            if (readerUsed[i])
+                continue;
+
+            readerUsed[i] = 1;
+            readerIndex = i;
+            if (readerCount < (unsigned int)i + 1)
+                __atomic_store_n(&readerCount, i + 1, __ATOMIC_RELEASE);
+            pthread_setspecific(readerKey, (void *)(size_t)(i + 1));
+            break;
+        }
+
+        pthread_mutex_unlock(&readerLock);
+    }
+
+    if (readerIndex < 0)
+        return NULL;
+
+    struct EpochSlot *slot = &db->epochSlots[readerIndex];
+
+    // the slot must be visible before any link is read
+    __atomic_store_n(&slot->epoch, LOAD(db->epoch), __ATOMIC_SEQ_CST);
+
+    return slot;
 }
 
 /**
- * SearchCustomerByName: search a customer by name
+ * ExitEpoch: announce that the calling thread finished a lock-free
+ * lookup
+ *
+ * param slot: pointer to epoch slot, as returned by EnterEpoch
+ */
+static void ExitEpoch(struct EpochSlot *slot) { STORE(slot->epoch, 0); }
+
+/**
+ * TryAdvanceEpoch: move the global epoch forward if every reader has
+ * seen the current one
  *
  * param db: pointer to database
- * param name: pointer to null terminated string containing name
  *
- * returns: pointer to customer. NULL if customer with the name does not
- * exist
+ * returns: the global epoch
  */
-static struct UserInfo *SearchCustomerByName(DB_T db,
-                                             const char *name) {
-    if (name == NULL)
-        return NULL;
+static unsigned long TryAdvanceEpoch(DB_T db) {
+    unsigned long epoch = LOAD(db->epoch);
+    unsigned int n = LOAD(readerCount);
 
-    int hash = hashfunc(name, db->capacity);
-    for (struct UserInfo *p = db->nameTable[hash]; p != NULL;
-         p = p->nameNext)
-        if (strcmp(p->name, name) == 0)
-            return p;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned long e = LOAD(db->epochSlots[i].epoch);
+        if (e != 0 && e != epoch)
+            return epoch;
+    }
 
-    return NULL;
+    __atomic_compare_exchange_n(&db->epoch, &epoch, epoch + 1, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return LOAD(db->epoch);
 }
 
 /**
- * UnlinkCustomerById: unlink a customer by id, and return the customer
- *  'unlink' means simply removing the desired customer from the id hash
- * table
+ * Retire: free a block unlinked from a lock-free db later
+ *
+ *  a block unlinked at epoch e may still be seen by readers that
+ *  entered at epoch e or e - 1, but not once the global epoch reached
+ *  e + 2. retired blocks are checked in batches
  *
  * param db: pointer to database
- * param id: pointer to null terminated string containing id
+ * param s: pointer to the locked shard owning the block
+ * param tables: pointer to tables. NULL for a customer
+ * param ref: reference to customer. RECORD_NONE for tables
+ * param size: size of the customer record. 0 for tables
+ */
+static void Retire(DB_T db, struct Shard *s, void *tables,
+                   unsigned int ref, size_t size) {
+    if (s->nretired == s->retiredCapacity) {
+        unsigned int n = s->retiredCapacity ? s->retiredCapacity << 1
+                                            : RECLAIM_BATCH;
+        struct Retired *r = realloc(s->retired, n * sizeof(*r));
+        if (r == NULL) {
+            // without memory to remember it, the block is leaked
+            fprintf(stderr, "Can't allocate memory for retired list\n");
+            return;
+        }
+        s->retired = r;
+        s->retiredCapacity = n;
+    }
+
+    s->retired[s->nretired].block = tables;
+    s->retired[s->nretired].ref = ref;
+    s->retired[s->nretired].size = size;
+    s->retired[s->nretired].epoch = LOAD(db->epoch);
+    s->nretired++;
+
+    if (s->nretired % RECLAIM_BATCH != 0)
+        return;
+
+    unsigned long epoch = TryAdvanceEpoch(db);
+    unsigned int kept = 0;
+
+    for (unsigned int i = 0; i < s->nretired; i++) {
+        struct Retired *r = &s->retired[i];
+
+        if (r->epoch + 2 > epoch)
+            s->retired[kept++] = *r;
+        else if (r->size == 0)
+            free(r->block);
+        else
+            RecordFree(&s->arena, r->ref, r->size);
+    }
+
+    s->nretired = kept;
+}
+
+/**
+ * LockAll: lock every shard of a db exclusively, in address order
+ *
+ * param db: pointer to database
+ */
+static void LockAll(DB_T db) {
+    if (!db->concurrent)
+        return;
+
+    for (unsigned int i = 0; i < db->nshards; i++)
+        pthread_rwlock_wrlock(&db->shards[i].lock);
+}
+
+/**
+ * UnlockAll: unlock every shard locked with LockAll
+ *
+ * param db: pointer to database
+ */
+static void UnlockAll(DB_T db) {
+    if (!db->concurrent)
+        return;
+
+    for (unsigned int i = 0; i < db->nshards; i++)
+        pthread_rwlock_unlock(&db->shards[i].lock);
+}
+
+/**
+ * SetAtomicAdds: let AddPurchaseByIDAtomic() add without a lock or not
+ *
+ *  turning them off waits until every atomic add that may have missed
+ *  it is done, so that customers can be copied afterwards
+ *
+ * param db: pointer to database, with every shard locked
+ * param on: nonzero to let atomic adds go on without a lock
+ */
+static void SetAtomicAdds(DB_T db, int on) {
+    if (!db->lockFree)
+        return;
+
+    __atomic_store_n(&db->atomicAdds, on, __ATOMIC_SEQ_CST);
+    if (!on)
+        WaitForReaders(db);
+}
+
+/**
+ * RefreshIndexes: rebuild the ordered indexes of a stale shard
+ *
+ *  the shard is locked exclusively and unmarked first. once every
+ *  atomic add that may have seen the mark is done, new indexes are
+ *  built from the amounts in the id tables and swapped in. an atomic
+ *  add that comes later marks the shard again, so a query sees the
+ *  amounts as they were when its shards were rebuilt
+ *
+ * param db: pointer to database
+ * param s: pointer to shard, not locked
+ *
+ * returns: 0 on success. -1 if out of memory, in which case the shard
+ *  stays stale
+ */
+static int RefreshIndexes(DB_T db, struct Shard *s) {
+    struct PurchaseIndex purchases;
+    struct NameIndex names;
+    int res;
+
+    if (!IndexesStale(s))
+        return 0;
+
+    // only atomic adds mark a shard, and only a lock-free db, whose
+    // shards are locked, has them
+    pthread_rwlock_wrlock(&s->lock);
+    if (!IndexesStale(s)) {
+        pthread_rwlock_unlock(&s->lock);
+        return 0;
+    }
+
+    __atomic_store_n(&s->stale, 0, __ATOMIC_SEQ_CST);
+    WaitForReaders(db);
+
+    PurchaseIndexInit(&purchases,
+                      db->seed + (unsigned int)(s - db->shards));
+    NameIndexInit(&names);
+    res = IndexShard(s, s->purchasesBuilt ? &purchases : NULL,
+                     s->namesBuilt ? &names : NULL);
+
+    if (res == 0) {
+        PurchaseIndexRelease(&s->purchases);
+        NameIndexRelease(&s->names);
+        s->purchases = purchases;
+        s->names = names;
+    } else {
+        fprintf(stderr, "Can't allocate a memory for indexes\n");
+        PurchaseIndexRelease(&purchases);
+        NameIndexRelease(&names);
+        __atomic_store_n(&s->stale, 1, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_rwlock_unlock(&s->lock);
+
+    return res;
+}
+
+/**
+ * BuildIndex: build the purchase or name index of a shard unless it is
+ * already there
+ *
+ *  the shard is locked exclusively meanwhile. the amounts are read as
+ *  by RefreshIndexes(), and an atomic add that changes one of them
+ *  marks the shard stale, which rebuilds the index again
+ *
+ * param s: pointer to shard, not locked
+ * param byName: nonzero for the name index
+ *
+ * returns: 0 on success. -1 if out of memory, in which case the index
+ *  is left empty
+ */
+static int BuildIndex(struct Shard *s, int byName) {
+    int *built = byName ? &s->namesBuilt : &s->purchasesBuilt;
+    int res = 0;
+
+    pthread_rwlock_wrlock(&s->lock);
+    if (!*built) {
+        res = IndexShard(s, byName ? NULL : &s->purchases,
+                         byName ? &s->names : NULL);
+        if (res == 0) {
+            *built = 1;
+        } else {
+            fprintf(stderr, "Can't allocate a memory for indexes\n");
+            if (byName)
+                NameIndexRelease(&s->names);
+            else
+                PurchaseIndexRelease(&s->purchases);
+        }
+    }
+    pthread_rwlock_unlock(&s->lock);
+
+    return res;
+}
+
+/**
+ * IndexShard: add the customers of a shard to ordered indexes
+ *
+ * param s: pointer to shard, locked exclusively
+ * param purchases: pointer to purchase index. NULL to leave it out
+ * param names: pointer to name index. NULL to leave it out
+ *
+ * returns: 0 on success. -1 if out of memory
+ */
+static int IndexShard(struct Shard *s, struct PurchaseIndex *purchases,
+                      struct NameIndex *names) {
+    struct Tables *old = s->oldTables;
+    int res = 0;
+
+    // while resizing, customers in unmigrated old buckets are not in
+    // the current table yet
+    if (old != NULL)
+        for (unsigned int b = s->migrated;
+             b < old->capacity && res == 0; b++)
+            res = IndexChain(s, old->idTable[b], purchases, names);
+    for (unsigned int b = 0; b < s->tables->capacity && res == 0; b++)
+        res = IndexChain(s, s->tables->idTable[b], purchases, names);
+
+    return res;
+}
+
+/**
+ * IndexChain: add the customers of an id bucket to ordered indexes
+ *
+ *  customers marked as removed are skipped
+ *
+ * param s: pointer to shard
+ * param ref: first customer of the bucket
+ * param purchases: pointer to purchase index. NULL to leave it out
+ * param names: pointer to name index. NULL to leave it out
  *
- * returns: pointer to unlinked customer. NULL if customer with the id
- * does not exist
+ * returns: 0 on success. -1 if out of memory
  */
-static struct UserInfo *UnlinkCustomerById(DB_T db, const char *id) {
-    struct UserInfo *p, *before = NULL;
+static int IndexChain(struct Shard *s, unsigned int ref,
+                      struct PurchaseIndex *purchases,
+                      struct NameIndex *names) {
+    for (; ref != RECORD_NONE; ref = UserAt(s, ref)->idNext) {
+        struct UserInfo *p = UserAt(s, ref);
+        int purchase = __atomic_load_n(&p->purchase, __ATOMIC_RELAXED);
 
-    int hash = hashfunc(id, db->capacity);
-    for (p = db->idTable[hash]; p != NULL; before = p, p = p->idNext) {
-        if (strcmp(p->id, id) != 0)
+        if (!Visible(s, p))
             continue;
+        if (purchases != NULL &&
+            PurchaseIndexInsert(purchases, IdOf(p), NameOf(p),
+                                purchase) < 0)
+            return -1;
+        if (names != NULL &&
+            NameIndexInsert(names, IdOf(p), NameOf(p), purchase) < 0)
+            return -1;
+    }
 
-        if (before == NULL)
-            db->idTable[hash] = db->idTable[hash]->idNext;
-        else
-            before->idNext = p->idNext;
+    return 0;
+}
+
+/**
+ * VisitByPurchase: apply a given function to the first customers in a
+ * range of purchase amounts, in index order over all shards
+ *
+ *  a db with one shard walks its index. otherwise each shard has a
+ *  cursor into its own index, and the customer coming first among the
+ *  cursors is taken each step
+ *
+ * param db: pointer to database
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param k: most customers to visit
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 if out
+ *  of memory
+ */
+static long long VisitByPurchase(DB_T db, int low, int high, int k,
+                                 FUNCPTR_T fp) {
+    const struct PurchaseNode **cursors;
+    long long sum = 0;
 
-        return p;
+    for (unsigned int i = 0; i < db->nshards; i++)
+        if (RefreshIndexes(db, &db->shards[i]) < 0 ||
+            BuildIndex(&db->shards[i], 0) < 0)
+            return -1;
+
+    if (db->nshards == 1) {
+        struct Shard *s = &db->shards[0];
+
+        if (db->concurrent)
+            pthread_rwlock_rdlock(&s->lock);
+        for (const struct PurchaseNode *n =
+                 PurchaseIndexSeek(&s->purchases, high);
+             n != NULL && n->purchase >= low && k > 0;
+             n = n->next[0], k--)
+            sum += fp(n->id, n->name, n->purchase);
+        if (db->concurrent)
+            pthread_rwlock_unlock(&s->lock);
+
+        return sum;
     }
 
-    return NULL;
+    cursors = malloc(db->nshards * sizeof(cursors[0]));
+    if (cursors == NULL) {
+        fprintf(stderr, "Can't allocate a memory for cursors\n");
+        return -1;
+    }
+
+    // shared locks are taken in the same order as LockAll(), so that
+    // the customers form one consistent state
+    for (unsigned int i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+
+        if (db->concurrent)
+            pthread_rwlock_rdlock(&s->lock);
+        cursors[i] = PurchaseIndexSeek(&s->purchases, high);
+    }
+
+    for (; k > 0; k--) {
+        const struct PurchaseNode *best = NULL;
+        unsigned int from = 0;
+
+        for (unsigned int i = 0; i < db->nshards; i++) {
+            const struct PurchaseNode *n = cursors[i];
+
+            if (n == NULL || n->purchase < low)
+                continue;
+            if (best == NULL || n->purchase > best->purchase ||
+                (n->purchase == best->purchase &&
+                 strcmp(n->id, best->id) < 0)) {
+                best = n;
+                from = i;
+            }
+        }
+        if (best == NULL)
+            break;
+
+        sum += fp(best->id, best->name, best->purchase);
+        cursors[from] = best->next[0];
+    }
+
+    if (db->concurrent)
+        for (unsigned int i = 0; i < db->nshards; i++)
+            pthread_rwlock_unlock(&db->shards[i].lock);
+    free(cursors);
+
+    return sum;
 }
 
 /**
- * UnlinkCustomerByName: unlink a customer by name, and return the
- * customer 'unlink' means simply removing the desired customer from the
- * name hash table
+ * VisitByNamePrefix: apply a given function to the customers whose
+ * name starts with a given prefix, one shard after another
  *
  * param db: pointer to database
- * param name: pointer to null terminated string containing name
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ * param count: pointer to a counter the number of customers visited
+ *  is added to
  *
- * returns: pointer to unlinked customer. NULL if customer with the name
- * does not exist
+ * returns: sum of function applications to the customers
  */
-static struct UserInfo *UnlinkCustomerByName(DB_T db,
-                                             const char *name) {
-    struct UserInfo *p, *before = NULL;
-    int hash = hashfunc(name, db->capacity);
-    for (p = db->nameTable[hash]; p != NULL;
-         before = p, p = p->nameNext) {
+static long long VisitByNamePrefix(DB_T db, const char *prefix,
+                                   FUNCPTR_T fp, int *count) {
+    long long sum = 0;
 
-        if (strcmp(p->name, name) != 0)
+    for (unsigned int i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+
+        // a snapshot has no index of its own
+        if (db->origin != NULL) {
+            sum += SumBuckets(s, 0, ShardBuckets(s), prefix, fp, count);
             continue;
+        }
 
-        if (before == NULL)
-            db->nameTable[hash] = db->nameTable[hash]->nameNext;
-        else
-            before->nameNext = p->nameNext;
+        // a shard that can't be rebuilt is searched like a snapshot
+        if (RefreshIndexes(db, s) < 0 || BuildIndex(s, 1) < 0) {
+            pthread_rwlock_rdlock(&s->lock);
+            sum += SumBuckets(s, 0, ShardBuckets(s), prefix, fp, count);
+            pthread_rwlock_unlock(&s->lock);
+            continue;
+        }
 
-        return p;
+        if (db->concurrent)
+            pthread_rwlock_rdlock(&s->lock);
+        sum += NameIndexVisit(&s->names, prefix, fp, count);
+        if (db->concurrent)
+            pthread_rwlock_unlock(&s->lock);
     }
 
-    return NULL;
+    return sum;
 }
 
 /**
- * rehash: resize hash tables by rehashing them, but only if necessary
+ * CompactShards: rebuild the tables and arena of every shard
  *
- * param db: pointer to database
+ *  the new tables and customer copies are built aside and published
+ *  one shard at a time. lookups that already read the old tables keep
+ *  walking old customers, which stay intact until they are freed
+ *
+ * param db: pointer to database, with every shard locked
+ *
+ * returns: 0 on success. -1 if out of memory
  */
-static void rehash(DB_T db) {
-    // if size is not over threshold, simply return
-    if (db->size < db->threshold)
-        return;
+static int CompactShards(DB_T db) {
+    struct Tables **newTables;
+    struct RecordArena *newArenas;
+    struct PurchaseIndex *newIndexes;
+    struct NameIndex *newNames;
+    unsigned int i;
+
+    newTables = calloc(db->nshards, sizeof(struct Tables *));
+    newArenas = calloc(db->nshards, sizeof(struct RecordArena));
+    newIndexes = calloc(db->nshards, sizeof(struct PurchaseIndex));
+    newNames = calloc(db->nshards, sizeof(struct NameIndex));
+    if (newTables == NULL || newArenas == NULL || newIndexes == NULL ||
+        newNames == NULL) {
+        fprintf(stderr, "Can't allocate a memory for compaction\n");
+        free(newTables);
+        free(newArenas);
+        free(newIndexes);
+        free(newNames);
+        return -1;
+    }
+
+    // resizes in progress are finished first, so that every customer
+    // is in the current tables
+    for (i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+
+        if (s->oldTables != NULL)
+            MigrateBuckets(db, s, NULL, UINT_MAX);
+    }
 
-    struct UserInfo *p, *nextp;
-    // increase capacity. bucket size is now twice as large
-    unsigned int newCapacity = db->capacity << 1;
+    for (i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+        unsigned int count =
+            s->idCount > s->nameCount ? s->idCount : s->nameCount;
+        unsigned int capacity = s->minCapacity;
 
-    struct UserInfo **newIdTable =
-        calloc(newCapacity, sizeof(struct UserInfo *));
-    if (newIdTable == NULL)
-        assert(1);
+        while (count >= (unsigned int)(THRESHOLD_RATIO * capacity))
+            capacity <<= 1;
 
-    struct UserInfo **newNameTable =
-        calloc(newCapacity, sizeof(struct UserInfo *));
-    if (newNameTable == NULL) {
-        free(newIdTable);
-        assert(1);
+        RecordArenaInit(&newArenas[i], &db->pool);
+        PurchaseIndexInit(&newIndexes[i], db->seed + i);
+        NameIndexInit(&newNames[i]);
+        newTables[i] = AllocTables(capacity);
+        if (newTables[i] == NULL)
+            goto fail;
     }
 
-    // iterating one table addresses all registered customers.
-    // here, we iterate over idTable
-    for (unsigned int i = 0; i < db->capacity; i++) {
-        for (p = db->idTable[i]; p != NULL; p = nextp) {
-            nextp = p->idNext;
+    // every customer is copied from the id table of its shard and
+    // linked into the new tables of its id and name shards
+    for (i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+        struct Tables *t = s->tables;
 
-            int newIdHash = (int)(p->idHash & (newCapacity - 1));
-            int newNameHash = (int)(p->nameHash & (newCapacity - 1));
+        for (unsigned int b = 0; b < t->capacity; b++) {
+            for (unsigned int ref = t->idTable[b]; ref != RECORD_NONE;
+                 ref = UserAt(s, ref)->idNext) {
+                struct UserInfo *p = UserAt(s, ref);
+                size_t size = UserSize(p);
+                unsigned int newRef = RecordAlloc(&newArenas[i], size);
+                if (newRef == RECORD_NONE)
+                    goto fail;
 
-            p->idNext = newIdTable[newIdHash];
-            newIdTable[newIdHash] = p;
+                struct UserInfo *q = UserAt(s, newRef);
+                memcpy(q, p, size);
+                if ((s->purchasesBuilt &&
+                     PurchaseIndexInsert(&newIndexes[i], IdOf(q),
+                                         NameOf(q), q->purchase) < 0) ||
+                    (s->namesBuilt &&
+                     NameIndexInsert(&newNames[i], IdOf(q), NameOf(q),
+                                     q->purchase) < 0))
+                    goto fail;
 
-            p->nameNext = newNameTable[newNameHash];
-            newNameTable[newNameHash] = p;
+                struct Shard *ns = ShardOf(db, q->nameHash);
+                LinkById(newTables[i], newRef, q);
+                LinkByName(newTables[ns - db->shards], newRef, q);
+            }
         }
     }
 
-    // we are done migrating.
-    // update the db to contain new members
-    db->capacity = newCapacity;
-    db->threshold = (int)(db->capacity * THRESHOLD_RATIO);
-    free(db->idTable);
-    free(db->nameTable);
-    db->idTable = newIdTable;
-    db->nameTable = newNameTable;
+    // the new tables, arenas and indexes are swapped with the current
+    // ones, so that from now on the arrays hold the old ones
+    for (i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+        struct Tables *t = s->tables;
+        struct RecordArena a = s->arena;
+        struct PurchaseIndex ix = s->purchases;
+        struct NameIndex names = s->names;
+
+        STORE(s->tables, newTables[i]);
+        s->arena = newArenas[i];
+        s->purchases = newIndexes[i];
+        s->names = newNames[i];
+        STORE(s->stale, 0);
+        SetThresholds(s, newTables[i]->capacity);
+
+        newTables[i] = t;
+        newArenas[i] = a;
+        newIndexes[i] = ix;
+        newNames[i] = names;
+    }
+
+    WaitForReaders(db);
+
+    // blocks retired earlier are old tables or old customers, which are
+    // all past their grace period now
+    for (i = 0; i < db->nshards; i++) {
+        struct Shard *s = &db->shards[i];
+
+        for (unsigned int j = 0; j < s->nretired; j++)
+            if (s->retired[j].size == 0)
+                free(s->retired[j].block);
+        s->nretired = 0;
+
+        free(newTables[i]);
+        RecordArenaRelease(&newArenas[i]);
+        PurchaseIndexRelease(&newIndexes[i]);
+        NameIndexRelease(&newNames[i]);
+    }
+
+    free(newTables);
+    free(newArenas);
+    free(newIndexes);
+    free(newNames);
+
+    return 0;
+
+fail:
+    fprintf(stderr, "Can't allocate a memory for compaction\n");
+    for (i = 0; i < db->nshards; i++) {
+        free(newTables[i]);
+        RecordArenaRelease(&newArenas[i]);
+        PurchaseIndexRelease(&newIndexes[i]);
+        NameIndexRelease(&newNames[i]);
+    }
+    free(newTables);
+    free(newArenas);
+    free(newIndexes);
+    free(newNames);
+
+    return -1;
+}
+
+/**
+ * WaitForReaders: wait until no lock-free lookup can still see a block
+ * unlinked before the call
+ *
+ *  lookups are short, so the global epoch soon moves two steps on
+ *
+ * param db: pointer to database
+ */
+static void WaitForReaders(DB_T db) {
+    if (!db->lockFree)
+        return;
+
+    unsigned long epoch = LOAD(db->epoch);
+    while (TryAdvanceEpoch(db) < epoch + 2)
+        sched_yield();
 }
@@ -0,0 +1,1414 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: customer_manager3.c
+ */
+
+#include "customer_manager.h"
+#include "db_stats.h"
+#include "keyhash.h"
+#include "name_index.h"
+#include "purchase_index.h"
+#include "record_file.h"
+#include "sum_job.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define UNIT_BUCKET_SIZE 1024
+
+// a table may be filled up to 7/8 of its capacity (counting tombstones)
+#define MAX_LOAD_NUMERATOR 7
+#define MAX_LOAD_DENOMINATOR 8
+
+// number of control bytes scanned at once
+enum { GROUP_SIZE = 16 };
+
+// slots in a chunk of GetSumCustomerPurchaseParallel()
+enum { SUM_CHUNK_SLOTS = 16384 };
+
+// keys of a batch are hashed and prefetched in groups of this many, so
+// that their cache misses overlap
+enum { BATCH_SIZE = 16 };
+
+// special control bytes. full slots hold the 7-bit tag (0 ~ 127) of the
+// key hash, so every special byte has its sign bit set.
+enum { CTRL_EMPTY = -128, CTRL_DELETED = -2 };
+
+struct UserInfo {
+    // customer name
+    char *name;
+
+    // customer id
+    char *id;
+
+    // purchase amount (> 0)
+    int purchase;
+
+    // hash value of id and name. not the remainder but the whole value.
+    unsigned int idHash;
+    unsigned int nameHash;
+};
+
+struct Table {
+    // control bytes. ctrl[i] describes slots[i]. the first
+    // GROUP_SIZE - 1 bytes are mirrored after the end so that a group
+    // can be loaded at any position without wrapping around.
+    signed char *ctrl;
+
+    // customers, valid only where the control byte is a tag
+    struct UserInfo **slots;
+
+    // number of slots. always a power of 2 and >= GROUP_SIZE
+    unsigned int capacity;
+
+    // number of full slots
+    unsigned int size;
+
+    // number of slots that can still become full before a resize
+    unsigned int growthLeft;
+
+    // resizes of the table, and the nanoseconds they took
+    unsigned long long rehashes;
+    unsigned long long rehashNsec;
+
+#if USE_STATS
+    // calls and probed groups of each kind of operation that started
+    // with a search of this table
+    struct DBCounters counters;
+#endif
+};
+
+struct DB {
+    // open addressing tables for id and name
+    struct Table idTable;
+    struct Table nameTable;
+
+    // current number of customers
+    unsigned int size;
+
+    // customers ordered by purchase amount, and by name. each is built
+    // by the first query that needs it, so that a db that never runs
+    // one doesn't maintain it
+    struct PurchaseIndex purchases;
+    struct NameIndex names;
+    int purchasesBuilt;
+    int namesBuilt;
+
+    // function keys are hashed with, and the seed it is given. the
+    // seed is random unless the creator chose one
+    HASHFUNC_T hash;
+    unsigned long long seed;
+};
+
+/* a GetSumCustomerPurchaseParallel() call, summed a chunk at a time
+   by SumChunk() */
+struct SumJob {
+    DB_T db;
+    FUNCPTR_T fp;
+};
+
+/* which key of a customer a table is indexed with */
+enum KeyKind { KEY_ID, KEY_NAME };
+
+/* raw hash value of a key under the hash function of db. the value
+   is finalized with an avalanche step in case the function leaves some
+   bits weak, since both its low bits (the tag) and its high bits (the
+   probe position) are used */
+static inline unsigned int HashOfKey(DB_T db, const char *key) {
+    unsigned int hash = db->hash(key, db->seed);
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static DB_T CreateDB(HASHFUNC_T hash, unsigned long long seed,
+                     unsigned int capacity);
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash);
+static void UpdatePurchase(DB_T db, struct UserInfo *p, int purchase);
+static void PrefetchProbe(const struct Table *t, unsigned int hash);
+static long long SumChunk(void *arg, unsigned int chunk);
+static int BuildPurchaseIndex(DB_T db);
+static int BuildNameIndex(DB_T db);
+static int InitTable(struct Table *t, unsigned int capacity);
+static struct UserInfo **FindSlot(struct Table *t, enum KeyKind kind,
+                                  const char *key, unsigned int hash);
+static int InsertSlot(struct Table *t, enum KeyKind kind,
+                      struct UserInfo *user);
+static void EraseSlot(struct Table *t, struct UserInfo **slot);
+static int ResizeTable(struct Table *t, enum KeyKind kind,
+                       unsigned int newCapacity);
+static unsigned int SlotsFor(unsigned int capacity,
+                             unsigned long long count);
+static int ReserveTable(struct Table *t, enum KeyKind kind,
+                        unsigned long long count);
+static void AddTableStats(struct DBTableStats *ts,
+                          const struct Table *t, enum KeyKind kind);
+
+/**
+ * CreateCustomerDB: create a new customer db
+ *
+ * this function allocates resources necessary for storing customer
+ * information, e.g. open addressing tables for storing customer info
+ * with id and name as key respectively
+ *
+ * returns: pointer to newly allocated database
+ */
+DB_T CreateCustomerDB(void) {
+    return CreateCustomerDBWithHash(HashKeyWide, RandomHashSeed());
+}
+
+/**
+ * CreateCustomerDBWithHash: create a new customer db with a given hash
+ * function
+ *
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithHash(HASHFUNC_T hash,
+                              unsigned long long seed) {
+    if (hash == NULL)
+        return NULL;
+
+    return CreateDB(hash, seed, UNIT_BUCKET_SIZE);
+}
+
+/**
+ * CreateCustomerDBWithCapacity: create a new customer db with room for
+ * a given number of customers
+ *
+ * param n: number of customers the tables are sized for
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithCapacity(int n) {
+    if (n < 0)
+        return NULL;
+
+    unsigned int capacity = SlotsFor(UNIT_BUCKET_SIZE, n);
+    if (capacity == 0)
+        return NULL;
+
+    return CreateDB(HashKeyWide, RandomHashSeed(), capacity);
+}
+
+/**
+ * CreateDB: allocate a db with tables of a given size
+ *
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ * param capacity: number of slots of each table. must be a power of
+ *  2 >= GROUP_SIZE
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+static DB_T CreateDB(HASHFUNC_T hash, unsigned long long seed,
+                     unsigned int capacity) {
+    DB_T db;
+
+    db = (DB_T)calloc(1, sizeof(struct DB));
+    if (db == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        return NULL;
+    }
+
+    db->hash = hash;
+    db->seed = seed;
+
+    if (InitTable(&db->idTable, capacity) < 0) {
+        free(db);
+        return NULL;
+    }
+
+    if (InitTable(&db->nameTable, capacity) < 0) {
+        free(db->idTable.ctrl);
+        free(db->idTable.slots);
+        free(db);
+        return NULL;
+    }
+
+    PurchaseIndexInit(&db->purchases, seed);
+    NameIndexInit(&db->names);
+
+    return db;
+}
+
+/**
+ * DestroyCustomerDB: destroy a customer db
+ *
+ * this function frees all dynamically allocated resources in the
+ * database
+ *
+ * param db: pointer to database
+ */
+void DestroyCustomerDB(DB_T db) {
+    if (db == NULL)
+        return;
+
+    // iterating one table addresses all registered customers
+    for (unsigned int i = 0; i < db->idTable.capacity; i++) {
+        if (db->idTable.ctrl[i] < 0)
+            continue;
+
+        struct UserInfo *p = db->idTable.slots[i];
+        free(p->id);
+        free(p->name);
+        free(p);
+    }
+
+    free(db->idTable.ctrl);
+    free(db->idTable.slots);
+    free(db->nameTable.ctrl);
+    free(db->nameTable.slots);
+    PurchaseIndexRelease(&db->purchases);
+    NameIndexRelease(&db->names);
+    free(db);
+}
+
+/**
+ * RegisterCustomer: register a new customer
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains customer's
+ * id param name: pointer to null terminated string that contains
+ * customer's name param purchase: purchase value of customer
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+int RegisterCustomer(DB_T db, const char *id, const char *name,
+                     const int purchase) {
+    if (db == NULL || id == NULL || name == NULL || purchase <= 0)
+        return -1;
+
+    return InsertCustomer(db, id, name, purchase, HashOfKey(db, id),
+                          HashOfKey(db, name));
+}
+
+/**
+ * RegisterCustomerBatch: register several customers at once
+ *
+ * the keys of a group are hashed and the first probed group of each
+ * table is prefetched before any customer is inserted, so that the
+ * cache misses of the group overlap
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param names: array of n names
+ * param purchases: array of n purchase values
+ * param n: number of customers
+ * param out: array receiving the result of each registration as
+ *  RegisterCustomer() returns it. may be NULL
+ *
+ * returns: number of customers registered. -1 on invalid arguments
+ */
+int RegisterCustomerBatch(DB_T db, const char **ids, const char **names,
+                          const int *purchases, int n, int *out) {
+    unsigned int idHashes[BATCH_SIZE], nameHashes[BATCH_SIZE];
+    int registered = 0;
+
+    if (db == NULL || ids == NULL || names == NULL ||
+        purchases == NULL || n < 0)
+        return -1;
+
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            if (id == NULL || name == NULL)
+                continue;
+
+            idHashes[j] = HashOfKey(db, id);
+            nameHashes[j] = HashOfKey(db, name);
+            PrefetchProbe(&db->idTable, idHashes[j]);
+            PrefetchProbe(&db->nameTable, nameHashes[j]);
+        }
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            int purchase = purchases[base + j];
+            int res = -1;
+
+            if (id != NULL && name != NULL && purchase > 0)
+                res = InsertCustomer(db, id, name, purchase,
+                                     idHashes[j], nameHashes[j]);
+            if (res == 0)
+                registered++;
+            if (out != NULL)
+                out[base + j] = res;
+        }
+    }
+
+    return registered;
+}
+
+/**
+ * LoadCustomersFromFile: register the customers of a file
+ *
+ *  both tables are resized once to hold every customer of the file
+ *  before they are registered
+ *
+ * param db: pointer to database
+ * param path: path of a file of "id,name,purchase" lines
+ *
+ * returns: number of customers registered. -1 if the file can't be
+ *  read or parsed, or on invalid arguments
+ */
+int LoadCustomersFromFile(DB_T db, const char *path) {
+    struct RecordFile f;
+
+    if (db == NULL || path == NULL)
+        return -1;
+    if (RecordFileOpen(&f, path) < 0)
+        return -1;
+
+    if (ReserveTable(&db->idTable, KEY_ID, f.count) < 0 ||
+        ReserveTable(&db->nameTable, KEY_NAME, f.count) < 0) {
+        RecordFileClose(&f);
+        return -1;
+    }
+
+    int registered = RegisterCustomerBatch(db, f.ids, f.names,
+                                           f.purchases, f.count, NULL);
+    RecordFileClose(&f);
+
+    return registered;
+}
+
+/**
+ * InsertCustomer: register a new customer whose keys are hashed
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param name: pointer to null terminated string that contains name
+ * param purchase: purchase value of customer. must be positive
+ * param idHash: raw hash value of id
+ * param nameHash: raw hash value of name
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash) {
+    STATS_OP(&db->idTable.counters, DB_OP_REGISTER);
+
+    if (FindSlot(&db->idTable, KEY_ID, id, idHash) != NULL ||
+        FindSlot(&db->nameTable, KEY_NAME, name, nameHash) != NULL)
+        return -1;
+
+    struct UserInfo *newUser = calloc(1, sizeof(struct UserInfo));
+    if (newUser == NULL) {
+        fprintf(stderr, "Can't allocate memory for new user\n");
+        return -1;
+    }
+
+    newUser->id = strdup(id);
+    if (newUser->id == NULL) {
+        free(newUser);
+        fprintf(stderr, "Can't allocate memory for new user id\n");
+        return -1;
+    }
+
+    newUser->name = strdup(name);
+    if (newUser->name == NULL) {
+        free(newUser->id);
+        free(newUser);
+        fprintf(stderr, "Can't allocate memory for new user name\n");
+        return -1;
+    }
+
+    newUser->purchase = purchase;
+    newUser->idHash = idHash;
+    newUser->nameHash = nameHash;
+
+    if (InsertSlot(&db->idTable, KEY_ID, newUser) < 0)
+        goto fail;
+
+    if (InsertSlot(&db->nameTable, KEY_NAME, newUser) < 0) {
+        EraseSlot(&db->idTable,
+                  FindSlot(&db->idTable, KEY_ID, id, idHash));
+        goto fail;
+    }
+
+    if (db->purchasesBuilt &&
+        PurchaseIndexInsert(&db->purchases, newUser->id, newUser->name,
+                            purchase) < 0)
+        goto unlink;
+
+    if (db->namesBuilt && NameIndexInsert(&db->names, newUser->id,
+                                          newUser->name, purchase) < 0) {
+        if (db->purchasesBuilt)
+            PurchaseIndexRemove(&db->purchases, newUser->id, purchase);
+        goto unlink;
+    }
+
+    db->size++;
+
+    return 0;
+
+unlink:
+    fprintf(stderr, "Can't allocate memory for new user\n");
+    EraseSlot(&db->idTable, FindSlot(&db->idTable, KEY_ID, id, idHash));
+    EraseSlot(&db->nameTable,
+              FindSlot(&db->nameTable, KEY_NAME, name, nameHash));
+fail:
+    free(newUser->name);
+    free(newUser->id);
+    free(newUser);
+    return -1;
+}
+
+/**
+ * UpdatePurchase: change the purchase field of a customer in place
+ *
+ *  neither key changes, so the customer keeps its table slots. only
+ *  its position in the purchase index moves
+ *
+ * param db: pointer to database
+ * param p: pointer to customer
+ * param purchase: new purchase amount
+ */
+static void UpdatePurchase(DB_T db, struct UserInfo *p, int purchase) {
+    if (purchase == p->purchase)
+        return;
+
+    if (db->purchasesBuilt)
+        PurchaseIndexUpdate(&db->purchases, p->id, p->purchase,
+                            purchase);
+    if (db->namesBuilt)
+        NameIndexUpdate(&db->names, p->name, purchase);
+    p->purchase = purchase;
+}
+
+/**
+ * UnregisterCustomerByID: unregister a customer by id
+ *
+ * remove AND free a customer entry with a given id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise
+ */
+int UnregisterCustomerByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->idTable.counters, DB_OP_UNREGISTER);
+
+    struct UserInfo **slot =
+        FindSlot(&db->idTable, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    struct UserInfo *p = *slot;
+    EraseSlot(&db->idTable, slot);
+
+    slot = FindSlot(&db->nameTable, KEY_NAME, p->name, p->nameHash);
+    assert(slot != NULL);
+    EraseSlot(&db->nameTable, slot);
+
+    if (db->purchasesBuilt)
+        PurchaseIndexRemove(&db->purchases, p->id, p->purchase);
+    if (db->namesBuilt)
+        NameIndexRemove(&db->names, p->name);
+
+    free(p->name);
+    free(p->id);
+    free(p);
+
+    db->size--;
+
+    return 0;
+}
+
+/**
+ * UnregisterCustomerByName: unregister a customer by name
+ *
+ * remove AND free a customer entry with a given name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise
+ */
+int UnregisterCustomerByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+    STATS_OP(&db->nameTable.counters, DB_OP_UNREGISTER);
+
+    struct UserInfo **slot =
+        FindSlot(&db->nameTable, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    struct UserInfo *p = *slot;
+    EraseSlot(&db->nameTable, slot);
+
+    slot = FindSlot(&db->idTable, KEY_ID, p->id, p->idHash);
+    assert(slot != NULL);
+    EraseSlot(&db->idTable, slot);
+
+    if (db->purchasesBuilt)
+        PurchaseIndexRemove(&db->purchases, p->id, p->purchase);
+    if (db->namesBuilt)
+        NameIndexRemove(&db->names, p->name);
+
+    free(p->name);
+    free(p->id);
+    free(p);
+
+    db->size--;
+
+    return 0;
+}
+
+/**
+ * GetPurchaseByID: get the purchase field of a customer by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: purchase field value of customer with id.
+ *  -1 if customer with id does not exist
+ */
+int GetPurchaseByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->idTable.counters, DB_OP_LOOKUP);
+
+    struct UserInfo **slot =
+        FindSlot(&db->idTable, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    return (*slot)->purchase;
+}
+
+/**
+ * GetPurchaseByIDBatch: get the purchase fields of several customers by
+ * id at once
+ *
+ * every key of a group is hashed and its first probed group prefetched
+ * before any of them is searched, so that the cache misses of the
+ * group overlap
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param n: number of ids
+ * param out: array receiving the purchase field of each customer. -1
+ *  if customer with the id does not exist
+ *
+ * returns: number of customers found. -1 on invalid arguments
+ */
+int GetPurchaseByIDBatch(DB_T db, const char **ids, int n, int *out) {
+    unsigned int hashes[BATCH_SIZE];
+    int found = 0;
+
+    if (db == NULL || ids == NULL || out == NULL || n < 0)
+        return -1;
+
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+        const char **keys = ids + base;
+
+        for (int j = 0; j < m; j++) {
+            if (keys[j] == NULL)
+                continue;
+
+            hashes[j] = HashOfKey(db, keys[j]);
+            PrefetchProbe(&db->idTable, hashes[j]);
+        }
+
+        for (int j = 0; j < m; j++) {
+            struct UserInfo **slot = NULL;
+            struct Table *t = &db->idTable;
+
+            if (keys[j] != NULL) {
+                STATS_OP(&t->counters, DB_OP_LOOKUP);
+                slot = FindSlot(t, KEY_ID, keys[j], hashes[j]);
+            }
+            out[base + j] = slot != NULL ? (*slot)->purchase : -1;
+            if (slot != NULL)
+                found++;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * GetPurchaseByName: get the purchase field of a customer by name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: purchase field value of customer with name
+ *  -1 if customer with name does not exist
+ */
+int GetPurchaseByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+    STATS_OP(&db->nameTable.counters, DB_OP_LOOKUP);
+
+    struct UserInfo **slot =
+        FindSlot(&db->nameTable, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    return (*slot)->purchase;
+}
+
+/**
+ * AddPurchaseByID: add an amount to the purchase field of a customer
+ * found by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param amount: amount to add. may be negative
+ *
+ * returns: new purchase field value of customer with id.
+ *  -1 if customer with id does not exist, or if the new value is not
+ *  a positive int
+ */
+int AddPurchaseByID(DB_T db, const char *id, int amount) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->idTable.counters, DB_OP_UPDATE);
+
+    struct UserInfo **slot =
+        FindSlot(&db->idTable, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    long long purchase = (long long)(*slot)->purchase + amount;
+    if (purchase <= 0 || purchase > INT_MAX)
+        return -1;
+
+    UpdatePurchase(db, *slot, (int)purchase);
+
+    return (int)purchase;
+}
+
+/**
+ * SetPurchaseByName: set the purchase field of a customer found by
+ * name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ * param purchase: new purchase amount (> 0)
+ *
+ * returns: 0 on success. -1 if customer with name does not exist or
+ *  purchase is not positive
+ */
+int SetPurchaseByName(DB_T db, const char *name, int purchase) {
+    if (db == NULL || name == NULL || purchase <= 0)
+        return -1;
+    STATS_OP(&db->nameTable.counters, DB_OP_UPDATE);
+
+    struct UserInfo **slot =
+        FindSlot(&db->nameTable, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    UpdatePurchase(db, *slot, purchase);
+
+    return 0;
+}
+
+/**
+ * GetSumCustomerPurchase: apply a given function to all customers and
+ * get the sum of results
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to all customers
+ */
+int GetSumCustomerPurchase(DB_T db, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL)
+        return -1;
+
+    int sum = 0;
+
+    // full slots have a non-negative control byte
+    for (unsigned int i = 0; i < db->idTable.capacity; i++) {
+        if (db->idTable.ctrl[i] < 0)
+            continue;
+
+        struct UserInfo *p = db->idTable.slots[i];
+        sum += fp(p->id, p->name, p->purchase);
+    }
+
+    return sum;
+}
+
+/**
+ * GetSumCustomerPurchaseParallel: apply a given function to all
+ * customers on several threads and get the 64-bit sum of results
+ *
+ * the slots are cut into chunks that the calling thread and up to
+ * nthreads - 1 helper threads take one at a time, each adding into
+ * its own partial sum
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T. it is called from
+ *  several threads at once
+ * param nthreads: number of threads to use
+ *
+ * returns: sum of function applications to all customers. -1 on
+ *  invalid arguments
+ */
+long long GetSumCustomerPurchaseParallel(DB_T db, FUNCPTR_T fp,
+                                         int nthreads) {
+    struct SumJob job;
+
+    if (db == NULL || fp == NULL || nthreads <= 0)
+        return -1;
+
+    job.db = db;
+    job.fp = fp;
+
+    return RunSumJob((db->idTable.capacity + SUM_CHUNK_SLOTS - 1) /
+                         SUM_CHUNK_SLOTS,
+                     SumChunk, &job, nthreads);
+}
+
+/**
+ * GetCustomersByPurchaseRange: apply a given function to the customers
+ * whose purchase amount lies in a range and get the sum of results
+ *
+ * the customers are found through the purchase index, largest amount
+ * first, in O(log n + k) for k customers in the range. the index is
+ * built first if no purchase query has run yet
+ *
+ * param db: pointer to database
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetCustomersByPurchaseRange(DB_T db, int low, int high,
+                                FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexRange(&db->purchases, low, high, fp);
+}
+
+/**
+ * GetTopKCustomers: apply a given function to the customers with the
+ * largest purchase amounts and get the sum of results
+ *
+ * param db: pointer to database
+ * param k: number of customers
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetTopKCustomers(DB_T db, int k, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || k < 0 ||
+        BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexTop(&db->purchases, k, fp);
+}
+
+/**
+ * ForEachCustomerWithNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix
+ *
+ * the customers are found through the name index in time proportional
+ * to the prefix length and the number of matches. the index is built
+ * first if no prefix query has run yet
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: number of matching customers. -1 on invalid arguments or if
+ *  the index can't be built
+ */
+int ForEachCustomerWithNamePrefix(DB_T db, const char *prefix,
+                                  FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    NameIndexVisit(&db->names, prefix, fp, &count);
+    return count;
+}
+
+/**
+ * GetSumCustomerPurchaseByNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix and get the sum of
+ * results
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetSumCustomerPurchaseByNamePrefix(DB_T db, const char *prefix,
+                                       FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    return (int)NameIndexVisit(&db->names, prefix, fp, &count);
+}
+
+/**
+ * GetCustomerDBStats: get the statistics of a customer db
+ *
+ * the chain length of a customer is the number of groups a lookup of
+ * its key probes
+ *
+ * param db: pointer to database
+ * param stats: pointer to the structure receiving the statistics
+ *
+ * returns: 0 on success. -1 on invalid arguments
+ */
+int GetCustomerDBStats(DB_T db, struct DBStats *stats) {
+    if (db == NULL || stats == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(struct DBStats));
+    AddTableStats(&stats->idTable, &db->idTable, KEY_ID);
+    AddTableStats(&stats->nameTable, &db->nameTable, KEY_NAME);
+
+    stats->bytesAllocated =
+        sizeof(struct DB) + db->purchases.arena.bytesReserved +
+        db->names.arena.bytesReserved +
+        (unsigned long long)db->size * sizeof(struct UserInfo);
+    for (unsigned int i = 0; i < db->idTable.capacity; i++) {
+        if (db->idTable.ctrl[i] < 0)
+            continue;
+
+        struct UserInfo *p = db->idTable.slots[i];
+        stats->bytesAllocated += strlen(p->id) + strlen(p->name) + 2;
+    }
+
+    const struct Table *tables[] = {&db->idTable, &db->nameTable};
+    for (int k = 0; k < 2; k++) {
+        const struct Table *t = tables[k];
+
+        stats->bytesAllocated +=
+            t->capacity + GROUP_SIZE - 1 +
+            (unsigned long long)t->capacity * sizeof(struct UserInfo *);
+        stats->rehashes += t->rehashes;
+        stats->rehashNsec += t->rehashNsec;
+#if USE_STATS
+        StatsAddCounters(stats, &t->counters);
+#endif
+    }
+
+    return 0;
+}
+
+/**
+ * H1: position part of a hash value, i.e. where probing starts
+ */
+static inline unsigned int H1(unsigned int hash) { return hash >> 7; }
+
+/**
+ * H2: tag part of a hash value, stored in the control byte
+ */
+static inline signed char H2(unsigned int hash) {
+    return (signed char)(hash & 0x7f);
+}
+
+/**
+ * MatchByte: find the control bytes of a group equal to a given byte
+ *
+ * param group: pointer to GROUP_SIZE control bytes
+ * param b: byte to search for
+ *
+ * returns: bitmask whose i-th bit is set if group[i] == b
+ */
+static inline unsigned int MatchByte(const signed char *group,
+                                     signed char b) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++)
+        if (group[i] == b)
+            mask |= 1U << i;
+    return mask;
+#endif
+}
+
+/**
+ * MatchFree: find the empty or deleted control bytes of a group
+ *
+ * param group: pointer to GROUP_SIZE control bytes
+ *
+ * returns: bitmask whose i-th bit is set if group[i] is not full
+ */
+static inline unsigned int MatchFree(const signed char *group) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(ctrl);
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++)
+        if (group[i] < 0)
+            mask |= 1U << i;
+    return mask;
+#endif
+}
+
+/**
+ * SetCtrl: set a control byte, along with its mirrored copy
+ *
+ * param t: pointer to table
+ * param i: slot index
+ * param c: new control byte
+ */
+static inline void SetCtrl(struct Table *t, unsigned int i,
+                           signed char c) {
+    t->ctrl[i] = c;
+    t->ctrl[((i - (GROUP_SIZE - 1)) & (t->capacity - 1)) +
+            (GROUP_SIZE - 1)] = c;
+}
+
+/**
+ * KeyOf: get the key a table is indexed with
+ */
+static inline const char *KeyOf(const struct UserInfo *p,
+                                enum KeyKind kind) {
+    return kind == KEY_ID ? p->id : p->name;
+}
+
+/**
+ * HashOf: get the hash of the key a table is indexed with
+ */
+static inline unsigned int HashOf(const struct UserInfo *p,
+                                  enum KeyKind kind) {
+    return kind == KEY_ID ? p->idHash : p->nameHash;
+}
+
+/**
+ * InitTable: allocate an empty table
+ *
+ * param t: pointer to table
+ * param capacity: number of slots. must be a power of 2 >= GROUP_SIZE
+ *
+ * returns: 0 on success. -1 if memory allocation fails
+ */
+static int InitTable(struct Table *t, unsigned int capacity) {
+    assert(capacity >= GROUP_SIZE && (capacity & (capacity - 1)) == 0);
+
+    t->ctrl = malloc(capacity + GROUP_SIZE - 1);
+    t->slots = malloc(capacity * sizeof(struct UserInfo *));
+    if (t->ctrl == NULL || t->slots == NULL) {
+        fprintf(stderr,
+                "Can't allocate a memory for table of size %u\n",
+                capacity);
+        free(t->ctrl);
+        free(t->slots);
+        return -1;
+    }
+
+    memset(t->ctrl, CTRL_EMPTY, capacity + GROUP_SIZE - 1);
+    t->capacity = capacity;
+    t->size = 0;
+    t->growthLeft =
+        capacity / MAX_LOAD_DENOMINATOR * MAX_LOAD_NUMERATOR;
+
+    return 0;
+}
+
+/**
+ * FindSlot: search a table for a customer with a given key
+ *
+ *  groups of GROUP_SIZE control bytes are compared against the tag of
+ *  the hash at once, so only slots whose tag matches are dereferenced.
+ *  probing stops at the first group containing an empty slot
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param key: pointer to null terminated string
+ * param hash: raw hash value of key
+ *
+ * returns: pointer to the slot holding the customer. NULL if customer
+ *  with the key does not exist
+ */
+static struct UserInfo **FindSlot(struct Table *t, enum KeyKind kind,
+                                  const char *key, unsigned int hash) {
+    unsigned int mask = t->capacity - 1;
+    unsigned int pos = H1(hash) & mask;
+    signed char tag = H2(hash);
+
+    // triangular probing visits every group exactly once
+    for (unsigned int step = GROUP_SIZE;; step += GROUP_SIZE) {
+        const signed char *group = t->ctrl + pos;
+
+        STATS_PROBES(&t->counters, 1);
+
+        for (unsigned int m = MatchByte(group, tag); m != 0;
+             m &= m - 1) {
+            unsigned int i = (pos + __builtin_ctz(m)) & mask;
+            struct UserInfo *p = t->slots[i];
+            if (HashOf(p, kind) == hash &&
+                strcmp(KeyOf(p, kind), key) == 0)
+                return &t->slots[i];
+        }
+
+        if (MatchByte(group, CTRL_EMPTY) != 0)
+            return NULL;
+
+        pos = (pos + step) & mask;
+    }
+}
+
+/**
+ * PrefetchProbe: prefetch the first group a lookup of a hash probes
+ *
+ * param t: pointer to table
+ * param hash: raw hash value of key
+ */
+static void PrefetchProbe(const struct Table *t, unsigned int hash) {
+    unsigned int pos = H1(hash) & (t->capacity - 1);
+
+    __builtin_prefetch(t->ctrl + pos);
+    __builtin_prefetch(t->slots + pos);
+}
+
+/**
+ * FindFree: find the first empty or deleted slot for a given hash
+ *
+ * param t: pointer to table
+ * param hash: raw hash value of key
+ *
+ * returns: slot index
+ */
+static unsigned int FindFree(const struct Table *t, unsigned int hash) {
+    unsigned int mask = t->capacity - 1;
+    unsigned int pos = H1(hash) & mask;
+
+    for (unsigned int step = GROUP_SIZE;; step += GROUP_SIZE) {
+        unsigned int m = MatchFree(t->ctrl + pos);
+        if (m != 0)
+            return (pos + __builtin_ctz(m)) & mask;
+
+        pos = (pos + step) & mask;
+    }
+}
+
+/**
+ * InsertSlot: insert a customer into a table, growing it if necessary
+ *
+ *  the caller must make sure that the key is not in the table yet
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param user: pointer to customer
+ *
+ * returns: 0 on success. -1 if memory allocation fails
+ */
+static int InsertSlot(struct Table *t, enum KeyKind kind,
+                      struct UserInfo *user) {
+    unsigned int hash = HashOf(user, kind);
+    unsigned int i = FindFree(t, hash);
+
+    // reusing a tombstone does not consume growth
+    if (t->growthLeft == 0 && t->ctrl[i] == CTRL_EMPTY) {
+        // if tombstones take up most of the table, cleaning them up is
+        // enough. otherwise the table is twice as large
+        unsigned int newCapacity = t->capacity;
+        if (t->size * 2 >=
+            t->capacity / MAX_LOAD_DENOMINATOR * MAX_LOAD_NUMERATOR)
+            newCapacity <<= 1;
+
+        if (ResizeTable(t, kind, newCapacity) < 0)
+            return -1;
+
+        i = FindFree(t, hash);
+    }
+
+    if (t->ctrl[i] == CTRL_EMPTY)
+        t->growthLeft--;
+
+    SetCtrl(t, i, H2(hash));
+    t->slots[i] = user;
+    t->size++;
+
+    return 0;
+}
+
+/**
+ * EraseSlot: remove a customer from a table
+ *
+ *  the slot becomes a tombstone so that probe sequences passing through
+ *  it are not cut. if its group has never been full, no probe sequence
+ *  can have passed through it and it becomes empty again
+ *
+ * param t: pointer to table
+ * param slot: pointer to the slot, as returned by FindSlot
+ */
+static void EraseSlot(struct Table *t, struct UserInfo **slot) {
+    unsigned int mask = t->capacity - 1;
+    unsigned int i = (unsigned int)(slot - t->slots);
+    unsigned int before = (i - GROUP_SIZE) & mask;
+
+    unsigned int emptyAfter = MatchByte(t->ctrl + i, CTRL_EMPTY);
+    unsigned int emptyBefore = MatchByte(t->ctrl + before, CTRL_EMPTY);
+
+    // any window of GROUP_SIZE slots containing i also contains an
+    // empty slot, so every probe would have stopped before passing i
+    int wasNeverFull =
+        emptyAfter != 0 && emptyBefore != 0 &&
+        __builtin_ctz(emptyAfter) +
+                __builtin_clz(emptyBefore << (32 - GROUP_SIZE)) <
+            GROUP_SIZE;
+
+    if (wasNeverFull) {
+        SetCtrl(t, i, CTRL_EMPTY);
+        t->growthLeft++;
+    } else {
+        SetCtrl(t, i, CTRL_DELETED);
+    }
+
+    t->size--;
+}
+
+/**
+ * ResizeTable: move all customers of a table into a new table
+ *
+ *  tombstones are dropped in the process
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param newCapacity: number of slots of the new table
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the table is left untouched
+ */
+static int ResizeTable(struct Table *t, enum KeyKind kind,
+                       unsigned int newCapacity) {
+    struct Table newTable;
+    unsigned long long start = StatsNow();
+
+    if (InitTable(&newTable, newCapacity) < 0)
+        return -1;
+
+    for (unsigned int i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] < 0)
+            continue;
+
+        struct UserInfo *p = t->slots[i];
+        unsigned int j = FindFree(&newTable, HashOf(p, kind));
+        SetCtrl(&newTable, j, t->ctrl[i]);
+        newTable.slots[j] = p;
+        newTable.size++;
+        newTable.growthLeft--;
+    }
+
+    // the statistics carry over to the new table
+    newTable.rehashes = t->rehashes + 1;
+    newTable.rehashNsec = t->rehashNsec + StatsNow() - start;
+#if USE_STATS
+    newTable.counters = t->counters;
+#endif
+
+    free(t->ctrl);
+    free(t->slots);
+    *t = newTable;
+
+    return 0;
+}
+
+/**
+ * SlotsFor: get the table capacity needed for a number of customers
+ *
+ * param capacity: current capacity, a power of 2
+ * param count: number of customers
+ *
+ * returns: capacity doubled until count fits under the maximum load.
+ *  0 if that does not fit in an unsigned int
+ */
+static unsigned int SlotsFor(unsigned int capacity,
+                             unsigned long long count) {
+    while (count > (unsigned long long)capacity / MAX_LOAD_DENOMINATOR *
+                       MAX_LOAD_NUMERATOR) {
+        if (capacity > UINT32_MAX / 2) {
+            fprintf(stderr, "Can't hold %llu customers\n", count);
+            return 0;
+        }
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+/**
+ * ReserveTable: grow a table once to hold a number of new customers
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param count: number of new customers
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the table is left as it was
+ */
+static int ReserveTable(struct Table *t, enum KeyKind kind,
+                        unsigned long long count) {
+    unsigned int capacity = SlotsFor(t->capacity, t->size + count);
+
+    if (capacity == 0)
+        return -1;
+    if (capacity == t->capacity)
+        return 0;
+
+    return ResizeTable(t, kind, capacity);
+}
+
+/**
+ * AddTableStats: fill in the statistics of a table
+ *
+ *  the chain length of a customer is found by following the probe
+ *  sequence of its hash until the group covering its slot
+ *
+ * param ts: pointer to zero-filled table statistics
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ */
+static void AddTableStats(struct DBTableStats *ts,
+                          const struct Table *t, enum KeyKind kind) {
+    unsigned int mask = t->capacity - 1;
+
+    for (unsigned int i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] < 0)
+            continue;
+
+        unsigned int pos = H1(HashOf(t->slots[i], kind)) & mask;
+        unsigned int len = 1;
+        for (unsigned int step = GROUP_SIZE;
+             ((i - pos) & mask) >= GROUP_SIZE; step += GROUP_SIZE) {
+            pos = (pos + step) & mask;
+            len++;
+        }
+        StatsAddChain(ts, len);
+    }
+
+    StatsFinishTable(ts, t->capacity);
+}
+
+/**
+ * SumChunk: sum a chunk of a GetSumCustomerPurchaseParallel() call
+ *
+ * param arg: pointer to the call's struct SumJob
+ * param chunk: index of the chunk
+ *
+ * returns: sum of function applications to the customers of the chunk
+ */
+static long long SumChunk(void *arg, unsigned int chunk) {
+    struct SumJob *job = arg;
+    struct Table *t = &job->db->idTable;
+    unsigned int begin = chunk * SUM_CHUNK_SLOTS;
+    unsigned int end = begin + SUM_CHUNK_SLOTS;
+    long long sum = 0;
+
+    if (end > t->capacity)
+        end = t->capacity;
+    for (unsigned int i = begin; i < end; i++) {
+        if (t->ctrl[i] < 0)
+            continue;
+
+        struct UserInfo *p = t->slots[i];
+        sum += job->fp(p->id, p->name, p->purchase);
+    }
+
+    return sum;
+}
+
+/**
+ * BuildPurchaseIndex: build the purchase index of a db unless it is
+ * already there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildPurchaseIndex(DB_T db) {
+    struct Table *t = &db->idTable;
+
+    if (db->purchasesBuilt)
+        return 0;
+
+    for (unsigned int i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] < 0)
+            continue;
+
+        struct UserInfo *p = t->slots[i];
+        if (PurchaseIndexInsert(&db->purchases, p->id, p->name,
+                                p->purchase) < 0) {
+            fprintf(stderr, "Can't allocate a memory for index\n");
+            PurchaseIndexRelease(&db->purchases);
+            return -1;
+        }
+    }
+
+    db->purchasesBuilt = 1;
+    return 0;
+}
+
+/**
+ * BuildNameIndex: build the name index of a db unless it is already
+ * there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildNameIndex(DB_T db) {
+    struct Table *t = &db->idTable;
+
+    if (db->namesBuilt)
+        return 0;
+
+    for (unsigned int i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] < 0)
+            continue;
+
+        struct UserInfo *p = t->slots[i];
+        if (NameIndexInsert(&db->names, p->id, p->name,
+                            p->purchase) < 0) {
+            fprintf(stderr, "Can't allocate a memory for index\n");
+            NameIndexRelease(&db->names);
+            return -1;
+        }
+    }
+
+    db->namesBuilt = 1;
+    return 0;
+}
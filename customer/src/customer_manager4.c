@@ -0,0 +1,1857 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: customer_manager4.c
+ */
+
+#include "customer_manager.h"
+#include "arena.h"
+#include "db_stats.h"
+#include "journal.h"
+#include "keyhash.h"
+#include "name_index.h"
+#include "purchase_index.h"
+#include "record_file.h"
+#include "sum_job.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define UNIT_ARRAY_SIZE 1024
+#define UNIT_INDEX_SIZE 2048
+
+// index slots hold 4 bytes only, so an index table is kept at most half
+// full to keep linear probe sequences short
+#define MAX_LOAD_NUMERATOR 1
+#define MAX_LOAD_DENOMINATOR 2
+
+// customers in a chunk of GetSumCustomerPurchaseParallel()
+#define SUM_CHUNK_SIZE 16384
+
+// keys of a batch are hashed and prefetched in groups of this many, so
+// that their cache misses overlap
+#define BATCH_SIZE 16
+
+// an index slot that refers to no customer
+#define NO_RECORD 0xffffffffU
+
+// snapshot files start with this magic and format version
+#define SNAPSHOT_MAGIC "EE209CDB"
+#define SNAPSHOT_VERSION 4
+
+// built-in hash functions a snapshot can record
+enum SnapshotHash {
+    SNAPSHOT_HASH_WIDE = 1,
+    SNAPSHOT_HASH_MULTIPLICATIVE
+};
+
+/* a customer. the layout is also the on-disk layout of a snapshot, so
+   it holds no pointer */
+struct UserInfo {
+    // offset of the customer id from the key base of the db. id and
+    // name share one block, id first
+    uint64_t id;
+
+    // purchase amount (> 0)
+    int purchase;
+
+    // offset of the name from the id
+    unsigned int nameOffset;
+
+    // hash value of id and name. not the remainder but the whole value.
+    unsigned int idHash;
+    unsigned int nameHash;
+};
+
+struct DB {
+    // customers. always dense: the first size entries are valid
+    struct UserInfo *array;
+
+    // current array capacity (max # of elements)
+    unsigned int capacity;
+
+    // current number of customers
+    unsigned int size;
+
+    // linear probing tables for id and name. a slot holds the index of
+    // a customer in array, or NO_RECORD
+    unsigned int *idIndex;
+    unsigned int *nameIndex;
+
+    // number of slots of each index table. always a power of 2
+    unsigned int indexCapacity;
+
+    // storage of id and name strings
+    struct Arena arena;
+
+    // customers ordered by purchase amount, and by name. each is built
+    // by the first query that needs it, so that loading stays O(1) and
+    // a db that never runs one doesn't maintain it
+    struct PurchaseIndex purchases;
+    struct NameIndex names;
+    int purchasesBuilt;
+    int namesBuilt;
+
+    // address the id offsets of customers are relative to. 0 unless
+    // the db was loaded from a snapshot, where it is the key section
+    uintptr_t keyBase;
+
+    // snapshot mapping of a loaded db. NULL otherwise
+    char *map;
+    size_t mapSize;
+
+    // nonzero while array or index tables still live in the mapping.
+    // they are then updated copy on write and never freed
+    int arrayMapped;
+    int indexMapped;
+
+    // sequence number of the last mutation. a snapshot records it, so
+    // that only later journal entries are replayed on top of it
+    unsigned long long seq;
+
+    // journal every mutation is logged to. NULL if there is none
+    struct Journal *journal;
+
+    // function keys are hashed with, and the seed it is given. the
+    // seed is random unless the creator chose one
+    HASHFUNC_T hash;
+    unsigned long long seed;
+
+    // times the index tables were rebuilt larger, and the nanoseconds
+    // it took
+    unsigned long long rehashes;
+    unsigned long long rehashNsec;
+
+#if USE_STATS
+    // calls and probes of each kind of operation
+    struct DBCounters counters;
+#endif
+};
+
+/* header of a snapshot file. records, id index, name index and keys
+   follow at the given offsets, all in host byte order */
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+
+    // sizeof(struct UserInfo) of the writer
+    uint32_t recordSize;
+
+    // number of customers and of slots of each index table
+    uint32_t size;
+    uint32_t indexCapacity;
+
+    // sequence number of the last mutation included
+    uint64_t seq;
+
+    // hash function the index tables were built with, and its seed
+    uint32_t hash;
+    uint32_t reserved;
+    uint64_t hashSeed;
+
+    // file offsets of the sections, and size of the key section
+    uint64_t recordsOffset;
+    uint64_t idIndexOffset;
+    uint64_t nameIndexOffset;
+    uint64_t keysOffset;
+    uint64_t keysSize;
+};
+
+/* state of a journal replay */
+struct Replay {
+    DB_T db;
+    int count;
+};
+
+/* which key of a customer an index table is indexed with */
+enum KeyKind { KEY_ID, KEY_NAME };
+
+/* a GetSumCustomerPurchaseParallel() call, summed a chunk at a time
+   by SumChunk() */
+struct SumJob {
+    DB_T db;
+    FUNCPTR_T fp;
+};
+
+static inline const char *IdOf(DB_T db, const struct UserInfo *p) {
+    return (const char *)(db->keyBase + (uintptr_t)p->id);
+}
+
+static inline const char *NameOf(DB_T db, const struct UserInfo *p) {
+    return IdOf(db, p) + p->nameOffset;
+}
+
+/* raw hash value of a key under the hash function of db. the value
+   is finalized with an avalanche step in case the function leaves some
+   bits weak, since linear probing clusters badly on weak low bits */
+static inline unsigned int HashOfKey(DB_T db, const char *key) {
+    unsigned int hash = db->hash(key, db->seed);
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static DB_T CreateDB(HASHFUNC_T hash, unsigned long long seed,
+                     unsigned int n);
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash);
+static int GrowArray(DB_T db, unsigned long long count);
+static unsigned int IndexSlotsFor(unsigned int capacity,
+                                  unsigned long long count);
+static int ReserveCustomers(DB_T db, unsigned long long count);
+static unsigned int *ProbeSlot(DB_T db, enum KeyKind kind,
+                               const char *key, unsigned int hash);
+static unsigned int *FindSlot(DB_T db, enum KeyKind kind,
+                              const char *key, unsigned int hash);
+static unsigned int *FindRecordSlot(DB_T db, enum KeyKind kind,
+                                    unsigned int rec);
+static void EraseSlot(DB_T db, enum KeyKind kind, unsigned int *slot);
+static int ResizeIndex(DB_T db, unsigned int newCapacity);
+static void RemoveCustomer(DB_T db, enum KeyKind kind,
+                           unsigned int *slot);
+static void UpdatePurchase(DB_T db, unsigned int rec, int purchase);
+static long long SumChunk(void *arg, unsigned int chunk);
+static int InsertOrdered(DB_T db, const char *id, const char *name,
+                         int purchase);
+static int BuildPurchaseIndex(DB_T db);
+static int BuildNameIndex(DB_T db);
+static int LogMutation(DB_T db, enum JournalType type,
+                       const struct UserInfo *p);
+static void ReplayEntry(void *arg, const struct JournalEntry *e);
+static int WriteSnapshot(DB_T db, FILE *fp);
+static int SnapshotHashOf(HASHFUNC_T hash);
+static int CheckSnapshot(const struct SnapshotHeader *h,
+                         size_t fileSize);
+
+/**
+ * CreateCustomerDB: create a new customer db
+ *
+ * this function allocates resources necessary for storing customer
+ * information, e.g. a dense array of customers and index tables for
+ * looking them up with id and name as key respectively
+ *
+ * returns: pointer to newly allocated database
+ */
+DB_T CreateCustomerDB(void) {
+    return CreateCustomerDBWithHash(HashKeyWide, RandomHashSeed());
+}
+
+/**
+ * CreateCustomerDBWithHash: create a new customer db with a given hash
+ * function
+ *
+ *  only dbs using a built-in hash function can be saved, since a
+ *  snapshot records which function its index tables were built with
+ *
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithHash(HASHFUNC_T hash,
+                              unsigned long long seed) {
+    if (hash == NULL)
+        return NULL;
+
+    return CreateDB(hash, seed, UNIT_ARRAY_SIZE);
+}
+
+/**
+ * CreateCustomerDBWithCapacity: create a new customer db with room for
+ * a given number of customers
+ *
+ * param n: number of customers the array and index tables are sized
+ *  for
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithCapacity(int n) {
+    if (n < 0)
+        return NULL;
+
+    return CreateDB(HashKeyWide, RandomHashSeed(), (unsigned int)n);
+}
+
+/**
+ * CreateDB: allocate a db with room for a given number of customers
+ *
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ * param n: number of customers. the array holds at least
+ *  UNIT_ARRAY_SIZE
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+static DB_T CreateDB(HASHFUNC_T hash, unsigned long long seed,
+                     unsigned int n) {
+    DB_T db;
+
+    db = (DB_T)calloc(1, sizeof(struct DB));
+    if (db == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        return NULL;
+    }
+
+    db->hash = hash;
+    db->seed = seed;
+
+    if (n < UNIT_ARRAY_SIZE)
+        n = UNIT_ARRAY_SIZE;
+    if (ReserveCustomers(db, n) < 0) {
+        free(db->array);
+        free(db);
+        return NULL;
+    }
+
+    ArenaInit(&db->arena);
+    PurchaseIndexInit(&db->purchases, seed);
+    NameIndexInit(&db->names);
+
+    return db;
+}
+
+/**
+ * DestroyCustomerDB: destroy a customer db
+ *
+ * this function frees all dynamically allocated resources in the
+ * database
+ *
+ * param db: pointer to database
+ */
+void DestroyCustomerDB(DB_T db) {
+    if (db == NULL)
+        return;
+
+    if (db->journal != NULL && JournalClose(db->journal) < 0)
+        fprintf(stderr, "Journal entries may have been lost\n");
+
+    // keys live in the arena or the mapping, so no customer has to
+    // be visited
+    ArenaRelease(&db->arena);
+    PurchaseIndexRelease(&db->purchases);
+    NameIndexRelease(&db->names);
+
+    if (!db->indexMapped) {
+        free(db->idIndex);
+        free(db->nameIndex);
+    }
+    if (!db->arrayMapped)
+        free(db->array);
+    if (db->map != NULL)
+        munmap(db->map, db->mapSize);
+    free(db);
+}
+
+/**
+ * RegisterCustomer: register a new customer
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains customer's
+ *  id
+ * param name: pointer to null terminated string that contains
+ *  customer's name
+ * param purchase: purchase value of customer
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+int RegisterCustomer(DB_T db, const char *id, const char *name,
+                     const int purchase) {
+    if (db == NULL || id == NULL || name == NULL || purchase <= 0)
+        return -1;
+
+    return InsertCustomer(db, id, name, purchase, HashOfKey(db, id),
+                          HashOfKey(db, name));
+}
+
+/**
+ * RegisterCustomerBatch: register several customers at once
+ *
+ * the keys of a group are hashed and their home slots in both index
+ * tables prefetched before any customer is inserted, so that the cache
+ * misses of the group overlap
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param names: array of n names
+ * param purchases: array of n purchase values
+ * param n: number of customers
+ * param out: array receiving the result of each registration as
+ *  RegisterCustomer() returns it. may be NULL
+ *
+ * returns: number of customers registered. -1 on invalid arguments
+ */
+int RegisterCustomerBatch(DB_T db, const char **ids, const char **names,
+                          const int *purchases, int n, int *out) {
+    unsigned int idHashes[BATCH_SIZE], nameHashes[BATCH_SIZE];
+    int registered = 0;
+
+    if (db == NULL || ids == NULL || names == NULL ||
+        purchases == NULL || n < 0)
+        return -1;
+
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+        unsigned int mask = db->indexCapacity - 1;
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            if (id == NULL || name == NULL)
+                continue;
+
+            idHashes[j] = HashOfKey(db, id);
+            nameHashes[j] = HashOfKey(db, name);
+            __builtin_prefetch(&db->idIndex[idHashes[j] & mask]);
+            __builtin_prefetch(&db->nameIndex[nameHashes[j] & mask]);
+        }
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            int purchase = purchases[base + j];
+            int res = -1;
+
+            if (id != NULL && name != NULL && purchase > 0)
+                res = InsertCustomer(db, id, name, purchase,
+                                     idHashes[j], nameHashes[j]);
+            if (res == 0)
+                registered++;
+            if (out != NULL)
+                out[base + j] = res;
+        }
+    }
+
+    return registered;
+}
+
+/**
+ * LoadCustomersFromFile: register the customers of a file
+ *
+ *  the array and both index tables are grown once to hold every
+ *  customer of the file before they are registered. loading into an
+ *  empty db leaves its ordered indexes to be built later
+ *
+ * param db: pointer to database
+ * param path: path of a file of "id,name,purchase" lines
+ *
+ * returns: number of customers registered. -1 if the file can't be
+ *  read or parsed, or on invalid arguments
+ */
+int LoadCustomersFromFile(DB_T db, const char *path) {
+    struct RecordFile f;
+
+    if (db == NULL || path == NULL)
+        return -1;
+    if (RecordFileOpen(&f, path) < 0)
+        return -1;
+
+    unsigned long long count = (unsigned long long)db->size + f.count;
+    if (ReserveCustomers(db, count) < 0) {
+        RecordFileClose(&f);
+        return -1;
+    }
+
+    // the ordered indexes of an empty db are left to be built by the
+    // next query that needs them, even if one was built already
+    if (db->size == 0) {
+        db->purchasesBuilt = 0;
+        db->namesBuilt = 0;
+    }
+
+    int registered = RegisterCustomerBatch(db, f.ids, f.names,
+                                           f.purchases, f.count, NULL);
+    RecordFileClose(&f);
+
+    return registered;
+}
+
+/**
+ * UnregisterCustomerByID: unregister a customer by id
+ *
+ * remove AND free a customer entry with a given id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise
+ */
+int UnregisterCustomerByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UNREGISTER);
+
+    unsigned int *slot = FindSlot(db, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    if (LogMutation(db, JOURNAL_UNREGISTER, &db->array[*slot]) < 0)
+        return -1;
+    RemoveCustomer(db, KEY_ID, slot);
+
+    return 0;
+}
+
+/**
+ * UnregisterCustomerByName: unregister a customer by name
+ *
+ * remove AND free a customer entry with a given name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise
+ */
+int UnregisterCustomerByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UNREGISTER);
+
+    unsigned int *slot =
+        FindSlot(db, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    if (LogMutation(db, JOURNAL_UNREGISTER, &db->array[*slot]) < 0)
+        return -1;
+    RemoveCustomer(db, KEY_NAME, slot);
+
+    return 0;
+}
+
+/**
+ * GetPurchaseByID: get the purchase field of a customer by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: purchase field value of customer with id.
+ *  -1 if customer with id does not exist
+ */
+int GetPurchaseByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_LOOKUP);
+
+    unsigned int *slot = FindSlot(db, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    return db->array[*slot].purchase;
+}
+
+/**
+ * GetPurchaseByIDBatch: get the purchase fields of several customers by
+ * id at once
+ *
+ * each group of keys is looked up in three passes: hash every key and
+ * prefetch its home slot, prefetch the customer the slot refers to,
+ * then probe. the misses of a pass are all in flight before the next
+ * pass needs them
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param n: number of ids
+ * param out: array receiving the purchase field of each customer. -1
+ *  if customer with the id does not exist
+ *
+ * returns: number of customers found. -1 on invalid arguments
+ */
+int GetPurchaseByIDBatch(DB_T db, const char **ids, int n, int *out) {
+    unsigned int hashes[BATCH_SIZE];
+    int found = 0;
+
+    if (db == NULL || ids == NULL || out == NULL || n < 0)
+        return -1;
+
+    unsigned int mask = db->indexCapacity - 1;
+
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+        const char **keys = ids + base;
+
+        for (int j = 0; j < m; j++) {
+            if (keys[j] == NULL)
+                continue;
+
+            hashes[j] = HashOfKey(db, keys[j]);
+            __builtin_prefetch(&db->idIndex[hashes[j] & mask]);
+        }
+
+        for (int j = 0; j < m; j++) {
+            if (keys[j] == NULL)
+                continue;
+
+            unsigned int rec = db->idIndex[hashes[j] & mask];
+            if (rec != NO_RECORD)
+                __builtin_prefetch(&db->array[rec]);
+        }
+
+        for (int j = 0; j < m; j++) {
+            unsigned int *slot = NULL;
+
+            if (keys[j] != NULL) {
+                STATS_OP(&db->counters, DB_OP_LOOKUP);
+                slot = FindSlot(db, KEY_ID, keys[j], hashes[j]);
+            }
+            if (slot != NULL) {
+                out[base + j] = db->array[*slot].purchase;
+                found++;
+            } else {
+                out[base + j] = -1;
+            }
+        }
+    }
+
+    return found;
+}
+
+/**
+ * GetPurchaseByName: get the purchase field of a customer by name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: purchase field value of customer with name
+ *  -1 if customer with name does not exist
+ */
+int GetPurchaseByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_LOOKUP);
+
+    unsigned int *slot =
+        FindSlot(db, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    return db->array[*slot].purchase;
+}
+
+/**
+ * AddPurchaseByID: add an amount to the purchase field of a customer
+ * found by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param amount: amount to add. may be negative
+ *
+ * returns: new purchase field value of customer with id.
+ *  -1 if customer with id does not exist, if the new value is not a
+ *  positive int, or if the journal failed
+ */
+int AddPurchaseByID(DB_T db, const char *id, int amount) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UPDATE);
+
+    unsigned int *slot = FindSlot(db, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    struct UserInfo update = db->array[*slot];
+    long long purchase = (long long)update.purchase + amount;
+    if (purchase <= 0 || purchase > INT_MAX)
+        return -1;
+
+    // the entry carries the new amount
+    update.purchase = (int)purchase;
+    if (LogMutation(db, JOURNAL_SET_PURCHASE, &update) < 0)
+        return -1;
+    UpdatePurchase(db, *slot, (int)purchase);
+
+    return (int)purchase;
+}
+
+/**
+ * SetPurchaseByName: set the purchase field of a customer found by
+ * name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ * param purchase: new purchase amount (> 0)
+ *
+ * returns: 0 on success. -1 if customer with name does not exist, if
+ *  purchase is not positive, or if the journal failed
+ */
+int SetPurchaseByName(DB_T db, const char *name, int purchase) {
+    if (db == NULL || name == NULL || purchase <= 0)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UPDATE);
+
+    unsigned int *slot =
+        FindSlot(db, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    struct UserInfo update = db->array[*slot];
+    update.purchase = purchase;
+    if (LogMutation(db, JOURNAL_SET_PURCHASE, &update) < 0)
+        return -1;
+    UpdatePurchase(db, *slot, purchase);
+
+    return 0;
+}
+
+/**
+ * GetSumCustomerPurchase: apply a given function to all customers and
+ * get the sum of results
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to all customers
+ */
+int GetSumCustomerPurchase(DB_T db, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL)
+        return -1;
+
+    int sum = 0;
+
+    // the array is dense, so this is a single sequential pass
+    for (unsigned int i = 0; i < db->size; i++) {
+        struct UserInfo *p = &db->array[i];
+        sum += fp(IdOf(db, p), NameOf(db, p), p->purchase);
+    }
+
+    return sum;
+}
+
+/**
+ * GetSumCustomerPurchaseParallel: apply a given function to all
+ * customers on several threads and get the 64-bit sum of results
+ *
+ * the array is cut into chunks that the calling thread and up to
+ * nthreads - 1 helper threads take one at a time, each adding into
+ * its own partial sum
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T. it is called from
+ *  several threads at once
+ * param nthreads: number of threads to use
+ *
+ * returns: sum of function applications to all customers. -1 on
+ *  invalid arguments
+ */
+long long GetSumCustomerPurchaseParallel(DB_T db, FUNCPTR_T fp,
+                                         int nthreads) {
+    struct SumJob job;
+
+    if (db == NULL || fp == NULL || nthreads <= 0)
+        return -1;
+
+    job.db = db;
+    job.fp = fp;
+
+    return RunSumJob((db->size + SUM_CHUNK_SIZE - 1) / SUM_CHUNK_SIZE,
+                     SumChunk, &job, nthreads);
+}
+
+/**
+ * GetCustomersByPurchaseRange: apply a given function to the customers
+ * whose purchase amount lies in a range and get the sum of results
+ *
+ * the customers are found through the purchase index, largest amount
+ * first, in O(log n + k) for k customers in the range. the index is
+ * built first if no purchase query has run yet
+ *
+ * param db: pointer to database
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetCustomersByPurchaseRange(DB_T db, int low, int high,
+                                FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexRange(&db->purchases, low, high, fp);
+}
+
+/**
+ * GetTopKCustomers: apply a given function to the customers with the
+ * largest purchase amounts and get the sum of results
+ *
+ * param db: pointer to database
+ * param k: number of customers
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetTopKCustomers(DB_T db, int k, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || k < 0 ||
+        BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexTop(&db->purchases, k, fp);
+}
+
+/**
+ * ForEachCustomerWithNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix
+ *
+ * the customers are found through the name index in time proportional
+ * to the prefix length and the number of matches. the index is built
+ * first if no prefix query has run yet
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: number of matching customers. -1 on invalid arguments or if
+ *  the index can't be built
+ */
+int ForEachCustomerWithNamePrefix(DB_T db, const char *prefix,
+                                  FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    NameIndexVisit(&db->names, prefix, fp, &count);
+    return count;
+}
+
+/**
+ * GetSumCustomerPurchaseByNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix and get the sum of
+ * results
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetSumCustomerPurchaseByNamePrefix(DB_T db, const char *prefix,
+                                       FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    return (int)NameIndexVisit(&db->names, prefix, fp, &count);
+}
+
+/**
+ * GetCustomerDBStats: get the statistics of a customer db
+ *
+ * the chain length of a customer is its distance from its home slot
+ * plus one. memory of a loaded db counts the whole snapshot mapping,
+ * along with whatever was copied out of it since
+ *
+ * param db: pointer to database
+ * param stats: pointer to the structure receiving the statistics
+ *
+ * returns: 0 on success. -1 on invalid arguments
+ */
+int GetCustomerDBStats(DB_T db, struct DBStats *stats) {
+    if (db == NULL || stats == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(struct DBStats));
+
+    unsigned int mask = db->indexCapacity - 1;
+    for (unsigned int i = 0; i <= mask; i++) {
+        unsigned int rec = db->idIndex[i];
+        if (rec != NO_RECORD)
+            StatsAddChain(&stats->idTable,
+                          ((i - db->array[rec].idHash) & mask) + 1);
+
+        rec = db->nameIndex[i];
+        if (rec != NO_RECORD)
+            StatsAddChain(&stats->nameTable,
+                          ((i - db->array[rec].nameHash) & mask) + 1);
+    }
+    StatsFinishTable(&stats->idTable, db->indexCapacity);
+    StatsFinishTable(&stats->nameTable, db->indexCapacity);
+
+    stats->bytesAllocated = sizeof(struct DB) + db->mapSize +
+                            db->arena.bytesReserved +
+                            db->purchases.arena.bytesReserved +
+                            db->names.arena.bytesReserved;
+    if (!db->arrayMapped)
+        stats->bytesAllocated +=
+            (unsigned long long)db->capacity * sizeof(struct UserInfo);
+    if (!db->indexMapped)
+        stats->bytesAllocated += 2ULL * db->indexCapacity *
+                                 sizeof(unsigned int);
+    stats->rehashes = db->rehashes;
+    stats->rehashNsec = db->rehashNsec;
+#if USE_STATS
+    StatsAddCounters(stats, &db->counters);
+#endif
+
+    return 0;
+}
+
+/**
+ * SaveCustomerDB: write a snapshot of a customer db to a file
+ *
+ * the snapshot holds the customer array, both index tables as they are
+ * and the keys, with every customer's id stored as an offset into the
+ * key section. the file is written next to path and renamed over it,
+ * so that path holds either the old or the new snapshot
+ *
+ * param db: pointer to database
+ * param path: path of the snapshot file
+ *
+ * returns: 0 on success. -1 otherwise
+ */
+int SaveCustomerDB(DB_T db, const char *path) {
+    if (db == NULL || path == NULL)
+        return -1;
+
+    // the index tables are saved as they are, so a loader has to know
+    // the hash function that built them
+    if (SnapshotHashOf(db->hash) < 0) {
+        fprintf(stderr,
+                "Can't save a db with a custom hash function\n");
+        return -1;
+    }
+
+    char *tmp = malloc(strlen(path) + sizeof(".tmp"));
+    if (tmp == NULL) {
+        fprintf(stderr, "Can't allocate memory for file name\n");
+        return -1;
+    }
+    strcpy(tmp, path);
+    strcat(tmp, ".tmp");
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open %s\n", tmp);
+        free(tmp);
+        return -1;
+    }
+
+    // the snapshot must be on disk before the journal entries it
+    // covers are dropped
+    int res = WriteSnapshot(db, fp);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+        res = -1;
+    if (fclose(fp) != 0)
+        res = -1;
+    if (res == 0 && rename(tmp, path) != 0)
+        res = -1;
+    if (res < 0) {
+        fprintf(stderr, "Can't write snapshot %s\n", path);
+        remove(tmp);
+    }
+    free(tmp);
+
+    if (res == 0 && db->journal != NULL)
+        res = JournalTruncate(db->journal);
+
+    return res;
+}
+
+/**
+ * LoadCustomerDB: open a customer db from a snapshot file
+ *
+ * the file is mapped privately and its customer array and index tables
+ * are used in place, so nothing is hashed or rebuilt and pages are
+ * only read when they are touched. updates copy the pages they modify.
+ * the array and the index tables are copied to the heap once they have
+ * to grow. the file itself is never modified
+ *
+ * param path: path of the snapshot file
+ *
+ * returns: pointer to the database. NULL if the file can't be mapped
+ *  or is not a valid snapshot
+ */
+DB_T LoadCustomerDB(const char *path) {
+    struct stat st;
+
+    if (path == NULL)
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(struct SnapshotHeader)) {
+        fprintf(stderr, "%s is not a snapshot\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *map =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", path);
+        return NULL;
+    }
+
+    const struct SnapshotHeader *h = (const struct SnapshotHeader *)map;
+    if (CheckSnapshot(h, size) < 0) {
+        fprintf(stderr, "%s is not a valid snapshot\n", path);
+        munmap(map, size);
+        return NULL;
+    }
+
+    DB_T db = calloc(1, sizeof(struct DB));
+    if (db == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        munmap(map, size);
+        return NULL;
+    }
+
+    db->array = (struct UserInfo *)(map + h->recordsOffset);
+    db->capacity = h->size;
+    db->size = h->size;
+    db->idIndex = (unsigned int *)(map + h->idIndexOffset);
+    db->nameIndex = (unsigned int *)(map + h->nameIndexOffset);
+    db->indexCapacity = h->indexCapacity;
+    db->keyBase = (uintptr_t)(map + h->keysOffset);
+    db->map = map;
+    db->mapSize = size;
+    db->arrayMapped = 1;
+    db->indexMapped = 1;
+    db->seq = h->seq;
+    db->hash = h->hash == SNAPSHOT_HASH_WIDE ? HashKeyWide
+                                             : HashKeyMultiplicative;
+    db->seed = h->hashSeed;
+    ArenaInit(&db->arena);
+    PurchaseIndexInit(&db->purchases, h->hashSeed);
+    NameIndexInit(&db->names);
+
+    return db;
+}
+
+/**
+ * OpenCustomerJournal: log every later mutation of a customer db to a
+ * journal file
+ *
+ * in DB_JOURNAL_DURABLE mode, a mutation returns once its entry is on
+ * disk, and fails if it can't be written. in DB_JOURNAL_ASYNC mode, it
+ * returns once its entry is buffered, and the buffer is committed at
+ * the latest maxDelayMs milliseconds after its first entry or once
+ * maxBytes are buffered. SyncCustomerJournal() waits for the current
+ * group. DB_JOURNAL_DEFERRED mode commits as DB_JOURNAL_DURABLE mode
+ * does, but a mutation returns once its entry is buffered, and
+ * WaitCustomerJournal() tells when it is on disk. either way, a group
+ * is committed with one write and fdatasync
+ *
+ * entries already in the file that the db does not include yet are
+ * replayed first. recovery is thus LoadCustomerDB() of the latest
+ * snapshot, or CreateCustomerDB() if there is none, followed by this
+ * function. SaveCustomerDB() empties the journal
+ *
+ * param db: pointer to database
+ * param path: path of the journal file
+ * param mode: when mutations return
+ * param maxDelayMs: longest time a mutation stays uncommitted in
+ *  DB_JOURNAL_ASYNC mode
+ * param maxBytes: largest group committed at once
+ *
+ * returns: number of entries replayed. -1 on failure
+ */
+int OpenCustomerJournal(DB_T db, const char *path,
+                        enum DBJournalMode mode, int maxDelayMs,
+                        int maxBytes) {
+    struct Replay r;
+    enum JournalMode jmode;
+
+    if (db == NULL || path == NULL || db->journal != NULL ||
+        maxBytes <= 0)
+        return -1;
+
+    switch (mode) {
+    case DB_JOURNAL_DURABLE:
+        jmode = JOURNAL_DURABLE;
+        break;
+    case DB_JOURNAL_ASYNC:
+        jmode = JOURNAL_ASYNC;
+        break;
+    case DB_JOURNAL_DEFERRED:
+        jmode = JOURNAL_DEFERRED;
+        break;
+    default:
+        return -1;
+    }
+
+    r.db = db;
+    r.count = 0;
+    db->journal = JournalOpen(path, jmode, maxDelayMs, (size_t)maxBytes,
+                              db->seq, ReplayEntry, &r);
+    if (db->journal == NULL)
+        return -1;
+
+    return r.count;
+}
+
+/**
+ * SyncCustomerJournal: wait until every mutation of a customer db is on
+ * disk
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if there is no journal or it failed
+ */
+int SyncCustomerJournal(DB_T db) {
+    if (db == NULL || db->journal == NULL)
+        return -1;
+
+    return JournalSync(db->journal);
+}
+
+/**
+ * CustomerJournalSeq: get the sequence number of the last mutation of
+ * a customer db
+ *
+ * param db: pointer to database
+ *
+ * returns: sequence number of the last mutation. 0 if there is none or
+ *  db is NULL
+ */
+unsigned long long CustomerJournalSeq(DB_T db) {
+    if (db == NULL)
+        return 0;
+
+    return db->seq;
+}
+
+/**
+ * WaitCustomerJournal: wait until the mutations of a customer db up to
+ * a sequence number are on disk
+ *
+ *  only the journal is looked at, under its own lock, so another
+ *  thread may go on updating the db meanwhile
+ *
+ * param db: pointer to database
+ * param seq: sequence number of the last mutation to wait for
+ *
+ * returns: 0 on success. -1 if there is no journal or it failed
+ */
+int WaitCustomerJournal(DB_T db, unsigned long long seq) {
+    if (db == NULL || db->journal == NULL)
+        return -1;
+
+    return JournalWait(db->journal, seq);
+}
+
+/**
+ * InsertCustomer: register a new customer whose keys are hashed
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param name: pointer to null terminated string that contains name
+ * param purchase: purchase value of customer. must be positive
+ * param idHash: raw hash value of id
+ * param nameHash: raw hash value of name
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash) {
+    STATS_OP(&db->counters, DB_OP_REGISTER);
+
+    // indices must stay below NO_RECORD
+    if (db->size == NO_RECORD - 1)
+        return -1;
+
+    // the db grows before the keys are searched for, so that the empty
+    // slots the searches end at are still valid for the insertion
+    if (db->size == db->capacity && GrowArray(db, db->size + 1ULL) < 0)
+        return -1;
+
+    // a failed resize is retried on the next insertion. one empty slot
+    // is enough for probing to terminate
+    unsigned long long load = (db->size + 1ULL) * MAX_LOAD_DENOMINATOR;
+    unsigned long long limit =
+        (unsigned long long)db->indexCapacity * MAX_LOAD_NUMERATOR;
+    if (load > limit &&
+        ResizeIndex(db, db->indexCapacity << 1) < 0 &&
+        db->size + 1 >= db->indexCapacity)
+        return -1;
+
+    unsigned int *idSlot = ProbeSlot(db, KEY_ID, id, idHash);
+    if (*idSlot != NO_RECORD)
+        return -1;
+    unsigned int *nameSlot = ProbeSlot(db, KEY_NAME, name, nameHash);
+    if (*nameSlot != NO_RECORD)
+        return -1;
+
+    size_t idSize = strlen(id) + 1;
+    size_t nameSize = strlen(name) + 1;
+    char *keys = ArenaAlloc(&db->arena, idSize + nameSize);
+    if (keys == NULL) {
+        fprintf(stderr, "Can't allocate memory for new user\n");
+        return -1;
+    }
+
+    memcpy(keys, id, idSize);
+    memcpy(keys + idSize, name, nameSize);
+
+    if (InsertOrdered(db, keys, keys + idSize, purchase) < 0) {
+        fprintf(stderr, "Can't allocate memory for new user\n");
+        ArenaFree(&db->arena, keys, idSize + nameSize);
+        return -1;
+    }
+
+    unsigned int rec = db->size++;
+    struct UserInfo *newUser = &db->array[rec];
+    newUser->id = (uintptr_t)keys - db->keyBase;
+    newUser->nameOffset = (unsigned int)idSize;
+    newUser->purchase = purchase;
+    newUser->idHash = idHash;
+    newUser->nameHash = nameHash;
+
+    *idSlot = rec;
+    *nameSlot = rec;
+
+    // a customer that can't be logged is taken back
+    if (LogMutation(db, JOURNAL_REGISTER, newUser) < 0) {
+        RemoveCustomer(db, KEY_NAME, nameSlot);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * GrowArray: grow the array to hold a given number of customers
+ *
+ *  the capacity is doubled until it is large enough
+ *
+ * param db: pointer to database
+ * param count: number of customers
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the array is left as it was
+ */
+static int GrowArray(DB_T db, unsigned long long count) {
+    unsigned long long capacity =
+        db->capacity ? db->capacity : UNIT_ARRAY_SIZE;
+    struct UserInfo *array;
+
+    while (capacity < count)
+        capacity <<= 1;
+    if (capacity > NO_RECORD)
+        capacity = NO_RECORD;
+
+    // a mapped array has no room left, so it is copied out first
+    if (db->arrayMapped)
+        array = malloc(capacity * sizeof(*array));
+    else
+        array = realloc(db->array, capacity * sizeof(*array));
+    if (array == NULL) {
+        fprintf(stderr,
+                "Can't allocate a memory for array of size %llu\n",
+                capacity);
+        return -1;
+    }
+
+    if (db->arrayMapped)
+        memcpy(array, db->array, db->size * sizeof(*array));
+    db->array = array;
+    db->capacity = (unsigned int)capacity;
+    db->arrayMapped = 0;
+
+    return 0;
+}
+
+/**
+ * IndexSlotsFor: get the index table size needed for a number of
+ * customers
+ *
+ * param capacity: current number of slots, a power of 2
+ * param count: number of customers
+ *
+ * returns: capacity doubled until count fits under the maximum load.
+ *  0 if that does not fit in an unsigned int
+ */
+static unsigned int IndexSlotsFor(unsigned int capacity,
+                                  unsigned long long count) {
+    while (count * MAX_LOAD_DENOMINATOR >
+           (unsigned long long)capacity * MAX_LOAD_NUMERATOR) {
+        if (capacity > UINT32_MAX / 2) {
+            fprintf(stderr, "Can't hold %llu customers\n", count);
+            return 0;
+        }
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+/**
+ * ReserveCustomers: grow the array and both index tables once to hold
+ * a given number of customers
+ *
+ * param db: pointer to database
+ * param count: number of customers, including the registered ones
+ *
+ * returns: 0 on success. -1 if memory allocation fails or count is too
+ *  large
+ */
+static int ReserveCustomers(DB_T db, unsigned long long count) {
+    if (count >= NO_RECORD) {
+        fprintf(stderr, "Can't hold %llu customers\n", count);
+        return -1;
+    }
+
+    if (count > db->capacity && GrowArray(db, count) < 0)
+        return -1;
+
+    unsigned int slots = IndexSlotsFor(
+        db->indexCapacity ? db->indexCapacity : UNIT_INDEX_SIZE, count);
+    if (slots == 0)
+        return -1;
+    if (slots != db->indexCapacity)
+        return ResizeIndex(db, slots);
+
+    return 0;
+}
+
+/**
+ * ProbeSlot: find the index slot of a key
+ *
+ *  probing starts at the home slot of the hash and stops at the first
+ *  empty slot. the stored hash is compared before the key itself
+ *
+ * param db: pointer to database
+ * param kind: which index table to search
+ * param key: pointer to null terminated string
+ * param hash: raw hash value of key
+ *
+ * returns: pointer to the slot referring to the customer with the key.
+ *  if there is none, pointer to the empty slot that ended the probing,
+ *  where the key would be inserted
+ */
+static unsigned int *ProbeSlot(DB_T db, enum KeyKind kind,
+                               const char *key, unsigned int hash) {
+    unsigned int *index = kind == KEY_ID ? db->idIndex : db->nameIndex;
+    unsigned int mask = db->indexCapacity - 1;
+    unsigned int i;
+
+    for (i = hash & mask; index[i] != NO_RECORD; i = (i + 1) & mask) {
+        struct UserInfo *p = &db->array[index[i]];
+
+        if (kind == KEY_ID) {
+            if (p->idHash == hash && strcmp(IdOf(db, p), key) == 0)
+                break;
+        } else {
+            if (p->nameHash == hash && strcmp(NameOf(db, p), key) == 0)
+                break;
+        }
+    }
+
+    STATS_PROBES(&db->counters, ((i - hash) & mask) + 1);
+    return &index[i];
+}
+
+/**
+ * FindSlot: find the index slot of a customer with a given key
+ *
+ * param db: pointer to database
+ * param kind: which index table to search
+ * param key: pointer to null terminated string
+ * param hash: raw hash value of key
+ *
+ * returns: pointer to the slot referring to the customer. NULL if
+ *  customer with the key does not exist
+ */
+static unsigned int *FindSlot(DB_T db, enum KeyKind kind,
+                              const char *key, unsigned int hash) {
+    unsigned int *slot = ProbeSlot(db, kind, key, hash);
+
+    return *slot != NO_RECORD ? slot : NULL;
+}
+
+/**
+ * FindRecordSlot: find the index slot referring to a given customer
+ *
+ * param db: pointer to database
+ * param kind: which index table to search
+ * param rec: index of a registered customer in the array
+ *
+ * returns: pointer to the slot referring to the customer
+ */
+static unsigned int *FindRecordSlot(DB_T db, enum KeyKind kind,
+                                    unsigned int rec) {
+    unsigned int *index = kind == KEY_ID ? db->idIndex : db->nameIndex;
+    unsigned int mask = db->indexCapacity - 1;
+    struct UserInfo *p = &db->array[rec];
+    unsigned int hash = kind == KEY_ID ? p->idHash : p->nameHash;
+    unsigned int i;
+
+    for (i = hash & mask; index[i] != rec; i = (i + 1) & mask)
+        assert(index[i] != NO_RECORD);
+
+    return &index[i];
+}
+
+/**
+ * EraseSlot: empty an index slot
+ *
+ *  later slots of the probe sequence are shifted back into the hole
+ *  unless that would move them before their home slot, so that no
+ *  tombstones are needed
+ *
+ * param db: pointer to database
+ * param kind: which index table the slot belongs to
+ * param slot: pointer to the slot
+ */
+static void EraseSlot(DB_T db, enum KeyKind kind, unsigned int *slot) {
+    unsigned int *index = kind == KEY_ID ? db->idIndex : db->nameIndex;
+    unsigned int mask = db->indexCapacity - 1;
+    unsigned int hole = (unsigned int)(slot - index);
+
+    for (unsigned int i = (hole + 1) & mask; index[i] != NO_RECORD;
+         i = (i + 1) & mask) {
+        struct UserInfo *p = &db->array[index[i]];
+        unsigned int home =
+            (kind == KEY_ID ? p->idHash : p->nameHash) & mask;
+
+        // the entry may move into the hole only if its home slot is
+        // not cyclically within (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            index[hole] = index[i];
+            hole = i;
+        }
+    }
+
+    index[hole] = NO_RECORD;
+}
+
+/**
+ * ResizeIndex: rebuild both index tables with a given size
+ *
+ *  customers are not moved. the new tables are filled from a single
+ *  pass over the dense array
+ *
+ * param db: pointer to database
+ * param newCapacity: number of slots. must be a power of 2
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the current tables are kept
+ */
+static int ResizeIndex(DB_T db, unsigned int newCapacity) {
+    unsigned long long start = StatsNow();
+    size_t size = newCapacity * sizeof(unsigned int);
+    unsigned int *idIndex = malloc(size);
+    unsigned int *nameIndex = malloc(size);
+    if (idIndex == NULL || nameIndex == NULL) {
+        fprintf(stderr,
+                "Can't allocate a memory for index of size %u\n",
+                newCapacity);
+        free(idIndex);
+        free(nameIndex);
+        return -1;
+    }
+
+    // every byte 0xff makes every slot NO_RECORD
+    memset(idIndex, 0xff, size);
+    memset(nameIndex, 0xff, size);
+
+    unsigned int mask = newCapacity - 1;
+    for (unsigned int rec = 0; rec < db->size; rec++) {
+        unsigned int i;
+
+        for (i = db->array[rec].idHash & mask; idIndex[i] != NO_RECORD;
+             i = (i + 1) & mask)
+            ;
+        idIndex[i] = rec;
+
+        for (i = db->array[rec].nameHash & mask;
+             nameIndex[i] != NO_RECORD; i = (i + 1) & mask)
+            ;
+        nameIndex[i] = rec;
+    }
+
+    if (!db->indexMapped) {
+        free(db->idIndex);
+        free(db->nameIndex);
+    }
+
+    // building the first tables of a new db is no rehash
+    if (db->indexCapacity != 0) {
+        db->rehashes++;
+        db->rehashNsec += StatsNow() - start;
+    }
+    db->idIndex = idIndex;
+    db->nameIndex = nameIndex;
+    db->indexCapacity = newCapacity;
+    db->indexMapped = 0;
+
+    return 0;
+}
+
+/**
+ * RemoveCustomer: remove a customer from the db and free its keys
+ *
+ *  the last customer of the array is moved into the hole, so that the
+ *  array stays dense. only its two index slots have to be updated
+ *
+ * param db: pointer to database
+ * param kind: which index table slot belongs to
+ * param slot: pointer to the slot referring to the customer
+ */
+static void RemoveCustomer(DB_T db, enum KeyKind kind,
+                           unsigned int *slot) {
+    unsigned int rec = *slot;
+    struct UserInfo *p = &db->array[rec];
+    unsigned int last = db->size - 1;
+    enum KeyKind other = kind == KEY_ID ? KEY_NAME : KEY_ID;
+
+    EraseSlot(db, kind, slot);
+    EraseSlot(db, other, FindRecordSlot(db, other, rec));
+    if (db->purchasesBuilt)
+        PurchaseIndexRemove(&db->purchases, IdOf(db, p), p->purchase);
+    if (db->namesBuilt)
+        NameIndexRemove(&db->names, NameOf(db, p));
+
+    // keys of a snapshot stay in the mapping
+    uintptr_t keys = (uintptr_t)IdOf(db, p);
+    if (keys - (uintptr_t)db->map >= db->mapSize)
+        ArenaFree(&db->arena, (void *)keys,
+                  p->nameOffset + strlen(NameOf(db, p)) + 1);
+
+    if (rec != last) {
+        *FindRecordSlot(db, KEY_ID, last) = rec;
+        *FindRecordSlot(db, KEY_NAME, last) = rec;
+        *p = db->array[last];
+    }
+
+    db->size--;
+}
+
+/**
+ * UpdatePurchase: change the purchase field of a customer in place
+ *
+ *  the customer keeps its array entry and index slots. an array still
+ *  in a snapshot mapping is written copy on write like any other
+ *  update
+ *
+ * param db: pointer to database
+ * param rec: index of the customer in the array
+ * param purchase: new purchase amount
+ */
+static void UpdatePurchase(DB_T db, unsigned int rec, int purchase) {
+    struct UserInfo *p = &db->array[rec];
+
+    if (db->purchasesBuilt)
+        PurchaseIndexUpdate(&db->purchases, IdOf(db, p), p->purchase,
+                            purchase);
+    if (db->namesBuilt)
+        NameIndexUpdate(&db->names, NameOf(db, p), purchase);
+    p->purchase = purchase;
+}
+
+/**
+ * SumChunk: sum a chunk of a GetSumCustomerPurchaseParallel() call
+ *
+ * param arg: pointer to the call's struct SumJob
+ * param chunk: index of the chunk
+ *
+ * returns: sum of function applications to the customers of the chunk
+ */
+static long long SumChunk(void *arg, unsigned int chunk) {
+    struct SumJob *job = arg;
+    DB_T db = job->db;
+    unsigned int begin = chunk * SUM_CHUNK_SIZE;
+    unsigned int end = begin + SUM_CHUNK_SIZE;
+    long long sum = 0;
+
+    if (end > db->size)
+        end = db->size;
+    for (unsigned int i = begin; i < end; i++) {
+        struct UserInfo *p = &db->array[i];
+        sum += job->fp(IdOf(db, p), NameOf(db, p), p->purchase);
+    }
+
+    return sum;
+}
+
+/**
+ * InsertOrdered: add a customer to the purchase and name indexes that
+ * are built
+ *
+ * param db: pointer to database
+ * param id: customer id, stored in the db
+ * param name: customer name, stored in the db
+ * param purchase: purchase amount
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  neither index holds the customer
+ */
+static int InsertOrdered(DB_T db, const char *id, const char *name,
+                         int purchase) {
+    if (db->purchasesBuilt &&
+        PurchaseIndexInsert(&db->purchases, id, name, purchase) < 0)
+        return -1;
+
+    if (db->namesBuilt &&
+        NameIndexInsert(&db->names, id, name, purchase) < 0) {
+        if (db->purchasesBuilt)
+            PurchaseIndexRemove(&db->purchases, id, purchase);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * BuildPurchaseIndex: build the purchase index of a db unless it is
+ * already there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildPurchaseIndex(DB_T db) {
+    if (db->purchasesBuilt)
+        return 0;
+
+    for (unsigned int i = 0; i < db->size; i++) {
+        const struct UserInfo *p = &db->array[i];
+
+        if (PurchaseIndexInsert(&db->purchases, IdOf(db, p),
+                                NameOf(db, p), p->purchase) < 0) {
+            fprintf(stderr, "Can't allocate a memory for index\n");
+            PurchaseIndexRelease(&db->purchases);
+            return -1;
+        }
+    }
+
+    db->purchasesBuilt = 1;
+    return 0;
+}
+
+/**
+ * BuildNameIndex: build the name index of a db unless it is already
+ * there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildNameIndex(DB_T db) {
+    if (db->namesBuilt)
+        return 0;
+
+    for (unsigned int i = 0; i < db->size; i++) {
+        const struct UserInfo *p = &db->array[i];
+
+        if (NameIndexInsert(&db->names, IdOf(db, p), NameOf(db, p),
+                            p->purchase) < 0) {
+            fprintf(stderr, "Can't allocate a memory for index\n");
+            NameIndexRelease(&db->names);
+            return -1;
+        }
+    }
+
+    db->namesBuilt = 1;
+    return 0;
+}
+
+/**
+ * WriteSnapshot: write the sections of a snapshot
+ *
+ *  the keys of the customers are laid out in array order, so that the
+ *  id offset of each customer is the total key size of the customers
+ *  before it
+ *
+ * param db: pointer to database
+ * param fp: file opened for writing at offset 0
+ *
+ * returns: 0 on success. -1 if a write fails
+ */
+static int WriteSnapshot(DB_T db, FILE *fp) {
+    struct SnapshotHeader h;
+    uint64_t indexSize = (uint64_t)db->indexCapacity * sizeof(unsigned);
+    uint64_t keysSize = 0;
+
+    for (unsigned int i = 0; i < db->size; i++) {
+        struct UserInfo *p = &db->array[i];
+        keysSize += p->nameOffset + strlen(NameOf(db, p)) + 1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.recordSize = sizeof(struct UserInfo);
+    h.size = db->size;
+    h.indexCapacity = db->indexCapacity;
+    h.seq = db->seq;
+    h.hash = (uint32_t)SnapshotHashOf(db->hash);
+    h.hashSeed = db->seed;
+    h.recordsOffset = sizeof(h);
+    h.idIndexOffset =
+        h.recordsOffset + (uint64_t)db->size * sizeof(struct UserInfo);
+    h.nameIndexOffset = h.idIndexOffset + indexSize;
+    h.keysOffset = h.nameIndexOffset + indexSize;
+    h.keysSize = keysSize;
+
+    if (fwrite(&h, sizeof(h), 1, fp) != 1)
+        return -1;
+
+    uint64_t offset = 0;
+    for (unsigned int i = 0; i < db->size; i++) {
+        struct UserInfo r = db->array[i];
+
+        r.id = offset;
+        offset += r.nameOffset + strlen(NameOf(db, &db->array[i])) + 1;
+        if (fwrite(&r, sizeof(r), 1, fp) != 1)
+            return -1;
+    }
+
+    if (fwrite(db->idIndex, sizeof(unsigned int), db->indexCapacity,
+               fp) != db->indexCapacity ||
+        fwrite(db->nameIndex, sizeof(unsigned int), db->indexCapacity,
+               fp) != db->indexCapacity)
+        return -1;
+
+    for (unsigned int i = 0; i < db->size; i++) {
+        struct UserInfo *p = &db->array[i];
+        size_t n = p->nameOffset + strlen(NameOf(db, p)) + 1;
+
+        if (fwrite(IdOf(db, p), 1, n, fp) != n)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * SnapshotHashOf: find how a snapshot refers to a hash function
+ *
+ * param hash: hash function of a db
+ *
+ * returns: SNAPSHOT_HASH_* value. -1 if hash is not built in
+ */
+static int SnapshotHashOf(HASHFUNC_T hash) {
+    if (hash == HashKeyWide)
+        return SNAPSHOT_HASH_WIDE;
+    if (hash == HashKeyMultiplicative)
+        return SNAPSHOT_HASH_MULTIPLICATIVE;
+    return -1;
+}
+
+/**
+ * CheckSnapshot: check that a snapshot header matches this build and
+ * describes sections inside the file
+ *
+ *  the customers themselves are trusted, as checking them would mean
+ *  touching every page of the file
+ *
+ * param h: pointer to the header at the start of the file
+ * param fileSize: size of the file
+ *
+ * returns: 0 if the snapshot can be used. -1 otherwise
+ */
+static int CheckSnapshot(const struct SnapshotHeader *h,
+                         size_t fileSize) {
+    uint64_t indexSize = (uint64_t)h->indexCapacity * sizeof(unsigned);
+    uint64_t recordsSize = (uint64_t)h->size * sizeof(struct UserInfo);
+
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != SNAPSHOT_VERSION ||
+        h->recordSize != sizeof(struct UserInfo))
+        return -1;
+
+    if (h->hash != SNAPSHOT_HASH_WIDE &&
+        h->hash != SNAPSHOT_HASH_MULTIPLICATIVE)
+        return -1;
+
+    // the index tables must be powers of 2 with an empty slot left
+    if (h->indexCapacity == 0 ||
+        (h->indexCapacity & (h->indexCapacity - 1)) != 0 ||
+        h->size >= h->indexCapacity)
+        return -1;
+
+    if (h->recordsOffset < sizeof(*h) ||
+        h->recordsOffset % sizeof(uint64_t) != 0 ||
+        h->idIndexOffset != h->recordsOffset + recordsSize ||
+        h->nameIndexOffset != h->idIndexOffset + indexSize ||
+        h->keysOffset != h->nameIndexOffset + indexSize ||
+        h->keysOffset > fileSize ||
+        h->keysSize > fileSize - h->keysOffset)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * LogMutation: log a mutation to the journal, if there is one, and
+ * count it
+ *
+ * param db: pointer to database
+ * param type: kind of mutation
+ * param p: pointer to the registered, removed or updated customer. an
+ *  update logs the purchase amount p holds
+ *
+ * returns: 0 on success. -1 if the journal failed
+ */
+static int LogMutation(DB_T db, enum JournalType type,
+                       const struct UserInfo *p) {
+    if (db->journal != NULL) {
+        struct JournalEntry e;
+
+        e.type = type;
+        e.seq = db->seq + 1;
+        e.id = IdOf(db, p);
+        e.name = type == JOURNAL_REGISTER ? NameOf(db, p) : NULL;
+        e.purchase = p->purchase;
+        if (JournalAppend(db->journal, &e) < 0)
+            return -1;
+    }
+
+    db->seq++;
+
+    return 0;
+}
+
+/**
+ * ReplayEntry: apply a journal entry to a db
+ *
+ *  the journal is not attached yet, so nothing is logged again
+ *
+ * param arg: pointer to struct Replay
+ * param e: pointer to entry
+ */
+static void ReplayEntry(void *arg, const struct JournalEntry *e) {
+    struct Replay *r = arg;
+    DB_T db = r->db;
+
+    if (e->type == JOURNAL_REGISTER) {
+        InsertCustomer(db, e->id, e->name, e->purchase,
+                       HashOfKey(db, e->id), HashOfKey(db, e->name));
+    } else {
+        unsigned int *slot =
+            FindSlot(db, KEY_ID, e->id, HashOfKey(db, e->id));
+        if (slot != NULL && e->type == JOURNAL_UNREGISTER)
+            RemoveCustomer(db, KEY_ID, slot);
+        else if (slot != NULL && e->purchase > 0)
+            UpdatePurchase(db, *slot, e->purchase);
+    }
+
+    db->seq = e->seq;
+    r->count++;
+}
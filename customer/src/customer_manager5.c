@@ -0,0 +1,1463 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: customer_manager5.c
+ */
+
+#include "customer_manager.h"
+#include "arena.h"
+#include "db_stats.h"
+#include "keyhash.h"
+#include "name_index.h"
+#include "purchase_index.h"
+#include "record_file.h"
+#include "sum_job.h"
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// number of buckets each table starts with, i.e. 1024 slots
+#define UNIT_BUCKET_SIZE 256
+
+// a table is grown once 9/10 of its slots are full. buckets of 4 slots
+// with 2 choices each can be filled to about 95% before displacement
+// searches start failing
+#define MAX_LOAD_NUMERATOR 9
+#define MAX_LOAD_DENOMINATOR 10
+
+// a bucket takes exactly one cache line
+#define CACHE_LINE_SIZE 64
+
+// number of customers a bucket holds
+enum { BUCKET_SLOTS = 4 };
+
+// a displacement search examines at most this many buckets, and moves
+// at most this many customers to make room for a new one
+enum { MAX_SEARCH_BUCKETS = 512, MAX_PATH_LENGTH = 5 };
+
+// buckets in a chunk of GetSumCustomerPurchaseParallel()
+enum { SUM_CHUNK_BUCKETS = 4096 };
+
+// keys of a batch are hashed and prefetched in groups of this many, so
+// that their cache misses overlap
+enum { BATCH_SIZE = 16 };
+
+struct UserInfo {
+    // purchase amount (> 0)
+    int purchase;
+
+    // hash value of id and name. not the remainder but the whole value.
+    unsigned int idHash;
+    unsigned int nameHash;
+
+    // offset of the name in keys, i.e. length of id + 1
+    unsigned int nameOffset;
+
+    // customer id followed by customer name, both null terminated.
+    // stored inline so that a customer is a single allocation
+    char keys[];
+};
+
+/* a bucket of a cuckoo table. the hash value of each customer is kept
+   next to it, so that a lookup only dereferences the customers whose
+   whole hash value matches */
+struct Bucket {
+    // hash values of the customers in slots. meaningless where the
+    // slot is empty
+    unsigned int hashes[BUCKET_SLOTS];
+
+    // customers. NULL where the slot is empty
+    struct UserInfo *slots[BUCKET_SLOTS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* a cuckoo hash table. every customer is in one of the two buckets its
+   hash value selects, so that a lookup reads at most two buckets */
+struct Table {
+    struct Bucket *buckets;
+
+    // number of buckets. always a power of 2 >= 2
+    unsigned int nbuckets;
+
+    // number of full slots
+    unsigned int size;
+
+    // resizes of the table, and the nanoseconds they took
+    unsigned long long rehashes;
+    unsigned long long rehashNsec;
+
+#if USE_STATS
+    // calls and probed buckets of each kind of operation that started
+    // with a search of this table
+    struct DBCounters counters;
+#endif
+};
+
+struct DB {
+    // cuckoo tables for id and name
+    struct Table idTable;
+    struct Table nameTable;
+
+    // current number of customers
+    unsigned int size;
+
+    // storage of the customers
+    struct Arena arena;
+
+    // customers ordered by purchase amount, and by name. each is built
+    // by the first query that needs it, so that a db that never runs
+    // one doesn't maintain it
+    struct PurchaseIndex purchases;
+    struct NameIndex names;
+    int purchasesBuilt;
+    int namesBuilt;
+
+    // function keys are hashed with, and the seed it is given. the
+    // seed is random unless the creator chose one
+    HASHFUNC_T hash;
+    unsigned long long seed;
+};
+
+/* a GetSumCustomerPurchaseParallel() call, summed a chunk at a time
+   by SumChunk() */
+struct SumJob {
+    DB_T db;
+    FUNCPTR_T fp;
+};
+
+/* a bucket reached by a displacement search. the customer in slot of
+   the parent bucket can move here */
+struct SearchNode {
+    unsigned int bucket;
+    int parent;
+    int slot;
+    int depth;
+};
+
+/* which key of a customer a table is indexed with */
+enum KeyKind { KEY_ID, KEY_NAME };
+
+/* raw hash value of a key under the hash function of db. the value is
+   finalized with an avalanche step, since both bucket choices are
+   taken from it */
+static inline unsigned int HashOfKey(DB_T db, const char *key) {
+    unsigned int hash = db->hash(key, db->seed);
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/* customer id, stored at the start of keys */
+static inline const char *IdOf(const struct UserInfo *p) {
+    return p->keys;
+}
+
+/* customer name, stored right after the id */
+static inline const char *NameOf(const struct UserInfo *p) {
+    return p->keys + p->nameOffset;
+}
+
+static DB_T CreateDB(HASHFUNC_T hash, unsigned long long seed,
+                     unsigned int nbuckets);
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash);
+static void RemoveCustomer(DB_T db, struct UserInfo *p);
+static void UpdatePurchase(DB_T db, struct UserInfo *p, int purchase);
+static void PrefetchBuckets(const struct Table *t, unsigned int hash);
+static long long SumChunk(void *arg, unsigned int chunk);
+static int BuildPurchaseIndex(DB_T db);
+static int BuildNameIndex(DB_T db);
+static int InitTable(struct Table *t, unsigned int nbuckets);
+static struct UserInfo **FindSlot(struct Table *t, enum KeyKind kind,
+                                  const char *key, unsigned int hash);
+static int InsertSlot(struct Table *t, enum KeyKind kind,
+                      struct UserInfo *user);
+static void EraseSlot(struct Table *t, struct UserInfo **slot);
+static int PlaceCustomer(struct Table *t, enum KeyKind kind,
+                         struct UserInfo *user);
+static int ResizeTable(struct Table *t, enum KeyKind kind,
+                       unsigned int nbuckets);
+static unsigned int BucketsFor(unsigned int nbuckets,
+                               unsigned long long count);
+static int ReserveTable(struct Table *t, enum KeyKind kind,
+                        unsigned long long count);
+static void AddTableStats(struct DBTableStats *ts,
+                          const struct Table *t, enum KeyKind kind);
+
+/**
+ * CreateCustomerDB: create a new customer db
+ *
+ * this function allocates resources necessary for storing customer
+ * information, e.g. cuckoo hash tables for storing customer info with
+ * id and name as key respectively
+ *
+ * returns: pointer to newly allocated database
+ */
+DB_T CreateCustomerDB(void) {
+    return CreateCustomerDBWithHash(HashKeyWide, RandomHashSeed());
+}
+
+/**
+ * CreateCustomerDBWithHash: create a new customer db with a given hash
+ * function
+ *
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithHash(HASHFUNC_T hash,
+                              unsigned long long seed) {
+    if (hash == NULL)
+        return NULL;
+
+    return CreateDB(hash, seed, UNIT_BUCKET_SIZE);
+}
+
+/**
+ * CreateCustomerDBWithCapacity: create a new customer db with room for
+ * a given number of customers
+ *
+ * param n: number of customers the tables are sized for
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithCapacity(int n) {
+    if (n < 0)
+        return NULL;
+
+    unsigned int nbuckets = BucketsFor(UNIT_BUCKET_SIZE, n);
+    if (nbuckets == 0)
+        return NULL;
+
+    return CreateDB(HashKeyWide, RandomHashSeed(), nbuckets);
+}
+
+/**
+ * CreateDB: allocate a db with tables of a given size
+ *
+ * param hash: function to hash ids and names with
+ * param seed: seed passed to hash
+ * param nbuckets: number of buckets of each table. must be a power of
+ *  2 >= 2
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+static DB_T CreateDB(HASHFUNC_T hash, unsigned long long seed,
+                     unsigned int nbuckets) {
+    DB_T db;
+
+    db = (DB_T)calloc(1, sizeof(struct DB));
+    if (db == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        return NULL;
+    }
+
+    db->hash = hash;
+    db->seed = seed;
+
+    if (InitTable(&db->idTable, nbuckets) < 0) {
+        free(db);
+        return NULL;
+    }
+
+    if (InitTable(&db->nameTable, nbuckets) < 0) {
+        free(db->idTable.buckets);
+        free(db);
+        return NULL;
+    }
+
+    ArenaInit(&db->arena);
+    PurchaseIndexInit(&db->purchases, seed);
+    NameIndexInit(&db->names);
+
+    return db;
+}
+
+/**
+ * DestroyCustomerDB: destroy a customer db
+ *
+ * this function frees all dynamically allocated resources in the
+ * database
+ *
+ * param db: pointer to database
+ */
+void DestroyCustomerDB(DB_T db) {
+    if (db == NULL)
+        return;
+
+    // every customer lives in the arena
+    ArenaRelease(&db->arena);
+    free(db->idTable.buckets);
+    free(db->nameTable.buckets);
+    PurchaseIndexRelease(&db->purchases);
+    NameIndexRelease(&db->names);
+    free(db);
+}
+
+/**
+ * RegisterCustomer: register a new customer
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains customer's
+ * id param name: pointer to null terminated string that contains
+ * customer's name param purchase: purchase value of customer
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+int RegisterCustomer(DB_T db, const char *id, const char *name,
+                     const int purchase) {
+    if (db == NULL || id == NULL || name == NULL || purchase <= 0)
+        return -1;
+
+    return InsertCustomer(db, id, name, purchase, HashOfKey(db, id),
+                          HashOfKey(db, name));
+}
+
+/**
+ * RegisterCustomerBatch: register several customers at once
+ *
+ * the keys of a group are hashed and both buckets of each key are
+ * prefetched in both tables before any customer is inserted, so that
+ * the cache misses of the group overlap
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param names: array of n names
+ * param purchases: array of n purchase values
+ * param n: number of customers
+ * param out: array receiving the result of each registration as
+ *  RegisterCustomer() returns it. may be NULL
+ *
+ * returns: number of customers registered. -1 on invalid arguments
+ */
+int RegisterCustomerBatch(DB_T db, const char **ids, const char **names,
+                          const int *purchases, int n, int *out) {
+    unsigned int idHashes[BATCH_SIZE], nameHashes[BATCH_SIZE];
+    int registered = 0;
+
+    if (db == NULL || ids == NULL || names == NULL ||
+        purchases == NULL || n < 0)
+        return -1;
+
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            if (id == NULL || name == NULL)
+                continue;
+
+            idHashes[j] = HashOfKey(db, id);
+            nameHashes[j] = HashOfKey(db, name);
+            PrefetchBuckets(&db->idTable, idHashes[j]);
+            PrefetchBuckets(&db->nameTable, nameHashes[j]);
+        }
+
+        for (int j = 0; j < m; j++) {
+            const char *id = ids[base + j], *name = names[base + j];
+            int purchase = purchases[base + j];
+            int res = -1;
+
+            if (id != NULL && name != NULL && purchase > 0)
+                res = InsertCustomer(db, id, name, purchase,
+                                     idHashes[j], nameHashes[j]);
+            if (res == 0)
+                registered++;
+            if (out != NULL)
+                out[base + j] = res;
+        }
+    }
+
+    return registered;
+}
+
+/**
+ * LoadCustomersFromFile: register the customers of a file
+ *
+ *  both tables are resized once to hold every customer of the file
+ *  before they are registered
+ *
+ * param db: pointer to database
+ * param path: path of a file of "id,name,purchase" lines
+ *
+ * returns: number of customers registered. -1 if the file can't be
+ *  read or parsed, or on invalid arguments
+ */
+int LoadCustomersFromFile(DB_T db, const char *path) {
+    struct RecordFile f;
+
+    if (db == NULL || path == NULL)
+        return -1;
+    if (RecordFileOpen(&f, path) < 0)
+        return -1;
+
+    if (ReserveTable(&db->idTable, KEY_ID, f.count) < 0 ||
+        ReserveTable(&db->nameTable, KEY_NAME, f.count) < 0) {
+        RecordFileClose(&f);
+        return -1;
+    }
+
+    int registered = RegisterCustomerBatch(db, f.ids, f.names,
+                                           f.purchases, f.count, NULL);
+    RecordFileClose(&f);
+
+    return registered;
+}
+
+/**
+ * InsertCustomer: register a new customer whose keys are hashed
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param name: pointer to null terminated string that contains name
+ * param purchase: purchase value of customer. must be positive
+ * param idHash: raw hash value of id
+ * param nameHash: raw hash value of name
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase, unsigned int idHash,
+                          unsigned int nameHash) {
+    STATS_OP(&db->idTable.counters, DB_OP_REGISTER);
+
+    if (FindSlot(&db->idTable, KEY_ID, id, idHash) != NULL ||
+        FindSlot(&db->nameTable, KEY_NAME, name, nameHash) != NULL)
+        return -1;
+
+    // the customer and both keys are a single block
+    size_t idSize = strlen(id) + 1;
+    size_t nameSize = strlen(name) + 1;
+    size_t size = offsetof(struct UserInfo, keys) + idSize + nameSize;
+    struct UserInfo *newUser = ArenaAlloc(&db->arena, size);
+    if (newUser == NULL) {
+        fprintf(stderr, "Can't allocate memory for new user\n");
+        return -1;
+    }
+
+    memcpy(newUser->keys, id, idSize);
+    memcpy(newUser->keys + idSize, name, nameSize);
+    newUser->nameOffset = (unsigned int)idSize;
+    newUser->purchase = purchase;
+    newUser->idHash = idHash;
+    newUser->nameHash = nameHash;
+
+    if (InsertSlot(&db->idTable, KEY_ID, newUser) < 0)
+        goto fail;
+
+    if (InsertSlot(&db->nameTable, KEY_NAME, newUser) < 0) {
+        EraseSlot(&db->idTable,
+                  FindSlot(&db->idTable, KEY_ID, id, idHash));
+        goto fail;
+    }
+
+    if (db->purchasesBuilt &&
+        PurchaseIndexInsert(&db->purchases, IdOf(newUser),
+                            NameOf(newUser), purchase) < 0)
+        goto unlink;
+
+    if (db->namesBuilt && NameIndexInsert(&db->names, IdOf(newUser),
+                                          NameOf(newUser), purchase) < 0) {
+        if (db->purchasesBuilt)
+            PurchaseIndexRemove(&db->purchases, IdOf(newUser), purchase);
+        goto unlink;
+    }
+
+    db->size++;
+
+    return 0;
+
+unlink:
+    fprintf(stderr, "Can't allocate memory for new user\n");
+    EraseSlot(&db->idTable, FindSlot(&db->idTable, KEY_ID, id, idHash));
+    EraseSlot(&db->nameTable,
+              FindSlot(&db->nameTable, KEY_NAME, name, nameHash));
+fail:
+    ArenaFree(&db->arena, newUser, size);
+    return -1;
+}
+
+/**
+ * RemoveCustomer: remove a customer from both tables and free it
+ *
+ * param db: pointer to database
+ * param p: pointer to customer
+ */
+static void RemoveCustomer(DB_T db, struct UserInfo *p) {
+    EraseSlot(&db->idTable,
+              FindSlot(&db->idTable, KEY_ID, IdOf(p), p->idHash));
+    EraseSlot(&db->nameTable, FindSlot(&db->nameTable, KEY_NAME,
+                                       NameOf(p), p->nameHash));
+
+    if (db->purchasesBuilt)
+        PurchaseIndexRemove(&db->purchases, IdOf(p), p->purchase);
+    if (db->namesBuilt)
+        NameIndexRemove(&db->names, NameOf(p));
+
+    size_t size = offsetof(struct UserInfo, keys) + p->nameOffset +
+                  strlen(NameOf(p)) + 1;
+    ArenaFree(&db->arena, p, size);
+
+    db->size--;
+}
+
+/**
+ * UpdatePurchase: change the purchase field of a customer in place
+ *
+ *  neither key changes, so the customer keeps its table slots. only
+ *  its position in the purchase index moves
+ *
+ * param db: pointer to database
+ * param p: pointer to customer
+ * param purchase: new purchase amount
+ */
+static void UpdatePurchase(DB_T db, struct UserInfo *p, int purchase) {
+    if (purchase == p->purchase)
+        return;
+
+    if (db->purchasesBuilt)
+        PurchaseIndexUpdate(&db->purchases, IdOf(p), p->purchase,
+                            purchase);
+    if (db->namesBuilt)
+        NameIndexUpdate(&db->names, NameOf(p), purchase);
+    p->purchase = purchase;
+}
+
+/**
+ * UnregisterCustomerByID: unregister a customer by id
+ *
+ * remove AND free a customer entry with a given id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise
+ */
+int UnregisterCustomerByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->idTable.counters, DB_OP_UNREGISTER);
+
+    struct UserInfo **slot =
+        FindSlot(&db->idTable, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    RemoveCustomer(db, *slot);
+
+    return 0;
+}
+
+/**
+ * UnregisterCustomerByName: unregister a customer by name
+ *
+ * remove AND free a customer entry with a given name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise
+ */
+int UnregisterCustomerByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+    STATS_OP(&db->nameTable.counters, DB_OP_UNREGISTER);
+
+    struct UserInfo **slot =
+        FindSlot(&db->nameTable, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    RemoveCustomer(db, *slot);
+
+    return 0;
+}
+
+/**
+ * GetPurchaseByID: get the purchase field of a customer by id
+ *
+ * the lookup reads at most the two buckets of the id, one cache line
+ * each, however full the table is
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: purchase field value of customer with id.
+ *  -1 if customer with id does not exist
+ */
+int GetPurchaseByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->idTable.counters, DB_OP_LOOKUP);
+
+    struct UserInfo **slot =
+        FindSlot(&db->idTable, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    return (*slot)->purchase;
+}
+
+/**
+ * GetPurchaseByIDBatch: get the purchase fields of several customers by
+ * id at once
+ *
+ * every key of a group is hashed and both of its buckets prefetched
+ * before any of them is searched, so that the cache misses of the
+ * group overlap
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param n: number of ids
+ * param out: array receiving the purchase field of each customer. -1
+ *  if customer with the id does not exist
+ *
+ * returns: number of customers found. -1 on invalid arguments
+ */
+int GetPurchaseByIDBatch(DB_T db, const char **ids, int n, int *out) {
+    unsigned int hashes[BATCH_SIZE];
+    int found = 0;
+
+    if (db == NULL || ids == NULL || out == NULL || n < 0)
+        return -1;
+
+    for (int base = 0; base < n; base += BATCH_SIZE) {
+        int m = n - base < BATCH_SIZE ? n - base : BATCH_SIZE;
+        const char **keys = ids + base;
+
+        for (int j = 0; j < m; j++) {
+            if (keys[j] == NULL)
+                continue;
+
+            hashes[j] = HashOfKey(db, keys[j]);
+            PrefetchBuckets(&db->idTable, hashes[j]);
+        }
+
+        for (int j = 0; j < m; j++) {
+            struct UserInfo **slot = NULL;
+            struct Table *t = &db->idTable;
+
+            if (keys[j] != NULL) {
+                STATS_OP(&t->counters, DB_OP_LOOKUP);
+                slot = FindSlot(t, KEY_ID, keys[j], hashes[j]);
+            }
+            out[base + j] = slot != NULL ? (*slot)->purchase : -1;
+            if (slot != NULL)
+                found++;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * GetPurchaseByName: get the purchase field of a customer by name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: purchase field value of customer with name
+ *  -1 if customer with name does not exist
+ */
+int GetPurchaseByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+    STATS_OP(&db->nameTable.counters, DB_OP_LOOKUP);
+
+    struct UserInfo **slot =
+        FindSlot(&db->nameTable, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    return (*slot)->purchase;
+}
+
+/**
+ * AddPurchaseByID: add an amount to the purchase field of a customer
+ * found by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param amount: amount to add. may be negative
+ *
+ * returns: new purchase field value of customer with id.
+ *  -1 if customer with id does not exist, or if the new value is not
+ *  a positive int
+ */
+int AddPurchaseByID(DB_T db, const char *id, int amount) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->idTable.counters, DB_OP_UPDATE);
+
+    struct UserInfo **slot =
+        FindSlot(&db->idTable, KEY_ID, id, HashOfKey(db, id));
+    if (slot == NULL)
+        return -1;
+
+    long long purchase = (long long)(*slot)->purchase + amount;
+    if (purchase <= 0 || purchase > INT_MAX)
+        return -1;
+
+    UpdatePurchase(db, *slot, (int)purchase);
+
+    return (int)purchase;
+}
+
+/**
+ * SetPurchaseByName: set the purchase field of a customer found by
+ * name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ * param purchase: new purchase amount (> 0)
+ *
+ * returns: 0 on success. -1 if customer with name does not exist or
+ *  purchase is not positive
+ */
+int SetPurchaseByName(DB_T db, const char *name, int purchase) {
+    if (db == NULL || name == NULL || purchase <= 0)
+        return -1;
+    STATS_OP(&db->nameTable.counters, DB_OP_UPDATE);
+
+    struct UserInfo **slot =
+        FindSlot(&db->nameTable, KEY_NAME, name, HashOfKey(db, name));
+    if (slot == NULL)
+        return -1;
+
+    UpdatePurchase(db, *slot, purchase);
+
+    return 0;
+}
+
+/**
+ * GetSumCustomerPurchase: apply a given function to all customers and
+ * get the sum of results
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to all customers
+ */
+int GetSumCustomerPurchase(DB_T db, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL)
+        return -1;
+
+    int sum = 0;
+
+    for (unsigned int i = 0; i < db->idTable.nbuckets; i++) {
+        const struct Bucket *b = &db->idTable.buckets[i];
+
+        for (int s = 0; s < BUCKET_SLOTS; s++) {
+            struct UserInfo *p = b->slots[s];
+            if (p != NULL)
+                sum += fp(IdOf(p), NameOf(p), p->purchase);
+        }
+    }
+
+    return sum;
+}
+
+/**
+ * GetSumCustomerPurchaseParallel: apply a given function to all
+ * customers on several threads and get the 64-bit sum of results
+ *
+ * the buckets are cut into chunks that the calling thread and up to
+ * nthreads - 1 helper threads take one at a time, each adding into
+ * its own partial sum
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T. it is called from
+ *  several threads at once
+ * param nthreads: number of threads to use
+ *
+ * returns: sum of function applications to all customers. -1 on
+ *  invalid arguments
+ */
+long long GetSumCustomerPurchaseParallel(DB_T db, FUNCPTR_T fp,
+                                         int nthreads) {
+    struct SumJob job;
+
+    if (db == NULL || fp == NULL || nthreads <= 0)
+        return -1;
+
+    job.db = db;
+    job.fp = fp;
+
+    return RunSumJob((db->idTable.nbuckets + SUM_CHUNK_BUCKETS - 1) /
+                         SUM_CHUNK_BUCKETS,
+                     SumChunk, &job, nthreads);
+}
+
+/**
+ * GetCustomersByPurchaseRange: apply a given function to the customers
+ * whose purchase amount lies in a range and get the sum of results
+ *
+ * the customers are found through the purchase index, largest amount
+ * first, in O(log n + k) for k customers in the range. the index is
+ * built first if no purchase query has run yet
+ *
+ * param db: pointer to database
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetCustomersByPurchaseRange(DB_T db, int low, int high,
+                                FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexRange(&db->purchases, low, high, fp);
+}
+
+/**
+ * GetTopKCustomers: apply a given function to the customers with the
+ * largest purchase amounts and get the sum of results
+ *
+ * param db: pointer to database
+ * param k: number of customers
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetTopKCustomers(DB_T db, int k, FUNCPTR_T fp) {
+    if (db == NULL || fp == NULL || k < 0 ||
+        BuildPurchaseIndex(db) < 0)
+        return -1;
+
+    return (int)PurchaseIndexTop(&db->purchases, k, fp);
+}
+
+/**
+ * ForEachCustomerWithNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix
+ *
+ * the customers are found through the name index in time proportional
+ * to the prefix length and the number of matches. the index is built
+ * first if no prefix query has run yet
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: number of matching customers. -1 on invalid arguments or if
+ *  the index can't be built
+ */
+int ForEachCustomerWithNamePrefix(DB_T db, const char *prefix,
+                                  FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    NameIndexVisit(&db->names, prefix, fp, &count);
+    return count;
+}
+
+/**
+ * GetSumCustomerPurchaseByNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix and get the sum of
+ * results
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if the index can't be built
+ */
+int GetSumCustomerPurchaseByNamePrefix(DB_T db, const char *prefix,
+                                       FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        BuildNameIndex(db) < 0)
+        return -1;
+
+    return (int)NameIndexVisit(&db->names, prefix, fp, &count);
+}
+
+/**
+ * GetCustomerDBStats: get the statistics of a customer db
+ *
+ * the chain length of a customer is the number of buckets a lookup of
+ * its key reads, i.e. 1 or 2
+ *
+ * param db: pointer to database
+ * param stats: pointer to the structure receiving the statistics
+ *
+ * returns: 0 on success. -1 on invalid arguments
+ */
+int GetCustomerDBStats(DB_T db, struct DBStats *stats) {
+    if (db == NULL || stats == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(struct DBStats));
+    AddTableStats(&stats->idTable, &db->idTable, KEY_ID);
+    AddTableStats(&stats->nameTable, &db->nameTable, KEY_NAME);
+
+    stats->bytesAllocated = sizeof(struct DB) +
+                            db->arena.bytesReserved +
+                            db->purchases.arena.bytesReserved +
+                            db->names.arena.bytesReserved;
+
+    const struct Table *tables[] = {&db->idTable, &db->nameTable};
+    for (int k = 0; k < 2; k++) {
+        const struct Table *t = tables[k];
+
+        stats->bytesAllocated +=
+            (unsigned long long)t->nbuckets * sizeof(struct Bucket);
+        stats->rehashes += t->rehashes;
+        stats->rehashNsec += t->rehashNsec;
+#if USE_STATS
+        StatsAddCounters(stats, &t->counters);
+#endif
+    }
+
+    return 0;
+}
+
+/**
+ * FirstBucket: first bucket a hash value selects
+ */
+static inline unsigned int FirstBucket(const struct Table *t,
+                                       unsigned int hash) {
+    return hash & (t->nbuckets - 1);
+}
+
+/**
+ * SecondBucket: second bucket a hash value selects
+ *
+ *  it is taken from a remix of the whole hash value, so that keys
+ *  sharing the first bucket are spread over different second buckets.
+ *  it never equals the first bucket
+ */
+static inline unsigned int SecondBucket(const struct Table *t,
+                                        unsigned int hash) {
+    unsigned int mix = hash * 0x9e3779b1U;
+    unsigned int b = ((mix >> 15) | (mix << 17)) & (t->nbuckets - 1);
+
+    return b != FirstBucket(t, hash) ? b : b ^ 1;
+}
+
+/**
+ * OtherBucket: the bucket of a hash value that is not a given one
+ *
+ * param t: pointer to table
+ * param hash: raw hash value of a key
+ * param bucket: one of the two buckets of hash
+ */
+static inline unsigned int OtherBucket(const struct Table *t,
+                                       unsigned int hash,
+                                       unsigned int bucket) {
+    unsigned int first = FirstBucket(t, hash);
+
+    return bucket != first ? first : SecondBucket(t, hash);
+}
+
+/**
+ * MatchHash: find the slots of a bucket holding a given hash value
+ *
+ * param b: pointer to bucket
+ * param hash: hash value to search for
+ *
+ * returns: bitmask whose i-th bit is set if b->hashes[i] == hash. the
+ *  slot may still be empty
+ */
+static inline unsigned int MatchHash(const struct Bucket *b,
+                                     unsigned int hash) {
+#if defined(__SSE2__)
+    __m128i hashes = _mm_load_si128((const __m128i *)b->hashes);
+    __m128i eq = _mm_cmpeq_epi32(hashes, _mm_set1_epi32((int)hash));
+    return (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(eq));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < BUCKET_SLOTS; i++)
+        if (b->hashes[i] == hash)
+            mask |= 1U << i;
+    return mask;
+#endif
+}
+
+/**
+ * KeyOf: get the key a table is indexed with
+ */
+static inline const char *KeyOf(const struct UserInfo *p,
+                                enum KeyKind kind) {
+    return kind == KEY_ID ? IdOf(p) : NameOf(p);
+}
+
+/**
+ * HashOf: get the hash of the key a table is indexed with
+ */
+static inline unsigned int HashOf(const struct UserInfo *p,
+                                  enum KeyKind kind) {
+    return kind == KEY_ID ? p->idHash : p->nameHash;
+}
+
+/**
+ * InitTable: allocate an empty table
+ *
+ * param t: pointer to table
+ * param nbuckets: number of buckets. must be a power of 2 >= 2
+ *
+ * returns: 0 on success. -1 if memory allocation fails
+ */
+static int InitTable(struct Table *t, unsigned int nbuckets) {
+    assert(nbuckets >= 2 && (nbuckets & (nbuckets - 1)) == 0);
+
+    if (posix_memalign((void **)&t->buckets, CACHE_LINE_SIZE,
+                       (size_t)nbuckets * sizeof(struct Bucket)) != 0) {
+        fprintf(stderr,
+                "Can't allocate a memory for table of %u buckets\n",
+                nbuckets);
+        t->buckets = NULL;
+        return -1;
+    }
+
+    memset(t->buckets, 0, (size_t)nbuckets * sizeof(struct Bucket));
+    t->nbuckets = nbuckets;
+    t->size = 0;
+
+    return 0;
+}
+
+/**
+ * FindSlot: search a table for a customer with a given key
+ *
+ *  the key can only be in one of its two buckets, so at most two
+ *  buckets are read. only customers whose whole hash value matches are
+ *  compared by key
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param key: pointer to null terminated string
+ * param hash: raw hash value of key
+ *
+ * returns: pointer to the slot holding the customer. NULL if customer
+ *  with the key does not exist
+ */
+static struct UserInfo **FindSlot(struct Table *t, enum KeyKind kind,
+                                  const char *key, unsigned int hash) {
+    unsigned int buckets[2] = {FirstBucket(t, hash),
+                               SecondBucket(t, hash)};
+
+    for (int k = 0; k < 2; k++) {
+        struct Bucket *b = &t->buckets[buckets[k]];
+
+        STATS_PROBES(&t->counters, 1);
+
+        for (unsigned int m = MatchHash(b, hash); m != 0; m &= m - 1) {
+            struct UserInfo *p = b->slots[__builtin_ctz(m)];
+            if (p != NULL && strcmp(KeyOf(p, kind), key) == 0)
+                return &b->slots[__builtin_ctz(m)];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * PrefetchBuckets: prefetch both buckets a lookup of a hash reads
+ *
+ * param t: pointer to table
+ * param hash: raw hash value of key
+ */
+static void PrefetchBuckets(const struct Table *t, unsigned int hash) {
+    __builtin_prefetch(&t->buckets[FirstBucket(t, hash)]);
+    __builtin_prefetch(&t->buckets[SecondBucket(t, hash)]);
+}
+
+/**
+ * FreeSlot: find an empty slot of a bucket
+ *
+ * returns: slot index. -1 if the bucket is full
+ */
+static inline int FreeSlot(const struct Bucket *b) {
+    for (int s = 0; s < BUCKET_SLOTS; s++)
+        if (b->slots[s] == NULL)
+            return s;
+
+    return -1;
+}
+
+/**
+ * PlaceCustomer: put a customer into one of its buckets, displacing
+ * others if both are full
+ *
+ *  the search for room is breadth first: starting from the two buckets
+ *  of the customer, each customer of a visited bucket leads to its own
+ *  other bucket, until a bucket with an empty slot is found. the
+ *  customers on the path to it are then moved one step each, last one
+ *  first, which frees a slot in a bucket of the new customer. breadth
+ *  first search finds the shortest such path, so few customers move
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param user: pointer to customer
+ *
+ * returns: 0 on success. -1 if no path within MAX_PATH_LENGTH moves
+ *  was found, in which case the table holds the same customers as
+ *  before
+ */
+static int PlaceCustomer(struct Table *t, enum KeyKind kind,
+                         struct UserInfo *user) {
+    struct SearchNode queue[MAX_SEARCH_BUCKETS];
+    unsigned int hash = HashOf(user, kind);
+    int head, tail = 0, hole = -1;
+
+    queue[tail++] =
+        (struct SearchNode){FirstBucket(t, hash), -1, -1, 0};
+    queue[tail++] =
+        (struct SearchNode){SecondBucket(t, hash), -1, -1, 0};
+
+    for (head = 0; head < tail; head++) {
+        const struct SearchNode *n = &queue[head];
+        const struct Bucket *b = &t->buckets[n->bucket];
+
+        if ((hole = FreeSlot(b)) >= 0)
+            break;
+        if (n->depth == MAX_PATH_LENGTH)
+            continue;
+
+        for (int s = 0; s < BUCKET_SLOTS && tail < MAX_SEARCH_BUCKETS;
+             s++) {
+            unsigned int next =
+                OtherBucket(t, HashOf(b->slots[s], kind), n->bucket);
+            queue[tail++] =
+                (struct SearchNode){next, head, s, n->depth + 1};
+        }
+    }
+
+    if (head == tail)
+        return -1;
+
+    // a bucket may appear twice on the path, in which case an earlier
+    // move has changed it. every move is checked, so that a stale one
+    // stops the walk before it puts a customer in a wrong bucket
+    int n = head;
+    for (; queue[n].parent >= 0; n = queue[n].parent) {
+        unsigned int src = queue[queue[n].parent].bucket;
+        struct Bucket *to = &t->buckets[queue[n].bucket];
+        struct Bucket *from = &t->buckets[src];
+        int s = queue[n].slot;
+        struct UserInfo *p = from->slots[s];
+
+        if (p == NULL || to->slots[hole] != NULL ||
+            OtherBucket(t, HashOf(p, kind), src) != queue[n].bucket)
+            return -1;
+
+        to->slots[hole] = p;
+        to->hashes[hole] = from->hashes[s];
+        from->slots[s] = NULL;
+        hole = s;
+    }
+
+    struct Bucket *b = &t->buckets[queue[n].bucket];
+    assert(b->slots[hole] == NULL);
+    b->slots[hole] = user;
+    b->hashes[hole] = hash;
+
+    return 0;
+}
+
+/**
+ * InsertSlot: insert a customer into a table, growing it if necessary
+ *
+ *  the table is doubled when it reaches the maximum load, or earlier
+ *  if no room can be made for the customer
+ *
+ *  the caller must make sure that the key is not in the table yet
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param user: pointer to customer
+ *
+ * returns: 0 on success. -1 if memory allocation fails
+ */
+static int InsertSlot(struct Table *t, enum KeyKind kind,
+                      struct UserInfo *user) {
+    unsigned int nbuckets = BucketsFor(t->nbuckets, t->size + 1ULL);
+
+    if (nbuckets == 0)
+        return -1;
+    if (nbuckets != t->nbuckets &&
+        ResizeTable(t, kind, nbuckets) < 0)
+        return -1;
+
+    // below half load, a failed search means that many keys share
+    // their buckets, which growing the table would not fix
+    while (PlaceCustomer(t, kind, user) < 0) {
+        if (t->size < t->nbuckets / 2 * BUCKET_SLOTS) {
+            fprintf(stderr, "Can't place new user in table\n");
+            return -1;
+        }
+        if (t->nbuckets > UINT32_MAX / BUCKET_SLOTS / 2 ||
+            ResizeTable(t, kind, t->nbuckets << 1) < 0)
+            return -1;
+    }
+
+    t->size++;
+
+    return 0;
+}
+
+/**
+ * EraseSlot: remove a customer from a table
+ *
+ *  no other customer has to move, since a lookup reads both buckets of
+ *  a key whether they are full or not
+ *
+ * param t: pointer to table
+ * param slot: pointer to the slot, as returned by FindSlot
+ */
+static void EraseSlot(struct Table *t, struct UserInfo **slot) {
+    *slot = NULL;
+    t->size--;
+}
+
+/**
+ * ResizeTable: move all customers of a table into a new table
+ *
+ *  if some customer can't be placed in the new table, a table twice as
+ *  large is tried instead
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param nbuckets: number of buckets of the new table
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the table is left untouched
+ */
+static int ResizeTable(struct Table *t, enum KeyKind kind,
+                       unsigned int nbuckets) {
+    struct Table newTable;
+    unsigned long long start = StatsNow();
+
+    for (;; nbuckets <<= 1) {
+        if (InitTable(&newTable, nbuckets) < 0)
+            return -1;
+
+        unsigned int i;
+        for (i = 0; i < t->nbuckets; i++) {
+            const struct Bucket *b = &t->buckets[i];
+            int s;
+
+            for (s = 0; s < BUCKET_SLOTS; s++)
+                if (b->slots[s] != NULL &&
+                    PlaceCustomer(&newTable, kind, b->slots[s]) < 0)
+                    break;
+            if (s < BUCKET_SLOTS)
+                break;
+        }
+
+        if (i == t->nbuckets)
+            break;
+
+        free(newTable.buckets);
+        if (nbuckets > UINT32_MAX / BUCKET_SLOTS / 2) {
+            fprintf(stderr, "Can't place %u customers\n", t->size);
+            return -1;
+        }
+    }
+
+    // the statistics carry over to the new table
+    newTable.size = t->size;
+    newTable.rehashes = t->rehashes + 1;
+    newTable.rehashNsec = t->rehashNsec + StatsNow() - start;
+#if USE_STATS
+    newTable.counters = t->counters;
+#endif
+
+    free(t->buckets);
+    *t = newTable;
+
+    return 0;
+}
+
+/**
+ * BucketsFor: get the number of buckets needed for a number of
+ * customers
+ *
+ * param nbuckets: current number of buckets, a power of 2
+ * param count: number of customers
+ *
+ * returns: nbuckets doubled until count fits under the maximum load.
+ *  0 if the slots would not fit in an unsigned int
+ */
+static unsigned int BucketsFor(unsigned int nbuckets,
+                               unsigned long long count) {
+    while (count > (unsigned long long)nbuckets * BUCKET_SLOTS /
+                       MAX_LOAD_DENOMINATOR * MAX_LOAD_NUMERATOR) {
+        if (nbuckets > UINT32_MAX / BUCKET_SLOTS / 2) {
+            fprintf(stderr, "Can't hold %llu customers\n", count);
+            return 0;
+        }
+        nbuckets <<= 1;
+    }
+
+    return nbuckets;
+}
+
+/**
+ * ReserveTable: grow a table once to hold a number of new customers
+ *
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ * param count: number of new customers
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the table is left as it was
+ */
+static int ReserveTable(struct Table *t, enum KeyKind kind,
+                        unsigned long long count) {
+    unsigned int nbuckets = BucketsFor(t->nbuckets, t->size + count);
+
+    if (nbuckets == 0)
+        return -1;
+    if (nbuckets == t->nbuckets)
+        return 0;
+
+    return ResizeTable(t, kind, nbuckets);
+}
+
+/**
+ * AddTableStats: fill in the statistics of a table
+ *
+ * param ts: pointer to zero-filled table statistics
+ * param t: pointer to table
+ * param kind: which key the table is indexed with
+ */
+static void AddTableStats(struct DBTableStats *ts,
+                          const struct Table *t, enum KeyKind kind) {
+    for (unsigned int i = 0; i < t->nbuckets; i++) {
+        const struct Bucket *b = &t->buckets[i];
+
+        for (int s = 0; s < BUCKET_SLOTS; s++) {
+            if (b->slots[s] == NULL)
+                continue;
+
+            unsigned int hash = HashOf(b->slots[s], kind);
+            StatsAddChain(ts, i == FirstBucket(t, hash) ? 1 : 2);
+        }
+    }
+
+    StatsFinishTable(ts,
+                     (unsigned long long)t->nbuckets * BUCKET_SLOTS);
+}
+
+/**
+ * SumChunk: sum a chunk of a GetSumCustomerPurchaseParallel() call
+ *
+ * param arg: pointer to the call's struct SumJob
+ * param chunk: index of the chunk
+ *
+ * returns: sum of function applications to the customers of the chunk
+ */
+static long long SumChunk(void *arg, unsigned int chunk) {
+    struct SumJob *job = arg;
+    struct Table *t = &job->db->idTable;
+    unsigned int begin = chunk * SUM_CHUNK_BUCKETS;
+    unsigned int end = begin + SUM_CHUNK_BUCKETS;
+    long long sum = 0;
+
+    if (end > t->nbuckets)
+        end = t->nbuckets;
+    for (unsigned int i = begin; i < end; i++) {
+        const struct Bucket *b = &t->buckets[i];
+
+        for (int s = 0; s < BUCKET_SLOTS; s++) {
+            struct UserInfo *p = b->slots[s];
+            if (p != NULL)
+                sum += job->fp(IdOf(p), NameOf(p), p->purchase);
+        }
+    }
+
+    return sum;
+}
+
+/**
+ * BuildPurchaseIndex: build the purchase index of a db unless it is
+ * already there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildPurchaseIndex(DB_T db) {
+    struct Table *t = &db->idTable;
+
+    if (db->purchasesBuilt)
+        return 0;
+
+    for (unsigned int i = 0; i < t->nbuckets; i++) {
+        const struct Bucket *b = &t->buckets[i];
+
+        for (int s = 0; s < BUCKET_SLOTS; s++) {
+            struct UserInfo *p = b->slots[s];
+
+            if (p != NULL &&
+                PurchaseIndexInsert(&db->purchases, IdOf(p), NameOf(p),
+                                    p->purchase) < 0) {
+                fprintf(stderr, "Can't allocate a memory for index\n");
+                PurchaseIndexRelease(&db->purchases);
+                return -1;
+            }
+        }
+    }
+
+    db->purchasesBuilt = 1;
+    return 0;
+}
+
+/**
+ * BuildNameIndex: build the name index of a db unless it is already
+ * there
+ *
+ * param db: pointer to database
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left empty
+ */
+static int BuildNameIndex(DB_T db) {
+    struct Table *t = &db->idTable;
+
+    if (db->namesBuilt)
+        return 0;
+
+    for (unsigned int i = 0; i < t->nbuckets; i++) {
+        const struct Bucket *b = &t->buckets[i];
+
+        for (int s = 0; s < BUCKET_SLOTS; s++) {
+            struct UserInfo *p = b->slots[s];
+
+            if (p != NULL && NameIndexInsert(&db->names, IdOf(p),
+                                             NameOf(p), p->purchase) < 0) {
+                fprintf(stderr, "Can't allocate a memory for index\n");
+                NameIndexRelease(&db->names);
+                return -1;
+            }
+        }
+    }
+
+    db->namesBuilt = 1;
+    return 0;
+}
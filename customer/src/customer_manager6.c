@@ -0,0 +1,1808 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: customer_manager6.c
+ */
+
+#include "customer_manager.h"
+#include "db_stats.h"
+#include "keyhash.h"
+#include "record_file.h"
+#include "sum_job.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define UNIT_ARRAY_SIZE 1024
+#define UNIT_INDEX_SIZE 2048
+
+// key bytes a region is sized for per customer, before its key section
+// has to grow
+#define UNIT_KEY_BYTES 32
+
+// index slots hold 4 bytes only, so an index table is kept at most half
+// full to keep linear probe sequences short
+#define MAX_LOAD_NUMERATOR 1
+#define MAX_LOAD_DENOMINATOR 2
+
+// customers in a chunk of GetSumCustomerPurchaseParallel()
+#define SUM_CHUNK_SIZE 16384
+
+// an index slot that refers to no customer
+#define NO_RECORD 0xffffffffU
+
+// regions start with this magic and format version
+#define REGION_MAGIC "EE209SHM"
+#define REGION_VERSION 2
+
+// sections of a region are aligned to cache lines, and regions are
+// sized in whole pages
+#define SECTION_ALIGN 64
+#define REGION_ALIGN 4096
+
+/* a customer. it lives in a region that every process maps at its own
+   address, so it holds no pointer */
+struct UserInfo {
+    // offset of the customer id from the key section. id and name
+    // share one block, id first
+    uint64_t id;
+
+    // purchase amount (> 0)
+    int purchase;
+
+    // offset of the name from the id
+    unsigned int nameOffset;
+
+    // hash value of id and name. not the remainder but the whole value.
+    unsigned int idHash;
+    unsigned int nameHash;
+};
+
+/* where the sections of a region lie, as offsets from its start */
+struct Sections {
+    // number of array entries, and of slots of each index table. the
+    // latter is always a power of 2
+    uint32_t capacity;
+    uint32_t indexCapacity;
+
+    // dense array of customers, linear probing tables for id and name
+    // holding indices into it, and the id and name strings
+    uint64_t arrayOffset;
+    uint64_t idIndexOffset;
+    uint64_t nameIndexOffset;
+    uint64_t keysOffset;
+    uint64_t keysSize;
+};
+
+/* header at the start of a region. everything else in the region is
+   found through it */
+struct SharedHeader {
+    char magic[8];
+    uint32_t version;
+
+    // sizeof(struct UserInfo) of the writer
+    uint32_t recordSize;
+
+    // seqlock of the region. odd while the writer is updating it. a
+    // reader retries whatever it read while the count was odd or
+    // changed
+    uint32_t seq;
+
+    // number of customers. the first size array entries are valid
+    uint32_t size;
+
+    // bytes the region spans. it only grows, so that the mappings of
+    // readers stay valid until they map it again
+    uint64_t regionSize;
+
+    // seed of HashKeyWide, which every process hashes keys with
+    uint64_t hashSeed;
+
+    struct Sections sections;
+
+    // bytes of the key section handed out, and those of them freed by
+    // removed customers. freed bytes are reclaimed when the region is
+    // repacked
+    uint64_t keysUsed;
+    uint64_t keysFree;
+
+    // times the region was repacked, and the nanoseconds it took
+    uint64_t rehashes;
+    uint64_t rehashNsec;
+};
+
+/* a handle on a region, private to the process that opened it */
+struct DB {
+    // mapping of the region, starting with its header
+    struct SharedHeader *h;
+    size_t mapSize;
+
+    // shared memory object the region lives in, read-only for readers.
+    // an unnamed db has a memory file instead
+    int fd;
+
+    // name of the object, removed when the writer is destroyed. NULL
+    // for an unnamed db and for readers
+    char *name;
+
+    // nonzero for the handle that created the region. only it updates
+    // the region, so it reads without the seqlock
+    int writer;
+
+    // seed keys are hashed with, copied from the header
+    unsigned long long seed;
+
+#if USE_STATS
+    // calls and probes of each kind of operation
+    struct DBCounters counters;
+#endif
+};
+
+/* the sections of a region at the addresses a handle maps them at, as
+   read from its header at the start of a read */
+struct Layout {
+    struct UserInfo *array;
+    unsigned int *idIndex;
+    unsigned int *nameIndex;
+    char *keys;
+    unsigned int size;
+    unsigned int capacity;
+    unsigned int indexCapacity;
+    uint64_t keysSize;
+    uint64_t keysUsed;
+
+#if USE_STATS
+    // counters of the handle, which probes are charged to
+    struct DBCounters *counters;
+#endif
+};
+
+/* customers a query walks. the writer walks the region itself; a
+   reader walks a copy it took under the seqlock, so that fp never sees
+   a torn customer and is never called twice for one */
+struct View {
+    const struct UserInfo *array;
+    unsigned int size;
+    const char *keys;
+
+    // malloc'ed block holding the copy. NULL for the writer
+    char *copy;
+};
+
+/* a customer passed to fp by the ordered queries */
+struct Match {
+    const char *id;
+    const char *name;
+    int purchase;
+};
+
+/* which key of a customer an index table is indexed with */
+enum KeyKind { KEY_ID, KEY_NAME };
+
+/* a GetSumCustomerPurchaseParallel() call, summed a chunk at a time
+   by SumChunk() */
+struct SumJob {
+    const struct View *view;
+    FUNCPTR_T fp;
+};
+
+static inline const char *IdOf(const struct View *v,
+                               const struct UserInfo *p) {
+    return v->keys + p->id;
+}
+
+static inline const char *NameOf(const struct View *v,
+                                 const struct UserInfo *p) {
+    return IdOf(v, p) + p->nameOffset;
+}
+
+/* raw hash value of a key under the seed of db */
+static inline unsigned int HashOfKey(DB_T db, const char *key) {
+    return HashKeyWide(key, db->seed);
+}
+
+static DB_T CreateDB(const char *name, unsigned int n);
+static uint64_t PlanSections(struct Sections *s, unsigned int capacity,
+                             unsigned int indexCapacity,
+                             uint64_t keysSize);
+static unsigned int IndexSlotsFor(unsigned int capacity,
+                                  unsigned long long count);
+static int LoadLayout(DB_T db, struct Layout *l);
+static int ReadBegin(DB_T db, struct Layout *l, unsigned int *seq);
+static int ReadRetry(DB_T db, unsigned int seq);
+static int Remap(DB_T db);
+static void WriteBegin(DB_T db);
+static void WriteEnd(DB_T db);
+static int GrowRegion(DB_T db, uint64_t size);
+static int Repack(DB_T db, unsigned long long count,
+                  uint64_t keyBytes);
+static int Reserve(DB_T db, unsigned long long count,
+                   uint64_t keyBytes);
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase);
+static unsigned int *ProbeSlot(const struct Layout *l,
+                               enum KeyKind kind, const char *key,
+                               unsigned int hash);
+static unsigned int *FindRecordSlot(const struct Layout *l,
+                                    enum KeyKind kind,
+                                    unsigned int rec);
+static void EraseSlot(const struct Layout *l, enum KeyKind kind,
+                      unsigned int *slot);
+static int RemoveCustomer(DB_T db, enum KeyKind kind, const char *key);
+static int LookupPurchase(DB_T db, enum KeyKind kind, const char *key);
+static int UpdatePurchase(DB_T db, enum KeyKind kind, const char *key,
+                          int amount, int add);
+static int OpenView(DB_T db, struct View *v);
+static void CloseView(struct View *v);
+static long long SumChunk(void *arg, unsigned int chunk);
+static struct Match *CollectMatches(const struct View *v, int low,
+                                    int high, unsigned int *n);
+static int CompareMatches(const void *a, const void *b);
+static long long VisitByNamePrefix(DB_T db, const char *prefix,
+                                   FUNCPTR_T fp, int *count);
+
+/**
+ * CreateCustomerDB: create a new customer db
+ *
+ * this function allocates resources necessary for storing customer
+ * information, e.g. a dense array of customers and index tables for
+ * looking them up with id and name as key respectively. they live in
+ * an unnamed shared region that no other process can open; see
+ * CreateSharedCustomerDB()
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDB(void) {
+    return CreateDB(NULL, UNIT_ARRAY_SIZE);
+}
+
+/**
+ * CreateCustomerDBWithCapacity: create a new customer db with room for
+ * a given number of customers
+ *
+ * param n: number of customers the region is sized for
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+DB_T CreateCustomerDBWithCapacity(int n) {
+    if (n < 0)
+        return NULL;
+
+    return CreateDB(NULL, (unsigned int)n);
+}
+
+/**
+ * CreateSharedCustomerDB: create a new customer db in a named shared
+ * memory object
+ *
+ *  any object of the same name is replaced. the object is readable by
+ *  the processes of the same user only
+ *
+ * param name: name of the object, as shm_open() takes it
+ *
+ * returns: pointer to newly allocated database, the writer of the
+ *  region. NULL on failure
+ */
+DB_T CreateSharedCustomerDB(const char *name) {
+    if (name == NULL)
+        return NULL;
+
+    return CreateDB(name, UNIT_ARRAY_SIZE);
+}
+
+/**
+ * OpenSharedCustomerDB: open a reader of a db another handle created
+ *
+ *  the region is mapped read-only. it is mapped again whenever a read
+ *  finds that the writer has grown it
+ *
+ * param name: name the db was created with
+ *
+ * returns: pointer to the reader. NULL if there is no such db or on
+ *  failure
+ */
+DB_T OpenSharedCustomerDB(const char *name) {
+    struct stat st;
+
+    if (name == NULL)
+        return NULL;
+
+    DB_T db = (DB_T)calloc(1, sizeof(struct DB));
+    if (db == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        return NULL;
+    }
+
+    db->fd = shm_open(name, O_RDONLY, 0);
+    if (db->fd < 0)
+        goto fail;
+    if (fstat(db->fd, &st) < 0 ||
+        (size_t)st.st_size < sizeof(struct SharedHeader))
+        goto fail;
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                     db->fd, 0);
+    if (map == MAP_FAILED)
+        goto fail;
+    db->h = map;
+    db->mapSize = (size_t)st.st_size;
+
+    // the writer sets the magic last
+    if (memcmp(db->h->magic, REGION_MAGIC, 8) != 0 ||
+        db->h->version != REGION_VERSION ||
+        db->h->recordSize != sizeof(struct UserInfo)) {
+        fprintf(stderr, "Shared region %s is not a db\n", name);
+        goto fail;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    db->seed = db->h->hashSeed;
+
+    return db;
+
+fail:
+    if (db->h != NULL)
+        munmap(db->h, db->mapSize);
+    if (db->fd >= 0)
+        close(db->fd);
+    free(db);
+    return NULL;
+}
+
+/**
+ * CreateDB: create the region of a db and its writer
+ *
+ * param name: name of the shared memory object to create. NULL for an
+ *  unnamed region
+ * param n: number of customers. the array holds at least
+ *  UNIT_ARRAY_SIZE
+ *
+ * returns: pointer to newly allocated database. NULL on failure
+ */
+static DB_T CreateDB(const char *name, unsigned int n) {
+    struct Sections s;
+
+    DB_T db = (DB_T)calloc(1, sizeof(struct DB));
+    if (db == NULL) {
+        fprintf(stderr, "Can't allocate a memory for DB_T\n");
+        return NULL;
+    }
+
+    db->fd = -1;
+    db->writer = 1;
+    db->seed = RandomHashSeed();
+
+    if (n < UNIT_ARRAY_SIZE)
+        n = UNIT_ARRAY_SIZE;
+    if (n >= NO_RECORD) {
+        fprintf(stderr, "Can't hold %u customers\n", n);
+        goto fail;
+    }
+    unsigned int slots = IndexSlotsFor(UNIT_INDEX_SIZE, n);
+    if (slots == 0)
+        goto fail;
+    uint64_t size =
+        PlanSections(&s, n, slots, (uint64_t)n * UNIT_KEY_BYTES);
+
+    // a new object is zero-filled. an unnamed one is a memory file
+    // rather than an anonymous mapping, which could not grow
+    if (name != NULL) {
+        db->name = strdup(name);
+        if (db->name == NULL)
+            goto fail;
+
+        shm_unlink(name);
+        db->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    } else {
+        db->fd = memfd_create("customer_db", 0);
+    }
+    if (db->fd < 0 || ftruncate(db->fd, (off_t)size) < 0) {
+        fprintf(stderr, "Can't create shared region %s\n",
+                name != NULL ? name : "");
+        goto fail;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     db->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr,
+                "Can't allocate a memory for region of size %llu\n",
+                (unsigned long long)size);
+        goto fail;
+    }
+    db->h = map;
+    db->mapSize = size;
+
+    struct SharedHeader *h = db->h;
+    h->version = REGION_VERSION;
+    h->recordSize = sizeof(struct UserInfo);
+    h->regionSize = size;
+    h->hashSeed = db->seed;
+    h->sections = s;
+
+    // both index tables are contiguous. every byte 0xff makes every
+    // slot NO_RECORD
+    memset((char *)h + s.idIndexOffset, 0xff,
+           2 * (size_t)slots * sizeof(unsigned int));
+
+    // readers check the magic before anything else
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(h->magic, REGION_MAGIC, 8);
+
+    return db;
+
+fail:
+    if (db->fd >= 0)
+        close(db->fd);
+    if (db->name != NULL)
+        shm_unlink(name);
+    free(db->name);
+    free(db);
+    return NULL;
+}
+
+/**
+ * DestroyCustomerDB: destroy a customer db
+ *
+ *  destroying the writer of a named db removes its name. readers that
+ *  still map the region keep reading it as the writer left it
+ *
+ * param db: pointer to database
+ */
+void DestroyCustomerDB(DB_T db) {
+    if (db == NULL)
+        return;
+
+    munmap(db->h, db->mapSize);
+    close(db->fd);
+    if (db->name != NULL)
+        shm_unlink(db->name);
+    free(db->name);
+    free(db);
+}
+
+/**
+ * RegisterCustomer: register a new customer
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains customer's
+ *  id
+ * param name: pointer to null terminated string that contains
+ *  customer's name
+ * param purchase: purchase value of customer
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise, as
+ *  for a reader
+ */
+int RegisterCustomer(DB_T db, const char *id, const char *name,
+                     const int purchase) {
+    if (db == NULL || id == NULL || name == NULL || purchase <= 0 ||
+        !db->writer)
+        return -1;
+
+    return InsertCustomer(db, id, name, purchase);
+}
+
+/**
+ * RegisterCustomerBatch: register several customers at once
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param names: array of n names
+ * param purchases: array of n purchase values
+ * param n: number of customers
+ * param out: array receiving the result of each registration as
+ *  RegisterCustomer() returns it. may be NULL
+ *
+ * returns: number of customers registered. -1 on invalid arguments
+ */
+int RegisterCustomerBatch(DB_T db, const char **ids, const char **names,
+                          const int *purchases, int n, int *out) {
+    int registered = 0;
+
+    if (db == NULL || ids == NULL || names == NULL ||
+        purchases == NULL || n < 0 || !db->writer)
+        return -1;
+
+    for (int i = 0; i < n; i++) {
+        int res = RegisterCustomer(db, ids[i], names[i], purchases[i]);
+
+        if (res == 0)
+            registered++;
+        if (out != NULL)
+            out[i] = res;
+    }
+
+    return registered;
+}
+
+/**
+ * LoadCustomersFromFile: register the customers of a file
+ *
+ *  the region is repacked at most once to hold every customer of the
+ *  file and its keys before they are registered
+ *
+ * param db: pointer to database
+ * param path: path of a file of "id,name,purchase" lines
+ *
+ * returns: number of customers registered. -1 if the file can't be
+ *  read or parsed, or on invalid arguments
+ */
+int LoadCustomersFromFile(DB_T db, const char *path) {
+    struct RecordFile f;
+    uint64_t keyBytes = 0;
+
+    if (db == NULL || path == NULL || !db->writer)
+        return -1;
+    if (RecordFileOpen(&f, path) < 0)
+        return -1;
+
+    for (int i = 0; i < f.count; i++)
+        keyBytes += strlen(f.ids[i]) + strlen(f.names[i]) + 2;
+
+    unsigned long long count =
+        db->h->size + (unsigned long long)f.count;
+    if (Reserve(db, count, keyBytes) < 0) {
+        RecordFileClose(&f);
+        return -1;
+    }
+
+    int registered = RegisterCustomerBatch(db, f.ids, f.names,
+                                           f.purchases, f.count, NULL);
+    RecordFileClose(&f);
+
+    return registered;
+}
+
+/**
+ * UnregisterCustomerByID: unregister a customer by id
+ *
+ * remove AND free a customer entry with a given id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise, as for
+ *  a reader
+ */
+int UnregisterCustomerByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL || !db->writer)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UNREGISTER);
+
+    return RemoveCustomer(db, KEY_ID, id);
+}
+
+/**
+ * UnregisterCustomerByName: unregister a customer by name
+ *
+ * remove AND free a customer entry with a given name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: 0 if customer is successfully removed. -1 otherwise, as for
+ *  a reader
+ */
+int UnregisterCustomerByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL || !db->writer)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UNREGISTER);
+
+    return RemoveCustomer(db, KEY_NAME, name);
+}
+
+/**
+ * GetPurchaseByID: get the purchase field of a customer by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ *
+ * returns: purchase field value of customer with id.
+ *  -1 if customer with id does not exist
+ */
+int GetPurchaseByID(DB_T db, const char *id) {
+    if (db == NULL || id == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_LOOKUP);
+
+    return LookupPurchase(db, KEY_ID, id);
+}
+
+/**
+ * GetPurchaseByIDBatch: get the purchase fields of several customers by
+ * id at once
+ *
+ * param db: pointer to database
+ * param ids: array of n ids
+ * param n: number of ids
+ * param out: array receiving the purchase field of each customer. -1
+ *  if customer with the id does not exist
+ *
+ * returns: number of customers found. -1 on invalid arguments
+ */
+int GetPurchaseByIDBatch(DB_T db, const char **ids, int n, int *out) {
+    int found = 0;
+
+    if (db == NULL || ids == NULL || out == NULL || n < 0)
+        return -1;
+
+    for (int i = 0; i < n; i++) {
+        out[i] = GetPurchaseByID(db, ids[i]);
+        if (out[i] >= 0)
+            found++;
+    }
+
+    return found;
+}
+
+/**
+ * GetPurchaseByName: get the purchase field of a customer by name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ *
+ * returns: purchase field value of customer with name
+ *  -1 if customer with name does not exist
+ */
+int GetPurchaseByName(DB_T db, const char *name) {
+    if (db == NULL || name == NULL)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_LOOKUP);
+
+    return LookupPurchase(db, KEY_NAME, name);
+}
+
+/**
+ * AddPurchaseByID: add an amount to the purchase field of a customer
+ * found by id
+ *
+ * param db: pointer to database
+ * param id: pointer to null terminated string that contains id
+ * param amount: amount to add. may be negative
+ *
+ * returns: new purchase field value of customer with id.
+ *  -1 if customer with id does not exist, if the new value is not a
+ *  positive int, or for a reader
+ */
+int AddPurchaseByID(DB_T db, const char *id, int amount) {
+    if (db == NULL || id == NULL || !db->writer)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UPDATE);
+
+    return UpdatePurchase(db, KEY_ID, id, amount, 1);
+}
+
+/**
+ * SetPurchaseByName: set the purchase field of a customer found by
+ * name
+ *
+ * param db: pointer to database
+ * param name: pointer to null terminated string that contains name
+ * param purchase: new purchase amount (> 0)
+ *
+ * returns: 0 on success. -1 if customer with name does not exist, if
+ *  purchase is not positive, or for a reader
+ */
+int SetPurchaseByName(DB_T db, const char *name, int purchase) {
+    if (db == NULL || name == NULL || purchase <= 0 || !db->writer)
+        return -1;
+    STATS_OP(&db->counters, DB_OP_UPDATE);
+
+    return UpdatePurchase(db, KEY_NAME, name, purchase, 0) < 0 ? -1 : 0;
+}
+
+/**
+ * GetSumCustomerPurchase: apply a given function to all customers and
+ * get the sum of results
+ *
+ *  a reader applies fp to a copy of the customers as they were at one
+ *  point in time
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to all customers. -1 on
+ *  invalid arguments or if a reader can't copy the customers
+ */
+int GetSumCustomerPurchase(DB_T db, FUNCPTR_T fp) {
+    struct View v;
+
+    if (db == NULL || fp == NULL || OpenView(db, &v) < 0)
+        return -1;
+
+    int sum = 0;
+
+    // the array is dense, so this is a single sequential pass
+    for (unsigned int i = 0; i < v.size; i++) {
+        const struct UserInfo *p = &v.array[i];
+        sum += fp(IdOf(&v, p), NameOf(&v, p), p->purchase);
+    }
+    CloseView(&v);
+
+    return sum;
+}
+
+/**
+ * GetSumCustomerPurchaseParallel: apply a given function to all
+ * customers on several threads and get the 64-bit sum of results
+ *
+ * the array is cut into chunks that the calling thread and up to
+ * nthreads - 1 helper threads take one at a time, each adding into
+ * its own partial sum
+ *
+ * param db: pointer to database
+ * param fp: pointer to a function of type FUNCPTR_T. it is called from
+ *  several threads at once
+ * param nthreads: number of threads to use
+ *
+ * returns: sum of function applications to all customers. -1 on
+ *  invalid arguments or if a reader can't copy the customers
+ */
+long long GetSumCustomerPurchaseParallel(DB_T db, FUNCPTR_T fp,
+                                         int nthreads) {
+    struct SumJob job;
+    struct View v;
+
+    if (db == NULL || fp == NULL || nthreads <= 0 ||
+        OpenView(db, &v) < 0)
+        return -1;
+
+    job.view = &v;
+    job.fp = fp;
+
+    long long sum =
+        RunSumJob((v.size + SUM_CHUNK_SIZE - 1) / SUM_CHUNK_SIZE,
+                  SumChunk, &job, nthreads);
+    CloseView(&v);
+
+    return sum;
+}
+
+/**
+ * GetCustomersByPurchaseRange: apply a given function to the customers
+ * whose purchase amount lies in a range and get the sum of results
+ *
+ * the region holds no ordered index, so the customers in the range
+ * are collected and sorted on every call, in O(n + k log k) for k
+ * customers in the range
+ *
+ * param db: pointer to database
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if memory allocation fails
+ */
+int GetCustomersByPurchaseRange(DB_T db, int low, int high,
+                                FUNCPTR_T fp) {
+    struct View v;
+    unsigned int n;
+    long long sum = 0;
+
+    if (db == NULL || fp == NULL || OpenView(db, &v) < 0)
+        return -1;
+
+    struct Match *matches = CollectMatches(&v, low, high, &n);
+    if (matches == NULL) {
+        CloseView(&v);
+        return -1;
+    }
+
+    qsort(matches, n, sizeof(struct Match), CompareMatches);
+    for (unsigned int i = 0; i < n; i++)
+        sum += fp(matches[i].id, matches[i].name, matches[i].purchase);
+
+    free(matches);
+    CloseView(&v);
+
+    return (int)sum;
+}
+
+/**
+ * GetTopKCustomers: apply a given function to the customers with the
+ * largest purchase amounts and get the sum of results
+ *
+ *  every customer is sorted, as the region holds no ordered index
+ *
+ * param db: pointer to database
+ * param k: number of customers
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if memory allocation fails
+ */
+int GetTopKCustomers(DB_T db, int k, FUNCPTR_T fp) {
+    struct View v;
+    unsigned int n;
+    long long sum = 0;
+
+    if (db == NULL || fp == NULL || k < 0 || OpenView(db, &v) < 0)
+        return -1;
+
+    struct Match *matches = CollectMatches(&v, 1, INT_MAX, &n);
+    if (matches == NULL) {
+        CloseView(&v);
+        return -1;
+    }
+
+    qsort(matches, n, sizeof(struct Match), CompareMatches);
+    for (unsigned int i = 0; i < n && i < (unsigned int)k; i++)
+        sum += fp(matches[i].id, matches[i].name, matches[i].purchase);
+
+    free(matches);
+    CloseView(&v);
+
+    return (int)sum;
+}
+
+/**
+ * ForEachCustomerWithNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix
+ *
+ *  every customer is checked, as the region holds no ordered index
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: number of matching customers. -1 on invalid arguments or if
+ *  a reader can't copy the customers
+ */
+int ForEachCustomerWithNamePrefix(DB_T db, const char *prefix,
+                                  FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL ||
+        VisitByNamePrefix(db, prefix, fp, &count) < 0)
+        return -1;
+
+    return count;
+}
+
+/**
+ * GetSumCustomerPurchaseByNamePrefix: apply a given function to the
+ * customers whose name starts with a given prefix and get the sum of
+ * results
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers. -1 on
+ *  invalid arguments or if a reader can't copy the customers
+ */
+int GetSumCustomerPurchaseByNamePrefix(DB_T db, const char *prefix,
+                                       FUNCPTR_T fp) {
+    int count = 0;
+
+    if (db == NULL || prefix == NULL || fp == NULL)
+        return -1;
+
+    return (int)VisitByNamePrefix(db, prefix, fp, &count);
+}
+
+/**
+ * GetCustomerDBStats: get the statistics of a customer db
+ *
+ * the chain length of a customer is its distance from its home slot
+ * plus one. memory counts the whole region, which the writer and its
+ * readers share
+ *
+ * param db: pointer to database
+ * param stats: pointer to the structure receiving the statistics
+ *
+ * returns: 0 on success. -1 on invalid arguments or if a reader can't
+ *  map the region
+ */
+int GetCustomerDBStats(DB_T db, struct DBStats *stats) {
+    struct Layout l;
+    unsigned int seq;
+
+    if (db == NULL || stats == NULL)
+        return -1;
+
+    do {
+        if (ReadBegin(db, &l, &seq) < 0)
+            return -1;
+        memset(stats, 0, sizeof(struct DBStats));
+
+        unsigned int mask = l.indexCapacity - 1;
+        for (unsigned int i = 0; i <= mask; i++) {
+            unsigned int rec = l.idIndex[i];
+            if (rec < l.size)
+                StatsAddChain(&stats->idTable,
+                              ((i - l.array[rec].idHash) & mask) + 1);
+
+            rec = l.nameIndex[i];
+            if (rec < l.size)
+                StatsAddChain(&stats->nameTable,
+                              ((i - l.array[rec].nameHash) & mask) + 1);
+        }
+        StatsFinishTable(&stats->idTable, l.indexCapacity);
+        StatsFinishTable(&stats->nameTable, l.indexCapacity);
+
+        stats->bytesAllocated = sizeof(struct DB) + db->mapSize;
+        stats->rehashes = db->h->rehashes;
+        stats->rehashNsec = db->h->rehashNsec;
+    } while (ReadRetry(db, seq));
+
+#if USE_STATS
+    StatsAddCounters(stats, &db->counters);
+#endif
+
+    return 0;
+}
+
+/**
+ * PlanSections: lay out the sections of a region
+ *
+ * param s: pointer to the structure receiving the offsets
+ * param capacity: number of array entries
+ * param indexCapacity: number of slots of each index table
+ * param keysSize: size of the key section in bytes
+ *
+ * returns: size of the region in bytes
+ */
+static uint64_t PlanSections(struct Sections *s, unsigned int capacity,
+                             unsigned int indexCapacity,
+                             uint64_t keysSize) {
+    uint64_t align = SECTION_ALIGN - 1;
+    uint64_t arraySize = (uint64_t)capacity * sizeof(struct UserInfo);
+
+    s->capacity = capacity;
+    s->indexCapacity = indexCapacity;
+    s->arrayOffset = (sizeof(struct SharedHeader) + align) & ~align;
+    s->idIndexOffset = s->arrayOffset + ((arraySize + align) & ~align);
+    s->nameIndexOffset = s->idIndexOffset +
+                         (uint64_t)indexCapacity * sizeof(unsigned int);
+    s->keysOffset = s->nameIndexOffset +
+                    (uint64_t)indexCapacity * sizeof(unsigned int);
+    s->keysSize = keysSize;
+
+    align = REGION_ALIGN - 1;
+    return (s->keysOffset + keysSize + align) & ~align;
+}
+
+/**
+ * IndexSlotsFor: get the index table size needed for a number of
+ * customers
+ *
+ * param capacity: current number of slots, a power of 2
+ * param count: number of customers
+ *
+ * returns: capacity doubled until count fits under the maximum load.
+ *  0 if that does not fit in an unsigned int
+ */
+static unsigned int IndexSlotsFor(unsigned int capacity,
+                                  unsigned long long count) {
+    while (count * MAX_LOAD_DENOMINATOR >
+           (unsigned long long)capacity * MAX_LOAD_NUMERATOR) {
+        if (capacity > UINT32_MAX / 2) {
+            fprintf(stderr, "Can't hold %llu customers\n", count);
+            return 0;
+        }
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+/**
+ * Fits: check that a range of bytes lies within a limit
+ *
+ * param offset: start of the range
+ * param size: size of the range
+ * param limit: end of the space the range must lie in
+ *
+ * returns: nonzero if [offset, offset + size) is within [0, limit)
+ */
+static inline int Fits(uint64_t offset, uint64_t size, uint64_t limit) {
+    return offset <= limit && size <= limit - offset;
+}
+
+/**
+ * LoadLayout: find the sections of the region through its header
+ *
+ *  a reader may read the header while the writer is updating it, so
+ *  the sections are checked to lie within the mapping before any of
+ *  them is read
+ *
+ * param db: pointer to database
+ * param l: pointer to the structure receiving the sections
+ *
+ * returns: 0 on success. -1 if the sections read do not fit in the
+ *  mapping, as when they are torn or the region has grown
+ */
+static int LoadLayout(DB_T db, struct Layout *l) {
+    const struct SharedHeader *h = db->h;
+    struct Sections s = h->sections;
+    uint64_t indexSize =
+        (uint64_t)s.indexCapacity * sizeof(unsigned int);
+    char *base = (char *)db->h;
+
+    l->size = h->size;
+    l->keysUsed = h->keysUsed;
+    if (s.indexCapacity == 0 ||
+        (s.indexCapacity & (s.indexCapacity - 1)) != 0 ||
+        l->size > s.capacity || l->keysUsed > s.keysSize ||
+        !Fits(s.arrayOffset,
+              (uint64_t)s.capacity * sizeof(struct UserInfo),
+              db->mapSize) ||
+        !Fits(s.idIndexOffset, indexSize, db->mapSize) ||
+        !Fits(s.nameIndexOffset, indexSize, db->mapSize) ||
+        !Fits(s.keysOffset, s.keysSize, db->mapSize) ||
+        s.arrayOffset % sizeof(uint64_t) != 0 ||
+        s.idIndexOffset % sizeof(unsigned int) != 0 ||
+        s.nameIndexOffset % sizeof(unsigned int) != 0)
+        return -1;
+
+    l->array = (struct UserInfo *)(base + s.arrayOffset);
+    l->idIndex = (unsigned int *)(base + s.idIndexOffset);
+    l->nameIndex = (unsigned int *)(base + s.nameIndexOffset);
+    l->keys = base + s.keysOffset;
+    l->capacity = s.capacity;
+    l->indexCapacity = s.indexCapacity;
+    l->keysSize = s.keysSize;
+#if USE_STATS
+    l->counters = &db->counters;
+#endif
+
+    return 0;
+}
+
+/**
+ * ReadBegin: start reading the region
+ *
+ *  a reader waits while the writer is updating the region, and maps
+ *  the region again if it has grown. the writer reads right away
+ *
+ * param db: pointer to database
+ * param l: pointer to the structure receiving the sections
+ * param seq: pointer receiving the seqlock count to pass to
+ *  ReadRetry()
+ *
+ * returns: 0 on success. -1 if a reader can't map the region
+ */
+static int ReadBegin(DB_T db, struct Layout *l, unsigned int *seq) {
+    *seq = 0;
+    if (db->writer)
+        return LoadLayout(db, l);
+
+    for (;;) {
+        *seq = __atomic_load_n(&db->h->seq, __ATOMIC_ACQUIRE);
+        if (*seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        if (LoadLayout(db, l) == 0)
+            return 0;
+
+        // sections that do not fit in a header that did not change
+        // are those of a grown region
+        if (!ReadRetry(db, *seq) && Remap(db) < 0 &&
+            !ReadRetry(db, *seq))
+            return -1;
+    }
+}
+
+/**
+ * ReadRetry: check whether a read has to be retried
+ *
+ * param db: pointer to database
+ * param seq: seqlock count ReadBegin() returned
+ *
+ * returns: nonzero if the writer updated the region since ReadBegin(),
+ *  so that what was read may be torn. always 0 for the writer
+ */
+static int ReadRetry(DB_T db, unsigned int seq) {
+    if (db->writer)
+        return 0;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&db->h->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/**
+ * Remap: map the region of a reader again after it has grown
+ *
+ * param db: pointer to database, a reader
+ *
+ * returns: 0 on success. -1 if the region has not grown or can't be
+ *  mapped, in which case the current mapping is kept
+ */
+static int Remap(DB_T db) {
+    struct stat st;
+    uint64_t size = __atomic_load_n(&db->h->regionSize,
+                                    __ATOMIC_RELAXED);
+
+    // the writer grows the object before it announces the new size
+    if (size <= db->mapSize || fstat(db->fd, &st) < 0 ||
+        (uint64_t)st.st_size < size)
+        return -1;
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, db->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+
+    munmap(db->h, db->mapSize);
+    db->h = map;
+    db->mapSize = size;
+
+    return 0;
+}
+
+/**
+ * WriteBegin: start updating the region
+ *
+ * param db: pointer to database, the writer
+ */
+static void WriteBegin(DB_T db) {
+    __atomic_store_n(&db->h->seq, db->h->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * WriteEnd: finish updating the region, so that readers see the update
+ *
+ * param db: pointer to database, the writer
+ */
+static void WriteEnd(DB_T db) {
+    __atomic_store_n(&db->h->seq, db->h->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * GrowRegion: make the region of the writer span a given size
+ *
+ *  the mapping may move. the new size is not published in the header
+ *
+ * param db: pointer to database, the writer
+ * param size: size in bytes, larger than the current one
+ *
+ * returns: 0 on success. -1 otherwise, in which case the region is left
+ *  as it was
+ */
+static int GrowRegion(DB_T db, uint64_t size) {
+    if (ftruncate(db->fd, (off_t)size) < 0) {
+        fprintf(stderr, "Can't grow shared region to %llu bytes\n",
+                (unsigned long long)size);
+        return -1;
+    }
+
+    void *map = mremap(db->h, db->mapSize, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        fprintf(stderr,
+                "Can't allocate a memory for region of size %llu\n",
+                (unsigned long long)size);
+        return -1;
+    }
+
+    db->h = map;
+    db->mapSize = size;
+
+    return 0;
+}
+
+/**
+ * Repack: lay the region out again with room for a given number of
+ * customers and key bytes
+ *
+ *  the array and index tables are doubled until they are large enough,
+ *  and the key section is made twice the size of the live keys and
+ *  those to come, so that the keys of removed customers are reclaimed.
+ *  the new contents are built aside and copied into the region in one
+ *  update, since they overlap the old ones. the region never shrinks
+ *
+ * param db: pointer to database, the writer
+ * param count: number of customers, including the registered ones
+ * param keyBytes: key bytes to make room for
+ *
+ * returns: 0 on success. -1 if memory allocation fails or count is too
+ *  large, in which case the region is left as it was
+ */
+static int Repack(DB_T db, unsigned long long count,
+                  uint64_t keyBytes) {
+    unsigned long long start = StatsNow();
+    struct SharedHeader *h = db->h;
+    struct Sections s;
+    struct Layout l;
+
+    if (count >= NO_RECORD) {
+        fprintf(stderr, "Can't hold %llu customers\n", count);
+        return -1;
+    }
+
+    unsigned long long capacity = h->sections.capacity;
+    while (capacity < count)
+        capacity <<= 1;
+    if (capacity >= NO_RECORD)
+        capacity = NO_RECORD - 1;
+
+    unsigned int slots =
+        IndexSlotsFor(h->sections.indexCapacity, count);
+    if (slots == 0)
+        return -1;
+
+    uint64_t live = h->keysUsed - h->keysFree + keyBytes;
+    uint64_t keysSize = h->sections.keysSize;
+    while (keysSize < 2 * live)
+        keysSize <<= 1;
+
+    uint64_t size = PlanSections(&s, (unsigned int)capacity, slots,
+                                 keysSize);
+
+    // the contents start at the array, and end at the live keys
+    uint64_t contents = s.keysOffset + live - s.arrayOffset;
+    char *buf = malloc(contents);
+    if (buf == NULL) {
+        fprintf(stderr,
+                "Can't allocate a memory for region of size %llu\n",
+                (unsigned long long)size);
+        return -1;
+    }
+
+    LoadLayout(db, &l);
+    struct UserInfo *array = (struct UserInfo *)buf;
+    unsigned int *idIndex =
+        (unsigned int *)(buf + (s.idIndexOffset - s.arrayOffset));
+    unsigned int *nameIndex =
+        (unsigned int *)(buf + (s.nameIndexOffset - s.arrayOffset));
+    char *keys = buf + (s.keysOffset - s.arrayOffset);
+    uint64_t keysUsed = 0;
+
+    memset(idIndex, 0xff, 2 * (size_t)slots * sizeof(unsigned int));
+
+    unsigned int mask = slots - 1;
+    for (unsigned int rec = 0; rec < l.size; rec++) {
+        const struct UserInfo *p = &l.array[rec];
+        const char *id = l.keys + p->id;
+        size_t bytes = p->nameOffset + strlen(id + p->nameOffset) + 1;
+        unsigned int i;
+
+        array[rec] = *p;
+        array[rec].id = keysUsed;
+        memcpy(keys + keysUsed, id, bytes);
+        keysUsed += bytes;
+
+        for (i = p->idHash & mask; idIndex[i] != NO_RECORD;
+             i = (i + 1) & mask)
+            ;
+        idIndex[i] = rec;
+
+        for (i = p->nameHash & mask; nameIndex[i] != NO_RECORD;
+             i = (i + 1) & mask)
+            ;
+        nameIndex[i] = rec;
+    }
+
+    // the object grows before readers can see the larger sections
+    if (size > db->mapSize && GrowRegion(db, size) < 0) {
+        free(buf);
+        return -1;
+    }
+    h = db->h;
+
+    WriteBegin(db);
+    memcpy((char *)h + s.arrayOffset, buf,
+           s.keysOffset - s.arrayOffset + keysUsed);
+    h->sections = s;
+    if (size > h->regionSize)
+        h->regionSize = size;
+    h->keysUsed = keysUsed;
+    h->keysFree = 0;
+    h->rehashes++;
+    h->rehashNsec += StatsNow() - start;
+    WriteEnd(db);
+
+    free(buf);
+
+    return 0;
+}
+
+/**
+ * Reserve: repack the region unless it has room for a given number of
+ * customers and key bytes
+ *
+ * param db: pointer to database, the writer
+ * param count: number of customers, including the registered ones
+ * param keyBytes: key bytes to make room for
+ *
+ * returns: 0 on success. -1 if the region lacks room and can't be
+ *  repacked
+ */
+static int Reserve(DB_T db, unsigned long long count,
+                   uint64_t keyBytes) {
+    const struct SharedHeader *h = db->h;
+
+    if (count <= h->sections.capacity &&
+        count * MAX_LOAD_DENOMINATOR <=
+            (unsigned long long)h->sections.indexCapacity *
+                MAX_LOAD_NUMERATOR &&
+        keyBytes <= h->sections.keysSize - h->keysUsed)
+        return 0;
+
+    return Repack(db, count, keyBytes);
+}
+
+/**
+ * InsertCustomer: register a new customer
+ *
+ *  the region is repacked first if the customer does not fit in it
+ *
+ * param db: pointer to database, the writer
+ * param id: pointer to null terminated string that contains id
+ * param name: pointer to null terminated string that contains name
+ * param purchase: purchase value of customer
+ *
+ * returns: 0 if customer is successfully registered. -1 otherwise
+ */
+static int InsertCustomer(DB_T db, const char *id, const char *name,
+                          int purchase) {
+    struct Layout l;
+
+    STATS_OP(&db->counters, DB_OP_REGISTER);
+
+    size_t idSize = strlen(id) + 1;
+    size_t nameSize = strlen(name) + 1;
+
+    // the region grows before the keys are searched for, so that the
+    // empty slots the searches end at are still valid for the
+    // insertion
+    if (Reserve(db, db->h->size + 1ULL, idSize + nameSize) < 0)
+        return -1;
+
+    struct SharedHeader *h = db->h;
+    LoadLayout(db, &l);
+    unsigned int idHash = HashOfKey(db, id);
+    unsigned int nameHash = HashOfKey(db, name);
+
+    unsigned int *idSlot = ProbeSlot(&l, KEY_ID, id, idHash);
+    if (*idSlot != NO_RECORD)
+        return -1;
+    unsigned int *nameSlot = ProbeSlot(&l, KEY_NAME, name, nameHash);
+    if (*nameSlot != NO_RECORD)
+        return -1;
+
+    unsigned int rec = l.size;
+    struct UserInfo *newUser = &l.array[rec];
+
+    WriteBegin(db);
+    memcpy(l.keys + h->keysUsed, id, idSize);
+    memcpy(l.keys + h->keysUsed + idSize, name, nameSize);
+
+    newUser->id = h->keysUsed;
+    newUser->nameOffset = (unsigned int)idSize;
+    newUser->purchase = purchase;
+    newUser->idHash = idHash;
+    newUser->nameHash = nameHash;
+
+    *idSlot = rec;
+    *nameSlot = rec;
+    h->keysUsed += idSize + nameSize;
+    h->size++;
+    WriteEnd(db);
+
+    return 0;
+}
+
+/**
+ * KeyEquals: compare a key of the region with a given key
+ *
+ * param l: pointer to the sections of the region
+ * param offset: offset of the key from the key section
+ * param key: pointer to null terminated string
+ * param size: size of key including its terminator
+ *
+ * returns: nonzero if the keys are equal. 0 if not, or if offset does
+ *  not lie within the key section
+ */
+static inline int KeyEquals(const struct Layout *l, uint64_t offset,
+                            const char *key, size_t size) {
+    return Fits(offset, size, l->keysSize) &&
+           memcmp(l->keys + offset, key, size) == 0;
+}
+
+/**
+ * ProbeSlot: find the index slot of a key
+ *
+ *  probing starts at the home slot of the hash and stops at the first
+ *  empty slot. the stored hash is compared before the key itself.
+ *  every record and key read is checked to lie within the region, so
+ *  that a reader can't go astray while the writer is updating it
+ *
+ * param l: pointer to the sections of the region
+ * param kind: which index table to search
+ * param key: pointer to null terminated string
+ * param hash: raw hash value of key
+ *
+ * returns: pointer to the slot referring to the customer with the key.
+ *  if there is none, pointer to the empty slot that ended the probing,
+ *  where the key would be inserted. NULL if the table read is torn
+ */
+static unsigned int *ProbeSlot(const struct Layout *l,
+                               enum KeyKind kind, const char *key,
+                               unsigned int hash) {
+    unsigned int *index = kind == KEY_ID ? l->idIndex : l->nameIndex;
+    unsigned int mask = l->indexCapacity - 1;
+    size_t size = strlen(key) + 1;
+    unsigned int i = hash & mask;
+    unsigned int n;
+
+    for (n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        unsigned int rec = index[i];
+        if (rec == NO_RECORD)
+            break;
+        if (rec >= l->size)
+            return NULL;
+
+        const struct UserInfo *p = &l->array[rec];
+        if (kind == KEY_ID) {
+            if (p->idHash == hash && KeyEquals(l, p->id, key, size))
+                break;
+        } else {
+            if (p->nameHash == hash &&
+                KeyEquals(l, p->id + p->nameOffset, key, size))
+                break;
+        }
+    }
+
+    STATS_PROBES(l->counters, n + 1);
+    return n <= mask ? &index[i] : NULL;
+}
+
+/**
+ * FindRecordSlot: find the index slot referring to a given customer
+ *
+ * param l: pointer to the sections of the region of the writer
+ * param kind: which index table to search
+ * param rec: index of a registered customer in the array
+ *
+ * returns: pointer to the slot referring to the customer
+ */
+static unsigned int *FindRecordSlot(const struct Layout *l,
+                                    enum KeyKind kind,
+                                    unsigned int rec) {
+    unsigned int *index = kind == KEY_ID ? l->idIndex : l->nameIndex;
+    unsigned int mask = l->indexCapacity - 1;
+    const struct UserInfo *p = &l->array[rec];
+    unsigned int hash = kind == KEY_ID ? p->idHash : p->nameHash;
+    unsigned int i;
+
+    for (i = hash & mask; index[i] != rec; i = (i + 1) & mask)
+        assert(index[i] != NO_RECORD);
+
+    return &index[i];
+}
+
+/**
+ * EraseSlot: empty an index slot
+ *
+ *  later slots of the probe sequence are shifted back into the hole
+ *  unless that would move them before their home slot, so that no
+ *  tombstones are needed
+ *
+ * param l: pointer to the sections of the region of the writer
+ * param kind: which index table the slot belongs to
+ * param slot: pointer to the slot
+ */
+static void EraseSlot(const struct Layout *l, enum KeyKind kind,
+                      unsigned int *slot) {
+    unsigned int *index = kind == KEY_ID ? l->idIndex : l->nameIndex;
+    unsigned int mask = l->indexCapacity - 1;
+    unsigned int hole = (unsigned int)(slot - index);
+
+    for (unsigned int i = (hole + 1) & mask; index[i] != NO_RECORD;
+         i = (i + 1) & mask) {
+        const struct UserInfo *p = &l->array[index[i]];
+        unsigned int home =
+            (kind == KEY_ID ? p->idHash : p->nameHash) & mask;
+
+        // the entry may move into the hole only if its home slot is
+        // not cyclically within (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            index[hole] = index[i];
+            hole = i;
+        }
+    }
+
+    index[hole] = NO_RECORD;
+}
+
+/**
+ * RemoveCustomer: remove a customer with a given key from the region
+ *
+ *  the last customer of the array is moved into the hole, so that the
+ *  array stays dense. the keys of the customer are left in the key
+ *  section until the region is repacked
+ *
+ * param db: pointer to database, the writer
+ * param kind: which key is given
+ * param key: pointer to null terminated string
+ *
+ * returns: 0 if customer is successfully removed. -1 if customer with
+ *  the key does not exist
+ */
+static int RemoveCustomer(DB_T db, enum KeyKind kind, const char *key) {
+    struct SharedHeader *h = db->h;
+    enum KeyKind other = kind == KEY_ID ? KEY_NAME : KEY_ID;
+    struct Layout l;
+
+    LoadLayout(db, &l);
+    unsigned int *slot = ProbeSlot(&l, kind, key, HashOfKey(db, key));
+    if (*slot == NO_RECORD)
+        return -1;
+
+    unsigned int rec = *slot;
+    struct UserInfo *p = &l.array[rec];
+    unsigned int last = l.size - 1;
+    const char *name = l.keys + p->id + p->nameOffset;
+
+    WriteBegin(db);
+    EraseSlot(&l, kind, slot);
+    EraseSlot(&l, other, FindRecordSlot(&l, other, rec));
+    h->keysFree += p->nameOffset + strlen(name) + 1;
+
+    if (rec != last) {
+        *FindRecordSlot(&l, KEY_ID, last) = rec;
+        *FindRecordSlot(&l, KEY_NAME, last) = rec;
+        *p = l.array[last];
+    }
+    h->size--;
+    WriteEnd(db);
+
+    return 0;
+}
+
+/**
+ * LookupPurchase: get the purchase field of a customer with a given
+ * key
+ *
+ * param db: pointer to database
+ * param kind: which key is given
+ * param key: pointer to null terminated string
+ *
+ * returns: purchase field value of customer with the key. -1 if
+ *  customer does not exist, or if a reader can't map the region
+ */
+static int LookupPurchase(DB_T db, enum KeyKind kind, const char *key) {
+    unsigned int hash = HashOfKey(db, key);
+    struct Layout l;
+    unsigned int seq;
+    int purchase;
+
+    do {
+        if (ReadBegin(db, &l, &seq) < 0)
+            return -1;
+
+        unsigned int *slot = ProbeSlot(&l, kind, key, hash);
+        purchase = -1;
+        if (slot != NULL && *slot < l.size)
+            purchase = l.array[*slot].purchase;
+    } while (ReadRetry(db, seq));
+
+    return purchase;
+}
+
+/**
+ * UpdatePurchase: change the purchase field of a customer with a given
+ * key in place
+ *
+ * param db: pointer to database, the writer
+ * param kind: which key is given
+ * param key: pointer to null terminated string
+ * param amount: amount to add, or new purchase amount
+ * param add: nonzero to add amount, 0 to set the field to it
+ *
+ * returns: new purchase field value. -1 if customer does not exist or
+ *  if the new value is not a positive int
+ */
+static int UpdatePurchase(DB_T db, enum KeyKind kind, const char *key,
+                          int amount, int add) {
+    struct Layout l;
+
+    LoadLayout(db, &l);
+    unsigned int *slot = ProbeSlot(&l, kind, key, HashOfKey(db, key));
+    if (*slot == NO_RECORD)
+        return -1;
+
+    struct UserInfo *p = &l.array[*slot];
+    long long purchase = add ? (long long)p->purchase + amount : amount;
+    if (purchase <= 0 || purchase > INT_MAX)
+        return -1;
+
+    // readers copying every customer must not see one update without
+    // the ones before it
+    WriteBegin(db);
+    p->purchase = (int)purchase;
+    WriteEnd(db);
+
+    return (int)purchase;
+}
+
+/**
+ * OpenView: get the customers for a query to walk
+ *
+ *  a reader copies the array and the key section, retrying until it
+ *  has copied them between two updates
+ *
+ * param db: pointer to database
+ * param v: pointer to the view to fill. closed with CloseView()
+ *
+ * returns: 0 on success. -1 if a reader can't map the region or copy
+ *  the customers
+ */
+static int OpenView(DB_T db, struct View *v) {
+    struct Layout l;
+    unsigned int seq;
+
+    v->copy = NULL;
+    if (db->writer) {
+        LoadLayout(db, &l);
+        v->array = l.array;
+        v->size = l.size;
+        v->keys = l.keys;
+        return 0;
+    }
+
+    do {
+        if (ReadBegin(db, &l, &seq) < 0) {
+            free(v->copy);
+            return -1;
+        }
+
+        uint64_t keysUsed = l.keysUsed;
+        size_t arraySize = (size_t)l.size * sizeof(struct UserInfo);
+        char *copy = realloc(v->copy, arraySize + keysUsed + 1);
+        if (copy == NULL) {
+            fprintf(stderr, "Can't allocate a memory for a copy of "
+                            "the customers\n");
+            free(v->copy);
+            return -1;
+        }
+
+        memcpy(copy, l.array, arraySize);
+        memcpy(copy + arraySize, l.keys, keysUsed);
+        copy[arraySize + keysUsed] = '\0';
+
+        v->copy = copy;
+        v->array = (const struct UserInfo *)copy;
+        v->size = l.size;
+        v->keys = copy + arraySize;
+    } while (ReadRetry(db, seq));
+
+    return 0;
+}
+
+/**
+ * CloseView: free what OpenView() allocated
+ *
+ * param v: pointer to view
+ */
+static void CloseView(struct View *v) {
+    free(v->copy);
+}
+
+/**
+ * SumChunk: sum a chunk of a GetSumCustomerPurchaseParallel() call
+ *
+ * param arg: pointer to the call's struct SumJob
+ * param chunk: index of the chunk
+ *
+ * returns: sum of function applications to the customers of the chunk
+ */
+static long long SumChunk(void *arg, unsigned int chunk) {
+    struct SumJob *job = arg;
+    const struct View *v = job->view;
+    long long sum = 0;
+
+    unsigned int begin = chunk * SUM_CHUNK_SIZE;
+    unsigned int end = begin + SUM_CHUNK_SIZE;
+
+    if (end > v->size)
+        end = v->size;
+    for (unsigned int i = begin; i < end; i++) {
+        const struct UserInfo *p = &v->array[i];
+        sum += job->fp(IdOf(v, p), NameOf(v, p), p->purchase);
+    }
+
+    return sum;
+}
+
+/**
+ * CollectMatches: collect the customers whose purchase amount lies in
+ * a range
+ *
+ * param v: pointer to view
+ * param low: smallest purchase amount
+ * param high: largest purchase amount
+ * param n: pointer receiving the number of customers collected
+ *
+ * returns: malloc'ed array of the customers, in array order. NULL if
+ *  memory allocation fails
+ */
+static struct Match *CollectMatches(const struct View *v, int low,
+                                    int high, unsigned int *n) {
+    // one more entry, so that an empty array is not NULL
+    struct Match *matches = malloc(((size_t)v->size + 1) *
+                                   sizeof(struct Match));
+    if (matches == NULL) {
+        fprintf(stderr, "Can't allocate a memory for %u customers\n",
+                v->size);
+        return NULL;
+    }
+
+    *n = 0;
+    for (unsigned int i = 0; i < v->size; i++) {
+        const struct UserInfo *p = &v->array[i];
+
+        if (p->purchase < low || p->purchase > high)
+            continue;
+        matches[*n].id = IdOf(v, p);
+        matches[*n].name = NameOf(v, p);
+        matches[*n].purchase = p->purchase;
+        (*n)++;
+    }
+
+    return matches;
+}
+
+/**
+ * CompareMatches: order customers by purchase amount, largest first,
+ * and equal amounts by id
+ *
+ * param a: pointer to a struct Match
+ * param b: pointer to a struct Match
+ *
+ * returns: negative if a comes first, positive if b does
+ */
+static int CompareMatches(const void *a, const void *b) {
+    const struct Match *x = a, *y = b;
+
+    if (x->purchase != y->purchase)
+        return x->purchase > y->purchase ? -1 : 1;
+    return strcmp(x->id, y->id);
+}
+
+/**
+ * VisitByNamePrefix: apply a given function to the customers whose
+ * name starts with a given prefix
+ *
+ * param db: pointer to database
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ * param count: pointer to the number of matches, incremented for each
+ *
+ * returns: sum of function applications to the customers. -1 if a
+ *  reader can't copy the customers
+ */
+static long long VisitByNamePrefix(DB_T db, const char *prefix,
+                                   FUNCPTR_T fp, int *count) {
+    size_t len = strlen(prefix);
+    long long sum = 0;
+    struct View v;
+
+    if (OpenView(db, &v) < 0)
+        return -1;
+
+    for (unsigned int i = 0; i < v.size; i++) {
+        const struct UserInfo *p = &v.array[i];
+        const char *name = NameOf(&v, p);
+
+        if (strncmp(name, prefix, len) != 0)
+            continue;
+        sum += fp(IdOf(&v, p), name, p->purchase);
+        (*count)++;
+    }
+    CloseView(&v);
+
+    return sum;
+}
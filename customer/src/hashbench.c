@@ -0,0 +1,229 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* hashbench.c */
+
+/* compares the key hash functions of keyhash.h: hashing speed for
+   several key lengths, and how evenly typical and adversarial keys
+   spread over the buckets of a table */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "customer_manager.h"
+#include "keyhash.h"
+
+/* number of keys hashed per speed measurement */
+#define SPEED_KEYS (1 << 16)
+
+/* times every key is hashed per speed measurement */
+#define SPEED_ROUNDS 64
+
+/* number of keys and buckets of the distribution test */
+#define SPREAD_KEYS (1 << 20)
+
+/* longest chain length counted separately */
+#define MAX_CHAIN 8
+
+/* buckets of the table the adversarial keys are made for, at most
+   1 << 16, and the number of keys made, 1 << ATTACK_BLOCKS */
+#define ATTACK_BUCKETS (1 << 16)
+#define ATTACK_BLOCKS 10
+#define ATTACK_KEYS (1 << ATTACK_BLOCKS)
+
+/* a hash function under test. the multiplicative hash is tested the
+   way the dbs used it, without a seed */
+struct HashFunc {
+    const char *name;
+    HASHFUNC_T fn;
+    int seeded;
+};
+
+static const struct HashFunc funcs[] = {
+    {"multiplicative", HashKeyMultiplicative, 0},
+    {"wide", HashKeyWide, 1},
+};
+
+#define NUM_FUNCS ((int)(sizeof(funcs) / sizeof(funcs[0])))
+
+/*--------------------------------------------------------------------*/
+static double NowSec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/*--------------------------------------------------------------------*/
+static unsigned long long NowCycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+/*--------------------------------------------------------------------*/
+static char *RandomKeys(int n, int len) {
+    static const char alnum[] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    char *keys = malloc((size_t)n * (len + 1));
+    if (keys == NULL) {
+        fprintf(stderr, "Can't allocate a memory for keys\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+        char *k = keys + (size_t)i * (len + 1);
+        for (int j = 0; j < len; j++)
+            k[j] = alnum[rand() % (sizeof(alnum) - 1)];
+        k[len] = '\0';
+    }
+    return keys;
+}
+/*--------------------------------------------------------------------*/
+static void BenchSpeed(void) {
+    static const int lengths[] = {4, 8, 16, 32, 64};
+    unsigned long long seed = RandomHashSeed();
+
+    printf("hashing speed (TSC cycles)\n");
+    printf("%-16s %6s %10s %10s %12s\n", "function", "length",
+           "ns/key", "bytes/ns", "bytes/cycle");
+
+    for (int l = 0; l < (int)(sizeof(lengths) / sizeof(lengths[0]));
+         l++) {
+        int len = lengths[l];
+        char *keys = RandomKeys(SPEED_KEYS, len);
+
+        for (int f = 0; f < NUM_FUNCS; f++) {
+            unsigned int sink = 0;
+            double t0 = NowSec();
+            unsigned long long c0 = NowCycles();
+
+            for (int r = 0; r < SPEED_ROUNDS; r++)
+                for (int i = 0; i < SPEED_KEYS; i++)
+                    sink ^= funcs[f].fn(keys + (size_t)i * (len + 1),
+                                        seed);
+
+            unsigned long long cycles = NowCycles() - c0;
+            double sec = NowSec() - t0;
+            double nkeys = (double)SPEED_KEYS * SPEED_ROUNDS;
+            double bytes = nkeys * len;
+
+            printf("%-16s %6d %10.2f %10.2f ", funcs[f].name, len,
+                   sec * 1e9 / nkeys, bytes / (sec * 1e9));
+            if (cycles > 0)
+                printf("%12.2f", bytes / cycles);
+            else
+                printf("%12s", "n/a");
+            printf(" (%x)\n", sink & 0xf);
+        }
+        free(keys);
+    }
+    printf("\n");
+}
+/*--------------------------------------------------------------------*/
+static void PrintSpread(const char *name, const unsigned int *hashes,
+                        int n, unsigned int nbuckets) {
+    unsigned int *chains = calloc(nbuckets, sizeof(unsigned int));
+    unsigned int hist[MAX_CHAIN + 1] = {0};
+    unsigned int longest = 0;
+
+    if (chains == NULL) {
+        fprintf(stderr, "Can't allocate a memory for buckets\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++)
+        chains[hashes[i] & (nbuckets - 1)]++;
+    for (unsigned int b = 0; b < nbuckets; b++) {
+        hist[chains[b] < MAX_CHAIN ? chains[b] : MAX_CHAIN]++;
+        if (chains[b] > longest)
+            longest = chains[b];
+    }
+
+    printf("%-16s", name);
+    for (int c = 0; c <= MAX_CHAIN; c++)
+        printf(" %8.4f", (double)hist[c] / nbuckets);
+    printf(" %7u\n", longest);
+    free(chains);
+}
+/*--------------------------------------------------------------------*/
+static void PrintSpreadHeader(const char *title) {
+    printf("%s\n%-16s", title, "function");
+    for (int c = 0; c < MAX_CHAIN; c++)
+        printf(" %8d", c);
+    printf(" %7d+ %7s\n", MAX_CHAIN, "max");
+}
+/*--------------------------------------------------------------------*/
+static void BenchSpread(void) {
+    unsigned int *hashes = malloc(SPREAD_KEYS * sizeof(unsigned int));
+    unsigned long long seed = RandomHashSeed();
+    char key[32];
+
+    if (hashes == NULL) {
+        fprintf(stderr, "Can't allocate a memory for hashes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // ids as clients tend to pick them, at load factor 1. an ideal
+    // hash gives the poisson fractions 0.368, 0.368, 0.184, 0.061...
+    PrintSpreadHeader("fraction of buckets by chain length, "
+                      "sequential ids");
+    for (int f = 0; f < NUM_FUNCS; f++) {
+        for (int i = 0; i < SPREAD_KEYS; i++) {
+            sprintf(key, "customer%d", i);
+            hashes[i] = funcs[f].fn(key, funcs[f].seeded ? seed : 0);
+        }
+        PrintSpread(funcs[f].name, hashes, SPREAD_KEYS, SPREAD_KEYS);
+    }
+    printf("\n");
+
+    // keys an attacker made offline to share bucket 0 under the
+    // multiplicative hash. its multiplier is 63 modulo 1 << 16, so the
+    // blocks "az" and "b;" change the bucket of any key they extend
+    // alike. a prefix, found by a short search, sends the key of
+    // ATTACK_BLOCKS "az" blocks to bucket 0, and every other choice of
+    // blocks follows it. the seed of the wide hash is unknown to the
+    // attacker, so nothing like this is possible for it
+    static char attack[ATTACK_KEYS][16 + 2 * ATTACK_BLOCKS];
+    char *blocks;
+    for (unsigned int i = 0;; i++) {
+        blocks = attack[0] + sprintf(attack[0], "evil%u", i);
+        for (int b = 0; b < ATTACK_BLOCKS; b++)
+            strcpy(blocks + 2 * b, "az");
+        if ((HashKeyMultiplicative(attack[0], 0) &
+             (ATTACK_BUCKETS - 1)) == 0)
+            break;
+    }
+    for (int n = 1; n < ATTACK_KEYS; n++) {
+        strcpy(attack[n], attack[0]);
+        for (int b = 0; b < ATTACK_BLOCKS; b++)
+            if (n & (1 << b))
+                memcpy(attack[n] + (blocks - attack[0]) + 2 * b, "b;",
+                       2);
+    }
+
+    PrintSpreadHeader("fraction of buckets by chain length, "
+                      "adversarial ids");
+    for (int f = 0; f < NUM_FUNCS; f++) {
+        for (int i = 0; i < ATTACK_KEYS; i++)
+            hashes[i] =
+                funcs[f].fn(attack[i], funcs[f].seeded ? seed : 0);
+        PrintSpread(funcs[f].name, hashes, ATTACK_KEYS,
+                    ATTACK_BUCKETS);
+    }
+
+    free(hashes);
+}
+/*--------------------------------------------------------------------*/
+int main(void) {
+    srand((unsigned int)time(NULL));
+
+    BenchSpeed();
+    BenchSpread();
+
+    return 0;
+}
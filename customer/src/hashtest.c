@@ -0,0 +1,141 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* hashtest.c */
+
+/* test of CreateCustomerDBWithHash, which customer_manager2.c/3.c/4.c/
+   5.c provide. a db must hash its keys with the function and the seed
+   it was given, and stay correct under a weak hash, even one that
+   gives every key the same value. a backend that can hold only a
+   limited number of keys of the same hash value is built with
+   KEYS_PER_HASH defined to that number, and must refuse the key past
+   it without losing the others */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "customer_manager.h"
+#include "keyhash.h"
+#include "testutil.h"
+
+/* number of customers registered under the multiplicative hash */
+#define KEYS 20000
+
+/* number of customers registered under a constant hash */
+#ifdef KEYS_PER_HASH
+#define SAME_HASH_KEYS KEYS_PER_HASH
+#else
+#define SAME_HASH_KEYS 64
+#endif
+
+/* seed the seeded test passes to CreateCustomerDBWithHash */
+#define SEED 0x5eed5eed5eedULL
+
+/* seeds ValueOfSeed was called with that differ from SEED */
+static int wrongSeeds;
+
+/*--------------------------------------------------------------------*/
+/* a hash that gives every key the same value */
+static unsigned int Constant(const char *key, unsigned long long seed) {
+    (void)key;
+    (void)seed;
+    return 0x9e3779b9U;
+}
+/*--------------------------------------------------------------------*/
+/* the multiplicative hash, counting the calls with another seed */
+static unsigned int ValueOfSeed(const char *key,
+                                unsigned long long seed) {
+    if (seed != SEED)
+        wrongSeeds++;
+    return HashKeyMultiplicative(key, seed);
+}
+/*--------------------------------------------------------------------*/
+/* register customers 0..n-1, unregister the odd ones and check every
+   lookup and the sum. returns nonzero on success */
+static int RegisterAndLookUp(DB_T d, int n) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    int sum = 0;
+
+    for (int k = 0; k < n; k++) {
+        KeysOf(k, id, name);
+        if (RegisterCustomer(d, id, name, k + 1) != 0)
+            return 0;
+    }
+    for (int k = 1; k < n; k += 2) {
+        KeysOf(k, id, name);
+        if ((k % 4 == 1 ? UnregisterCustomerByID(d, id)
+                        : UnregisterCustomerByName(d, name)) != 0)
+            return 0;
+    }
+    for (int k = 0; k < n; k++) {
+        int e = k % 2 == 0 ? k + 1 : -1;
+
+        KeysOf(k, id, name);
+        if (GetPurchaseByID(d, id) != e ||
+            GetPurchaseByName(d, name) != e)
+            return 0;
+        if (e > 0)
+            sum += e;
+    }
+
+    return GetSumCustomerPurchase(d, Purchase) == sum;
+}
+/*--------------------------------------------------------------------*/
+int main(void) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    DB_T d;
+
+    Check(CreateCustomerDBWithHash(NULL, 0) == NULL,
+          "CreateCustomerDBWithHash rejects a NULL hash");
+
+    /* the unseeded hash the dbs used to have */
+    d = CreateCustomerDBWithHash(HashKeyMultiplicative, 0);
+    Check(d != NULL && RegisterAndLookUp(d, KEYS),
+          "multiplicative hash");
+    DestroyCustomerDB(d);
+
+    /* a hash only ever sees the seed it was given */
+    d = CreateCustomerDBWithHash(ValueOfSeed, SEED);
+    Check(d != NULL && RegisterAndLookUp(d, KEYS) && wrongSeeds == 0,
+          "hash called with the seed of the db");
+    DestroyCustomerDB(d);
+
+    /* every key collides with every other */
+    d = CreateCustomerDBWithHash(Constant, SEED);
+    Check(d != NULL && RegisterAndLookUp(d, SAME_HASH_KEYS),
+          "constant hash");
+    DestroyCustomerDB(d);
+
+#ifdef KEYS_PER_HASH
+    /* one key too many of the same hash is refused, and the db keeps
+       all the others */
+    d = CreateCustomerDBWithHash(Constant, SEED);
+    for (int k = 0; k < KEYS_PER_HASH; k++) {
+        KeysOf(k, id, name);
+        RegisterCustomer(d, id, name, k + 1);
+    }
+    KeysOf(KEYS_PER_HASH, id, name);
+    Check(RegisterCustomer(d, id, name, 1) == -1 &&
+              GetPurchaseByID(d, id) == -1 &&
+              GetPurchaseByName(d, name) == -1,
+          "key past the limit of the same hash is refused");
+
+    int sum = 0;
+    for (int k = 0; k < KEYS_PER_HASH; k++) {
+        KeysOf(k, id, name);
+        if (GetPurchaseByID(d, id) == k + 1 &&
+            GetPurchaseByName(d, name) == k + 1)
+            sum += k + 1;
+    }
+    Check(sum == KEYS_PER_HASH * (KEYS_PER_HASH + 1) / 2 &&
+              GetSumCustomerPurchase(d, Purchase) == sum,
+          "keys of the same hash kept after a refusal");
+    DestroyCustomerDB(d);
+#else
+    (void)id;
+    (void)name;
+#endif
+
+    return Failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,595 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: journal.c
+ */
+
+#include "journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// journal files start with this magic and format version
+#define JOURNAL_MAGIC "EE209JNL"
+#define JOURNAL_VERSION 1
+
+// bytes of an entry before the keys, and of the checksum after them
+#define RECORD_HEADER_SIZE 28
+#define RECORD_TRAILER_SIZE 4
+
+// longest entry accepted when scanning. anything longer is garbage
+#define MAX_RECORD_SIZE (16 * 1024 * 1024)
+
+/* header of a journal file. entries follow, each laid out as
+   size, type, seq, purchase, id length, name length (all in host byte
+   order), the keys without terminators and a checksum of the rest */
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct Journal {
+    // journal file, opened for appending
+    int fd;
+
+    // protects everything below. the flusher writes without holding it
+    pthread_mutex_t lock;
+
+    // signaled when the flusher has something to do, and when a group
+    // was taken or committed
+    pthread_cond_t wake;
+    pthread_cond_t done;
+
+    // thread committing groups
+    pthread_t flusher;
+
+    // group being filled
+    char *buf;
+    size_t len;
+    size_t cap;
+
+    // buffer of the group being written, swapped with buf
+    char *spare;
+    size_t spareCap;
+
+    // commit bounds
+    size_t maxBytes;
+    int maxDelayMs;
+
+    // when appending returns, and when a group is committed
+    enum JournalMode mode;
+
+    // bytes appended and bytes known to be on disk since opening
+    unsigned long long appended;
+    unsigned long long durable;
+
+    // sequence numbers of the last entry appended and of the last one
+    // known to be on disk
+    unsigned long long appendedSeq;
+    unsigned long long durableSeq;
+
+    // nonzero if a group must be committed without waiting, if the
+    // journal is being closed, and if a write failed
+    int urgent;
+    int stop;
+    int failed;
+};
+
+static void *FlusherMain(void *arg);
+static int ScanJournal(struct Journal *j, unsigned long long afterSeq,
+                       JOURNAL_REPLAY_T replay, void *arg);
+static int WriteAll(int fd, const char *buf, size_t len);
+
+/**
+ * Checksum: compute the FNV-1a hash of a byte range
+ */
+static uint32_t Checksum(const char *p, size_t len) {
+    uint32_t h = 2166136261U;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)p[i]) * 16777619U;
+
+    return h;
+}
+
+/**
+ * JournalOpen: open or create a journal file and replay its entries
+ *
+ * param path: path of the journal file
+ * param mode: when appending returns and a group is committed
+ * param maxDelayMs: longest time an entry is buffered in
+ *  JOURNAL_ASYNC mode
+ * param maxBytes: size of a group that is committed at once
+ * param afterSeq: entries up to this sequence number are skipped
+ * param replay: function called for every other valid entry
+ * param arg: first argument of replay
+ *
+ * returns: pointer to journal. NULL on failure
+ */
+struct Journal *JournalOpen(const char *path, enum JournalMode mode,
+                            int maxDelayMs, size_t maxBytes,
+                            unsigned long long afterSeq,
+                            JOURNAL_REPLAY_T replay, void *arg) {
+    if (path == NULL || maxDelayMs < 0 || maxBytes == 0)
+        return NULL;
+
+    struct Journal *j = calloc(1, sizeof(struct Journal));
+    if (j == NULL) {
+        fprintf(stderr, "Can't allocate a memory for journal\n");
+        return NULL;
+    }
+
+    j->maxBytes = maxBytes;
+    j->maxDelayMs = maxDelayMs;
+    j->mode = mode;
+    j->appendedSeq = afterSeq;
+    j->durableSeq = afterSeq;
+    j->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (j->fd < 0) {
+        fprintf(stderr, "Can't open %s\n", path);
+        free(j);
+        return NULL;
+    }
+
+    if (ScanJournal(j, afterSeq, replay, arg) < 0) {
+        fprintf(stderr, "%s is not a valid journal\n", path);
+        close(j->fd);
+        free(j);
+        return NULL;
+    }
+
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+    pthread_cond_init(&j->done, NULL);
+    if (pthread_create(&j->flusher, NULL, FlusherMain, j) != 0) {
+        pthread_cond_destroy(&j->done);
+        pthread_cond_destroy(&j->wake);
+        pthread_mutex_destroy(&j->lock);
+        close(j->fd);
+        free(j);
+        return NULL;
+    }
+
+    return j;
+}
+
+/**
+ * JournalAppend: buffer an entry for the next group commit
+ *
+ *  an entry that does not fit in the current group waits until the
+ *  flusher has taken the group. in JOURNAL_DURABLE mode, the caller
+ *  then waits until the entry is on disk. unless the journal is async,
+ *  the group is committed right away, or as soon as the flusher is done
+ *  with the previous one, so that every entry appended meanwhile shares
+ *  its fdatasync
+ *
+ * param j: pointer to journal
+ * param e: pointer to entry
+ *
+ * returns: 0 on success. -1 if the journal failed
+ */
+int JournalAppend(struct Journal *j, const struct JournalEntry *e) {
+    uint32_t idLen = (uint32_t)strlen(e->id);
+    uint32_t nameLen = e->name != NULL ? (uint32_t)strlen(e->name) : 0;
+    uint32_t size = RECORD_HEADER_SIZE + idLen + nameLen +
+                    RECORD_TRAILER_SIZE;
+
+    pthread_mutex_lock(&j->lock);
+
+    while (!j->failed && j->len > 0 && j->len + size > j->maxBytes) {
+        j->urgent = 1;
+        pthread_cond_signal(&j->wake);
+        pthread_cond_wait(&j->done, &j->lock);
+    }
+
+    if (!j->failed && j->len + size > j->cap) {
+        size_t cap = j->maxBytes > j->len + size ? j->maxBytes
+                                                 : j->len + size;
+        char *buf = realloc(j->buf, cap);
+        if (buf == NULL) {
+            fprintf(stderr, "Can't allocate a memory for journal\n");
+            j->failed = 1;
+        } else {
+            j->buf = buf;
+            j->cap = cap;
+        }
+    }
+
+    if (j->failed) {
+        pthread_mutex_unlock(&j->lock);
+        return -1;
+    }
+
+    char *p = j->buf + j->len;
+    uint32_t type = (uint32_t)e->type;
+    int32_t purchase = e->purchase;
+    uint64_t seq = e->seq;
+
+    memcpy(p, &size, 4);
+    memcpy(p + 4, &type, 4);
+    memcpy(p + 8, &seq, 8);
+    memcpy(p + 16, &purchase, 4);
+    memcpy(p + 20, &idLen, 4);
+    memcpy(p + 24, &nameLen, 4);
+    memcpy(p + RECORD_HEADER_SIZE, e->id, idLen);
+    if (nameLen > 0)
+        memcpy(p + RECORD_HEADER_SIZE + idLen, e->name, nameLen);
+
+    uint32_t sum = Checksum(p, size - RECORD_TRAILER_SIZE);
+    memcpy(p + size - RECORD_TRAILER_SIZE, &sum, 4);
+
+    // the first entry of a group starts its delay
+    if (j->len == 0)
+        pthread_cond_signal(&j->wake);
+    j->len += size;
+    j->appended += size;
+    j->appendedSeq = e->seq;
+
+    if (j->mode != JOURNAL_ASYNC) {
+        j->urgent = 1;
+        pthread_cond_signal(&j->wake);
+    }
+    if (j->mode == JOURNAL_DURABLE) {
+        unsigned long long target = j->appended;
+
+        while (!j->failed && j->durable < target)
+            pthread_cond_wait(&j->done, &j->lock);
+    }
+
+    int res = j->failed ? -1 : 0;
+    pthread_mutex_unlock(&j->lock);
+
+    return res;
+}
+
+/**
+ * JournalSync: commit the current group now and wait until every
+ * appended entry is on disk
+ *
+ * param j: pointer to journal
+ *
+ * returns: 0 on success. -1 if the journal failed
+ */
+int JournalSync(struct Journal *j) {
+    pthread_mutex_lock(&j->lock);
+
+    // the entries may also be in a group that is being written already
+    unsigned long long target = j->appended;
+    while (!j->failed && j->durable < target) {
+        if (j->len > 0) {
+            j->urgent = 1;
+            pthread_cond_signal(&j->wake);
+        }
+        pthread_cond_wait(&j->done, &j->lock);
+    }
+
+    int res = j->failed ? -1 : 0;
+    pthread_mutex_unlock(&j->lock);
+
+    return res;
+}
+
+/**
+ * JournalWait: wait until the entries up to a sequence number are on
+ * disk
+ *
+ *  unless the journal is async, their group is already due, and the
+ *  wait lets it collect every entry appended until the flusher takes
+ *  it. an async journal commits the current group now, as a sync does
+ *
+ * param j: pointer to journal
+ * param seq: sequence number of the last entry to wait for
+ *
+ * returns: 0 on success. -1 if the journal failed
+ */
+int JournalWait(struct Journal *j, unsigned long long seq) {
+    pthread_mutex_lock(&j->lock);
+
+    // entries after the last appended one are not waited for
+    if (seq > j->appendedSeq)
+        seq = j->appendedSeq;
+    while (!j->failed && j->durableSeq < seq) {
+        if (j->len > 0 && j->mode == JOURNAL_ASYNC) {
+            j->urgent = 1;
+            pthread_cond_signal(&j->wake);
+        }
+        pthread_cond_wait(&j->done, &j->lock);
+    }
+
+    int res = j->failed ? -1 : 0;
+    pthread_mutex_unlock(&j->lock);
+
+    return res;
+}
+
+/**
+ * JournalTruncate: drop every entry of a journal
+ *
+ *  the caller must not append concurrently. since the file is opened
+ *  for appending, later entries follow the header directly
+ *
+ * param j: pointer to journal
+ *
+ * returns: 0 on success. -1 on failure
+ */
+int JournalTruncate(struct Journal *j) {
+    if (JournalSync(j) < 0)
+        return -1;
+
+    pthread_mutex_lock(&j->lock);
+    int res = 0;
+    if (ftruncate(j->fd, sizeof(struct JournalHeader)) != 0 ||
+        fdatasync(j->fd) != 0) {
+        j->failed = 1;
+        res = -1;
+    }
+    pthread_mutex_unlock(&j->lock);
+
+    return res;
+}
+
+/**
+ * JournalClose: commit the remaining entries and close a journal
+ *
+ * param j: pointer to journal
+ *
+ * returns: 0 on success. -1 if entries may have been lost
+ */
+int JournalClose(struct Journal *j) {
+    if (j == NULL)
+        return 0;
+
+    pthread_mutex_lock(&j->lock);
+    j->stop = 1;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+
+    pthread_join(j->flusher, NULL);
+
+    int res = j->failed ? -1 : 0;
+    if (close(j->fd) != 0)
+        res = -1;
+
+    pthread_cond_destroy(&j->done);
+    pthread_cond_destroy(&j->wake);
+    pthread_mutex_destroy(&j->lock);
+    free(j->buf);
+    free(j->spare);
+    free(j);
+
+    return res;
+}
+
+/**
+ * FlusherMain: commit groups until the journal is closed
+ *
+ *  a group is committed maxDelayMs after its first entry, or earlier
+ *  if it is full, an append or a sync waits for it or the journal is
+ *  closed. the buffers are swapped, so that entries can be appended to
+ *  the next group while the previous one is written
+ *
+ * param arg: pointer to journal
+ *
+ * returns: NULL
+ */
+static void *FlusherMain(void *arg) {
+    struct Journal *j = arg;
+
+    pthread_mutex_lock(&j->lock);
+
+    for (;;) {
+        while (j->len == 0 && !j->stop)
+            pthread_cond_wait(&j->wake, &j->lock);
+        if (j->len == 0)
+            break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += j->maxDelayMs / 1000;
+        deadline.tv_nsec += (long)(j->maxDelayMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!j->urgent && !j->stop && j->len < j->maxBytes)
+            if (pthread_cond_timedwait(&j->wake, &j->lock, &deadline) ==
+                ETIMEDOUT)
+                break;
+
+        // take the group and let appenders go on
+        char *buf = j->buf;
+        size_t len = j->len;
+        unsigned long long seq = j->appendedSeq;
+        size_t cap = j->cap;
+        j->buf = j->spare;
+        j->cap = j->spareCap;
+        j->len = 0;
+        j->spare = buf;
+        j->spareCap = cap;
+        j->urgent = 0;
+        pthread_cond_broadcast(&j->done);
+
+        int failed = j->failed;
+        pthread_mutex_unlock(&j->lock);
+
+        if (!failed &&
+            (WriteAll(j->fd, buf, len) < 0 || fdatasync(j->fd) != 0)) {
+            fprintf(stderr, "Can't write journal\n");
+            failed = 1;
+        }
+
+        pthread_mutex_lock(&j->lock);
+        if (failed) {
+            j->failed = 1;
+        } else {
+            j->durable += len;
+            j->durableSeq = seq;
+        }
+        pthread_cond_broadcast(&j->done);
+    }
+
+    pthread_mutex_unlock(&j->lock);
+
+    return NULL;
+}
+
+/**
+ * ScanJournal: check the header of a journal file and replay its
+ * entries
+ *
+ *  an empty file gets a header. scanning stops at the first entry that
+ *  is incomplete or fails its checksum, which can only be the tail of a
+ *  group whose commit was interrupted. the file is cut there, so that
+ *  new entries are not appended after garbage
+ *
+ * param j: pointer to journal whose file is open
+ * param afterSeq: entries up to this sequence number are skipped
+ * param replay: function called for every other valid entry
+ * param arg: first argument of replay
+ *
+ * returns: 0 on success. -1 if the file is not a journal or can't be
+ *  read
+ */
+static int ScanJournal(struct Journal *j, unsigned long long afterSeq,
+                       JOURNAL_REPLAY_T replay, void *arg) {
+    struct JournalHeader h;
+    struct stat st;
+
+    if (fstat(j->fd, &st) != 0)
+        return -1;
+
+    if (st.st_size == 0) {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+        h.version = JOURNAL_VERSION;
+        if (WriteAll(j->fd, (const char *)&h, sizeof(h)) < 0 ||
+            fdatasync(j->fd) != 0)
+            return -1;
+        return 0;
+    }
+
+    int fd = dup(j->fd);
+    FILE *fp = fd >= 0 ? fdopen(fd, "rb") : NULL;
+    if (fp == NULL) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    if (fread(&h, sizeof(h), 1, fp) != 1 ||
+        memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != JOURNAL_VERSION) {
+        fclose(fp);
+        return -1;
+    }
+
+    char *rec = NULL, *keys = NULL;
+    size_t recCap = 0;
+    off_t end = sizeof(h);
+
+    for (;;) {
+        uint32_t size, type, idLen, nameLen, sum;
+        int32_t purchase;
+        uint64_t seq;
+
+        if (fread(&size, 4, 1, fp) != 1 ||
+            size < RECORD_HEADER_SIZE + RECORD_TRAILER_SIZE ||
+            size > MAX_RECORD_SIZE)
+            break;
+
+        if (size > recCap) {
+            char *p = realloc(rec, size);
+            char *q = realloc(keys, size);
+            if (p != NULL)
+                rec = p;
+            if (q != NULL)
+                keys = q;
+            if (p == NULL || q == NULL)
+                break;
+            recCap = size;
+        }
+
+        memcpy(rec, &size, 4);
+        if (fread(rec + 4, size - 4, 1, fp) != 1)
+            break;
+
+        memcpy(&type, rec + 4, 4);
+        memcpy(&seq, rec + 8, 8);
+        memcpy(&purchase, rec + 16, 4);
+        memcpy(&idLen, rec + 20, 4);
+        memcpy(&nameLen, rec + 24, 4);
+        memcpy(&sum, rec + size - RECORD_TRAILER_SIZE, 4);
+        if ((uint64_t)idLen + nameLen + RECORD_HEADER_SIZE +
+                    RECORD_TRAILER_SIZE !=
+                size ||
+            Checksum(rec, size - RECORD_TRAILER_SIZE) != sum ||
+            (type != JOURNAL_REGISTER && type != JOURNAL_UNREGISTER &&
+             type != JOURNAL_SET_PURCHASE))
+            break;
+
+        end += size;
+        if (seq > j->durableSeq) {
+            j->appendedSeq = seq;
+            j->durableSeq = seq;
+        }
+        if (seq <= afterSeq)
+            continue;
+
+        // the keys are stored without terminators
+        struct JournalEntry e;
+        memcpy(keys, rec + RECORD_HEADER_SIZE, idLen);
+        keys[idLen] = '\0';
+        memcpy(keys + idLen + 1, rec + RECORD_HEADER_SIZE + idLen,
+               nameLen);
+        keys[idLen + 1 + nameLen] = '\0';
+
+        e.type = (enum JournalType)type;
+        e.seq = seq;
+        e.id = keys;
+        e.name = type == JOURNAL_REGISTER ? keys + idLen + 1 : NULL;
+        e.purchase = purchase;
+        replay(arg, &e);
+    }
+
+    free(rec);
+    free(keys);
+    fclose(fp);
+
+    if (end < st.st_size &&
+        (ftruncate(j->fd, end) != 0 || fdatasync(j->fd) != 0))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * WriteAll: write a whole buffer to a file
+ *
+ * param fd: file descriptor
+ * param buf: pointer to bytes
+ * param len: number of bytes
+ *
+ * returns: 0 on success. -1 on failure
+ */
+static int WriteAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: keyhash.c
+ */
+
+#include "keyhash.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+enum { HASH_MULTIPLIER = 65599 };
+
+// odd constants with evenly spread bits that HashKeyWide() mixes with
+static const uint64_t SECRET[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL};
+
+/**
+ * Multiply: multiply two words into 128 bits
+ *
+ * param a, b: pointers to the factors. receive the low and the high
+ *  half of the product
+ */
+static inline void Multiply(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 uint128;
+    uint128 r = (uint128)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, la = (uint32_t)*a;
+    uint64_t hb = *b >> 32, lb = (uint32_t)*b;
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+    uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+    *a = (mid << 32) | (uint32_t)ll;
+    *b = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
+}
+
+/**
+ * Mix: multiply two words and fold the product back into one
+ *
+ * returns: high half xor low half of a * b
+ */
+static inline uint64_t Mix(uint64_t a, uint64_t b) {
+    Multiply(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t Read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t Read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/**
+ * HashKeyWide: computes the raw hash value of a string, a word at a
+ * time
+ *
+ *  the key is consumed in 16-byte steps, each one multiplication that
+ *  does not wait for the previous step's bytes. the last 1-16 bytes
+ *  are read as two possibly overlapping words, so nothing past the
+ *  terminator is ever read
+ *
+ * param key: pointer to null terminated string
+ * param seed: seed of the db. it is only xored into the state, so it
+ *  should be random, e.g. from RandomHashSeed()
+ *
+ * returns: raw hash value
+ */
+unsigned int HashKeyWide(const char *key, unsigned long long seed) {
+    const unsigned char *p = (const unsigned char *)key;
+    size_t len = strlen(key);
+    uint64_t a, b;
+
+    seed ^= SECRET[0];
+
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t step = (len >> 3) << 2;
+            const unsigned char *q = p + len - 4;
+            a = (Read32(p) << 32) | Read32(p + step);
+            b = (Read32(q) << 32) | Read32(q - step);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) |
+                p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t n = len;
+        while (n > 16) {
+            seed = Mix(Read64(p) ^ SECRET[1], Read64(p + 8) ^ seed);
+            p += 16;
+            n -= 16;
+        }
+        a = Read64(p + n - 16);
+        b = Read64(p + n - 8);
+    }
+
+    a ^= SECRET[1];
+    b ^= seed;
+    Multiply(&a, &b);
+    uint64_t h = Mix(a ^ SECRET[0] ^ len, b ^ SECRET[1]);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+/**
+ * HashKeyMultiplicative: computes the raw hash value of a string, a
+ * byte at a time
+ *
+ * param key: pointer to null terminated string
+ * param seed: initial value. 0 gives the historical hash values
+ *
+ * returns: raw hash value
+ */
+unsigned int HashKeyMultiplicative(const char *key,
+                                   unsigned long long seed) {
+    unsigned int hash = (unsigned int)seed;
+    for (int i = 0; key[i] != '\0'; i++)
+        hash =
+            hash * (unsigned int)HASH_MULTIPLIER + (unsigned int)key[i];
+    return hash;
+}
+
+/**
+ * RandomHashSeed: make up a seed for a new db
+ *
+ *  the seed comes from getrandom(), a system call that neither opens
+ *  a file nor blocks. where that is unavailable, the time, the
+ *  process id and a counter are mixed instead, which is still
+ *  different for every db but no longer secret
+ *
+ * returns: seed
+ */
+unsigned long long RandomHashSeed(void) {
+    static unsigned long long counter;
+    uint64_t seed = 0;
+
+#ifdef __linux__
+    if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) ==
+        (ssize_t)sizeof(seed))
+        return seed;
+#endif
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t c = __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    seed = Mix((uint64_t)ts.tv_sec ^ SECRET[0],
+               (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 32));
+    return Mix(seed ^ SECRET[2], c ^ SECRET[3]);
+}
@@ -0,0 +1,402 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* mttest.c */
+
+/* multi-threaded test of the concurrent and lock-free dbs of
+   customer_manager2.c. writer threads churn customers of their own,
+   registering them and unregistering them by id and by name, while
+   reader threads look up a set of stable customers that never change
+   and check that every sum over them stays exact. then adder threads
+   add to a few hot customers with AddPurchaseByIDAtomic while writers
+   churn others and a query thread walks the ordered queries, takes
+   snapshots and compacts the db. build it with "make build/mttest-tsan"
+   to run it under ThreadSanitizer, with fewer updates, e.g.
+   "./build/mttest-tsan 10000" */
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "customer_manager.h"
+#include "testutil.h"
+
+/* number of writer and reader threads */
+#define WRITERS 4
+#define READERS 4
+
+/* number of stable customers, and of customers each writer churns */
+#define STABLE 2000
+#define CHURN_KEYS 500
+
+/* default number of updates of each writer */
+#define DEFAULT_OPS 100000
+
+/* shards of the dbs under test */
+#define SHARDS 8
+
+/* number of adder threads, and of the hot customers they add to */
+#define ADDERS 4
+#define HOT 64
+
+static DB_T db;
+static int ops = DEFAULT_OPS;
+
+/* writers still running */
+static int writersLeft;
+
+/* sum of the purchases of the stable customers */
+static long long stableSum;
+
+/* adds each hot customer received */
+static int hotAdds[HOT];
+
+/* purchase amount the ordered query being checked visited last */
+static __thread int lastPurchase;
+
+/*--------------------------------------------------------------------*/
+/* register, unregister and update the customers of one writer, and
+   check every result against what the writer knows it holds. the
+   purchase of a customer the writer holds is left in live[] */
+static void *WriterMain(void *arg) {
+    int w = (int)(long)arg;
+    int *live = calloc(CHURN_KEYS, sizeof(int));
+    unsigned int seed = 7919U * (unsigned int)w + 1;
+    char id[KEY_SIZE], name[KEY_SIZE];
+
+    if (live == NULL) {
+        Fail("calloc");
+        return NULL;
+    }
+
+    for (int i = 0; i < ops; i++) {
+        int k = rand_r(&seed) % CHURN_KEYS;
+        int res;
+
+        snprintf(id, KEY_SIZE, "w%d-%d", w, k);
+        snprintf(name, KEY_SIZE, "wn%d-%d", w, k);
+
+        switch (rand_r(&seed) % 5) {
+        case 0:
+        case 1:
+            res = RegisterCustomer(db, id, name, k + 1);
+            if (res != (live[k] ? -1 : 0))
+                Fail("RegisterCustomer \"%s\": %d", id, res);
+            if (res == 0)
+                live[k] = k + 1;
+            break;
+        case 2:
+            res = UnregisterCustomerByID(db, id);
+            if (res != (live[k] ? 0 : -1))
+                Fail("UnregisterCustomerByID \"%s\": %d", id, res);
+            live[k] = 0;
+            break;
+        case 3:
+            res = UnregisterCustomerByName(db, name);
+            if (res != (live[k] ? 0 : -1))
+                Fail("UnregisterCustomerByName \"%s\": %d", name, res);
+            live[k] = 0;
+            break;
+        default:
+            res = AddPurchaseByID(db, id, 1);
+            if (res != (live[k] ? live[k] + 1 : -1))
+                Fail("AddPurchaseByID \"%s\": %d", id, res);
+            if (live[k])
+                live[k]++;
+            break;
+        }
+    }
+
+    // leave only the stable customers behind
+    for (int k = 0; k < CHURN_KEYS; k++) {
+        snprintf(id, KEY_SIZE, "w%d-%d", w, k);
+        if (live[k] && UnregisterCustomerByID(db, id) != 0)
+            Fail("UnregisterCustomerByID \"%s\": %d", id, -1);
+    }
+
+    free(live);
+    __atomic_fetch_sub(&writersLeft, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* look up stable customers and sum them up until every writer is
+   done */
+static void *ReaderMain(void *arg) {
+    int r = (int)(long)arg;
+    unsigned int seed = 104729U * (unsigned int)r + 3;
+    char id[KEY_SIZE], name[KEY_SIZE];
+    const char *ids[2];
+    int out[2];
+    long long sum;
+    int res, round = 0;
+
+    while (__atomic_load_n(&writersLeft, __ATOMIC_ACQUIRE) > 0) {
+        int k = rand_r(&seed) % STABLE;
+
+        snprintf(id, KEY_SIZE, "s%d", k);
+        snprintf(name, KEY_SIZE, "sn%d", k);
+        if ((res = GetPurchaseByID(db, id)) != k + 1)
+            Fail("GetPurchaseByID \"%s\": %d", id, res);
+        if ((res = GetPurchaseByName(db, name)) != k + 1)
+            Fail("GetPurchaseByName \"%s\": %d", name, res);
+
+        // a churned key may or may not be there, but never changes the
+        // stable one next to it
+        ids[0] = id;
+        ids[1] = "w0-0";
+        res = GetPurchaseByIDBatch(db, ids, 2, out);
+        if (res < 1 || out[0] != k + 1)
+            Fail("GetPurchaseByIDBatch \"%s\": %d", id, res);
+
+        switch (round++ % 64) {
+        case 0:
+            sum = GetSumCustomerPurchase(db, StablePurchase);
+            if (sum != stableSum)
+                Fail("GetSumCustomerPurchase: %lld", sum);
+            break;
+        case 16:
+            sum = GetSumCustomerPurchaseParallel(db, StablePurchase, 2);
+            if (sum != stableSum)
+                Fail("GetSumCustomerPurchaseParallel: %lld", sum);
+            break;
+        case 32:
+            sum = GetSumCustomerPurchaseByNamePrefix(db, "sn",
+                                                     Purchase);
+            if (sum != stableSum)
+                Fail("GetSumCustomerPurchaseByNamePrefix \"sn\": %lld",
+                     sum);
+            break;
+        }
+    }
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* add 1 to random hot customers with AddPurchaseByIDAtomic, and count
+   the adds in hotAdds[] */
+static void *AdderMain(void *arg) {
+    int a = (int)(long)arg;
+    unsigned int seed = 15485863U * (unsigned int)a + 5;
+    int adds[HOT] = {0};
+    char id[KEY_SIZE];
+
+    for (int i = 0; i < ops; i++) {
+        int k = rand_r(&seed) % HOT;
+        int res;
+
+        snprintf(id, KEY_SIZE, "h%d", k);
+        if ((res = AddPurchaseByIDAtomic(db, id, 1)) < 2)
+            Fail("AddPurchaseByIDAtomic \"%s\": %d", id, res);
+        adds[k]++;
+    }
+
+    for (int k = 0; k < HOT; k++)
+        __atomic_fetch_add(&hotAdds[k], adds[k], __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&writersLeft, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* a FUNCPTR_T that returns 1, and fails if the customers are not
+   visited largest amount first */
+static int Ordered(const char *id, const char *name,
+                   const int purchase) {
+    (void)name;
+    if (purchase > lastPurchase)
+        Fail("\"%s\" with %d after %d", id, purchase, lastPurchase);
+    lastPurchase = purchase;
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+/* run the ordered queries, take snapshots and compact the db until
+   every writer and adder is done */
+static void *QueryMain(void *arg) {
+    long long sum, lastSum = 0;
+    int res, round = 0;
+
+    (void)arg;
+    while (__atomic_load_n(&writersLeft, __ATOMIC_ACQUIRE) > 0) {
+        lastPurchase = INT_MAX;
+        if ((res = GetTopKCustomers(db, HOT, Ordered)) != HOT)
+            Fail("GetTopKCustomers: %d", res);
+        lastPurchase = INT_MAX;
+        if ((res = GetCustomersByPurchaseRange(db, 2, INT_MAX,
+                                               Ordered)) < 0)
+            Fail("GetCustomersByPurchaseRange: %d", res);
+
+        // adds never take anything away from the hot customers
+        sum = GetSumCustomerPurchaseByNamePrefix(db, "hn", Purchase);
+        if (sum < lastSum)
+            Fail("GetSumCustomerPurchaseByNamePrefix \"hn\": %lld",
+                 sum);
+        lastSum = sum;
+
+        // adds take the lock while a snapshot is open, so it is only
+        // taken now and then. it never sees the adds made after it was
+        // taken
+        round++;
+        if (round % 8 == 0) {
+            DB_T snap = SnapshotCustomerDB(db);
+            int before = GetPurchaseByID(snap, "h0");
+
+            sched_yield();
+            if (snap == NULL)
+                Fail("SnapshotCustomerDB");
+            else if ((res = GetPurchaseByID(snap, "h0")) != before)
+                Fail("snapshot sees \"h0\" at %d, then %d", before,
+                     res);
+            ReleaseCustomerSnapshot(snap);
+        }
+        if (round % 64 == 0 && CompactCustomerDB(db) != 0)
+            Fail("CompactCustomerDB");
+    }
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* run the adders and two writers against a db made by create, along
+   with the query thread, and check that every add reached its hot
+   customer and the ordered queries. returns 0 on success */
+static int RunAtomicTest(const char *kind, DB_T (*create)(int)) {
+    pthread_t adders[ADDERS], writers[2], query;
+    char id[KEY_SIZE], name[KEY_SIZE];
+    long long hotSum = 0;
+
+    printf("%s(%d): %d adders x %d atomic adds, 2 writers\n", kind,
+           SHARDS, ADDERS, ops);
+
+    db = create(SHARDS);
+    if (db == NULL) {
+        printf("[FAILED] %s returned NULL\n", kind);
+        return -1;
+    }
+
+    int before = Failures();
+    for (int k = 0; k < HOT; k++) {
+        snprintf(id, KEY_SIZE, "h%d", k);
+        snprintf(name, KEY_SIZE, "hn%d", k);
+        if (RegisterCustomer(db, id, name, 1) != 0)
+            Fail("RegisterCustomer \"%s\": %d", id, -1);
+        hotAdds[k] = 0;
+    }
+    if (AddPurchaseByIDAtomic(db, "h0", INT_MAX) != -1 ||
+        AddPurchaseByIDAtomic(db, "h0", -1) != -1 ||
+        AddPurchaseByIDAtomic(db, "nobody", 1) != -1)
+        Fail("AddPurchaseByIDAtomic out of range or of nobody");
+    if (AddPurchaseByIDAtomic(db, "h1", 9) != 10 ||
+        GetTopKCustomers(db, 1, Purchase) != 10 ||
+        GetCustomersByPurchaseRange(db, 2, 10, Purchase) != 10 ||
+        GetSumCustomerPurchaseByNamePrefix(db, "hn", Purchase) !=
+            HOT + 9)
+        Fail("ordered queries after AddPurchaseByIDAtomic");
+    hotAdds[1] = 9;
+
+    writersLeft = ADDERS + 2;
+    for (long i = 0; i < ADDERS; i++)
+        pthread_create(&adders[i], NULL, AdderMain, (void *)i);
+    for (long i = 0; i < 2; i++)
+        pthread_create(&writers[i], NULL, WriterMain, (void *)i);
+    pthread_create(&query, NULL, QueryMain, NULL);
+    for (int i = 0; i < ADDERS; i++)
+        pthread_join(adders[i], NULL);
+    for (int i = 0; i < 2; i++)
+        pthread_join(writers[i], NULL);
+    pthread_join(query, NULL);
+
+    // the last adds come after any compaction of the query thread, so
+    // only a rebuild lets the ordered queries see them
+    for (int k = 0; k < HOT; k++) {
+        int res;
+
+        snprintf(id, KEY_SIZE, "h%d", k);
+        snprintf(name, KEY_SIZE, "hn%d", k);
+        if (AddPurchaseByIDAtomic(db, id, 1) == 2 + hotAdds[k])
+            hotAdds[k]++;
+        if ((res = GetPurchaseByID(db, id)) != 1 + hotAdds[k] ||
+            GetPurchaseByName(db, name) != res)
+            Fail("\"%s\" at %d after %d adds", id, res, hotAdds[k]);
+        hotSum += 1 + hotAdds[k];
+    }
+
+    // only the hot customers are left
+    lastPurchase = INT_MAX;
+    if (GetTopKCustomers(db, HOT + 1, Ordered) != HOT ||
+        GetTopKCustomers(db, HOT, Purchase) != hotSum ||
+        GetCustomersByPurchaseRange(db, 1, INT_MAX, Purchase) !=
+            hotSum ||
+        GetSumCustomerPurchaseByNamePrefix(db, "hn", Purchase) !=
+            hotSum)
+        Fail("ordered queries after the adders");
+
+    DestroyCustomerDB(db);
+
+    Check(Failures() == before, "%s with AddPurchaseByIDAtomic", kind);
+    return Failures() == before ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* run the writers and readers against a db made by create, and check
+   that only the stable customers are left. returns 0 on success */
+static int RunTest(const char *kind, DB_T (*create)(int)) {
+    pthread_t writers[WRITERS], readers[READERS];
+    char id[KEY_SIZE], name[KEY_SIZE];
+
+    printf("%s(%d): %d writers x %d updates, %d readers\n", kind,
+           SHARDS, WRITERS, ops, READERS);
+
+    db = create(SHARDS);
+    if (db == NULL) {
+        printf("[FAILED] %s returned NULL\n", kind);
+        return -1;
+    }
+
+    int before = Failures();
+    stableSum = 0;
+    for (int k = 0; k < STABLE; k++) {
+        snprintf(id, KEY_SIZE, "s%d", k);
+        snprintf(name, KEY_SIZE, "sn%d", k);
+        if (RegisterCustomer(db, id, name, k + 1) != 0)
+            Fail("RegisterCustomer \"%s\": %d", id, -1);
+        stableSum += k + 1;
+    }
+
+    writersLeft = WRITERS;
+    for (long i = 0; i < WRITERS; i++)
+        pthread_create(&writers[i], NULL, WriterMain, (void *)i);
+    for (long i = 0; i < READERS; i++)
+        pthread_create(&readers[i], NULL, ReaderMain, (void *)i);
+    for (int i = 0; i < WRITERS; i++)
+        pthread_join(writers[i], NULL);
+    for (int i = 0; i < READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    if (GetSumCustomerPurchase(db, Purchase) != stableSum)
+        Fail("GetSumCustomerPurchase after the writers");
+
+    DestroyCustomerDB(db);
+
+    Check(Failures() == before, "%s", kind);
+    return Failures() == before ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int main(int argc, const char *argv[]) {
+    int res = 0;
+
+    /* ./mttest [updates] : number of updates of each writer */
+    if (argc == 2 && (ops = atoi(argv[1])) <= 0) {
+        printf("Usage:  %s [updates per writer]\n", argv[0]);
+        return 1;
+    }
+
+    res |= RunTest("CreateCustomerDBConcurrent",
+                   CreateCustomerDBConcurrent);
+    res |= RunTest("CreateCustomerDBLockFree",
+                   CreateCustomerDBLockFree);
+    res |= RunAtomicTest("CreateCustomerDBConcurrent",
+                         CreateCustomerDBConcurrent);
+    res |= RunAtomicTest("CreateCustomerDBLockFree",
+                         CreateCustomerDBLockFree);
+
+    return res == 0 ? 0 : 1;
+}
@@ -0,0 +1,368 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: name_index.c
+ */
+
+#include "name_index.h"
+#include <assert.h>
+#include <string.h>
+
+/**
+ * NewNode: allocate a node with a given label and nothing below it
+ *
+ * param ix: pointer to index
+ * param label: bytes of the label, or NULL to fill them in later
+ * param len: length of the label
+ *
+ * returns: pointer to node. NULL if memory allocation fails
+ */
+static struct NameNode *NewNode(struct NameIndex *ix, const char *label,
+                                unsigned int len) {
+    struct NameNode *n =
+        ArenaAlloc(&ix->arena, sizeof(struct NameNode) + len);
+    if (n == NULL)
+        return NULL;
+
+    memset(n, 0, sizeof(struct NameNode));
+    n->label = (char *)(n + 1);
+    n->len = len;
+    if (label != NULL)
+        memcpy(n->label, label, len);
+
+    return n;
+}
+
+/**
+ * FreeNode: give back the storage of a node
+ */
+static void FreeNode(struct NameIndex *ix, struct NameNode *n) {
+    ArenaFree(&ix->arena, n, sizeof(struct NameNode) + n->len);
+}
+
+/**
+ * ChildLink: find where the child starting with a given byte is or
+ * would be among the children of a node
+ *
+ * param n: pointer to node
+ * param c: first byte of the child's label
+ *
+ * returns: pointer to the link to the child, or to the link where it
+ *  would be inserted
+ */
+static struct NameNode **ChildLink(struct NameNode *n, char c) {
+    struct NameNode **link = &n->child;
+
+    while (*link != NULL &&
+           (unsigned char)(*link)->label[0] < (unsigned char)c)
+        link = &(*link)->next;
+
+    return link;
+}
+
+/**
+ * CommonLength: get the length of the common prefix of a label and a
+ * string
+ *
+ * param n: pointer to node
+ * param s: pointer to null terminated string
+ *
+ * returns: number of bytes the label of n and s have in common
+ */
+static inline unsigned int CommonLength(const struct NameNode *n,
+                                        const char *s) {
+    unsigned int m = 0;
+
+    while (m < n->len && n->label[m] == s[m])
+        m++;
+
+    return m;
+}
+
+/**
+ * Merge: join a node without a customer to its only child
+ *
+ *  if no memory is left for the joined label, the nodes are kept as
+ *  they are, which wastes a node but is still a valid index
+ *
+ * param ix: pointer to index
+ * param link: pointer to the link to the node
+ */
+static void Merge(struct NameIndex *ix, struct NameNode **link) {
+    struct NameNode *n = *link;
+    struct NameNode *c = n->child;
+
+    assert(n->id == NULL && c != NULL && c->next == NULL);
+
+    struct NameNode *m = NewNode(ix, NULL, n->len + c->len);
+    if (m == NULL)
+        return;
+
+    memcpy(m->label, n->label, n->len);
+    memcpy(m->label + n->len, c->label, c->len);
+    m->id = c->id;
+    m->name = c->name;
+    m->purchase = c->purchase;
+    m->child = c->child;
+    m->next = n->next;
+    *link = m;
+
+    FreeNode(ix, n);
+    FreeNode(ix, c);
+}
+
+/**
+ * VisitSubtree: apply a given function to every customer at or below a
+ * node, in name order
+ *
+ * param n: pointer to node
+ * param fp: pointer to a function of type FUNCPTR_T
+ * param count: pointer to the number of customers visited so far
+ *
+ * returns: sum of function applications to the customers
+ */
+static long long VisitSubtree(const struct NameNode *n, FUNCPTR_T fp,
+                              int *count) {
+    long long sum = 0;
+
+    if (n->id != NULL) {
+        sum += fp(n->id, n->name, n->purchase);
+        (*count)++;
+    }
+
+    for (const struct NameNode *c = n->child; c != NULL; c = c->next)
+        sum += VisitSubtree(c, fp, count);
+
+    return sum;
+}
+
+/**
+ * NameIndexInit: initialize an empty name index
+ *
+ * param ix: pointer to index
+ */
+void NameIndexInit(struct NameIndex *ix) {
+    memset(ix, 0, sizeof(struct NameIndex));
+    ArenaInit(&ix->arena);
+}
+
+/**
+ * NameIndexInsert: add a customer to a name index
+ *
+ *  the path of the name is followed as far as it exists. a node whose
+ *  label only partly matches is split, and the rest of the name becomes
+ *  a new leaf
+ *
+ * param ix: pointer to index
+ * param id: customer id. referred to, not copied
+ * param name: customer name. referred to, not copied
+ * param purchase: purchase amount
+ *
+ * returns: 0 on success. -1 if memory allocation fails, in which case
+ *  the index is left as it was
+ */
+int NameIndexInsert(struct NameIndex *ix, const char *id,
+                    const char *name, int purchase) {
+    struct NameNode *n = &ix->root;
+    const char *p = name;
+
+    while (*p != '\0') {
+        struct NameNode **link = ChildLink(n, *p);
+        struct NameNode *c = *link;
+
+        if (c == NULL || c->label[0] != *p) {
+            struct NameNode *leaf = NewNode(ix, p, strlen(p));
+            if (leaf == NULL)
+                return -1;
+
+            leaf->next = c;
+            *link = leaf;
+            n = leaf;
+            break;
+        }
+
+        unsigned int m = CommonLength(c, p);
+        if (m < c->len) {
+            // the first m bytes of c become a new parent of the rest
+            struct NameNode *top = NewNode(ix, c->label, m);
+            struct NameNode *bottom =
+                NewNode(ix, c->label + m, c->len - m);
+            if (top == NULL || bottom == NULL) {
+                if (top != NULL)
+                    FreeNode(ix, top);
+                if (bottom != NULL)
+                    FreeNode(ix, bottom);
+                return -1;
+            }
+
+            bottom->id = c->id;
+            bottom->name = c->name;
+            bottom->purchase = c->purchase;
+            bottom->child = c->child;
+            top->child = bottom;
+            top->next = c->next;
+            *link = top;
+            FreeNode(ix, c);
+            c = top;
+        }
+
+        n = c;
+        p += m;
+    }
+
+    assert(n->id == NULL);
+    n->id = id;
+    n->name = name;
+    n->purchase = purchase;
+
+    return 0;
+}
+
+/**
+ * NameIndexRemove: remove a customer from a name index
+ *
+ *  a leaf left without a customer is freed, and a node left with
+ *  neither a customer nor a second child is joined to its child
+ *
+ * param ix: pointer to index
+ * param name: customer name
+ */
+void NameIndexRemove(struct NameIndex *ix, const char *name) {
+    struct NameNode *n = &ix->root, *parent = NULL;
+    struct NameNode **link = NULL, **parentLink = NULL;
+    const char *p = name;
+
+    while (*p != '\0') {
+        struct NameNode **l = ChildLink(n, *p);
+
+        assert(*l != NULL && CommonLength(*l, p) == (*l)->len);
+        parent = n;
+        parentLink = link;
+        link = l;
+        n = *l;
+        p += n->len;
+    }
+
+    assert(n->id != NULL);
+    n->id = NULL;
+    n->name = NULL;
+
+    if (n == &ix->root)
+        return;
+
+    if (n->child == NULL) {
+        *link = n->next;
+        FreeNode(ix, n);
+
+        // the parent may now be left with a single child
+        if (parent == &ix->root || parent->id != NULL)
+            return;
+        n = parent;
+        link = parentLink;
+    }
+
+    if (n->child != NULL && n->child->next == NULL)
+        Merge(ix, link);
+}
+
+/**
+ * FindName: find the node of a customer in a name index
+ *
+ * param ix: pointer to index
+ * param name: customer name, which must be indexed
+ *
+ * returns: pointer to the node where the name ends
+ */
+static struct NameNode *FindName(struct NameIndex *ix,
+                                 const char *name) {
+    struct NameNode *n = &ix->root;
+    const char *p = name;
+
+    while (*p != '\0') {
+        n = *ChildLink(n, *p);
+        assert(n != NULL && CommonLength(n, p) == n->len);
+        p += n->len;
+    }
+
+    assert(n->id != NULL);
+    return n;
+}
+
+/**
+ * NameIndexUpdate: change the purchase amount of a customer in a name
+ * index
+ *
+ * param ix: pointer to index
+ * param name: customer name
+ * param purchase: new purchase amount
+ */
+void NameIndexUpdate(struct NameIndex *ix, const char *name,
+                     int purchase) {
+    FindName(ix, name)->purchase = purchase;
+}
+
+/**
+ * NameIndexRelocate: point a customer of a name index at a copy of its
+ * keys
+ *
+ * param ix: pointer to index
+ * param id: the copy of the customer id. referred to, not copied
+ * param name: the copy of the customer name. referred to, not copied
+ */
+void NameIndexRelocate(struct NameIndex *ix, const char *id,
+                       const char *name) {
+    struct NameNode *n = FindName(ix, name);
+
+    n->id = id;
+    n->name = name;
+}
+
+/**
+ * NameIndexVisit: apply a given function to the customers whose name
+ * starts with a given prefix
+ *
+ *  the prefix is looked up in time proportional to its length, and
+ *  the subtree below it holds exactly the matching customers
+ *
+ * param ix: pointer to index
+ * param prefix: pointer to null terminated string
+ * param fp: pointer to a function of type FUNCPTR_T
+ * param count: pointer to a counter the number of customers visited
+ *  is added to
+ *
+ * returns: sum of function applications to the customers
+ */
+long long NameIndexVisit(const struct NameIndex *ix, const char *prefix,
+                         FUNCPTR_T fp, int *count) {
+    const struct NameNode *n = &ix->root;
+    const char *p = prefix;
+
+    while (*p != '\0') {
+        const struct NameNode *c = n->child;
+
+        while (c != NULL && c->label[0] != *p)
+            c = c->next;
+        if (c == NULL)
+            return 0;
+
+        // the prefix may end in the middle of a label
+        unsigned int m = CommonLength(c, p);
+        if (m < c->len && p[m] != '\0')
+            return 0;
+
+        n = c;
+        p += m;
+    }
+
+    return VisitSubtree(n, fp, count);
+}
+
+/**
+ * NameIndexRelease: free every node of a name index at once
+ *
+ * param ix: pointer to index. it is left empty
+ */
+void NameIndexRelease(struct NameIndex *ix) {
+    ArenaRelease(&ix->arena);
+    NameIndexInit(ix);
+}
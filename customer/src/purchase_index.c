@@ -0,0 +1,300 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: purchase_index.c
+ */
+
+#include "purchase_index.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Before: check whether a node is ordered before a customer
+ *
+ * returns: nonzero if node n comes before (purchase, id)
+ */
+static inline int Before(const struct PurchaseNode *n, int purchase,
+                         const char *id) {
+    if (n->purchase != purchase)
+        return n->purchase > purchase;
+    return strcmp(n->id, id) < 0;
+}
+
+/**
+ * Link: get the link to the node after a given one on a level
+ *
+ * param ix: pointer to index
+ * param prev: pointer to node. NULL for the head of the list
+ * param l: level, below the level of prev
+ *
+ * returns: pointer to the link
+ */
+static inline struct PurchaseNode **Link(struct PurchaseIndex *ix,
+                                         struct PurchaseNode *prev,
+                                         int l) {
+    return prev == NULL ? &ix->head[l] : &prev->next[l];
+}
+
+/**
+ * FindLinks: find the link to where a customer is or would be on
+ * each level
+ *
+ * param ix: pointer to index
+ * param purchase: purchase amount of the customer
+ * param id: id of the customer
+ * param update: array receiving the link of each level in use
+ */
+static void FindLinks(struct PurchaseIndex *ix, int purchase,
+                      const char *id, struct PurchaseNode ***update) {
+    struct PurchaseNode *prev = NULL, *n;
+
+    for (int l = ix->level - 1; l >= 0; l--) {
+        while ((n = *Link(ix, prev, l)) != NULL &&
+               Before(n, purchase, id))
+            prev = n;
+        update[l] = Link(ix, prev, l);
+    }
+}
+
+/**
+ * RandomLevel: choose the number of levels of a new node
+ *
+ *  each level is kept with probability 1/4, decided by two bits of a
+ *  xorshift generator
+ *
+ * param ix: pointer to index
+ *
+ * returns: level between 1 and PURCHASE_INDEX_MAX_LEVEL
+ */
+static int RandomLevel(struct PurchaseIndex *ix) {
+    unsigned long long x = ix->random;
+    int level = 1;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    ix->random = x;
+
+    while (level < PURCHASE_INDEX_MAX_LEVEL && (x & 3) == 0) {
+        level++;
+        x >>= 2;
+    }
+
+    return level;
+}
+
+/**
+ * PurchaseIndexInit: initialize an empty purchase index
+ *
+ * param ix: pointer to index
+ * param seed: seed of the level generator
+ */
+void PurchaseIndexInit(struct PurchaseIndex *ix,
+                       unsigned long long seed) {
+    memset(ix, 0, sizeof(struct PurchaseIndex));
+    ix->level = 1;
+
+    // xorshift must not start from 0
+    ix->random = seed | 1;
+    ArenaInit(&ix->arena);
+}
+
+/**
+ * PurchaseIndexInsert: add a customer to a purchase index
+ *
+ * param ix: pointer to index
+ * param id: customer id. referred to, not copied
+ * param name: customer name. referred to, not copied
+ * param purchase: purchase amount
+ *
+ * returns: 0 on success. -1 if memory allocation fails
+ */
+int PurchaseIndexInsert(struct PurchaseIndex *ix, const char *id,
+                        const char *name, int purchase) {
+    struct PurchaseNode **update[PURCHASE_INDEX_MAX_LEVEL];
+    int level = RandomLevel(ix);
+
+    struct PurchaseNode *node =
+        ArenaAlloc(&ix->arena, offsetof(struct PurchaseNode, next) +
+                                   level * sizeof(node->next[0]));
+    if (node == NULL)
+        return -1;
+
+    node->id = id;
+    node->name = name;
+    node->purchase = purchase;
+    node->level = level;
+
+    if (level > ix->level)
+        ix->level = level;
+    FindLinks(ix, purchase, id, update);
+
+    for (int l = 0; l < level; l++) {
+        node->next[l] = *update[l];
+        *update[l] = node;
+    }
+
+    return 0;
+}
+
+/**
+ * PurchaseIndexRemove: remove a customer from a purchase index
+ *
+ * param ix: pointer to index
+ * param id: customer id
+ * param purchase: purchase amount the customer was indexed with
+ */
+void PurchaseIndexRemove(struct PurchaseIndex *ix, const char *id,
+                         int purchase) {
+    struct PurchaseNode **update[PURCHASE_INDEX_MAX_LEVEL];
+
+    FindLinks(ix, purchase, id, update);
+
+    struct PurchaseNode *node = *update[0];
+    assert(node != NULL && node->purchase == purchase &&
+           strcmp(node->id, id) == 0);
+
+    for (int l = 0; l < node->level; l++)
+        *update[l] = node->next[l];
+    while (ix->level > 1 && ix->head[ix->level - 1] == NULL)
+        ix->level--;
+
+    ArenaFree(&ix->arena, node,
+              offsetof(struct PurchaseNode, next) +
+                  node->level * sizeof(node->next[0]));
+}
+
+/**
+ * PurchaseIndexUpdate: change the purchase amount of a customer in a
+ * purchase index
+ *
+ *  the node is unlinked from every level and linked in again at its
+ *  new position, keeping its level
+ *
+ * param ix: pointer to index
+ * param id: customer id
+ * param old: purchase amount the customer was indexed with
+ * param purchase: new purchase amount
+ */
+void PurchaseIndexUpdate(struct PurchaseIndex *ix, const char *id,
+                         int old, int purchase) {
+    struct PurchaseNode **update[PURCHASE_INDEX_MAX_LEVEL];
+
+    FindLinks(ix, old, id, update);
+
+    struct PurchaseNode *node = *update[0];
+    assert(node != NULL && node->purchase == old &&
+           strcmp(node->id, id) == 0);
+
+    for (int l = 0; l < node->level; l++)
+        *update[l] = node->next[l];
+
+    node->purchase = purchase;
+    FindLinks(ix, purchase, id, update);
+    for (int l = 0; l < node->level; l++) {
+        node->next[l] = *update[l];
+        *update[l] = node;
+    }
+}
+
+/**
+ * PurchaseIndexRelocate: point a customer of a purchase index at a
+ * copy of its keys
+ *
+ * param ix: pointer to index
+ * param id: the copy of the customer id. referred to, not copied
+ * param name: the copy of the customer name. referred to, not copied
+ * param purchase: purchase amount the customer is indexed with
+ */
+void PurchaseIndexRelocate(struct PurchaseIndex *ix, const char *id,
+                           const char *name, int purchase) {
+    struct PurchaseNode **update[PURCHASE_INDEX_MAX_LEVEL];
+
+    FindLinks(ix, purchase, id, update);
+
+    struct PurchaseNode *node = *update[0];
+    assert(node != NULL && node->purchase == purchase &&
+           strcmp(node->id, id) == 0);
+
+    node->id = id;
+    node->name = name;
+}
+
+/**
+ * PurchaseIndexSeek: find the first customer whose purchase amount is
+ * at most a given value
+ *
+ * param ix: pointer to index
+ * param high: largest purchase amount wanted
+ *
+ * returns: pointer to node. NULL if there is none
+ */
+const struct PurchaseNode *
+PurchaseIndexSeek(const struct PurchaseIndex *ix, int high) {
+    const struct PurchaseNode *prev = NULL, *n;
+
+    for (int l = ix->level - 1; l >= 0; l--) {
+        for (;;) {
+            n = prev == NULL ? ix->head[l] : prev->next[l];
+            if (n == NULL || n->purchase <= high)
+                break;
+            prev = n;
+        }
+    }
+
+    return prev == NULL ? ix->head[0] : prev->next[0];
+}
+
+/**
+ * PurchaseIndexRange: apply a given function to the customers in a
+ * range of purchase amounts and get the sum of results
+ *
+ * param ix: pointer to index
+ * param low: smallest purchase amount wanted
+ * param high: largest purchase amount wanted
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers
+ */
+long long PurchaseIndexRange(const struct PurchaseIndex *ix, int low,
+                             int high, FUNCPTR_T fp) {
+    long long sum = 0;
+
+    for (const struct PurchaseNode *n = PurchaseIndexSeek(ix, high);
+         n != NULL && n->purchase >= low; n = n->next[0])
+        sum += fp(n->id, n->name, n->purchase);
+
+    return sum;
+}
+
+/**
+ * PurchaseIndexTop: apply a given function to the customers with the
+ * largest purchase amounts and get the sum of results
+ *
+ * param ix: pointer to index
+ * param k: number of customers
+ * param fp: pointer to a function of type FUNCPTR_T
+ *
+ * returns: sum of function applications to the customers
+ */
+long long PurchaseIndexTop(const struct PurchaseIndex *ix, int k,
+                           FUNCPTR_T fp) {
+    long long sum = 0;
+
+    for (const struct PurchaseNode *n = ix->head[0]; n != NULL && k > 0;
+         n = n->next[0], k--)
+        sum += fp(n->id, n->name, n->purchase);
+
+    return sum;
+}
+
+/**
+ * PurchaseIndexRelease: free every node of a purchase index at once
+ *
+ * param ix: pointer to index. it is left empty
+ */
+void PurchaseIndexRelease(struct PurchaseIndex *ix) {
+    ArenaRelease(&ix->arena);
+    PurchaseIndexInit(ix, ix->random);
+}
@@ -0,0 +1,463 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: record_file.c
+ */
+
+#include "record_file.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a file is split into chunks of at least this many bytes, one per
+// parsing thread, and into at most this many chunks
+#define MIN_CHUNK_SIZE (1 << 20)
+#define MAX_PARSE_THREADS 64
+
+/* a range of whole lines parsed by one thread */
+struct Chunk {
+    pthread_t thread;
+    struct RecordFile *f;
+
+    // lines of the chunk
+    char *begin;
+    char *end;
+
+    // field separator of the file
+    char sep;
+
+    // number of lines, counted by the first pass
+    size_t lines;
+
+    // line number of the first line, and index of the first record
+    // slot in the arrays of f. both come from the counts of the
+    // chunks before
+    size_t firstLine;
+    size_t first;
+
+    // records parsed by the second pass, fewer than lines if some
+    // lines are empty
+    size_t count;
+
+    // line number of the first malformed line. 0 if there is none
+    size_t badLine;
+};
+
+/**
+ * ParsePurchase: parse the purchase field of a record
+ *
+ *  the field is a decimal number with an optional sign
+ *
+ * param p: first byte of the field
+ * param end: byte after the field
+ * param purchase: set to the amount
+ *
+ * returns: 0 on success. -1 if the field is not a positive number that
+ *  fits in an int
+ */
+static int ParsePurchase(const char *p, const char *end,
+                         int *purchase) {
+    long long value = 0;
+    int negative = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p == end)
+        return -1;
+
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return -1;
+        value = value * 10 + (*p - '0');
+        if (value > (long long)INT_MAX + 1)
+            return -1;
+    }
+
+    value = negative ? -value : value;
+    if (value <= 0 || value > INT_MAX)
+        return -1;
+
+    *purchase = (int)value;
+    return 0;
+}
+
+/**
+ * SplitLine: find the fields of a record
+ *
+ * param line: first byte of the line
+ * param end: byte after the line, without its line break
+ * param sep: field separator
+ * param name: set to the first byte of the name
+ * param purchase: set to the first byte of the purchase field
+ *
+ * returns: 0 on success. -1 if the line has fewer than three fields
+ */
+static int SplitLine(char *line, char *end, char sep, char **name,
+                     char **purchase) {
+    char *s = memchr(line, sep, end - line);
+    if (s == NULL)
+        return -1;
+
+    *name = s + 1;
+    s = memchr(*name, sep, end - *name);
+    if (s == NULL)
+        return -1;
+
+    *purchase = s + 1;
+    return 0;
+}
+
+/**
+ * LineEnd: find the end of a line
+ *
+ * param p: first byte of the line
+ * param end: end of the mapped text
+ * param next: set to the first byte of the next line
+ *
+ * returns: pointer to the line break, or to a '\r' right before it
+ */
+static char *LineEnd(char *p, char *end, char **next) {
+    char *nl = memchr(p, '\n', end - p);
+
+    if (nl == NULL)
+        nl = end;
+    *next = nl < end ? nl + 1 : end;
+    if (nl > p && nl[-1] == '\r')
+        nl--;
+
+    return nl;
+}
+
+/**
+ * CountLines: first pass over a chunk, counting its lines
+ *
+ * param arg: pointer to the struct Chunk
+ *
+ * returns: NULL
+ */
+static void *CountLines(void *arg) {
+    struct Chunk *c = arg;
+    char *p = c->begin;
+
+    c->lines = 0;
+    while (p < c->end) {
+        char *nl = memchr(p, '\n', c->end - p);
+        c->lines++;
+        if (nl == NULL)
+            break;
+        p = nl + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * ParseLines: second pass over a chunk, storing its records
+ *
+ *  the separators after the id and the name are overwritten with
+ *  terminators, so that the keys are used where they are
+ *
+ * param arg: pointer to the struct Chunk
+ *
+ * returns: NULL
+ */
+static void *ParseLines(void *arg) {
+    struct Chunk *c = arg;
+    struct RecordFile *f = c->f;
+    size_t line = c->firstLine;
+    char *p = c->begin, *next;
+
+    c->count = 0;
+    c->badLine = 0;
+    for (; p < c->end; p = next, line++) {
+        char *eol = LineEnd(p, c->end, &next);
+        char *name, *purchase;
+        size_t i = c->first + c->count;
+
+        if (eol == p)
+            continue;
+        if (SplitLine(p, eol, c->sep, &name, &purchase) < 0 ||
+            ParsePurchase(purchase, eol, &f->purchases[i]) < 0) {
+            c->badLine = line;
+            return NULL;
+        }
+
+        name[-1] = '\0';
+        purchase[-1] = '\0';
+        f->ids[i] = p;
+        f->names[i] = name;
+        c->count++;
+    }
+
+    return NULL;
+}
+
+/**
+ * RunChunks: run a pass over every chunk, one thread per chunk
+ *
+ *  the calling thread takes the first chunk, and any chunk whose
+ *  thread can't be started afterwards
+ *
+ * param chunks: array of chunks
+ * param n: number of chunks
+ * param pass: function run on each chunk
+ */
+static void RunChunks(struct Chunk *chunks, int n,
+                      void *(*pass)(void *)) {
+    int started[MAX_PARSE_THREADS] = {0};
+
+    for (int i = 1; i < n; i++)
+        started[i] = pthread_create(&chunks[i].thread, NULL, pass,
+                                    &chunks[i]) == 0;
+
+    pass(&chunks[0]);
+    for (int i = 1; i < n; i++) {
+        if (started[i])
+            pthread_join(chunks[i].thread, NULL);
+        else
+            pass(&chunks[i]);
+    }
+}
+
+/**
+ * AllocRecords: allocate the arrays of a record file
+ *
+ * param f: pointer to the record file
+ * param n: number of records the arrays have room for
+ *
+ * returns: 0 on success. -1 if memory allocation fails
+ */
+static int AllocRecords(struct RecordFile *f, size_t n) {
+    // one more entry, so that no array is empty
+    f->ids = malloc((n + 1) * sizeof(const char *));
+    f->names = malloc((n + 1) * sizeof(const char *));
+    f->purchases = malloc((n + 1) * sizeof(int));
+    if (f->ids == NULL || f->names == NULL || f->purchases == NULL) {
+        fprintf(stderr, "Can't allocate a memory for %zu records\n", n);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * FindSeparator: find the field separator of a file
+ *
+ * param text: first line of the file
+ * param end: end of the first line
+ *
+ * returns: ',' or '\t', whichever comes first. 0 if there is neither
+ */
+static char FindSeparator(const char *text, const char *end) {
+    for (const char *p = text; p < end; p++)
+        if (*p == ',' || *p == '\t')
+            return *p;
+
+    return 0;
+}
+
+/**
+ * FieldIs: check whether a field is a given word, ignoring case
+ *
+ * param p: first byte of the field
+ * param end: byte after the field
+ * param word: null terminated word
+ *
+ * returns: 1 if the field is word. 0 otherwise
+ */
+static int FieldIs(const char *p, const char *end, const char *word) {
+    size_t len = strlen(word);
+
+    return (size_t)(end - p) == len && strncasecmp(p, word, len) == 0;
+}
+
+/**
+ * ParseRecords: parse the records of a mapped file
+ *
+ * param f: pointer to the record file, with the file mapped
+ * param path: path of the file, for messages
+ *
+ * returns: 0 on success. -1 on failure
+ */
+static int ParseRecords(struct RecordFile *f, const char *path) {
+    struct Chunk chunks[MAX_PARSE_THREADS];
+    char *text = f->map, *end = f->map + f->mapSize, *next;
+    size_t firstLine = 1;
+
+    // the first line that is not empty decides the separator, and is
+    // skipped if it is the header "id,name,purchase". any other first
+    // line is a record, and has to parse as one
+    char *eol = LineEnd(text, end, &next);
+    while (text < end && eol == text) {
+        text = next;
+        firstLine++;
+        eol = LineEnd(text, end, &next);
+    }
+
+    char sep = FindSeparator(text, eol);
+    char *name, *purchase;
+    if (text < end) {
+        if (sep == 0 ||
+            SplitLine(text, eol, sep, &name, &purchase) < 0) {
+            fprintf(stderr, "%s:%zu: malformed record\n", path,
+                    firstLine);
+            return -1;
+        }
+        if (FieldIs(text, name - 1, "id") &&
+            FieldIs(name, purchase - 1, "name") &&
+            FieldIs(purchase, eol, "purchase")) {
+            text = next;
+            firstLine++;
+        }
+    }
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t size = (size_t)(end - text);
+    int n = (int)(size / MIN_CHUNK_SIZE);
+    if (n > ncpu)
+        n = (int)ncpu;
+    if (n > MAX_PARSE_THREADS)
+        n = MAX_PARSE_THREADS;
+    if (n < 1)
+        n = 1;
+
+    // chunks end right after a line break
+    for (int i = 0; i < n; i++) {
+        chunks[i].f = f;
+        chunks[i].sep = sep;
+        chunks[i].begin = i == 0 ? text : chunks[i - 1].end;
+        chunks[i].end = i == n - 1 ? end : text + size / n * (i + 1);
+        if (chunks[i].end < chunks[i].begin)
+            chunks[i].end = chunks[i].begin;
+        if (chunks[i].end < end) {
+            char *nl = memchr(chunks[i].end, '\n',
+                              end - chunks[i].end);
+            chunks[i].end = nl != NULL ? nl + 1 : end;
+        }
+    }
+
+    RunChunks(chunks, n, CountLines);
+
+    size_t lines = 0;
+    for (int i = 0; i < n; i++) {
+        chunks[i].firstLine = firstLine + lines;
+        chunks[i].first = lines;
+        lines += chunks[i].lines;
+    }
+    if (lines > INT_MAX) {
+        fprintf(stderr, "%s: too many records\n", path);
+        return -1;
+    }
+
+    if (AllocRecords(f, lines) < 0)
+        return -1;
+
+    RunChunks(chunks, n, ParseLines);
+
+    // records of later chunks are moved down over the slots of the
+    // empty lines before them
+    size_t count = 0;
+    for (int i = 0; i < n; i++) {
+        struct Chunk *c = &chunks[i];
+
+        if (c->badLine != 0) {
+            fprintf(stderr, "%s:%zu: malformed record\n", path,
+                    c->badLine);
+            return -1;
+        }
+        if (c->first != count) {
+            memmove(f->ids + count, f->ids + c->first,
+                    c->count * sizeof(const char *));
+            memmove(f->names + count, f->names + c->first,
+                    c->count * sizeof(const char *));
+            memmove(f->purchases + count, f->purchases + c->first,
+                    c->count * sizeof(int));
+        }
+        count += c->count;
+    }
+    f->count = (int)count;
+
+    return 0;
+}
+
+/**
+ * RecordFileOpen: map a file of customer records and parse it
+ *
+ *  the file is mapped privately, so that the keys can be terminated in
+ *  place without copying them or changing the file. it is cut into
+ *  chunks of whole lines that several threads parse in two passes:
+ *  the first counts the lines of each chunk, which tells every chunk
+ *  where its records go, and the second stores them there
+ *
+ * param f: pointer to the record file to fill
+ * param path: path of the file
+ *
+ * returns: 0 on success. -1 if the file can't be read or holds a
+ *  malformed line, in which case nothing is left allocated
+ */
+int RecordFileOpen(struct RecordFile *f, const char *path) {
+    struct stat st;
+
+    memset(f, 0, sizeof(struct RecordFile));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Can't read %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    // an empty file holds no records, and can't be mapped
+    if (st.st_size == 0) {
+        close(fd);
+        if (AllocRecords(f, 0) < 0) {
+            RecordFileClose(f);
+            return -1;
+        }
+        return 0;
+    }
+
+    f->mapSize = (size_t)st.st_size;
+    f->map = mmap(NULL, f->mapSize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (f->map == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", path);
+        f->map = NULL;
+        return -1;
+    }
+
+    if (ParseRecords(f, path) < 0) {
+        RecordFileClose(f);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * RecordFileClose: free the records of a record file and unmap it
+ *
+ * param f: pointer to the record file. it is left empty
+ */
+void RecordFileClose(struct RecordFile *f) {
+    free(f->ids);
+    free(f->names);
+    free(f->purchases);
+    if (f->map != NULL)
+        munmap(f->map, f->mapSize);
+
+    memset(f, 0, sizeof(struct RecordFile));
+}
@@ -0,0 +1,327 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: record_pool.c
+ */
+
+#include "record_pool.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * RoundUp: round a size up to a multiple of RECORD_ALIGN
+ */
+static inline size_t RoundUp(size_t size) {
+    return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+/**
+ * Grow: make room for one more element at the end of an array
+ *
+ * param array: the array
+ * param capacity: pointer to the number of elements there is room for
+ * param n: number of elements in the array
+ * param elemSize: size of an element
+ *
+ * returns: the array, moved if it had to grow. NULL if out of memory,
+ *  in which case the array is left as it was
+ */
+static void *Grow(void *array, unsigned int *capacity, unsigned int n,
+                  size_t elemSize) {
+    if (n < *capacity)
+        return array;
+
+    unsigned int newCapacity = *capacity == 0 ? 16 : *capacity * 2;
+    void *p = realloc(array, newCapacity * elemSize);
+    if (p != NULL)
+        *capacity = newCapacity;
+
+    return p;
+}
+
+/**
+ * RecordPoolInit: initialize an empty pool
+ *
+ *  the chunk table has an entry for every possible chunk number. it is
+ *  obtained zero-filled, so that the system only backs the pages of
+ *  the entries in use
+ *
+ * param pool: pointer to pool
+ *
+ * returns: 0 on success. -1 if out of memory
+ */
+int RecordPoolInit(struct RecordPool *pool) {
+    memset(pool, 0, sizeof(struct RecordPool));
+
+    pool->chunks = calloc(RECORD_MAX_CHUNKS, sizeof(char *));
+    if (pool->chunks == NULL)
+        return -1;
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool->chunks);
+        return -1;
+    }
+
+    // chunk 0 is never handed out, so that no reference is RECORD_NONE
+    pool->nchunks = 1;
+
+    return 0;
+}
+
+/**
+ * RecordPoolRelease: free the chunk table of a pool
+ *
+ * param pool: pointer to pool whose arenas are all released
+ */
+void RecordPoolRelease(struct RecordPool *pool) {
+    free(pool->chunks);
+    free(pool->freeChunks);
+    pthread_mutex_destroy(&pool->lock);
+    memset(pool, 0, sizeof(struct RecordPool));
+}
+
+/**
+ * RecordPoolBytes: get the size of the chunk table entries in use
+ *
+ * param pool: pointer to pool
+ *
+ * returns: size in bytes
+ */
+size_t RecordPoolBytes(struct RecordPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t size = pool->nchunks * sizeof(char *) +
+                  pool->freeCapacity * sizeof(unsigned int);
+    pthread_mutex_unlock(&pool->lock);
+
+    return size;
+}
+
+/**
+ * GrabChunks: allocate chunks of contiguous numbers
+ *
+ *  single chunks reuse numbers given back to the pool. runs of several
+ *  chunks always take new numbers
+ *
+ * param pool: pointer to pool
+ * param count: number of chunks
+ *
+ * returns: number of the first chunk. 0 if out of memory or numbers
+ */
+static unsigned int GrabChunks(struct RecordPool *pool,
+                               unsigned int count) {
+    unsigned int first = 0;
+
+    char *p = malloc((size_t)count * RECORD_CHUNK_SIZE);
+    if (p == NULL)
+        return 0;
+
+    // the last number is left out, so that references to the end of a
+    // chunk do not wrap around
+    pthread_mutex_lock(&pool->lock);
+    if (count == 1 && pool->nfree > 0) {
+        first = pool->freeChunks[--pool->nfree];
+    } else if (count < RECORD_MAX_CHUNKS - pool->nchunks) {
+        first = pool->nchunks;
+        pool->nchunks += count;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (first == 0) {
+        free(p);
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+        pool->chunks[first + i] = p + (size_t)i * RECORD_CHUNK_SIZE;
+
+    return first;
+}
+
+/**
+ * DropChunks: free chunks taken by GrabChunks and give their numbers
+ * back to the pool
+ *
+ * param pool: pointer to pool
+ * param first: number of the first chunk
+ * param count: number of chunks
+ */
+static void DropChunks(struct RecordPool *pool, unsigned int first,
+                       unsigned int count) {
+    free(pool->chunks[first]);
+    for (unsigned int i = 0; i < count; i++)
+        pool->chunks[first + i] = NULL;
+
+    // numbers that can't be kept are never used again
+    pthread_mutex_lock(&pool->lock);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int *numbers =
+            Grow(pool->freeChunks, &pool->freeCapacity, pool->nfree,
+                 sizeof(unsigned int));
+        if (numbers == NULL)
+            break;
+        pool->freeChunks = numbers;
+        pool->freeChunks[pool->nfree++] = first + i;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * RecordArenaInit: initialize an empty arena
+ *
+ * param a: pointer to arena
+ * param pool: pointer to the pool chunks are taken from
+ */
+void RecordArenaInit(struct RecordArena *a, struct RecordPool *pool) {
+    memset(a, 0, sizeof(struct RecordArena));
+    a->pool = pool;
+}
+
+/**
+ * AllocLarge: allocate a record that does not fit in a size class
+ *
+ * param a: pointer to arena
+ * param size: size of the record, already rounded up
+ *
+ * returns: reference to the record. RECORD_NONE if out of memory
+ */
+static unsigned int AllocLarge(struct RecordArena *a, size_t size) {
+    if (size / RECORD_CHUNK_SIZE >= RECORD_MAX_CHUNKS)
+        return RECORD_NONE;
+
+    unsigned int count = (unsigned int)((size + RECORD_CHUNK_SIZE - 1) /
+                                        RECORD_CHUNK_SIZE);
+    struct RecordRun *runs = Grow(a->runs, &a->runCapacity, a->nruns,
+                                  sizeof(struct RecordRun));
+    if (runs == NULL)
+        return RECORD_NONE;
+    a->runs = runs;
+
+    unsigned int first = GrabChunks(a->pool, count);
+    if (first == 0)
+        return RECORD_NONE;
+
+    a->runs[a->nruns].first = first;
+    a->runs[a->nruns].count = count;
+    a->nruns++;
+    a->bytesReserved += (size_t)count * RECORD_CHUNK_SIZE;
+    a->bytesInUse += size;
+
+    return first << RECORD_CHUNK_SHIFT;
+}
+
+/**
+ * RecordAlloc: allocate a record from an arena
+ *
+ *  small records are taken from the free list of their size class, or
+ *  else carved out of the current chunk. a new chunk is started when
+ *  the current one is exhausted; its unused tail is given up
+ *
+ * param a: pointer to arena
+ * param size: size of the record in bytes
+ *
+ * returns: reference to the record, aligned to RECORD_ALIGN.
+ *  RECORD_NONE if out of memory
+ */
+unsigned int RecordAlloc(struct RecordArena *a, size_t size) {
+    if (size == 0)
+        size = 1;
+    size = RoundUp(size);
+
+    if (size > RECORD_MAX_SMALL)
+        return AllocLarge(a, size);
+
+    unsigned int units = (unsigned int)(size / RECORD_ALIGN);
+    unsigned int *list = &a->freeLists[units - 1];
+    if (*list != RECORD_NONE) {
+        unsigned int ref = *list;
+        *list = *(unsigned int *)RecordAt(a->pool, ref);
+        a->bytesInUse += size;
+        return ref;
+    }
+
+    if (a->limit - a->cursor < units) {
+        unsigned int *chunks = Grow(a->chunks, &a->chunkCapacity,
+                                    a->nchunks, sizeof(unsigned int));
+        if (chunks == NULL)
+            return RECORD_NONE;
+        a->chunks = chunks;
+
+        unsigned int n = GrabChunks(a->pool, 1);
+        if (n == 0)
+            return RECORD_NONE;
+
+        a->chunks[a->nchunks++] = n;
+        a->cursor = n << RECORD_CHUNK_SHIFT;
+        a->limit = a->cursor + (1U << RECORD_CHUNK_SHIFT);
+        a->bytesReserved += RECORD_CHUNK_SIZE;
+    }
+
+    unsigned int ref = a->cursor;
+    a->cursor += units;
+    a->bytesInUse += size;
+
+    return ref;
+}
+
+/**
+ * RecordFree: give a record back to an arena
+ *
+ *  small records are pushed on the free list of their size class and
+ *  stay reserved by the arena. the chunks of large records are freed
+ *
+ * param a: pointer to arena
+ * param ref: reference to record, as returned by RecordAlloc(a, size)
+ * param size: size the record was allocated with
+ */
+void RecordFree(struct RecordArena *a, unsigned int ref, size_t size) {
+    if (ref == RECORD_NONE)
+        return;
+
+    if (size == 0)
+        size = 1;
+    size = RoundUp(size);
+    assert(a->bytesInUse >= size);
+    a->bytesInUse -= size;
+
+    if (size > RECORD_MAX_SMALL) {
+        unsigned int first = ref >> RECORD_CHUNK_SHIFT;
+
+        for (unsigned int i = 0; i < a->nruns; i++) {
+            if (a->runs[i].first != first)
+                continue;
+
+            unsigned int count = a->runs[i].count;
+            a->runs[i] = a->runs[--a->nruns];
+            a->bytesReserved -= (size_t)count * RECORD_CHUNK_SIZE;
+            DropChunks(a->pool, first, count);
+            return;
+        }
+        assert(0);
+        return;
+    }
+
+    unsigned int *list = &a->freeLists[size / RECORD_ALIGN - 1];
+    *(unsigned int *)RecordAt(a->pool, ref) = *list;
+    *list = ref;
+}
+
+/**
+ * RecordArenaRelease: free all records of an arena at once
+ *
+ *  the arena is left empty and may be used again
+ *
+ * param a: pointer to arena
+ */
+void RecordArenaRelease(struct RecordArena *a) {
+    struct RecordPool *pool = a->pool;
+
+    for (unsigned int i = 0; i < a->nchunks; i++)
+        DropChunks(pool, a->chunks[i], 1);
+    for (unsigned int i = 0; i < a->nruns; i++)
+        DropChunks(pool, a->runs[i].first, a->runs[i].count);
+
+    free(a->chunks);
+    free(a->runs);
+    RecordArenaInit(a, pool);
+}
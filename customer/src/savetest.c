@@ -0,0 +1,295 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* savetest.c */
+
+/* test of the snapshots and the journal of customer_manager4.c. a db
+   is saved, updated through every kind of mutation while a journal
+   logs them, and recovered by loading the snapshot and replaying the
+   journal. a torn tail of the journal must be cut off, and a loaded db
+   must go on growing past the mapped snapshot. with a deferred
+   journal, another thread acknowledges the mutations once they are on
+   disk */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "customer_manager.h"
+#include "testutil.h"
+
+/* number of customer keys the test uses, and of those registered
+   before the snapshot is saved */
+#define KEYS 4000
+#define SAVED 1000
+
+/* largest group of journal entries committed at once */
+#define GROUP_BYTES 4096
+
+/* mutations made with a deferred journal, and how many of them are
+   made before their sequence number is handed to the acknowledger */
+#define DEFERRED 1000
+#define DEFERRED_STEP 10
+
+/* size of the buffer of a path, including the null byte */
+#define PATH_SIZE 64
+
+/* purchase of each customer the db should hold, 0 if none */
+static int expected[KEYS];
+
+static char dir[] = "/tmp/savetestXXXXXX";
+static char snapPath[PATH_SIZE];
+static char journalPath[PATH_SIZE];
+
+/* a thread that waits for the mutations of a db with a deferred
+   journal. 'published' is the sequence number of the last mutation
+   made, and 'acked' that of the last one known to be on disk */
+struct Acker {
+    DB_T db;
+    unsigned long long published;
+    unsigned long long acked;
+    int done;
+    int failed;
+};
+
+/*--------------------------------------------------------------------*/
+/* returns nonzero if db holds exactly the expected customers */
+static int Matches(DB_T d) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    int sum = 0;
+
+    for (int k = 0; k < KEYS; k++) {
+        int e = expected[k] ? expected[k] : -1;
+
+        KeysOf(k, id, name);
+        if (GetPurchaseByID(d, id) != e ||
+            GetPurchaseByName(d, name) != e)
+            return 0;
+        sum += expected[k];
+    }
+
+    return GetSumCustomerPurchase(d, Purchase) == sum;
+}
+/*--------------------------------------------------------------------*/
+/* apply one mutation to each of the 'count' customers from 'first' on,
+   and to expected[]. an absent customer is registered, and a present
+   one goes through the other kinds of mutations in turn. returns the
+   number of mutations, or -1 if one returned something unexpected */
+static int Mutate(DB_T d, int first, int count) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    int done = 0;
+
+    for (int i = 0; i < count; i++) {
+        int k = first + i;
+        int res, ok;
+
+        KeysOf(k, id, name);
+        switch (expected[k] == 0 ? 0 : 1 + i % 4) {
+        case 0:
+            ok = RegisterCustomer(d, id, name, k + 1) == 0;
+            expected[k] = k + 1;
+            break;
+        case 1:
+            ok = UnregisterCustomerByID(d, id) == 0;
+            expected[k] = 0;
+            break;
+        case 2:
+            ok = UnregisterCustomerByName(d, name) == 0;
+            expected[k] = 0;
+            break;
+        case 3:
+            res = AddPurchaseByID(d, id, 10);
+            ok = res == expected[k] + 10;
+            expected[k] = res;
+            break;
+        default:
+            ok = SetPurchaseByName(d, name, 7) == 0;
+            expected[k] = 7;
+            break;
+        }
+
+        if (!ok)
+            return -1;
+        done++;
+    }
+
+    return done;
+}
+/*--------------------------------------------------------------------*/
+/* acknowledge the published mutations until told that no more come */
+static void *AckerMain(void *arg) {
+    struct Acker *a = arg;
+
+    for (;;) {
+        int done = __atomic_load_n(&a->done, __ATOMIC_ACQUIRE);
+        unsigned long long seq =
+            __atomic_load_n(&a->published, __ATOMIC_ACQUIRE);
+
+        if (seq > a->acked) {
+            if (WaitCustomerJournal(a->db, seq) < 0)
+                a->failed = 1;
+            a->acked = seq;
+        } else if (done) {
+            break;
+        } else {
+            usleep(100);
+        }
+    }
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* load the snapshot and replay the journal. *replayed receives what
+   OpenCustomerJournal returns */
+static DB_T Recover(enum DBJournalMode mode, int *replayed) {
+    DB_T d = LoadCustomerDB(snapPath);
+
+    *replayed = -1;
+    if (d != NULL)
+        *replayed =
+            OpenCustomerJournal(d, journalPath, mode, 5, GROUP_BYTES);
+
+    return d;
+}
+/*--------------------------------------------------------------------*/
+int main(void) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    int replayed, n;
+
+    if (mkdtemp(dir) == NULL) {
+        printf("[FAILED] can't create a directory for the files\n");
+        return 1;
+    }
+    snprintf(snapPath, PATH_SIZE, "%s/db.snap", dir);
+    snprintf(journalPath, PATH_SIZE, "%s/db.jnl", dir);
+
+    /* save a db, then update it with a journal attached */
+    DB_T d = CreateCustomerDB();
+    for (int k = 0; k < SAVED; k++) {
+        KeysOf(k, id, name);
+        RegisterCustomer(d, id, name, k + 1);
+        expected[k] = k + 1;
+    }
+    Check(OpenCustomerJournal(d, journalPath, DB_JOURNAL_DURABLE, 5,
+                              GROUP_BYTES) == 0,
+          "OpenCustomerJournal on an empty journal");
+    Check(SaveCustomerDB(d, snapPath) == 0, "SaveCustomerDB");
+
+    int saved[KEYS];
+    memcpy(saved, expected, sizeof(saved));
+
+    // the mutations start inside the saved customers, so that every
+    // kind of them finds its customer
+    n = Mutate(d, SAVED - 500, 1000);
+    Check(n == 1000, "mutations after the snapshot");
+    Check(Matches(d), "db after the mutations");
+    DestroyCustomerDB(d);
+
+    /* the snapshot alone holds the db as it was saved */
+    int after[KEYS];
+    memcpy(after, expected, sizeof(after));
+    memcpy(expected, saved, sizeof(expected));
+    d = LoadCustomerDB(snapPath);
+    Check(d != NULL && Matches(d), "LoadCustomerDB");
+
+    /* the journal brings it up to date */
+    memcpy(expected, after, sizeof(expected));
+    replayed = OpenCustomerJournal(d, journalPath, DB_JOURNAL_DURABLE,
+                                   5, GROUP_BYTES);
+    Check(replayed == n, "OpenCustomerJournal replays the mutations");
+    Check(Matches(d), "db after the replay");
+
+    /* a loaded db grows past the mapped arrays and tables */
+    n = Mutate(d, SAVED + 500, KEYS - SAVED - 500);
+    Check(n == KEYS - SAVED - 500, "mutations of the loaded db");
+    for (int k = 0; k < KEYS; k++) {
+        KeysOf(k, id, name);
+        if (expected[k] == 0 &&
+            RegisterCustomer(d, id, name, k + 1) == 0)
+            expected[k] = k + 1;
+    }
+    Check(Matches(d), "loaded db grown past the snapshot");
+    DestroyCustomerDB(d);
+
+    d = Recover(DB_JOURNAL_DURABLE, &replayed);
+    Check(d != NULL && Matches(d), "recovery of the grown db");
+    DestroyCustomerDB(d);
+
+    /* a torn tail is cut off, so that later entries are found */
+    FILE *fp = fopen(journalPath, "ab");
+    if (fp != NULL) {
+        fwrite("\x40\0\0\0torn entry", 1, 14, fp);
+        fclose(fp);
+    }
+    int before = replayed;
+    d = Recover(DB_JOURNAL_DURABLE, &replayed);
+    Check(replayed == before && Matches(d),
+          "recovery ignores a torn tail");
+    KeysOf(0, id, name);
+    Check(UnregisterCustomerByID(d, id) == 0,
+          "mutation after a torn tail");
+    expected[0] = 0;
+    DestroyCustomerDB(d);
+
+    d = Recover(DB_JOURNAL_DURABLE, &replayed);
+    Check(replayed == before + 1 && Matches(d),
+          "recovery finds the entry after the torn tail");
+
+    /* an asynchronous journal is on disk after a sync */
+    Check(SaveCustomerDB(d, snapPath) == 0, "SaveCustomerDB again");
+    DestroyCustomerDB(d);
+    d = Recover(DB_JOURNAL_ASYNC, &replayed);
+    Check(replayed == 0, "SaveCustomerDB empties the journal");
+    n = Mutate(d, 0, 500);
+    Check(n == 500 && SyncCustomerJournal(d) == 0,
+          "SyncCustomerJournal");
+    DestroyCustomerDB(d);
+    d = Recover(DB_JOURNAL_ASYNC, &replayed);
+    Check(replayed == n && Matches(d), "recovery of an async journal");
+    DestroyCustomerDB(d);
+
+    /* the mutations of a deferred journal return before they are on
+       disk, and another thread waits for them meanwhile */
+    d = Recover(DB_JOURNAL_DEFERRED, &replayed);
+    Check(replayed == n && Matches(d),
+          "OpenCustomerJournal in deferred mode");
+    struct Acker acker = {d, 0, 0, 0, 0};
+    unsigned long long first = CustomerJournalSeq(d);
+    pthread_t thread;
+    int made = 0;
+
+    if (pthread_create(&thread, NULL, AckerMain, &acker) != 0) {
+        printf("[FAILED] can't start the acknowledging thread\n");
+        return 1;
+    }
+    for (int i = 0; i < DEFERRED; i += DEFERRED_STEP) {
+        if (Mutate(d, 500 + i, DEFERRED_STEP) == DEFERRED_STEP)
+            made += DEFERRED_STEP;
+        __atomic_store_n(&acker.published, CustomerJournalSeq(d),
+                         __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&acker.done, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    Check(made == DEFERRED &&
+              CustomerJournalSeq(d) == first + DEFERRED,
+          "mutations with a deferred journal");
+    Check(!acker.failed && acker.acked == first + DEFERRED,
+          "WaitCustomerJournal from another thread");
+    Check(WaitCustomerJournal(d, first + 2 * DEFERRED) == 0,
+          "WaitCustomerJournal past the last mutation");
+    DestroyCustomerDB(d);
+    d = Recover(DB_JOURNAL_DURABLE, &replayed);
+    Check(replayed == n + DEFERRED && Matches(d),
+          "recovery of a deferred journal");
+    Check(WaitCustomerJournal(NULL, 1) == -1,
+          "WaitCustomerJournal without a db");
+    DestroyCustomerDB(d);
+
+    remove(snapPath);
+    remove(journalPath);
+    rmdir(dir);
+
+    return Failures() == 0 ? 0 : 1;
+}
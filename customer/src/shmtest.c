@@ -0,0 +1,209 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* shmtest.c */
+
+/* test of the shared memory dbs of customer_manager6.c. a reader handle
+   opened by OpenSharedCustomerDB must refuse every update, and must see
+   each update of the writer as soon as it returns. a reader in another
+   process looks up customers that never change while the writer churns
+   others and grows the region, and both handles must agree on every
+   customer and sum afterwards */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "customer_manager.h"
+#include "testutil.h"
+
+/* number of customers that never change, and of churned ones */
+#define STABLE 1000
+#define CHURN_KEYS 20000
+
+/* updates of the churn */
+#define OPS 200000
+
+/* purchase of each churned customer, 0 if none */
+static int live[CHURN_KEYS];
+
+/*--------------------------------------------------------------------*/
+/* look up the stable customers and sum them up until *done is set,
+   and at least once each. returns nonzero if any lookup or sum was
+   wrong */
+static int ReadStable(DB_T r, const int *done, int stableSum) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    int bad = 0;
+
+    for (int i = 0;
+         i < STABLE || !__atomic_load_n(done, __ATOMIC_ACQUIRE); i++) {
+        int k = i % STABLE;
+
+        snprintf(id, KEY_SIZE, "s%d", k);
+        snprintf(name, KEY_SIZE, "sn%d", k);
+        if (GetPurchaseByID(r, id) != k + 1 ||
+            GetPurchaseByName(r, name) != k + 1)
+            bad = 1;
+        if (k == 0 && GetSumCustomerPurchase(r, StablePurchase) !=
+                          stableSum)
+            bad = 1;
+    }
+
+    return bad;
+}
+/*--------------------------------------------------------------------*/
+/* register, unregister and update churned customers through the
+   writer w, and keep live[] up to date. returns nonzero if an update
+   returned something unexpected */
+static int Churn(DB_T w) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    unsigned int seed = 12345;
+    int bad = 0;
+
+    for (int i = 0; i < OPS; i++) {
+        int k = rand_r(&seed) % CHURN_KEYS;
+        int res;
+
+        snprintf(id, KEY_SIZE, "c%d", k);
+        snprintf(name, KEY_SIZE, "cn%d", k);
+        switch (rand_r(&seed) % 5) {
+        case 0:
+        case 1:
+            res = RegisterCustomer(w, id, name, k + 1);
+            bad |= res != (live[k] ? -1 : 0);
+            if (res == 0)
+                live[k] = k + 1;
+            break;
+        case 2:
+            res = k % 2 ? UnregisterCustomerByID(w, id)
+                        : UnregisterCustomerByName(w, name);
+            bad |= res != (live[k] ? 0 : -1);
+            live[k] = 0;
+            break;
+        case 3:
+            res = AddPurchaseByID(w, id, 3);
+            bad |= res != (live[k] ? live[k] + 3 : -1);
+            if (live[k])
+                live[k] += 3;
+            break;
+        default:
+            res = SetPurchaseByName(w, name, 7);
+            bad |= res != (live[k] ? 0 : -1);
+            if (live[k])
+                live[k] = 7;
+            break;
+        }
+    }
+
+    return bad;
+}
+/*--------------------------------------------------------------------*/
+/* returns nonzero if the handle d holds the stable customers and the
+   churned ones of live[] */
+static int Matches(DB_T d, int stableSum) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+    int sum = stableSum;
+
+    for (int k = 0; k < CHURN_KEYS; k++) {
+        int e = live[k] ? live[k] : -1;
+
+        snprintf(id, KEY_SIZE, "c%d", k);
+        snprintf(name, KEY_SIZE, "cn%d", k);
+        if (GetPurchaseByID(d, id) != e ||
+            GetPurchaseByName(d, name) != e)
+            return 0;
+        sum += live[k];
+    }
+
+    return GetSumCustomerPurchase(d, Purchase) == sum &&
+           GetSumCustomerPurchaseParallel(d, Purchase, 2) == sum &&
+           GetSumCustomerPurchaseByNamePrefix(d, "sn", Purchase) ==
+               stableSum;
+}
+/*--------------------------------------------------------------------*/
+int main(void) {
+    char dbName[KEY_SIZE], id[KEY_SIZE], name[KEY_SIZE];
+    int stableSum = 0;
+
+    snprintf(dbName, KEY_SIZE, "/shmtest%d", (int)getpid());
+    DB_T w = CreateSharedCustomerDB(dbName);
+    DB_T r = OpenSharedCustomerDB(dbName);
+    Check(w != NULL && r != NULL, "CreateSharedCustomerDB and "
+                                  "OpenSharedCustomerDB");
+    if (w == NULL || r == NULL)
+        return 1;
+
+    for (int k = 0; k < STABLE; k++) {
+        snprintf(id, KEY_SIZE, "s%d", k);
+        snprintf(name, KEY_SIZE, "sn%d", k);
+        RegisterCustomer(w, id, name, k + 1);
+        stableSum += k + 1;
+    }
+    Check(GetPurchaseByID(r, "s10") == 11 &&
+              GetPurchaseByName(r, "sn20") == 21 &&
+              GetSumCustomerPurchase(r, Purchase) == stableSum,
+          "reader sees the registrations of the writer");
+
+    /* the reader can't update the region */
+    Check(RegisterCustomer(r, "x", "y", 1) == -1 &&
+              UnregisterCustomerByID(r, "s1") == -1 &&
+              UnregisterCustomerByName(r, "sn1") == -1 &&
+              AddPurchaseByID(r, "s1", 1) == -1 &&
+              SetPurchaseByName(r, "sn1", 5) == -1,
+          "reader refuses updates");
+    Check(GetPurchaseByID(r, "x") == -1 &&
+              GetPurchaseByID(w, "s1") == 2 &&
+              GetPurchaseByName(r, "sn1") == 2,
+          "db unchanged by the refused updates");
+
+    /* an update of the writer is visible once it returns */
+    Check(AddPurchaseByID(w, "s5", 100) == 106 &&
+              GetPurchaseByID(r, "s5") == 106 &&
+              GetPurchaseByName(r, "sn5") == 106,
+          "reader sees AddPurchaseByID of the writer");
+    Check(SetPurchaseByName(w, "sn5", 6) == 0 &&
+              GetPurchaseByID(r, "s5") == 6,
+          "reader sees SetPurchaseByName of the writer");
+
+    /* a reader in another process checks the stable customers while
+       the writer churns the others */
+    int *done = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (done == MAP_FAILED) {
+        printf("[FAILED] can't map a flag to share\n");
+        return 1;
+    }
+    *done = 0;
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        DB_T cr = OpenSharedCustomerDB(dbName);
+        int bad = cr == NULL || ReadStable(cr, done, stableSum);
+        DestroyCustomerDB(cr);
+        _exit(bad);
+    }
+
+    Check(Churn(w) == 0, "updates of the writer during the churn");
+    __atomic_store_n(done, 1, __ATOMIC_RELEASE);
+
+    int status = -1;
+    if (child > 0)
+        waitpid(child, &status, 0);
+    Check(child > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "reader in another process during the churn");
+
+    Check(Matches(w, stableSum), "writer after the churn");
+    Check(Matches(r, stableSum), "reader after the churn");
+
+    DestroyCustomerDB(r);
+    DestroyCustomerDB(w);
+    Check(OpenSharedCustomerDB(dbName) == NULL,
+          "destroying the writer removes the name");
+    munmap(done, sizeof(int));
+
+    return Failures() == 0 ? 0 : 1;
+}
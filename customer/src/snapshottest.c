@@ -0,0 +1,245 @@
+/**********************
+ * EE209 Assignment 3 *
+ **********************/
+/* snapshottest.c */
+
+/* test of SnapshotCustomerDB of customer_manager2.c. a snapshot must
+   go on showing the db as it was when it was opened, whatever is
+   unregistered, updated or registered again in the db afterwards, and
+   must refuse updates of its own. while a snapshot is open the db
+   can't be compacted but its tables still grow, and once the last one
+   is released the customers removed or copied meanwhile are
+   reclaimed */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "customer_manager.h"
+#include "testutil.h"
+
+/* number of customer keys the test uses */
+#define KEYS 5000
+
+/* customers registered again under a new name while a snapshot is
+   open */
+#define RENAMED 50
+
+/* the customers a db or a snapshot should hold: the purchase of each
+   key, 0 if none, and whether its name is the renamed one */
+struct Model {
+    int purchase[KEYS];
+    int renamed[KEYS];
+};
+
+/*--------------------------------------------------------------------*/
+/* the keys of customer k, with the new name if it was renamed */
+static void ModelKeysOf(int k, int renamed, char *id, char *name) {
+    KeysOf(k, id, name);
+    if (renamed)
+        snprintf(name, KEY_SIZE, "renamed%05d", k);
+}
+/*--------------------------------------------------------------------*/
+/* returns nonzero if the db or snapshot d holds exactly the customers
+   of m, as every kind of lookup and sum sees them */
+static int Matches(DB_T d, const struct Model *m) {
+    char id[KEY_SIZE], name[KEY_SIZE], other[KEY_SIZE];
+    const char *ids[1];
+    int out[1];
+    int sum = 0, nameSum = 0;
+
+    for (int k = 0; k < KEYS; k++) {
+        int e = m->purchase[k] ? m->purchase[k] : -1;
+
+        ModelKeysOf(k, !m->renamed[k], id, other);
+        ModelKeysOf(k, m->renamed[k], id, name);
+        ids[0] = id;
+        if (GetPurchaseByID(d, id) != e ||
+            GetPurchaseByName(d, name) != e ||
+            GetPurchaseByName(d, other) != -1 ||
+            GetPurchaseByIDBatch(d, ids, 1, out) != (e > 0) ||
+            out[0] != e)
+            return 0;
+        sum += m->purchase[k];
+        if (!m->renamed[k])
+            nameSum += m->purchase[k];
+    }
+
+    return GetSumCustomerPurchase(d, Purchase) == sum &&
+           GetSumCustomerPurchaseParallel(d, Purchase, 2) == sum &&
+           GetSumCustomerPurchaseByNamePrefix(d, "name", Purchase) ==
+               nameSum;
+}
+/*--------------------------------------------------------------------*/
+/* update the customers of db and m: unregister a fifth of them by id
+   and a fifth by name, add to the purchase of a fifth and set that of
+   another, and register the rest again if they are absent */
+static void Mutate(DB_T db, struct Model *m, int round) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+
+    for (int k = 0; k < KEYS; k++) {
+        ModelKeysOf(k, m->renamed[k], id, name);
+        if (m->purchase[k] == 0) {
+            RegisterCustomer(db, id, name, k + 1);
+            m->purchase[k] = k + 1;
+            continue;
+        }
+
+        switch ((k + round) % 5) {
+        case 0:
+            UnregisterCustomerByID(db, id);
+            m->purchase[k] = 0;
+            break;
+        case 1:
+            UnregisterCustomerByName(db, name);
+            m->purchase[k] = 0;
+            break;
+        case 2:
+            AddPurchaseByID(db, id, 100);
+            m->purchase[k] += 100;
+            break;
+        case 3:
+            SetPurchaseByName(db, name, 7);
+            m->purchase[k] = 7;
+            break;
+        }
+    }
+}
+/*--------------------------------------------------------------------*/
+/* unregister the first RENAMED customers and register them again at
+   once under a new name and purchase */
+static void Rename(DB_T db, struct Model *m) {
+    char id[KEY_SIZE], name[KEY_SIZE];
+
+    for (int k = 0; k < RENAMED; k++) {
+        m->renamed[k] = !m->renamed[k];
+        ModelKeysOf(k, m->renamed[k], id, name);
+        if (m->purchase[k] != 0)
+            UnregisterCustomerByID(db, id);
+        m->purchase[k] = 1000 + k;
+        RegisterCustomer(db, id, name, m->purchase[k]);
+    }
+}
+/*--------------------------------------------------------------------*/
+static unsigned long long BytesOf(DB_T db) {
+    struct DBStats stats;
+
+    GetCustomerDBStats(db, &stats);
+    return stats.bytesAllocated;
+}
+/*--------------------------------------------------------------------*/
+static unsigned long long CapacityOf(DB_T db) {
+    struct DBStats stats;
+
+    GetCustomerDBStats(db, &stats);
+    return stats.idTable.capacity;
+}
+/*--------------------------------------------------------------------*/
+int main(void) {
+    static struct Model now, first, second;
+    char id[KEY_SIZE], name[KEY_SIZE];
+
+    DB_T db = CreateCustomerDB();
+    Mutate(db, &now, 0);
+    Check(Matches(db, &now), "db before any snapshot");
+
+    /* the first snapshot sees none of the later updates */
+    DB_T s1 = SnapshotCustomerDB(db);
+    first = now;
+    Check(s1 != NULL && Matches(s1, &first), "SnapshotCustomerDB");
+
+    Mutate(db, &now, 1);
+    Rename(db, &now);
+    Check(Matches(db, &now), "db updated while a snapshot is open");
+    Check(Matches(s1, &first), "snapshot after the updates");
+
+    ModelKeysOf(1, first.renamed[1], id, name);
+    Check(RegisterCustomer(s1, "x", "y", 1) == -1 &&
+              UnregisterCustomerByID(s1, id) == -1 &&
+              UnregisterCustomerByName(s1, name) == -1 &&
+              AddPurchaseByID(s1, id, 1) == -1 &&
+              SetPurchaseByName(s1, name, 1) == -1 &&
+              SnapshotCustomerDB(s1) == NULL,
+          "snapshot refuses updates");
+    Check(Matches(s1, &first), "snapshot after refused updates");
+    Check(CompactCustomerDB(db) == -1,
+          "CompactCustomerDB fails while a snapshot is open");
+
+    /* a second snapshot sees the updates before it, and neither sees
+       those after it. renaming again brings back names the first
+       snapshot holds for other purchases */
+    DB_T s2 = SnapshotCustomerDB(db);
+    second = now;
+    Mutate(db, &now, 2);
+    Rename(db, &now);
+    Check(s2 != NULL && Matches(s2, &second), "second snapshot");
+    Check(Matches(s1, &first), "first snapshot after more updates");
+    Check(Matches(db, &now), "db with two snapshots open");
+
+    ReleaseCustomerSnapshot(s1);
+    Check(Matches(s2, &second) && Matches(db, &now),
+          "second snapshot after the first is released");
+    Check(CompactCustomerDB(db) == -1,
+          "CompactCustomerDB fails while one snapshot is left");
+    ReleaseCustomerSnapshot(s2);
+    Check(Matches(db, &now), "db after every snapshot is released");
+
+    /* customers removed under a snapshot are reclaimed on its
+       release, so that registering as many again takes no more
+       memory */
+    DestroyCustomerDB(db);
+    memset(&now, 0, sizeof(now));
+    db = CreateCustomerDB();
+    Mutate(db, &now, 0);
+    /* the name index is built by the first prefix query, so that both
+       measurements include it */
+    Check(Matches(db, &now), "db before the snapshot");
+    unsigned long long full = BytesOf(db);
+
+    s1 = SnapshotCustomerDB(db);
+    for (int k = 0; k < KEYS; k++) {
+        KeysOf(k, id, name);
+        UnregisterCustomerByID(db, id);
+    }
+    ReleaseCustomerSnapshot(s1);
+    for (int k = 0; k < KEYS; k++) {
+        KeysOf(k, id, name);
+        RegisterCustomer(db, id, name, k + 1);
+    }
+    Check(Matches(db, &now) && BytesOf(db) <= full,
+          "removed customers reclaimed after the release");
+    Check(CompactCustomerDB(db) == 0,
+          "CompactCustomerDB after every snapshot is released");
+    Check(Matches(db, &now), "db after the compaction");
+
+    /* the tables grow as customers are registered under a snapshot,
+       which still sees none of them */
+    DestroyCustomerDB(db);
+    memset(&now, 0, sizeof(now));
+    memset(&first, 0, sizeof(first));
+    db = CreateCustomerDB();
+    unsigned long long empty = CapacityOf(db);
+
+    s1 = SnapshotCustomerDB(db);
+    Mutate(db, &now, 0);
+    Check(CapacityOf(db) > empty && CapacityOf(db) >= KEYS,
+          "tables grow from %llu to %llu buckets under a snapshot",
+          empty, CapacityOf(db));
+    Check(Matches(db, &now) && Matches(s1, &first),
+          "db and snapshot after the growth");
+
+    s2 = SnapshotCustomerDB(db);
+    second = now;
+    Mutate(db, &now, 1);
+    Rename(db, &now);
+    Mutate(db, &now, 2);
+    Check(Matches(db, &now) && Matches(s1, &first) &&
+              Matches(s2, &second),
+          "db and both snapshots after more updates");
+    ReleaseCustomerSnapshot(s2);
+    ReleaseCustomerSnapshot(s1);
+    Check(Matches(db, &now), "db after both snapshots are released");
+    DestroyCustomerDB(db);
+
+    return Failures() == 0 ? 0 : 1;
+}
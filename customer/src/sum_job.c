@@ -0,0 +1,97 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: sum_job.c
+ */
+
+#include "sum_job.h"
+#include <pthread.h>
+
+/* a RunSumJob() call. its workers claim chunks by incrementing next
+   until every chunk is taken */
+struct SumJob {
+    SUMCHUNK_T chunkSum;
+    void *arg;
+    unsigned int nchunks;
+    unsigned int next;
+};
+
+/* a worker of a sum job and its partial sum */
+struct SumWorker {
+    pthread_t thread;
+    struct SumJob *job;
+    long long sum;
+};
+
+/**
+ * SumWorkerMain: sum chunks of a sum job until none is left
+ *
+ * param arg: pointer to the worker's struct SumWorker
+ *
+ * returns: NULL
+ */
+static void *SumWorkerMain(void *arg) {
+    struct SumWorker *w = arg;
+    struct SumJob *job = w->job;
+    unsigned int chunk;
+
+    w->sum = 0;
+    while ((chunk = __atomic_fetch_add(&job->next, 1,
+                                       __ATOMIC_RELAXED)) <
+           job->nchunks)
+        w->sum += job->chunkSum(job->arg, chunk);
+
+    return NULL;
+}
+
+/**
+ * RunSumJob: sum every chunk of a job on several threads
+ *
+ * param nchunks: number of chunks
+ * param chunkSum: function that sums one chunk
+ * param arg: argument passed to chunkSum
+ * param nthreads: number of threads to use, the calling one included
+ *
+ * returns: sum of chunkSum over all chunks
+ */
+long long RunSumJob(unsigned int nchunks, SUMCHUNK_T chunkSum,
+                    void *arg, int nthreads) {
+    struct SumWorker workers[MAX_SUM_THREADS];
+    struct SumJob job;
+
+    if (nchunks == 0)
+        return 0;
+
+    job.chunkSum = chunkSum;
+    job.arg = arg;
+    job.nchunks = nchunks;
+    job.next = 0;
+
+    if (nthreads < 1)
+        nthreads = 1;
+    if ((unsigned int)nthreads > nchunks)
+        nthreads = (int)nchunks;
+    if (nthreads > MAX_SUM_THREADS)
+        nthreads = MAX_SUM_THREADS;
+
+    // if a helper can't be started, the remaining threads take over
+    // its chunks
+    int started = 1;
+    for (; started < nthreads; started++) {
+        workers[started].job = &job;
+        if (pthread_create(&workers[started].thread, NULL,
+                           SumWorkerMain, &workers[started]) != 0)
+            break;
+    }
+
+    workers[0].job = &job;
+    SumWorkerMain(&workers[0]);
+
+    long long sum = workers[0].sum;
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        sum += workers[i].sum;
+    }
+
+    return sum;
+}
@@ -4,13 +4,35 @@
 /* testclient.c */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "customer_manager.h"
 
+/* number of keys passed to a batched call at once */
+#define BATCH 64
+
+/* number of threads summing in parallel */
+#define SUM_THREADS 4
+
+/* number of users the parallel sum is checked with, more than a chunk
+   of the parallel sum of any backend holds */
+#define SUM_TEST_USERS 50000
+
+/* number of users registered by one batch of the batch tests, which
+   the backends split into many batches of their own */
+#define BATCH_TEST_USERS 1000
+
+/* number of users visited by the top-k performance test */
+#define TOP_K 100
+
+/* name prefix searched by the prefix performance test */
+#define NAME_PREFIX "name123"
+
 /*--------------------------------------------------------------------*/
 int TestRegisterCustomer(DB_T d, const char *id, const char *name,
                          int purchase, int expected_result) {
@@ -97,6 +119,110 @@ int TestGetPurchaseByName(DB_T d, const char *name,
     return (expected_result == test_result) ? 0 : -1;
 }
 /*--------------------------------------------------------------------*/
+int TestAddPurchaseByID(DB_T d, const char *id, int amount,
+                        int expected_result) {
+    int test_result;
+
+    printf("AddPurchaseByID(d, \"%s\", %d);\n", id, amount);
+    test_result = AddPurchaseByID(d, id, amount);
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int TestSetPurchaseByName(DB_T d, const char *name, int purchase,
+                          int expected_result) {
+    int test_result;
+
+    printf("SetPurchaseByName(d, \"%s\", %d);\n", name, purchase);
+    test_result = SetPurchaseByName(d, name, purchase);
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* count the results of a batch that differ from the expected ones */
+int CountBatchMismatches(const int *out, const int *expected_out,
+                         int n) {
+    int i, mismatches = 0;
+
+    for (i = 0; i < n; i++)
+        if (out[i] != expected_out[i])
+            mismatches++;
+
+    return mismatches;
+}
+/*--------------------------------------------------------------------*/
+int TestGetPurchaseByIDBatch(DB_T d, const char **ids, int n,
+                             const int *expected_out,
+                             int expected_result) {
+    int test_result, mismatches = 0;
+    int *out = calloc(n > 0 ? n : 1, sizeof(int));
+
+    if (out == NULL) {
+        printf("[FAILED] can't allocate the results\n");
+        return -1;
+    }
+
+    printf("GetPurchaseByIDBatch(d, ids, %d, out);\n", n);
+    test_result = GetPurchaseByIDBatch(d, ids, n, out);
+    if (expected_out != NULL)
+        mismatches = CountBatchMismatches(out, expected_out, n);
+    free(out);
+
+    if (expected_result == test_result && mismatches == 0)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d, %d wrong out[i] / expected result: %d\n",
+           test_result, mismatches, expected_result);
+
+    return (expected_result == test_result && mismatches == 0) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int TestRegisterCustomerBatch(DB_T d, const char **ids,
+                              const char **names, const int *purchases,
+                              int n, const int *expected_out,
+                              int expected_result) {
+    int test_result, mismatches = 0;
+    int *out = calloc(n > 0 ? n : 1, sizeof(int));
+
+    if (out == NULL) {
+        printf("[FAILED] can't allocate the results\n");
+        return -1;
+    }
+
+    printf("RegisterCustomerBatch(d, ids, names, purchases, %d, "
+           "out);\n",
+           n);
+    test_result =
+        RegisterCustomerBatch(d, ids, names, purchases, n, out);
+    if (expected_out != NULL)
+        mismatches = CountBatchMismatches(out, expected_out, n);
+    free(out);
+
+    if (expected_result == test_result && mismatches == 0)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d, %d wrong out[i] / expected result: %d\n",
+           test_result, mismatches, expected_result);
+
+    return (expected_result == test_result && mismatches == 0) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
 int NameStartsWithA(const char *id, const char *name, int purchase) {
     if (*name == 'A')
         return purchase;
@@ -136,6 +262,155 @@ int TestGetSumCustomerPurchase(DB_T d, FUNCPTR_T fp, const char *fname,
     return (expected_result == test_result) ? 0 : -1;
 }
 /*--------------------------------------------------------------------*/
+int TestGetSumCustomerPurchaseParallel(DB_T d, FUNCPTR_T fp,
+                                       const char *fname, int nthreads,
+                                       long long expected_result) {
+    long long test_result;
+
+    printf("GetSumCustomerPurchaseParallel(d, %s, %d);\n", fname,
+           nthreads);
+    test_result = GetSumCustomerPurchaseParallel(d, fp, nthreads);
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %lld / expected result: %lld\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int TestGetCustomersByPurchaseRange(DB_T d, int low, int high,
+                                    FUNCPTR_T fp, const char *fname,
+                                    int expected_result) {
+    int test_result;
+
+    printf("GetCustomersByPurchaseRange(d, %d, %d, %s);\n", low, high,
+           fname);
+    test_result = GetCustomersByPurchaseRange(d, low, high, fp);
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int TestGetTopKCustomers(DB_T d, int k, FUNCPTR_T fp, const char *fname,
+                         int expected_result) {
+    int test_result;
+
+    printf("GetTopKCustomers(d, %d, %s);\n", k, fname);
+    test_result = GetTopKCustomers(d, k, fp);
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int TestForEachCustomerWithNamePrefix(DB_T d, const char *prefix,
+                                      FUNCPTR_T fp, const char *fname,
+                                      int expected_result) {
+    int test_result;
+
+    printf("ForEachCustomerWithNamePrefix(d, \"%s\", %s);\n", prefix,
+           fname);
+    test_result = ForEachCustomerWithNamePrefix(d, prefix, fp);
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int TestGetSumCustomerPurchaseByNamePrefix(DB_T d, const char *prefix,
+                                           FUNCPTR_T fp,
+                                           const char *fname,
+                                           int expected_result) {
+    int test_result;
+
+    printf("GetSumCustomerPurchaseByNamePrefix(d, \"%s\", %s);\n",
+           prefix, fname);
+    test_result = GetSumCustomerPurchaseByNamePrefix(d, prefix, fp);
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+int TestGetCustomerDBStats(DB_T d, int expected_result) {
+    struct DBStats stats;
+    int test_result = -1;
+
+    printf("GetCustomerDBStats(d, &stats);\n");
+    if (GetCustomerDBStats(d, &stats) == 0 &&
+        stats.idTable.count == stats.nameTable.count &&
+        stats.idTable.count <= stats.idTable.capacity &&
+        stats.idTable.meanChain <= stats.idTable.maxChain &&
+        stats.nameTable.meanChain <= stats.nameTable.maxChain &&
+        stats.bytesAllocated > 0)
+        test_result = (int)stats.idTable.count;
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* create a temporary file, open for writing. path is a mkstemp()
+   template, which receives the name of the file */
+FILE *CreateTempFile(char *path) {
+    int fd = mkstemp(path);
+
+    return (fd < 0) ? NULL : fdopen(fd, "w");
+}
+/*--------------------------------------------------------------------*/
+int TestLoadCustomersFromFile(DB_T d, const char *contents,
+                              const char *fname, int expected_result) {
+    char path[] = "/tmp/customersXXXXXX";
+    int test_result = -1;
+    FILE *fp;
+
+    printf("LoadCustomersFromFile(d, %s);\n", fname);
+    if ((fp = CreateTempFile(path)) != NULL) {
+        fputs(contents, fp);
+        if (fclose(fp) == 0)
+            test_result = LoadCustomersFromFile(d, path);
+        unlink(path);
+    }
+
+    if (expected_result == test_result)
+        printf("[PASSED] ");
+    else
+        printf("[FAILED] ");
+    printf("test result: %d / expected result: %d\n", test_result,
+           expected_result);
+
+    return (expected_result == test_result) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
 /* Correctness Test 1: RegisterCustomer only */
 int CorrectnessTest1() {
 
@@ -234,6 +509,43 @@ int CorrectnessTest3() {
     result += TestRegisterCustomer(d, "id3", "name3", 300, 0);
     result += TestGetPurchaseByID(d, "id3", 300);
 
+    /* header, empty line, taken id, duplicate id and no line break at
+       the end */
+    result += TestLoadCustomersFromFile(
+        d,
+        "id,name,purchase\r\n"
+        "id4,name4,400\r\n"
+        "\r\n"
+        "id1,name9,900\r\n"
+        "id5,name5,500\r\n"
+        "id5,name6,600",
+        "\"customers.csv\"", 2);
+    result += TestLoadCustomersFromFile(d, "id8\tname8\t800\n",
+                                        "\"customers.tsv\"", 1);
+    result += TestLoadCustomersFromFile(d, "id9,name9\n",
+                                        "\"malformed.csv\"", -1);
+
+    /* a first line that is not the header is a record, and a purchase
+       that is not positive makes the file malformed */
+    result += TestLoadCustomersFromFile(d, "id10,name10,6x\n",
+                                        "\"malformed.csv\"", -1);
+    result += TestLoadCustomersFromFile(d, "id10,name10,99999999999\n",
+                                        "\"malformed.csv\"", -1);
+    result += TestLoadCustomersFromFile(d, "id10,name10,6\n"
+                                        "id11,name11,-5\n",
+                                        "\"malformed.csv\"", -1);
+    result += TestLoadCustomersFromFile(d, "id10,name10,6\n"
+                                        "id11,name11,0\n",
+                                        "\"malformed.csv\"", -1);
+    result += TestLoadCustomersFromFile(d, "id10,name10,6\n",
+                                        "\"customers.csv\"", 1);
+    result += TestGetPurchaseByID(d, "id10", 6);
+    result += TestGetPurchaseByName(d, "name11", -1);
+    result += TestGetPurchaseByName(d, "name5", 500);
+    result += TestGetPurchaseByID(d, "id8", 800);
+    result += TestGetPurchaseByName(d, "name9", -1);
+    result += TestGetPurchaseByID(d, "id5", 500);
+
     DestroyCustomerDB(d);
 
     printf("\nCorrectness Test 3 %s\n\n",
@@ -272,6 +584,7 @@ int CorrectnessTest4() {
     result += TestRegisterCustomer(d, "id2", "name2", 400, 0);
     result += TestGetPurchaseByID(d, "id1", 100);
     result += TestGetPurchaseByName(d, "name2", 400);
+    result += TestGetCustomerDBStats(d, 2);
 
     DestroyCustomerDB(d);
 
@@ -281,8 +594,9 @@ int CorrectnessTest4() {
     return (result >= 0) ? 0 : -1;
 }
 /*--------------------------------------------------------------------*/
-/* Correctness Test 5: Register/UnregisterCustomer and
-   GetSumCustomerPurchase */
+/* Correctness Test 5: Register/UnregisterCustomer,
+   GetSumCustomerPurchase, the purchase and name order queries and
+   purchase updates */
 int CorrectnessTest5() {
 
     DB_T d;
@@ -311,6 +625,23 @@ int CorrectnessTest5() {
                                          "IDStartsWithA", 100);
     result += TestGetSumCustomerPurchase(d, &PurchaseLargerThan100,
                                          "PurchaseLargerThan100", 600);
+    result += TestGetCustomersByPurchaseRange(
+        d, 101, INT_MAX, &PurchaseLargerThan100,
+        "PurchaseLargerThan100", 600);
+    result += TestGetCustomersByPurchaseRange(
+        d, 50, 100, &NameStartsWithA, "NameStartsWithA", 50);
+    result += TestGetTopKCustomers(d, 2, &NameStartsWithA,
+                                   "NameStartsWithA", 400);
+    result += TestForEachCustomerWithNamePrefix(
+        d, "A", &PurchaseLargerThan100, "PurchaseLargerThan100", 2);
+    result += TestGetSumCustomerPurchaseByNamePrefix(
+        d, "A", &NameStartsWithA, "NameStartsWithA", 450);
+    result += TestGetSumCustomerPurchaseByNamePrefix(
+        d, "Ad", &NameStartsWithA, "NameStartsWithA", 400);
+    result += TestGetSumCustomerPurchaseByNamePrefix(
+        d, "", &PurchaseLargerThan100, "PurchaseLargerThan100", 600);
+    result += TestGetSumCustomerPurchaseByNamePrefix(
+        d, "Adrians", &NameStartsWithA, "NameStartsWithA", 0);
 
     result += TestUnregisterCustomerByName(d, "Adrian", 0);
     result += TestRegisterCustomer(d, "Adriano", "Ardriano", 800, 0);
@@ -321,6 +652,39 @@ int CorrectnessTest5() {
                                          "IDStartsWithA", 900);
     result += TestGetSumCustomerPurchase(d, &PurchaseLargerThan100,
                                          "PurchaseLargerThan100", 1000);
+    result += TestGetCustomersByPurchaseRange(
+        d, 101, INT_MAX, &PurchaseLargerThan100,
+        "PurchaseLargerThan100", 1000);
+    result += TestGetTopKCustomers(d, 1, &IDStartsWithA,
+                                   "IDStartsWithA", 800);
+    result += TestGetTopKCustomers(d, 10, &NameStartsWithA,
+                                   "NameStartsWithA", 850);
+    result += TestForEachCustomerWithNamePrefix(
+        d, "", &NameStartsWithA, "NameStartsWithA", 4);
+    result += TestGetSumCustomerPurchaseByNamePrefix(
+        d, "A", &NameStartsWithA, "NameStartsWithA", 850);
+    result += TestGetSumCustomerPurchaseByNamePrefix(
+        d, "Ad", &NameStartsWithA, "NameStartsWithA", 0);
+
+    result += TestAddPurchaseByID(d, "mike3002", 700, 900);
+    result += TestAddPurchaseByID(d, "Adele", -100, -1);
+    result += TestAddPurchaseByID(d, "Adele", INT_MAX, -1);
+    result += TestAddPurchaseByID(d, "adrian", 1, -1);
+    result += TestSetPurchaseByName(d, "Anderson", 1000, 0);
+    result += TestSetPurchaseByName(d, "Anderson", 0, -1);
+    result += TestSetPurchaseByName(d, "Adrian", 1, -1);
+    result += TestGetPurchaseByID(d, "ander2003", 1000);
+    result += TestGetPurchaseByName(d, "Mike", 900);
+
+    result += TestGetTopKCustomers(d, 2, &NameStartsWithA,
+                                   "NameStartsWithA", 1000);
+    result += TestGetCustomersByPurchaseRange(
+        d, 101, 900, &PurchaseLargerThan100, "PurchaseLargerThan100",
+        1700);
+    result += TestGetSumCustomerPurchaseByNamePrefix(
+        d, "A", &NameStartsWithA, "NameStartsWithA", 1800);
+    result += TestGetSumCustomerPurchase(d, &PurchaseLargerThan100,
+                                         "PurchaseLargerThan100", 2700);
 
     DestroyCustomerDB(d);
 
@@ -330,6 +694,186 @@ int CorrectnessTest5() {
     return (result >= 0) ? 0 : -1;
 }
 /*--------------------------------------------------------------------*/
+/* Correctness Test 6: GetSumCustomerPurchaseParallel against
+   GetSumCustomerPurchase */
+int CorrectnessTest6() {
+
+    DB_T d;
+    int result, i, expected;
+    char name[100];
+    char id[100];
+
+    result = 0;
+    printf("------------------------------------------------------\n"
+           "  Correctness Test 6:\n"
+           "  GetSumCustomerPurchaseParallel\n"
+           "------------------------------------------------------\n");
+
+    d = CreateCustomerDB();
+    if (d == NULL) {
+        printf("CreateCustomerDB() failed, cannot perform the test\n");
+        return -1;
+    }
+
+    result += TestGetSumCustomerPurchaseParallel(
+        d, &PurchaseLargerThan100, "PurchaseLargerThan100", SUM_THREADS,
+        0);
+    result += TestGetSumCustomerPurchaseParallel(
+        d, &PurchaseLargerThan100, "PurchaseLargerThan100", 0, -1);
+
+    /* the db holds several chunks of every backend, so the threads
+       split it */
+    printf("Register %d users\n", SUM_TEST_USERS);
+    expected = 0;
+    for (i = 0; i < SUM_TEST_USERS; i++) {
+        sprintf(name, "name%d", i);
+        sprintf(id, "id%d", i);
+        if (RegisterCustomer(d, id, name, i % 200 + 1) < 0) {
+            printf("RegisterCustomer returns error\n");
+            DestroyCustomerDB(d);
+            return -1;
+        }
+        expected += PurchaseLargerThan100(id, name, i % 200 + 1);
+    }
+
+    result += TestGetSumCustomerPurchase(d, &PurchaseLargerThan100,
+                                         "PurchaseLargerThan100",
+                                         expected);
+    result += TestGetSumCustomerPurchaseParallel(
+        d, &PurchaseLargerThan100, "PurchaseLargerThan100", 1,
+        expected);
+    result += TestGetSumCustomerPurchaseParallel(
+        d, &PurchaseLargerThan100, "PurchaseLargerThan100", 2,
+        expected);
+    result += TestGetSumCustomerPurchaseParallel(
+        d, &PurchaseLargerThan100, "PurchaseLargerThan100", SUM_THREADS,
+        expected);
+    result += TestGetSumCustomerPurchaseParallel(
+        d, &PurchaseLargerThan100, "PurchaseLargerThan100", 1000,
+        expected);
+
+    /* the chunks keep the holes unregistering leaves */
+    printf("Unregister every third user\n");
+    for (i = 0; i < SUM_TEST_USERS; i += 3) {
+        sprintf(id, "id%d", i);
+        UnregisterCustomerByID(d, id);
+        expected -= PurchaseLargerThan100(id, NULL, i % 200 + 1);
+    }
+
+    result += TestGetSumCustomerPurchase(d, &PurchaseLargerThan100,
+                                         "PurchaseLargerThan100",
+                                         expected);
+    result += TestGetSumCustomerPurchaseParallel(
+        d, &PurchaseLargerThan100, "PurchaseLargerThan100", SUM_THREADS,
+        expected);
+
+    DestroyCustomerDB(d);
+
+    printf("\nCorrectness Test 6 %s\n\n",
+           (result >= 0) ? "PASSED" : "FAILED!");
+
+    return (result >= 0) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
+/* Correctness Test 7: RegisterCustomerBatch and GetPurchaseByIDBatch */
+int CorrectnessTest7() {
+
+    DB_T d;
+    int result, i, registered;
+    static char bigIds[BATCH_TEST_USERS][100];
+    static char bigNames[BATCH_TEST_USERS][100];
+    const char *bigIdKeys[BATCH_TEST_USERS + 1];
+    const char *bigNameKeys[BATCH_TEST_USERS];
+    int bigPurchases[BATCH_TEST_USERS];
+    int bigOut[BATCH_TEST_USERS + 1];
+
+    /* duplicates of an id and a name within the batch, NULL keys and a
+       purchase of 0 are refused one by one */
+    const char *ids[] = {"id1", "id2", "id1", "id3",
+                         NULL,  "id5", "id6", "id7"};
+    const char *names[] = {"name1", "name2", "name9", "name1",
+                           "name4", NULL,    "name6", "name7"};
+    const int purchases[] = {10, 20, 30, 40, 50, 60, 0, 70};
+    const int registerOut[] = {0, 0, -1, -1, -1, -1, -1, 0};
+
+    /* duplicates of an id and a name already in the db */
+    const char *ids2[] = {"id1", "id8", "id9"};
+    const char *names2[] = {"name8", "name2", "name9"};
+    const int purchases2[] = {5, 5, 5};
+    const int registerOut2[] = {-1, -1, 0};
+
+    /* hits, misses, a NULL key and an id asked for twice */
+    const char *lookupIds[] = {"id1", "id2", "id3", "id7", "id9",
+                               NULL,  "id1", "id5", "name1"};
+    const int lookupOut[] = {10, 20, -1, 70, 5, -1, 10, -1, -1};
+
+    result = 0;
+    printf("------------------------------------------------------\n"
+           "  Correctness Test 7:\n"
+           "  RegisterCustomerBatch and GetPurchaseByIDBatch\n"
+           "------------------------------------------------------\n");
+
+    d = CreateCustomerDB();
+    if (d == NULL) {
+        printf("CreateCustomerDB() failed, cannot perform the test\n");
+        return -1;
+    }
+
+    result += TestRegisterCustomerBatch(d, ids, names, purchases, 8,
+                                        registerOut, 3);
+    result += TestRegisterCustomerBatch(d, ids2, names2, purchases2, 3,
+                                        registerOut2, 1);
+    result += TestRegisterCustomerBatch(d, ids, NULL, purchases, 8,
+                                        NULL, -1);
+    result += TestRegisterCustomerBatch(d, ids, names, purchases, 0,
+                                        NULL, 0);
+    result += TestGetPurchaseByName(d, "name1", 10);
+    result += TestGetPurchaseByName(d, "name9", 5);
+    result += TestGetPurchaseByName(d, "name8", -1);
+    result += TestGetCustomerDBStats(d, 4);
+
+    result += TestGetPurchaseByIDBatch(d, lookupIds, 9, lookupOut, 5);
+    result += TestGetPurchaseByIDBatch(d, NULL, 1, NULL, -1);
+    result += TestGetPurchaseByIDBatch(d, lookupIds, -1, NULL, -1);
+    result += TestGetPurchaseByIDBatch(d, lookupIds, 0, NULL, 0);
+
+    /* a batch the backends take in many pieces while their tables
+       grow. every tenth user repeats the id of the one before it */
+    registered = 0;
+    for (i = 0; i < BATCH_TEST_USERS; i++) {
+        sprintf(bigIds[i], "bid%d", i % 10 == 9 ? i - 1 : i);
+        sprintf(bigNames[i], "bname%d", i);
+        bigIdKeys[i] = bigIds[i];
+        bigNameKeys[i] = bigNames[i];
+        bigPurchases[i] = i + 1;
+        bigOut[i] = i % 10 == 9 ? -1 : 0;
+        if (bigOut[i] == 0)
+            registered++;
+    }
+    result += TestRegisterCustomerBatch(d, bigIdKeys, bigNameKeys,
+                                        bigPurchases, BATCH_TEST_USERS,
+                                        bigOut, registered);
+    result += TestGetCustomerDBStats(d, 4 + registered);
+
+    /* the first of two users with the same id was registered, and an
+       id past the batch is missing */
+    for (i = 0; i < BATCH_TEST_USERS; i++)
+        bigOut[i] = i % 10 == 9 ? i : i + 1;
+    bigIdKeys[BATCH_TEST_USERS] = "bid-missing";
+    bigOut[BATCH_TEST_USERS] = -1;
+    result += TestGetPurchaseByIDBatch(
+        d, bigIdKeys, BATCH_TEST_USERS + 1, bigOut, BATCH_TEST_USERS);
+    result += TestGetPurchaseByName(d, "bname9", -1);
+    result += TestGetPurchaseByName(d, "bname8", 9);
+
+    DestroyCustomerDB(d);
+
+    printf("\nCorrectness Test 7 %s\n\n",
+           (result >= 0) ? "PASSED" : "FAILED!");
+
+    return (result >= 0) ? 0 : -1;
+}
+/*--------------------------------------------------------------------*/
 float timedifference_msec(struct timeval *t0, struct timeval *t1) {
     return (t1->tv_sec - t0->tv_sec) * 1000.0f +
            (t1->tv_usec - t0->tv_usec) / 1000.0f;
@@ -344,15 +888,57 @@ int OddNumber(const char *id, const char *name, const int purchase) {
     return 0;
 }
 /*--------------------------------------------------------------------*/
+void PrintTableStats(const char *name, const struct DBTableStats *t) {
+    printf("%-10s capacity %llu, load factor %.3f, "
+           "chain length mean %.3f / max %u\n",
+           name, t->capacity, t->loadFactor, t->meanChain, t->maxChain);
+    if (t->filterFalsePositiveRate > 0)
+        printf("%-10s filter false positive rate %.5f expected\n", "",
+               t->filterFalsePositiveRate);
+}
+/*--------------------------------------------------------------------*/
+void PrintDBStats(DB_T d) {
+    static const char *ops[DB_NUM_OPS] = {"register", "unregister",
+                                          "lookup", "update"};
+    struct DBStats stats;
+
+    if (GetCustomerDBStats(d, &stats) < 0) {
+        printf("GetCustomerDBStats returns error\n");
+        return;
+    }
+
+    PrintTableStats("idTable", &stats.idTable);
+    PrintTableStats("nameTable", &stats.nameTable);
+    printf("%llu bytes allocated, %llu rehashes in %.3f ms\n",
+           stats.bytesAllocated, stats.rehashes,
+           stats.rehashNsec / 1e6);
+    for (int i = 0; i < DB_NUM_OPS; i++)
+        if (stats.ops[i] > 0)
+            printf("%-10s %llu calls, %.3f probes per call\n", ops[i],
+                   stats.ops[i],
+                   (double)stats.probes[i] / stats.ops[i]);
+    if (stats.filterChecks > 0)
+        printf("filter     %llu checks, %llu misses, "
+               "%llu false positives\n",
+               stats.filterChecks, stats.filterMisses,
+               stats.filterFalsePositives);
+}
+/*--------------------------------------------------------------------*/
 /* Performance Test */
 void PerformanceTest(int num) {
 
-    DB_T d;
+    DB_T d, d2;
     int sum, i, res;
+    long long sum64;
+    char path[] = "/tmp/customersXXXXXX";
+    FILE *fp;
     char name[100];
     char id[100];
     struct timeval start, end;
     double elapsed;
+    char batchIds[BATCH][100];
+    const char *batchKeys[BATCH];
+    int batchRes[BATCH];
 
     printf("---------------------------------------------------\n"
            "  Performance Test\n"
@@ -383,6 +969,39 @@ void PerformanceTest(int num) {
     printf("Finished registering %d users\n", num);
     printf("[elapsed time: %f ms]\n\n", elapsed);
 
+    /*---------------------- Test 1-1 ---------------------*/
+    printf("[Test 1-1] Register %d users from a file\n"
+           "           with LoadCustomersFromFile()\n",
+           num);
+    if ((fp = CreateTempFile(path)) == NULL) {
+        printf("Can't create a temporary file\n");
+        return;
+    }
+    for (i = 0; i < num; i++)
+        fprintf(fp, "id%d,name%d,10\n", i, i);
+    fclose(fp);
+    d2 = CreateCustomerDBWithCapacity(num);
+    if (d2 == NULL) {
+        printf("CreateCustomerDBWithCapacity() failed\n");
+        unlink(path);
+        return;
+    }
+    /* start timer */
+    gettimeofday(&start, NULL);
+    /* run test */
+    res = LoadCustomersFromFile(d2, path);
+    /* stop timer and calulate elapsed time*/
+    gettimeofday(&end, NULL);
+    elapsed = timedifference_msec(&start, &end);
+    unlink(path);
+    DestroyCustomerDB(d2);
+    if (res != num) {
+        printf("LoadCustomersFromFile returns %d\n", res);
+        return;
+    }
+    printf("Finished registering %d users\n", num);
+    printf("[elapsed time: %f ms]\n\n", elapsed);
+
     /*----------------------- Test 2 ----------------------*/
     printf("[Test 2] Total sum of purchase of %d users\n"
            "         with GetPurchaseByName()\n",
@@ -421,6 +1040,44 @@ void PerformanceTest(int num) {
     printf("Finished calculating the total sum = %d\n", sum);
     printf("[elapsed time: %f ms]\n\n", elapsed);
 
+    /*---------------------- Test 3-1 ---------------------*/
+    printf("[Test 3-1] Total sum of purchase of %d users\n"
+           "           with GetPurchaseByIDBatch()\n",
+           num);
+    /* start timer */
+    gettimeofday(&start, NULL);
+    /* run test */
+    sum = 0;
+    for (i = 0; i < num; i += BATCH) {
+        int j, n = (num - i < BATCH) ? num - i : BATCH;
+        for (j = 0; j < n; j++) {
+            sprintf(batchIds[j], "id%d", i + j);
+            batchKeys[j] = batchIds[j];
+        }
+        GetPurchaseByIDBatch(d, batchKeys, n, batchRes);
+        for (j = 0; j < n; j++)
+            if (batchRes[j] > 0)
+                sum += batchRes[j];
+    }
+    /* stop timer and calulate elapsed time*/
+    gettimeofday(&end, NULL);
+    elapsed = timedifference_msec(&start, &end);
+    printf("Finished calculating the total sum = %d\n", sum);
+    printf("[elapsed time: %f ms]\n\n", elapsed);
+
+    /*---------------------- Test 3-2 ---------------------*/
+    printf("[Test 3-2] Statistics of the db with %d users\n"
+           "           with GetCustomerDBStats()\n",
+           num);
+    /* start timer */
+    gettimeofday(&start, NULL);
+    /* run test */
+    PrintDBStats(d);
+    /* stop timer and calulate elapsed time*/
+    gettimeofday(&end, NULL);
+    elapsed = timedifference_msec(&start, &end);
+    printf("[elapsed time: %f ms]\n\n", elapsed);
+
     /*----------------------- Test 4 ----------------------*/
     printf("[Test 4] Total sum of purchase of odd number users\n"
            "         with GetSumCustomerPurchase()\n");
@@ -434,6 +1091,51 @@ void PerformanceTest(int num) {
     printf("Finished calculating the odd number user sum = %d\n", sum);
     printf("[elapsed time: %f ms]\n\n", elapsed);
 
+    /*---------------------- Test 4-1 ---------------------*/
+    printf("[Test 4-1] Total sum of purchase of odd number users\n"
+           "           with GetSumCustomerPurchaseParallel() on %d "
+           "threads\n",
+           SUM_THREADS);
+    /* start timer */
+    gettimeofday(&start, NULL);
+    /* run test */
+    sum64 = GetSumCustomerPurchaseParallel(d, OddNumber, SUM_THREADS);
+    /* stop timer and calulate elapsed time*/
+    gettimeofday(&end, NULL);
+    elapsed = timedifference_msec(&start, &end);
+    printf("Finished calculating the odd number user sum = %lld\n",
+           sum64);
+    printf("[elapsed time: %f ms]\n\n", elapsed);
+
+    /*---------------------- Test 4-2 ---------------------*/
+    printf("[Test 4-2] Sum of purchase of odd number users among the\n"
+           "           top %d with GetTopKCustomers()\n",
+           TOP_K);
+    /* start timer */
+    gettimeofday(&start, NULL);
+    /* run test */
+    sum = GetTopKCustomers(d, TOP_K, OddNumber);
+    /* stop timer and calulate elapsed time*/
+    gettimeofday(&end, NULL);
+    elapsed = timedifference_msec(&start, &end);
+    printf("Finished calculating the odd number user sum = %d\n", sum);
+    printf("[elapsed time: %f ms]\n\n", elapsed);
+
+    /*---------------------- Test 4-3 ---------------------*/
+    printf("[Test 4-3] Sum of purchase of odd number users whose name\n"
+           "           starts with \"%s\" with "
+           "GetSumCustomerPurchaseByNamePrefix()\n",
+           NAME_PREFIX);
+    /* start timer */
+    gettimeofday(&start, NULL);
+    /* run test */
+    sum = GetSumCustomerPurchaseByNamePrefix(d, NAME_PREFIX, OddNumber);
+    /* stop timer and calulate elapsed time*/
+    gettimeofday(&end, NULL);
+    elapsed = timedifference_msec(&start, &end);
+    printf("Finished calculating the odd number user sum = %d\n", sum);
+    printf("[elapsed time: %f ms]\n\n", elapsed);
+
     /*----------------------- Test 5 ----------------------*/
     printf("[Test 5] Unregister all the %d users\n"
            "         with UnregisterCustomerByName()\n",
@@ -456,7 +1158,7 @@ void PerformanceTest(int num) {
 
 /*--------------------------------------------------------------------*/
 int main(int argc, const char *argv[]) {
-    int res[5], i;
+    int res[7], i;
 
     /* ./testclient -c : run all the correctness tests */
     if (argc == 2 && strcmp("-c", argv[1]) == 0) {
@@ -465,8 +1167,10 @@ int main(int argc, const char *argv[]) {
         res[2] = CorrectnessTest3();
         res[3] = CorrectnessTest4();
         res[4] = CorrectnessTest5();
+        res[5] = CorrectnessTest6();
+        res[6] = CorrectnessTest7();
 
-        for (i = 0; i < 5; i++)
+        for (i = 0; i < 7; i++)
             printf("Test %d %s\n", i + 1,
                    (res[i] == 0) ? "PASSED" : "FAILED");
 
@@ -484,6 +1188,10 @@ int main(int argc, const char *argv[]) {
             CorrectnessTest4();
         else if (atoi(argv[2]) == 5)
             CorrectnessTest5();
+        else if (atoi(argv[2]) == 6)
+            CorrectnessTest6();
+        else if (atoi(argv[2]) == 7)
+            CorrectnessTest7();
         else
             goto error;
         return 0;
@@ -499,7 +1207,7 @@ int main(int argc, const char *argv[]) {
 
 error:
     printf("Usage:  %s -c      run all the correctness tests\n"
-           "        %s -c 3    run the correctness test 3 (1~5)\n"
+           "        %s -c 3    run the correctness test 3 (1~7)\n"
            "        %s -p 2000 run performance test with data set"
            " of 2000 users",
            argv[0], argv[0], argv[0]);
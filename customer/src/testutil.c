@@ -0,0 +1,95 @@
+/**
+ * Author: Haechan Kwon (권해찬)
+ * Assignment: Customer Management (Assignment 3)
+ * Filename: testutil.c
+ */
+
+#include "testutil.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+// checks that failed, counted from every thread
+static int failures;
+
+/**
+ * Report: print the result of a check and count it if it failed
+ *
+ * param ok: nonzero if the check passed
+ * param format: printf-style format of the message
+ * param args: arguments of the format
+ */
+static void Report(int ok, const char *format, va_list args) {
+    char message[256];
+
+    vsnprintf(message, sizeof(message), format, args);
+    printf("%s %s\n", ok ? "[PASSED]" : "[FAILED]", message);
+    if (!ok)
+        __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Check: print the result of a check and count it if it failed
+ *
+ * param ok: nonzero if the check passed
+ * param format: printf-style format of the message
+ */
+void Check(int ok, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    Report(ok, format, args);
+    va_end(args);
+}
+
+/**
+ * Fail: print a failed check and count it
+ *
+ * param format: printf-style format of the message
+ */
+void Fail(const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    Report(0, format, args);
+    va_end(args);
+}
+
+/**
+ * Failures: get the number of checks that failed so far
+ *
+ * returns: number of failed checks
+ */
+int Failures(void) {
+    return __atomic_load_n(&failures, __ATOMIC_RELAXED);
+}
+
+/**
+ * Purchase: a FUNCPTR_T that returns the purchase of every customer
+ */
+int Purchase(const char *id, const char *name, const int purchase) {
+    (void)id;
+    (void)name;
+    return purchase;
+}
+
+/**
+ * StablePurchase: a FUNCPTR_T that returns the purchase of a customer
+ * whose id starts with 's', and 0 for any other
+ */
+int StablePurchase(const char *id, const char *name,
+                   const int purchase) {
+    (void)name;
+    return id[0] == 's' ? purchase : 0;
+}
+
+/**
+ * KeysOf: write the id and the name of a customer
+ *
+ * param k: number of the customer
+ * param id: buffer of KEY_SIZE bytes that receives the id
+ * param name: buffer of KEY_SIZE bytes that receives the name
+ */
+void KeysOf(int k, char *id, char *name) {
+    snprintf(id, KEY_SIZE, "id%05d", k);
+    snprintf(name, KEY_SIZE, "name%05d", k);
+}
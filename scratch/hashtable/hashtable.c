@@ -2,24 +2,63 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
 
-static unsigned int hash(const char *x) {
-    int i;
-    unsigned int h = 0U;
-    for (i = 0; x[i] != '\0'; i++)
-        h = h * 65599 + (unsigned char) x[i];
+/* multiply-xorshift: every output bit depends on every input bit */
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    return h ^ (h >> 32);
+}
+
+/* 8 bytes per step instead of 1, seeded per table so that colliding
+   keys can't be picked in advance */
+static unsigned int hash(const struct Table *table, const char *x) {
+    size_t len = strlen(x);
+    uint64_t h = table->seed ^ len, w;
+
+    for (; len >= 8; len -= 8, x += 8) {
+        memcpy(&w, x, 8);
+        h = mix(h ^ w);
+    }
+    w = 0;
+    memcpy(&w, x, len);
+    h = mix(h ^ w);
+
+    return (unsigned int)(h % BUCKET_COUNT);
+}
+
+/* an unpredictable seed from the kernel. without getrandom(), the
+   time and the address of the table are all there is, and those can
+   be guessed */
+static uint64_t random_seed(const struct Table *table) {
+    uint64_t seed;
 
-    return h % BUCKET_COUNT;
+#ifdef __linux__
+    if (getrandom(&seed, sizeof seed, GRND_NONBLOCK) ==
+        (ssize_t)sizeof seed)
+        return seed;
+#endif
+    return mix((uint64_t)time(NULL) ^ (uintptr_t)table);
 }
 
 struct Table *table_create(void) {
     struct Table *table = malloc(sizeof (struct Table));
+    if (table == NULL)
+        return NULL;
     memset(table->array, 0, sizeof (struct Node *) * BUCKET_COUNT);
+    table->seed = random_seed(table);
     return table;
 }
 
 void table_add(struct Table *table, const char *key, int value) {
-    int hashed = hash(key);
+    int hashed = hash(table, key);
     struct Node *node = malloc(sizeof (struct Node));
     node->key = malloc(strlen(key) + 1);
     strcpy(node->key, key);
@@ -29,7 +68,7 @@ void table_add(struct Table *table, const char *key, int value) {
 }
 
 bool table_search(struct Table *table, const char *key, int *value) {
-    int hashed = hash(key);
+    int hashed = hash(table, key);
 
     for (struct Node *p = table->array[hashed]; p != NULL; p = p->next)
         if (strcmp(p->key, key) == 0) {
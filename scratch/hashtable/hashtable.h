@@ -12,6 +12,7 @@ struct Node {
 };
 
 struct Table {
+    unsigned long long seed;
     struct Node *array[BUCKET_COUNT];
 };
 
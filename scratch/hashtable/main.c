@@ -3,6 +3,10 @@
 
 int main(void) {
     struct Table *table = table_create();
+    if (table == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
 
     table_add(table, "foo", 3);
     table_add(table, "bar", 4);